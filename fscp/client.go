@@ -6,44 +6,139 @@ import (
 	"fmt"
 	"io"
 	"net"
+	"sort"
 	"sync"
+	"sync/atomic"
+	"time"
 )
 
+// contactRequestPeriod is the interval at which ConnectByHash repeats its
+// contact requests.
+const contactRequestPeriod = time.Second * 3
+
+// roamingSequenceWindow is how far ahead of the last sequence number received
+// on a session a message from an unknown address may be to be tried on it.
+const roamingSequenceWindow = 1 << 16
+
+// sourceTimeout is how long another address that the remote host of a
+// connection was seen sending from is remembered once no message comes from
+// it anymore.
+const sourceTimeout = time.Minute * 2
+
+// roamingFrame is an encrypted message received from an unknown address.
+type roamingFrame struct {
+	from  *Addr
+	frame messageFrame
+
+	// tried, if set, is a connection that failed to decrypt the message
+	// already.
+	tried *Conn
+}
+
+// source is another address that the remote host of a connection was seen
+// sending from.
+type source struct {
+	conn     *Conn
+	lastSeen time.Time
+}
+
 // Client represents a FSCP connection.
 type Client struct {
-	transportConn  net.PacketConn
-	hostIdentifier HostIdentifier
-	security       ClientSecurity
-	backlog        chan *Conn
-	closed         bool
-
-	lock        sync.Mutex
-	connsByAddr map[string]*Conn
+	transportConn      net.PacketConn
+	hostIdentifier     HostIdentifier
+	security           ClientSecurity
+	securityGeneration uint64
+	rotation           chan struct{}
+	config             ClientConfig
+	timers             *timerWheel
+	tickets            *ticketCache
+	backlog            chan *Conn
+	roaming            chan roamingFrame
+	closed             bool
+
+	lock           sync.Mutex
+	connsByAddr    map[string]*Conn
+	connsByHash    map[CertificateHash]*Conn
+	connsByAlias   map[string]*Conn
+	connsBySource  map[string]*source
+	connsByHost    map[string][]*Conn
+	contactWaiters map[CertificateHash][]chan *Conn
+
+	peersLock sync.Mutex
+	peers     map[string]*Addr
+
+	batchWriter *batchWriter
+	mesh        *meshState
+
+	uplinks       []*uplink
+	flows         []net.PacketConn
+	uplinksClosed bool
+	readers       sync.WaitGroup
 }
 
 // NewClient creates a new client.
 func NewClient(conn net.PacketConn, security *ClientSecurity) (client *Client, err error) {
+	return NewClientWithConfig(conn, security, nil)
+}
+
+// NewClientWithConfig creates a new client with the specified configuration.
+func NewClientWithConfig(conn net.PacketConn, security *ClientSecurity, config *ClientConfig) (client *Client, err error) {
 	if security == nil {
 		security = &ClientSecurity{}
 	}
 
+	if config == nil {
+		config = &ClientConfig{}
+	}
+
 	if err = security.Validate(); err != nil {
 		return nil, fmt.Errorf("failed to instanciate a new client: %s", err)
 	}
 
 	client = &Client{
-		transportConn: conn,
-		security:      *security,
-		backlog:       make(chan *Conn, 20),
-		closed:        false,
-		connsByAddr:   map[string]*Conn{},
+		transportConn:  conn,
+		security:       *security,
+		config:         *config,
+		timers:         newTimerWheel(DefaultTimerWheelResolution, defaultTimerWheelSize),
+		tickets:        newTicketCache(config.Resumption),
+		backlog:        make(chan *Conn, 20),
+		roaming:        make(chan roamingFrame, 16),
+		closed:         false,
+		connsByAddr:    map[string]*Conn{},
+		connsByHash:    map[CertificateHash]*Conn{},
+		connsByAlias:   map[string]*Conn{},
+		connsBySource:  map[string]*source{},
+		connsByHost:    map[string][]*Conn{},
+		contactWaiters: map[CertificateHash][]chan *Conn{},
+		batchWriter:    newBatchWriter(conn),
 	}
 
 	if client.hostIdentifier, err = GenerateHostIdentifier(); err != nil {
+		client.timers.Close()
 		return
 	}
 
+	client.mesh = newMeshState(client.hostIdentifier, config.Mesh)
+
+	if config.MultiFlow.enabled() {
+		if client.flows, err = openFlowSockets(conn, config.MultiFlow.Flows-1); err != nil {
+			client.timers.Close()
+			return nil, fmt.Errorf("failed to instanciate a new client: %s", err)
+		}
+	}
+
+	for _, flow := range client.flows {
+		flow := flow
+		client.readers.Add(1)
+
+		go func() {
+			defer client.readers.Done()
+			client.readLoop(flow)
+		}()
+	}
+
 	go client.dispatchLoop()
+	go client.roamingLoop()
 
 	return client, nil
 }
@@ -58,13 +153,48 @@ func (c *Client) Security() ClientSecurity {
 
 // SetSecurity sets the security used by the client.
 //
-// Existing connections are shut-down.
+// New connections use it right away. Existing connections keep their
+// sessions and migrate to it gradually, at the rate set in the rotation
+// settings. Resumption tickets are discarded.
 func (c *Client) SetSecurity(security ClientSecurity) {
 	c.lock.Lock()
 	defer c.lock.Unlock()
 
 	c.security = security
-	c.closeConns()
+	c.securityGeneration++
+	c.tickets.clear()
+	c.rotateConns()
+}
+
+// Config gets the client's configuration.
+func (c *Client) Config() ClientConfig {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	return c.config
+}
+
+// SetConfig sets the configuration used by the client.
+//
+// Existing connections keep the configuration they were created with.
+func (c *Client) SetConfig(config ClientConfig) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	c.config = config
+}
+
+// ResumptionStats returns the session resumption statistics of the client.
+func (c *Client) ResumptionStats() ResumptionStats {
+	return c.tickets.snapshot()
+}
+
+// isClosed tells whether the client was closed.
+func (c *Client) isClosed() bool {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	return c.closed
 }
 
 // Addr returns the listener address.
@@ -90,7 +220,7 @@ func (c *Client) Close() error {
 func (c *Client) Connect(ctx context.Context, remoteAddr *Addr) (conn *Conn, err error) {
 	var ok bool
 
-	conn, ok = c.addConn(remoteAddr)
+	conn, ok = c.addConn(remoteAddr, nil)
 
 	if conn == nil {
 		return nil, io.EOF
@@ -102,6 +232,10 @@ func (c *Client) Connect(ctx context.Context, remoteAddr *Addr) (conn *Conn, err
 
 		select {
 		case <-conn.closed:
+			if conn.closeError == ErrHandshakeTimeout {
+				return nil, ErrHandshakeTimeout
+			}
+
 			return nil, io.EOF
 		case <-conn.connected:
 		case <-ctx.Done():
@@ -112,66 +246,512 @@ func (c *Client) Connect(ctx context.Context, remoteAddr *Addr) (conn *Conn, err
 	return
 }
 
+// ConnectByHash connects to the host with the specified certificate hash,
+// which the host at the other end of via must be connected to.
+//
+// The host at the other end of via introduces both hosts to one another,
+// which makes them connect directly.
+func (c *Client) ConnectByHash(ctx context.Context, via *Conn, hash CertificateHash) (*Conn, error) {
+	waiter := make(chan *Conn, 1)
+
+	c.lock.Lock()
+
+	if conn, ok := c.connsByHash[hash]; ok {
+		c.lock.Unlock()
+		return conn, nil
+	}
+
+	if c.closed {
+		c.lock.Unlock()
+		return nil, io.EOF
+	}
+
+	c.contactWaiters[hash] = append(c.contactWaiters[hash], waiter)
+	c.lock.Unlock()
+
+	defer c.removeContactWaiter(hash, waiter)
+
+	ticker := time.NewTicker(contactRequestPeriod)
+	defer ticker.Stop()
+
+	for {
+		if err := via.RequestContacts(hash); err != nil {
+			return nil, err
+		}
+
+		select {
+		case conn := <-waiter:
+			return conn, nil
+		case <-ticker.C:
+		case <-ctx.Done():
+			return nil, ctx.Err()
+		}
+	}
+}
+
+func (c *Client) removeContactWaiter(hash CertificateHash, waiter chan *Conn) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	waiters := c.contactWaiters[hash]
+
+	for i, w := range waiters {
+		if w == waiter {
+			waiters = append(waiters[:i], waiters[i+1:]...)
+			break
+		}
+	}
+
+	if len(waiters) == 0 {
+		delete(c.contactWaiters, hash)
+	} else {
+		c.contactWaiters[hash] = waiters
+	}
+}
+
+// registerConn registers a connection whose remote host presented a
+// certificate with the specified hash, once its session is established.
+//
+// Callers of ConnectByHash that wait for that host get the connection, which
+// then doesn't go to the backlog.
+func (c *Client) registerConn(conn *Conn, hash CertificateHash) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	// The remote host may have presented another certificate before.
+	for h, other := range c.connsByHash {
+		if other == conn && h != hash {
+			delete(c.connsByHash, h)
+		}
+	}
+
+	c.connsByHash[hash] = conn
+
+	if waiters, ok := c.contactWaiters[hash]; ok {
+		atomic.StoreInt32(&conn.claimed, 1)
+
+		for _, waiter := range waiters {
+			select {
+			case waiter <- conn:
+			default:
+			}
+		}
+
+		delete(c.contactWaiters, hash)
+	}
+}
+
+// findContacts returns the contacts of the connected hosts with the specified
+// certificate hashes, except the requesting one, as well as their
+// connections.
+func (c *Client) findContacts(requester *Conn, hashes []CertificateHash) (contacts []contact, conns []*Conn) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	for _, hash := range hashes {
+		conn, ok := c.connsByHash[hash]
+
+		if !ok || conn == requester {
+			continue
+		}
+
+		if addr, ok := conn.RemoteAddr().(*Addr).TransportAddr.(*net.UDPAddr); ok {
+			contacts = append(contacts, contact{Hash: hash, Addr: addr})
+			conns = append(conns, conn)
+		}
+	}
+
+	return
+}
+
+// introduce connects to a contact, unless we are connected to it already.
+//
+// The resulting connection is added to the backlog once connected, unless it
+// was waited for by ConnectByHash.
+func (c *Client) introduce(contact contact) {
+	c.lock.Lock()
+
+	_, connected := c.connsByHash[contact.Hash]
+	self := c.security.Certificate != nil && HashCertificate(c.security.Certificate) == contact.Hash
+
+	c.lock.Unlock()
+
+	if connected || self {
+		return
+	}
+
+	remoteAddr := &Addr{TransportAddr: contact.Addr}
+
+	if conn, ok := c.addConn(remoteAddr, &contact.Hash); ok {
+		c.acceptWhenConnected(conn)
+	}
+}
+
+// acceptWhenConnected adds a connection to the backlog once it is connected.
+func (c *Client) acceptWhenConnected(conn *Conn) {
+	go func() {
+		select {
+		case <-conn.connected:
+		case <-conn.closed:
+			// If we get there, it means the connection was closed
+			// before it completed its handshake.
+			return
+		}
+
+		if atomic.LoadInt32(&conn.claimed) != 0 {
+			// The connection was handed to a ConnectByHash caller.
+			return
+		}
+
+		// The backlog gets closed along with the client.
+		c.lock.Lock()
+		defer c.lock.Unlock()
+
+		if c.closed {
+			return
+		}
+
+		select {
+		case <-conn.closed:
+			// If we get there, it means the connection was closed
+			// right after it completed its handshake. This is rare,
+			// but if it happens we might as well not add the
+			// connection to the backlog.
+		case c.backlog <- conn:
+			// We added the connection to the backlog and can happily
+			// move on.
+		default:
+			// If the backlog is full, we shut down the connection.
+			conn.Close()
+		}
+	}()
+}
+
 func (c *Client) dispatchLoop() {
 	defer c.finalize()
-	defer close(c.backlog)
 
-	b := make([]byte, 1500)
+	c.readLoop(c.transportConn)
+
+	// The uplinks share the fate of the client's socket.
+	c.closeUplinks()
+}
+
+// readLoop dispatches the messages received on a socket until it is closed.
+func (c *Client) readLoop(transportConn net.PacketConn) {
+	// Legacy hosts send large handshake messages whole, which may come
+	// IP-fragmented.
+	b := make([]byte, 65535)
 
 	for {
-		n, addr, err := c.transportConn.ReadFrom(b)
+		n, addr, err := transportConn.ReadFrom(b)
 
 		if err != nil {
 			return
 		}
 
-		data := b[:n]
 		remoteAddr := &Addr{TransportAddr: addr}
-		conn, ok := c.addConn(remoteAddr)
+		reader := bytes.NewReader(b[:n])
 
-		// A nil conn indicates that the client is closing, which means we will
-		// soon exit from the incoming loop anyway.
+		// A datagram may contain several messages.
+		for reader.Len() > 0 {
+			messageType, message, err := readMessage(reader)
+
+			if err != nil {
+				debugPrintf("failed to read message: %s\n", err)
+				break
+			}
+
+			c.dispatch(remoteAddr, messageFrame{messageType: messageType, message: message})
+		}
+	}
+}
+
+// dispatch routes a received message to its connection.
+func (c *Client) dispatch(remoteAddr *Addr, frame messageFrame) {
+	// Encrypted messages from an unknown address never start a new
+	// connection: they may come from a known host whose address changed.
+	if _, encrypted := frame.message.(*messageData); encrypted {
+		conn := c.getConn(remoteAddr)
+
+		// Aliases may be stale, or shared with another host: the message is
+		// matched against the other sessions if it does not decrypt.
 		if conn == nil {
-			continue
+			if conn = c.getConnByAlias(remoteAddr); conn != nil {
+				frame.alias = remoteAddr
+			}
+		}
+
+		// Another port of a host that spreads its messages over several
+		// ones needs no lookup among all the sessions. Other hosts behind
+		// the same address fall back to that lookup.
+		if conn == nil {
+			if conn = c.getSiblingConn(remoteAddr); conn != nil {
+				frame.sibling = remoteAddr
+				frame.alias = remoteAddr
+			}
 		}
 
-		if ok {
-			go func(conn *Conn) {
-				select {
-				case <-conn.connected:
-				case <-conn.closed:
-					// If we get there, it means the connection was closed
-					// before it completed its handshake.
-					return
-				}
-
-				select {
-				case <-conn.closed:
-					// If we get there, it means the connection was closed
-					// right after it completed its handshake. This is rare,
-					// but if it happens we might as well not add the
-					// connection to the backlog.
-				case c.backlog <- conn:
-					// We added the connection to the backlog and can happily
-					// move on.
-				default:
-					// If the backlog is full, we shut down the connection.
-					conn.Close()
-				}
-			}(conn)
-		}
-
-		var reader lenReader = bytes.NewReader(data)
-
-		if messageType, message, err := readMessage(reader); err == nil {
+		if conn == nil {
 			select {
-			case conn.incoming <- messageFrame{messageType, message}:
+			case c.roaming <- roamingFrame{from: remoteAddr, frame: frame}:
 			default:
-				// If the connection's incoming queue is full, we simply discard
-				// the frame.
+				// We are busy matching other messages already.
+			}
+
+			return
+		}
+
+		select {
+		case conn.incoming <- frame:
+		default:
+		}
+
+		return
+	}
+
+	conn, ok := c.addConn(remoteAddr, nil)
+
+	// A nil conn indicates that the client is closing, which means we will
+	// soon exit from the incoming loop anyway.
+	if conn == nil {
+		return
+	}
+
+	if ok {
+		c.acceptWhenConnected(conn)
+	}
+
+	select {
+	case conn.incoming <- frame:
+	default:
+		// If the connection's incoming queue is full, we simply discard
+		// the frame.
+	}
+}
+
+// roamingLoop matches the encrypted messages received from unknown addresses
+// against the established sessions.
+//
+// A match means that the remote host changed address, and the connection
+// moves to the new one without any new handshake.
+func (c *Client) roamingLoop() {
+	for rf := range c.roaming {
+		sequenceNumber := uint32(rf.frame.message.(*messageData).SequenceNumber)
+
+		for _, conn := range c.roamingCandidates(sequenceNumber) {
+			if conn != rf.tried && conn.tryRoam(rf.from, rf.frame) {
+				break
 			}
-		} else {
-			debugPrintf("failed to read message: %s\n", err)
+		}
+	}
+}
+
+// reroute hands an encrypted message that reached a connection through one of
+// its aliases, but that its session failed to decrypt, to the roaming
+// goroutine.
+func (c *Client) reroute(rf roamingFrame) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if c.closed {
+		return
+	}
+
+	select {
+	case c.roaming <- rf:
+	default:
+		// We are busy matching other messages already.
+	}
+}
+
+// roamingCandidates returns the connections a message with the specified
+// sequence number may belong to, most likely first.
+//
+// Sequence numbers only increase within a session, so that the last one
+// received is a cheap hint which saves most trial decryptions. Messages sent
+// over several paths may arrive a little late, though.
+func (c *Client) roamingCandidates(sequenceNumber uint32) []*Conn {
+	type candidate struct {
+		conn     *Conn
+		distance uint32
+	}
+
+	var candidates []candidate
+
+	c.lock.Lock()
+
+	for _, conn := range c.connsByAddr {
+		hint := atomic.LoadUint32(&conn.remoteSequenceHint)
+		distance := sequenceNumber - hint
+
+		if hint-sequenceNumber < replayWindowSize {
+			distance = hint - sequenceNumber
+		}
+
+		if distance > 0 && distance <= roamingSequenceWindow {
+			candidates = append(candidates, candidate{conn, distance})
+		}
+	}
+
+	c.lock.Unlock()
+
+	sort.Slice(candidates, func(i, j int) bool { return candidates[i].distance < candidates[j].distance })
+
+	conns := make([]*Conn, len(candidates))
+
+	for i, candidate := range candidates {
+		conns[i] = candidate.conn
+	}
+
+	return conns
+}
+
+// moveConn changes the remote address of a connection.
+func (c *Client) moveConn(conn *Conn, remoteAddr *Addr) {
+	key := remoteAddr.String()
+
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	// A connection that was started from the new address is superseded.
+	if other, ok := c.connsByAddr[key]; ok && other != conn {
+		other.Close()
+	}
+
+	now := time.Now()
+
+	// Messages may still come from the previous address, for instance when
+	// the remote host sends over several uplinks.
+	if oldKey := conn.RemoteAddr().String(); c.connsByAddr[oldKey] == conn {
+		delete(c.connsByAddr, oldKey)
+		c.connsBySource[oldKey] = &source{conn: conn, lastSeen: now}
+	}
+
+	delete(c.connsBySource, key)
+	c.expireSources(now)
+	c.connsByAddr[key] = conn
+
+	if atomic.LoadInt32(&conn.multiFlow) != 0 {
+		c.removeMultiFlowConn(conn)
+		conn.setRemoteAddr(remoteAddr)
+		c.addMultiFlowConn(conn)
+	} else {
+		conn.setRemoteAddr(remoteAddr)
+	}
+
+	if writer, ok := conn.writer.(*clientWriter); ok {
+		writer.setRemoteAddr(remoteAddr.TransportAddr)
+	}
+}
+
+func (c *Client) getConn(remoteAddr *Addr) *Conn {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	return c.connsByAddr[remoteAddr.String()]
+}
+
+// openConns returns the number of connections of the client that are not
+// closed.
+func (c *Client) openConns() (n int) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	for _, conn := range c.connsByAddr {
+		select {
+		case <-conn.closed:
+		default:
+			n++
+		}
+	}
+
+	return n
+}
+
+// setCandidates registers the candidate endpoints of a connection, so that
+// the encrypted messages received from them reach it.
+//
+// The candidates replace the previous ones.
+func (c *Client) setCandidates(conn *Conn, candidates []*Addr) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	removeConnFrom(c.connsByAlias, conn)
+
+	for _, addr := range candidates {
+		c.connsByAlias[addr.String()] = conn
+	}
+}
+
+// addSources registers other addresses that the remote host of a connection
+// was seen sending from, so that the encrypted messages received from them
+// reach it.
+//
+// Sources are kept apart from the candidates, which they outlive. They expire
+// once no message comes from them for sourceTimeout.
+func (c *Client) addSources(conn *Conn, addrs ...*Addr) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	now := time.Now()
+
+	for _, addr := range addrs {
+		c.connsBySource[addr.String()] = &source{conn: conn, lastSeen: now}
+	}
+
+	c.expireSources(now)
+}
+
+// expireSources forgets the sources that no message came from for
+// sourceTimeout.
+//
+// The mutex *MUST* be held before calling this method.
+func (c *Client) expireSources(now time.Time) {
+	for key, source := range c.connsBySource {
+		if now.Sub(source.lastSeen) > sourceTimeout {
+			delete(c.connsBySource, key)
+		}
+	}
+}
+
+func (c *Client) getConnByAlias(remoteAddr *Addr) *Conn {
+	key := remoteAddr.String()
+
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if conn, ok := c.connsByAlias[key]; ok {
+		return conn
+	}
+
+	if source, ok := c.connsBySource[key]; ok {
+		source.lastSeen = time.Now()
+
+		return source.conn
+	}
+
+	return nil
+}
+
+// removeAliases unregisters the candidate endpoints and the sources of a
+// connection.
+//
+// The mutex *MUST* be held before calling this method.
+func (c *Client) removeAliases(conn *Conn) {
+	removeConnFrom(c.connsByAlias, conn)
+
+	for key, source := range c.connsBySource {
+		if source.conn == conn {
+			delete(c.connsBySource, key)
+		}
+	}
+}
+
+// removeConnFrom removes all the entries of a connection from a map.
+func removeConnFrom(conns map[string]*Conn, conn *Conn) {
+	for key, other := range conns {
+		if other == conn {
+			delete(conns, key)
 		}
 	}
 }
@@ -184,9 +764,17 @@ func (c *Client) finalize() {
 	// connections which means Connect() can't either.
 	c.closed = true
 	c.closeConns()
+	c.timers.Close()
+
+	if c.rotation != nil {
+		close(c.rotation)
+		c.rotation = nil
+	}
+	close(c.backlog)
+	close(c.roaming)
 }
 
-func (c *Client) addConn(remoteAddr *Addr) (conn *Conn, ok bool) {
+func (c *Client) addConn(remoteAddr *Addr, expectedHash *CertificateHash) (conn *Conn, ok bool) {
 	key := remoteAddr.String()
 
 	c.lock.Lock()
@@ -200,8 +788,8 @@ func (c *Client) addConn(remoteAddr *Addr) (conn *Conn, ok bool) {
 		}
 
 		// This is a new peer so we start a new connection.
-		writer := &clientWriter{c, remoteAddr.TransportAddr}
-		conn = newConn(&Addr{TransportAddr: c.Addr()}, remoteAddr, writer, c.hostIdentifier, c.security)
+		writer := &clientWriter{client: c, remoteAddr: remoteAddr.TransportAddr}
+		conn = newConn(c, remoteAddr, writer, expectedHash)
 
 		c.connsByAddr[key] = conn
 
@@ -221,8 +809,22 @@ func (c *Client) removeConn(conn *Conn) {
 	key := conn.RemoteAddr().String()
 
 	c.lock.Lock()
-	delete(c.connsByAddr, key)
-	c.lock.Unlock()
+	defer c.lock.Unlock()
+
+	// A new connection may have replaced this one already.
+	if c.connsByAddr[key] == conn {
+		delete(c.connsByAddr, key)
+	}
+
+	for hash, other := range c.connsByHash {
+		if other == conn {
+			delete(c.connsByHash, hash)
+		}
+	}
+
+	c.removeAliases(conn)
+	c.removeMultiFlowConn(conn)
+	c.mesh.remove(conn, time.Now())
 }
 
 // closeConns closes all the connections.
@@ -234,15 +836,30 @@ func (c *Client) closeConns() {
 		conn.Close()
 	}
 
-	// Clear the map.
+	// Clear the maps.
 	c.connsByAddr = map[string]*Conn{}
+	c.connsByHash = map[CertificateHash]*Conn{}
+	c.connsByAlias = map[string]*Conn{}
+	c.connsBySource = map[string]*source{}
+	c.connsByHost = map[string][]*Conn{}
 }
 
 type clientWriter struct {
 	client     *Client
+	lock       sync.Mutex
 	remoteAddr net.Addr
 }
 
 func (w *clientWriter) Write(b []byte) (n int, err error) {
-	return w.client.transportConn.WriteTo(b, w.remoteAddr)
+	w.lock.Lock()
+	remoteAddr := w.remoteAddr
+	w.lock.Unlock()
+
+	return w.client.transportConn.WriteTo(b, remoteAddr)
+}
+
+func (w *clientWriter) setRemoteAddr(remoteAddr net.Addr) {
+	w.lock.Lock()
+	w.remoteAddr = remoteAddr
+	w.lock.Unlock()
 }
@@ -0,0 +1,525 @@
+package fscp
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"math"
+	"sync"
+	"sync/atomic"
+)
+
+// Once compression is negotiated, every DATA payload starts with a prefix
+// that tells whether it is compressed. The prefix is encrypted along with the
+// payload, so that it can't be tampered with. Compressed payloads are followed
+// by their uncompressed size.
+const (
+	compressionPrefixNone = 0x00
+	compressionPrefixLZ4  = 0x01
+)
+
+const (
+	// DefaultCompressionMinSize is the default size under which payloads are
+	// never compressed.
+	DefaultCompressionMinSize = 128
+
+	// DefaultCompressionMaxEntropy is the default estimated entropy, in bits
+	// per byte, above which payloads are deemed incompressible.
+	//
+	// Encrypted or already compressed data is typically above 7.5.
+	DefaultCompressionMaxEntropy = 7.0
+
+	// DefaultCompressionMaxRatio is the default average compression ratio
+	// above which compression is temporarily bypassed.
+	DefaultCompressionMaxRatio = 0.9
+)
+
+// CompressionConfig contains the payload compression settings.
+type CompressionConfig struct {
+	// Enabled advertises support for compression and compresses outgoing
+	// payloads when the remote host supports it as well.
+	Enabled bool
+
+	// Channels restricts compression to the specified channels.
+	//
+	// If empty, all channels are compressed.
+	Channels []uint8
+
+	// MinSize is the size under which payloads are never compressed.
+	MinSize int
+
+	// MaxEntropy is the estimated entropy, in bits per byte, above which a
+	// payload is sent without trying to compress it.
+	MaxEntropy float64
+
+	// MaxRatio is the average compressed to uncompressed size ratio above
+	// which compression is bypassed for a while.
+	MaxRatio float64
+}
+
+func (c *CompressionConfig) compresses(channel uint8) bool {
+	if !c.Enabled {
+		return false
+	}
+
+	if len(c.Channels) == 0 {
+		return true
+	}
+
+	for _, ch := range c.Channels {
+		if ch == channel {
+			return true
+		}
+	}
+
+	return false
+}
+
+func (c *CompressionConfig) minSize() int {
+	if c.MinSize <= 0 {
+		return DefaultCompressionMinSize
+	}
+
+	return c.MinSize
+}
+
+func (c *CompressionConfig) maxEntropy() float64 {
+	if c.MaxEntropy <= 0 {
+		return DefaultCompressionMaxEntropy
+	}
+
+	return c.MaxEntropy
+}
+
+func (c *CompressionConfig) maxRatio() float64 {
+	if c.MaxRatio <= 0 {
+		return DefaultCompressionMaxRatio
+	}
+
+	return c.MaxRatio
+}
+
+// CompressionStats contains compression statistics.
+type CompressionStats struct {
+	// Compressed is the number of payloads that were sent compressed.
+	Compressed uint64
+
+	// Bypassed is the number of payloads that were sent uncompressed because
+	// they were deemed incompressible.
+	Bypassed uint64
+
+	// Decompressed is the number of compressed payloads that were received.
+	Decompressed uint64
+
+	// BytesIn is the total size of the payloads that were sent compressed,
+	// before compression.
+	BytesIn uint64
+
+	// BytesOut is the total size of the payloads that were sent compressed,
+	// after compression.
+	BytesOut uint64
+
+	// BytesSaved is the number of bytes that compression saved.
+	BytesSaved uint64
+}
+
+func (s *CompressionStats) snapshot() CompressionStats {
+	return CompressionStats{
+		Compressed:   atomic.LoadUint64(&s.Compressed),
+		Bypassed:     atomic.LoadUint64(&s.Bypassed),
+		Decompressed: atomic.LoadUint64(&s.Decompressed),
+		BytesIn:      atomic.LoadUint64(&s.BytesIn),
+		BytesOut:     atomic.LoadUint64(&s.BytesOut),
+		BytesSaved:   atomic.LoadUint64(&s.BytesSaved),
+	}
+}
+
+const (
+	// compressionMinBackoff and compressionMaxBackoff bound the number of
+	// payloads that bypass compression once it was found ineffective.
+	compressionMinBackoff = 8
+	compressionMaxBackoff = 1024
+
+	// compressionEntropySample is the number of bytes that are looked at to
+	// estimate the entropy of a payload.
+	compressionEntropySample = 512
+)
+
+// A compressor compresses the payloads of a channel.
+//
+// It is not thread-safe.
+type compressor struct {
+	config  *CompressionConfig
+	stats   *CompressionStats
+	ratio   float64
+	probing bool
+	skip    int
+	backoff int
+}
+
+func newCompressor(config *CompressionConfig, stats *CompressionStats) *compressor {
+	return &compressor{
+		config:  config,
+		stats:   stats,
+		probing: true,
+		backoff: compressionMinBackoff,
+	}
+}
+
+// compress tries to compress the specified data.
+//
+// If compression succeeded, the compressed payload is returned, prefixed with
+// compressionPrefixLZ4, along with the pooled buffer that holds it, which must be released with
+// putCompressionBuffer() once it is no longer used. Otherwise, a nil buffer is
+// returned.
+func (c *compressor) compress(data []byte) ([]byte, *[]byte) {
+	if len(data) < c.config.minSize() || len(data) > math.MaxUint16 {
+		return nil, nil
+	}
+
+	if c.skip > 0 {
+		c.skip--
+		atomic.AddUint64(&c.stats.Bypassed, 1)
+
+		if c.skip == 0 {
+			c.probing = true
+		}
+
+		return nil, nil
+	}
+
+	if estimateEntropy(data) > c.config.maxEntropy() {
+		atomic.AddUint64(&c.stats.Bypassed, 1)
+		return nil, nil
+	}
+
+	buf := getCompressionBuffer()
+	table := compressionTablePool.Get().(*lz4Table)
+
+	out := (*buf)[:3+lz4CompressBound(len(data))]
+	out[0] = compressionPrefixLZ4
+	binary.BigEndian.PutUint16(out[1:], uint16(len(data)))
+	n := 3 + lz4CompressBlock(out[3:], data, table)
+
+	compressionTablePool.Put(table)
+
+	ratio := float64(n) / float64(len(data))
+
+	if c.probing {
+		c.ratio, c.probing = ratio, false
+	} else {
+		c.ratio += (ratio - c.ratio) / 8
+	}
+
+	if c.ratio > c.config.maxRatio() {
+		// Compression is not effective on this traffic: bypass it for an
+		// increasing number of payloads before trying again.
+		c.skip = c.backoff
+
+		if c.backoff < compressionMaxBackoff {
+			c.backoff *= 2
+		}
+	} else {
+		c.backoff = compressionMinBackoff
+	}
+
+	if n >= len(data) {
+		putCompressionBuffer(buf)
+		atomic.AddUint64(&c.stats.Bypassed, 1)
+
+		return nil, nil
+	}
+
+	atomic.AddUint64(&c.stats.Compressed, 1)
+	atomic.AddUint64(&c.stats.BytesIn, uint64(len(data)))
+	atomic.AddUint64(&c.stats.BytesOut, uint64(n))
+	atomic.AddUint64(&c.stats.BytesSaved, uint64(len(data)-n))
+
+	return out[:n], buf
+}
+
+// prefixUncompressed returns data prefixed with compressionPrefixNone, in a
+// pooled buffer that must be released with putCompressionBuffer().
+func prefixUncompressed(data []byte) ([]byte, *[]byte) {
+	buf := getCompressionBuffer()
+	out := append(append((*buf)[:0], compressionPrefixNone), data...)
+
+	return out, buf
+}
+
+// decompress a prefixed payload, which may or may not be compressed.
+func decompress(payload []byte) (data []byte, compressed bool, err error) {
+	if len(payload) == 0 {
+		return nil, false, errors.New("payload has no compression prefix")
+	}
+
+	switch payload[0] {
+	case compressionPrefixNone:
+		return payload[1:], false, nil
+	case compressionPrefixLZ4:
+		data, err = decompressLZ4(payload[1:])
+
+		return data, true, err
+	}
+
+	return nil, false, fmt.Errorf("unknown compression prefix: %d", payload[0])
+}
+
+// decompressLZ4 decompresses a payload that starts with its uncompressed size.
+func decompressLZ4(payload []byte) ([]byte, error) {
+	if len(payload) < 2 {
+		return nil, errors.New("compressed payload is too short")
+	}
+
+	size := int(binary.BigEndian.Uint16(payload))
+	data := make([]byte, size)
+	n, err := lz4DecompressBlock(data, payload[2:])
+
+	if err != nil {
+		return nil, err
+	}
+
+	if n != size {
+		return nil, fmt.Errorf("decompressed payload should be %d byte(s) long but is %d", size, n)
+	}
+
+	return data, nil
+}
+
+// estimateEntropy estimates the Shannon entropy, in bits per byte, of the
+// beginning of the specified data.
+func estimateEntropy(data []byte) float64 {
+	if len(data) > compressionEntropySample {
+		data = data[:compressionEntropySample]
+	}
+
+	var counts [256]int
+
+	for _, b := range data {
+		counts[b]++
+	}
+
+	entropy := 0.0
+	total := float64(len(data))
+
+	for _, count := range counts {
+		if count > 0 {
+			p := float64(count) / total
+			entropy -= p * math.Log2(p)
+		}
+	}
+
+	return entropy
+}
+
+var compressionBufferPool = sync.Pool{
+	New: func() interface{} {
+		buf := make([]byte, 3+lz4CompressBound(math.MaxUint16))
+		return &buf
+	},
+}
+
+var compressionTablePool = sync.Pool{
+	New: func() interface{} {
+		return &lz4Table{}
+	},
+}
+
+func getCompressionBuffer() *[]byte {
+	return compressionBufferPool.Get().(*[]byte)
+}
+
+func putCompressionBuffer(buf *[]byte) {
+	compressionBufferPool.Put(buf)
+}
+
+// The functions below implement the LZ4 block format, as described in
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md.
+
+const (
+	lz4MinMatch     = 4
+	lz4HashLog      = 12
+	lz4MFLimit      = 12
+	lz4LastLiterals = 5
+	lz4MaxOffset    = 65535
+)
+
+// lz4Table maps hashed sequences to their position, plus one.
+type lz4Table [1 << lz4HashLog]int32
+
+func lz4CompressBound(n int) int {
+	return n + n/255 + 16
+}
+
+func lz4Hash(sequence uint32) uint32 {
+	return (sequence * 2654435761) >> (32 - lz4HashLog)
+}
+
+// lz4CompressBlock compresses src into dst and returns the compressed size.
+//
+// dst must be at least lz4CompressBound(len(src)) bytes long.
+func lz4CompressBlock(dst, src []byte, table *lz4Table) int {
+	*table = lz4Table{}
+
+	d, anchor, i := 0, 0, 0
+	limit := len(src) - lz4MFLimit
+
+	for i < limit {
+		sequence := binary.LittleEndian.Uint32(src[i:])
+		h := lz4Hash(sequence)
+		ref := int(table[h]) - 1
+		table[h] = int32(i + 1)
+
+		if ref < 0 || i-ref > lz4MaxOffset || binary.LittleEndian.Uint32(src[ref:]) != sequence {
+			i++
+			continue
+		}
+
+		for i > anchor && ref > 0 && src[i-1] == src[ref-1] {
+			i--
+			ref--
+		}
+
+		matchLen := lz4MinMatch
+
+		for i+matchLen < len(src)-lz4LastLiterals && src[i+matchLen] == src[ref+matchLen] {
+			matchLen++
+		}
+
+		d = lz4WriteSequence(dst, d, src[anchor:i], i-ref, matchLen)
+		i += matchLen
+		anchor = i
+	}
+
+	return lz4WriteSequence(dst, d, src[anchor:], 0, 0)
+}
+
+// lz4WriteSequence writes a sequence at dst[d:] and returns the new position.
+//
+// A zero matchLen indicates the last sequence, which only has literals.
+func lz4WriteSequence(dst []byte, d int, literals []byte, offset int, matchLen int) int {
+	token := d
+	d++
+
+	if len(literals) >= 15 {
+		dst[token] = 15 << 4
+		d = lz4WriteLength(dst, d, len(literals)-15)
+	} else {
+		dst[token] = byte(len(literals) << 4)
+	}
+
+	d += copy(dst[d:], literals)
+
+	if matchLen == 0 {
+		return d
+	}
+
+	binary.LittleEndian.PutUint16(dst[d:], uint16(offset))
+	d += 2
+
+	if matchLen-lz4MinMatch >= 15 {
+		dst[token] |= 15
+		d = lz4WriteLength(dst, d, matchLen-lz4MinMatch-15)
+	} else {
+		dst[token] |= byte(matchLen - lz4MinMatch)
+	}
+
+	return d
+}
+
+func lz4WriteLength(dst []byte, d int, n int) int {
+	for n >= 255 {
+		dst[d] = 255
+		d++
+		n -= 255
+	}
+
+	dst[d] = byte(n)
+
+	return d + 1
+}
+
+func lz4ReadLength(src []byte, s int, n int) (int, int, error) {
+	for {
+		if s >= len(src) {
+			return 0, 0, errors.New("truncated LZ4 length")
+		}
+
+		b := src[s]
+		s++
+		n += int(b)
+
+		if b != 255 {
+			return s, n, nil
+		}
+	}
+}
+
+// lz4DecompressBlock decompresses src into dst and returns the decompressed
+// size.
+func lz4DecompressBlock(dst, src []byte) (d int, err error) {
+	s := 0
+
+	for s < len(src) {
+		token := src[s]
+		s++
+
+		literalsLen := int(token >> 4)
+
+		if literalsLen == 15 {
+			if s, literalsLen, err = lz4ReadLength(src, s, literalsLen); err != nil {
+				return 0, err
+			}
+		}
+
+		if s+literalsLen > len(src) || d+literalsLen > len(dst) {
+			return 0, errors.New("LZ4 literals out of bounds")
+		}
+
+		d += copy(dst[d:], src[s:s+literalsLen])
+		s += literalsLen
+
+		if s == len(src) {
+			break
+		}
+
+		if s+2 > len(src) {
+			return 0, errors.New("truncated LZ4 match offset")
+		}
+
+		offset := int(binary.LittleEndian.Uint16(src[s:]))
+		s += 2
+
+		if offset == 0 || offset > d {
+			return 0, fmt.Errorf("invalid LZ4 match offset: %d", offset)
+		}
+
+		matchLen := int(token & 15)
+
+		if matchLen == 15 {
+			if s, matchLen, err = lz4ReadLength(src, s, matchLen); err != nil {
+				return 0, err
+			}
+		}
+
+		matchLen += lz4MinMatch
+
+		if d+matchLen > len(dst) {
+			return 0, errors.New("LZ4 match out of bounds")
+		}
+
+		ref := d - offset
+
+		if offset >= matchLen {
+			d += copy(dst[d:d+matchLen], dst[ref:ref+matchLen])
+		} else {
+			// The match overlaps the output: copy byte by byte.
+			for end := d + matchLen; d < end; d++ {
+				dst[d] = dst[ref]
+				ref++
+			}
+		}
+	}
+
+	return d, nil
+}
@@ -0,0 +1,197 @@
+package fscp
+
+import (
+	"bytes"
+	"context"
+	"crypto/rand"
+	"fmt"
+	"math"
+	"testing"
+	"time"
+)
+
+func TestLZ4RoundTrip(t *testing.T) {
+	random := make([]byte, 4096)
+	rand.Read(random)
+
+	testCases := map[string][]byte{
+		"empty":       {},
+		"short":       []byte("hello"),
+		"repeated":    bytes.Repeat([]byte("a"), 1000),
+		"overlapping": bytes.Repeat([]byte("abc"), 500),
+		"text":        bytes.Repeat([]byte("The quick brown fox jumps over the lazy dog. "), 100),
+		"random":      random,
+		"long":        bytes.Repeat([]byte{0x01, 0x02, 0x03, 0x04, 0x05}, math.MaxUint16/5),
+	}
+
+	for name, testCase := range testCases {
+		t.Run(name, func(t *testing.T) {
+			table := &lz4Table{}
+			compressed := make([]byte, lz4CompressBound(len(testCase)))
+			n := lz4CompressBlock(compressed, testCase, table)
+
+			result := make([]byte, len(testCase))
+			m, err := lz4DecompressBlock(result, compressed[:n])
+
+			if err != nil {
+				t.Fatalf("expected no error but got: %s", err)
+			}
+
+			if !bytes.Equal(result[:m], testCase) {
+				t.Errorf("decompressed data does not match the original data")
+			}
+		})
+	}
+}
+
+func TestLZ4DecompressInvalid(t *testing.T) {
+	testCases := [][]byte{
+		{0xf0},
+		{0x10},
+		{0x11, 'a', 0x00},
+		{0x11, 'a', 0x02, 0x00},
+		{0x1f, 'a', 0x01, 0x00, 0xff},
+	}
+
+	for i, testCase := range testCases {
+		t.Run(fmt.Sprintf("%d", i), func(t *testing.T) {
+			if _, err := lz4DecompressBlock(make([]byte, 1024), testCase); err == nil {
+				t.Errorf("expected an error")
+			}
+		})
+	}
+}
+
+func TestCompressor(t *testing.T) {
+	config := &CompressionConfig{Enabled: true}
+	stats := &CompressionStats{}
+	c := newCompressor(config, stats)
+
+	text := bytes.Repeat([]byte("some highly compressible telemetry; "), 20)
+	payload, buf := c.compress(text)
+
+	if buf == nil {
+		t.Fatal("expected the payload to be compressed")
+	}
+
+	data, compressed, err := decompress(payload)
+	putCompressionBuffer(buf)
+
+	if err != nil {
+		t.Fatalf("expected no error but got: %s", err)
+	}
+
+	if !compressed || !bytes.Equal(data, text) {
+		t.Errorf("decompressed data does not match the original data")
+	}
+
+	payload, buf = prefixUncompressed(text)
+	data, compressed, err = decompress(payload)
+
+	if err != nil {
+		t.Fatalf("expected no error but got: %s", err)
+	}
+
+	if compressed || !bytes.Equal(data, text) {
+		t.Errorf("uncompressed data does not match the original data")
+	}
+
+	putCompressionBuffer(buf)
+
+	random := make([]byte, 1024)
+	rand.Read(random)
+
+	if _, buf = c.compress(random); buf != nil {
+		t.Errorf("expected a high entropy payload to bypass compression")
+	}
+
+	if _, buf = c.compress(text[:config.minSize()-1]); buf != nil {
+		t.Errorf("expected a short payload to bypass compression")
+	}
+
+	s := stats.snapshot()
+
+	if s.Compressed != 1 {
+		t.Errorf("expected %d compressed payload(s) but got %d", 1, s.Compressed)
+	}
+
+	if s.Bypassed != 1 {
+		t.Errorf("expected %d bypassed payload(s) but got %d", 1, s.Bypassed)
+	}
+
+	if s.BytesSaved != s.BytesIn-s.BytesOut || s.BytesSaved == 0 {
+		t.Errorf("unexpected saved bytes count: %d", s.BytesSaved)
+	}
+}
+
+func TestCompressorBackoff(t *testing.T) {
+	// An entropy threshold above the maximum forces compression attempts,
+	// which leaves the ratio heuristic alone.
+	config := &CompressionConfig{Enabled: true, MaxEntropy: 9}
+	stats := &CompressionStats{}
+	c := newCompressor(config, stats)
+
+	random := make([]byte, 1024)
+	rand.Read(random)
+
+	c.compress(random)
+
+	if c.skip != compressionMinBackoff {
+		t.Fatalf("expected %d payloads to be skipped but got %d", compressionMinBackoff, c.skip)
+	}
+
+	for i := 0; i < compressionMinBackoff; i++ {
+		c.compress(random)
+	}
+
+	if !c.probing {
+		t.Fatalf("expected the compressor to probe again")
+	}
+
+	text := bytes.Repeat([]byte("compressible "), 100)
+
+	if _, buf := c.compress(text); buf == nil {
+		t.Fatalf("expected the payload to be compressed")
+	} else {
+		putCompressionBuffer(buf)
+	}
+
+	if c.skip != 0 || c.backoff != compressionMinBackoff {
+		t.Errorf("expected compression to be resumed")
+	}
+}
+
+func TestCompressedConnection(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	config := &ClientConfig{
+		Compression: CompressionConfig{Enabled: true},
+	}
+	clientConn, serverConn := connectTestClients(ctx, t, config, config)
+
+	text := bytes.Repeat([]byte("some highly compressible telemetry; "), 20)
+
+	if _, err := clientConn.Write(text); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	msg := make([]byte, 2048)
+	n, err := serverConn.Read(msg)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if !bytes.Equal(msg[:n], text) {
+		t.Errorf("received data does not match the sent data")
+	}
+
+	if stats := clientConn.CompressionStats(); stats.Compressed != 1 || stats.BytesSaved == 0 {
+		t.Errorf("expected the payload to be compressed: %#v", stats)
+	}
+
+	if stats := serverConn.(*Conn).CompressionStats(); stats.Decompressed != 1 {
+		t.Errorf("expected the payload to be decompressed: %#v", stats)
+	}
+}
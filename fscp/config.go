@@ -0,0 +1,102 @@
+package fscp
+
+// ClientConfig contains the settings of a client that are not related to
+// security.
+//
+// The zero value is a valid configuration that uses the default settings.
+type ClientConfig struct {
+	// Handshake contains the handshake settings.
+	Handshake HandshakeConfig
+
+	// Compression contains the payload compression settings.
+	Compression CompressionConfig
+
+	// KeepAlive contains the keep-alive settings.
+	KeepAlive KeepAliveConfig
+
+	// Liveness contains the dead peer detection settings.
+	Liveness LivenessConfig
+
+	// Contacts contains the contact exchange settings.
+	Contacts ContactConfig
+
+	// Resumption contains the session resumption settings.
+	Resumption ResumptionConfig
+
+	// Rotation contains the credential rotation settings.
+	Rotation RotationConfig
+
+	// Peers contains the peer set reconciliation settings.
+	Peers PeersConfig
+
+	// Paths contains the settings of the selection among the candidate
+	// endpoints of connections.
+	Paths PathsConfig
+
+	// Multipath contains the settings of the connections of clients that
+	// have several uplinks.
+	Multipath MultipathConfig
+
+	// MultiFlow contains the settings of the spreading of DATA messages over
+	// several source ports.
+	MultiFlow MultiFlowConfig
+
+	// Race contains the settings of the races between the endpoints of a
+	// host.
+	Race RaceConfig
+
+	// WriteQueue contains the settings of the writes that happen before a
+	// session is established.
+	WriteQueue WriteQueueConfig
+
+	// Relay contains the settings of the forwarding of DATA messages between
+	// connections.
+	Relay RelayConfig
+
+	// Mesh contains the settings of the routing between the peers of a mesh.
+	Mesh MeshConfig
+
+	// Streams contains the settings of the reliable streams multiplexed over
+	// connections.
+	Streams StreamConfig
+}
+
+// features returns the features that the configuration enables.
+func (c *ClientConfig) features() (result FeatureSet) {
+	// Answering keep-alives is cheap, so we always do.
+	result = result.With(FeatureKeepAliveEcho)
+
+	if c.Compression.Enabled {
+		result = result.With(FeatureCompression)
+	}
+
+	if !c.Resumption.Disabled {
+		result = result.With(FeatureResumption)
+	}
+
+	if !c.Handshake.DisableCompactKeys {
+		result = result.With(FeatureCompactKeys)
+	}
+
+	// Reassembling fragments is cheap, so we always do.
+	result = result.With(FeatureFragmentation)
+
+	// So is accepting DATA messages from several ports.
+	result = result.With(FeatureMultiFlow)
+
+	// Announcing certificates is what allows their rotation.
+	result = result.With(FeatureRotation)
+
+	// Every message of a datagram gets read anyway.
+	result = result.With(FeatureCoalescing)
+
+	if c.Mesh.Enabled {
+		result = result.With(FeatureMesh)
+	}
+
+	if c.Streams.Enabled {
+		result = result.With(FeatureStreams)
+	}
+
+	return
+}
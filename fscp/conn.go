@@ -2,259 +2,1382 @@ package fscp
 
 import (
 	"bytes"
+	"context"
+	"crypto/x509"
+	"errors"
 	"fmt"
 	"io"
 	"math/rand"
 	"net"
 	"sync"
+	"sync/atomic"
 	"time"
 )
 
+// ErrNoSession is returned when an operation requires an established session.
+var ErrNoSession = errors.New("no session is established")
+
 type messageFrame struct {
 	messageType MessageType
 	message     interface{}
+
+	// sibling, if set, is another port of the remote host the message came
+	// from.
+	sibling *Addr
+
+	// alias, if set, is the address the message came from, when it is not the
+	// remote address of the connection.
+	alias *Addr
 }
 
 // Conn is a FSCP connection.
 type Conn struct {
+	client               *Client
 	writer               io.Writer
 	localAddr            *Addr
+	remoteAddrLock       sync.Mutex
 	remoteAddr           *Addr
 	localHostIdentifier  HostIdentifier
 	remoteHostIdentifier *HostIdentifier
 	security             ClientSecurity
+	securityGeneration   uint64
+	previousSecurity     *ClientSecurity
+	presentedSecurity    *RemoteClientSecurity
+	announcedHash        *CertificateHash
+	config               ClientConfig
+	remoteFeatures       FeatureSet
 	session              *Session
 	nextSession          *Session
+	previousSession      *Session
+	compressors          [16]*compressor
+	compressionStats     CompressionStats
+	timers               *timerWheel
+	timer                *wheelTimer
+	tick                 chan struct{}
+	lastSent             time.Time
+	lastReceived         time.Time
+	keepAlive            *keepAliveState
+	liveness             *livenessState
+	paths                *pathState
+	candidates           []*Addr
+	uplinks              []*uplink
+	flows                []net.PacketConn
+	multiFlow            int32
+	uniqueNumber         UniqueNumber
+	handshakeRetrier     *Retrier
+	handshakeStage       handshakeStage
+	handshakeSentAt      time.Time
+	handshakeRTT         rttEstimator
+	reassembler          *reassembler
+	handshakeDeadline    time.Time
+	sessionNumberHint    SessionNumber
+	remoteSecurityPreset bool
+	expectedHash         *CertificateHash
+	claimed              int32
+	remoteSequenceHint   uint32
+	resumeTicket         *resumptionTicket
+	resumeRequest        *messageResume
+	lastResume           *messageResume
+	lastResumeNonce      ResumptionNonce
+
+	statsLock      sync.Mutex
+	remoteHash     *CertificateHash
+	keepAliveStats KeepAliveStats
+	livenessStats  LivenessStats
+	pathsStats     PathsStats
 
 	incoming   chan messageFrame
+	actions    chan func()
 	connected  chan struct{}
 	closed     chan struct{}
 	closeError error
 	once       sync.Once
 
-	incomingData chan []byte
-	outgoingData chan []byte
+	incomingData   chan []byte
+	outgoingData   chan []byte
+	outgoingFrames chan outgoingFrame
+	frameBatch     []outgoingFrame
+
+	meshLoss          float64
+	meshEchoed        uint64
+	meshLost          uint64
+	meshNextAdvertise time.Time
+
+	streamsLock       sync.Mutex
+	streams           map[streamKey]*Stream
+	streamsNextID     uint32
+	streamsRemoteMax  uint32
+	streamsRemoteGaps map[uint32]struct{}
+	accepted          chan *Stream
+	streamSegments    chan relayedMessage
+
+	relayed        chan relayedMessage
+	relayStats     RelayStats
+	relayBatch     []relayedMessage
+	relayBuf       bytes.Buffer
+	relayOffsets   []int
+	relayDatagrams [][]byte
+
+	pendingLock    sync.Mutex
+	pendingWrites  [][]byte
+	pendingBytes   int
+	pendingFlushed bool
+}
+
+// newConn creates a connection that belongs to the specified client.
+//
+// If expectedHash is not nil, the remote host must present a certificate with
+// that hash.
+//
+// The client's lock *MUST* be held before calling this function.
+func newConn(client *Client, remoteAddr *Addr, w io.Writer, expectedHash *CertificateHash) *Conn {
+	conn := &Conn{
+		client:               client,
+		writer:               w,
+		localAddr:            &Addr{TransportAddr: client.Addr()},
+		remoteAddr:           remoteAddr,
+		localHostIdentifier:  client.hostIdentifier,
+		security:             client.security,
+		securityGeneration:   client.securityGeneration,
+		config:               client.config,
+		timers:               client.timers,
+		remoteSecurityPreset: client.security.RemoteClientSecurity != nil,
+		expectedHash:         expectedHash,
+		tick:                 make(chan struct{}, 1),
+
+		incoming:  make(chan messageFrame, 100),
+		actions:   make(chan func(), 10),
+		connected: make(chan struct{}),
+		closed:    make(chan struct{}),
+
+		incomingData:   make(chan []byte, 100),
+		outgoingData:   make(chan []byte, 100),
+		outgoingFrames: make(chan outgoingFrame, 100),
+
+		relayed: make(chan relayedMessage, client.config.Relay.queueSize()),
+	}
+
+	// With a pre-shared key and no certificate, we assume the remote host
+	// uses the pre-shared key too until it presents a certificate.
+	if conn.security.RemoteClientSecurity == nil && conn.security.usesPresharedKeyOnly() {
+		conn.security.RemoteClientSecurity = &RemoteClientSecurity{}
+	}
+
+	conn.keepAlive = newKeepAliveState(&conn.config.KeepAlive)
+	conn.keepAliveStats = conn.keepAlive.stats
+	conn.liveness = newLivenessState(&conn.config.Liveness)
+	conn.paths = newPathState(&conn.config.Paths)
+	conn.uplinks = client.connUplinks()
+	conn.flows = client.flows
+	conn.refreshPaths()
+
+	if remoteClientSecurity := conn.security.RemoteClientSecurity; remoteClientSecurity != nil && remoteClientSecurity.Certificate != nil {
+		hash := HashCertificate(remoteClientSecurity.Certificate)
+		conn.remoteHash = &hash
+	}
+
+	if conn.config.Streams.Enabled {
+		conn.streams = map[streamKey]*Stream{}
+		conn.streamsRemoteGaps = map[uint32]struct{}{}
+		conn.accepted = make(chan *Stream, conn.config.Streams.backlog())
+		conn.streamSegments = make(chan relayedMessage, streamQueueSize)
+	}
+
+	go conn.dispatchLoop()
+
+	return conn
+}
+
+func (c *Conn) Read(b []byte) (n int, err error) {
+	select {
+	case <-c.closed:
+		return 0, io.EOF
+	case buf := <-c.incomingData:
+		return copy(b, buf), nil
+	}
+}
+
+func (c *Conn) Write(p []byte) (n int, err error) {
+	if !c.isConnected() {
+		if queued, err := c.queueWrite(p); err != nil {
+			return 0, err
+		} else if queued {
+			return len(p), nil
+		}
+	}
+
+	select {
+	case <-c.connected:
+		// Implementations must not retain p.
+		b := make([]byte, len(p))
+		copy(b, p)
+
+		select {
+		case <-c.closed:
+			return 0, io.ErrClosedPipe
+
+		case c.outgoingData <- b:
+			return len(b), nil
+		}
+
+	case <-c.closed:
+		return 0, io.ErrClosedPipe
+	}
+}
+
+// Close closes the connection.
+func (c *Conn) Close() error {
+	return c.closeWithError(io.EOF)
+}
+
+func (c *Conn) debugPrintf(msg string, args ...interface{}) {
+	debugPrintf("(%s <- %s) %s", c.LocalAddr(), c.RemoteAddr(), fmt.Sprintf(msg, args...))
+}
+
+// closeWithError closes the connection with the specified error.
+func (c *Conn) closeWithError(err error) error {
+	c.once.Do(func() {
+		c.debugPrintf("closing connection: %s\n", err)
+
+		c.closeError = err
+		close(c.closed)
+	})
+
+	return c.closeError
+}
+
+func (c *Conn) warning(err error) {
+	c.debugPrintf("Warning: %s\n", err.Error())
+}
+
+// LocalAddr returns the local address of the connection.
+func (c *Conn) LocalAddr() net.Addr { return c.localAddr }
+
+// RemoteAddr returns the remote address of the connection.
+//
+// It changes when the remote host roams to another address.
+func (c *Conn) RemoteAddr() net.Addr {
+	c.remoteAddrLock.Lock()
+	defer c.remoteAddrLock.Unlock()
+
+	return c.remoteAddr
+}
+
+func (c *Conn) setRemoteAddr(remoteAddr *Addr) {
+	c.remoteAddrLock.Lock()
+	c.remoteAddr = remoteAddr
+	c.remoteAddrLock.Unlock()
+}
+
+// RemoteCertificateHash returns the hash of the certificate of the remote
+// host, if it presented one.
+func (c *Conn) RemoteCertificateHash() (hash CertificateHash, ok bool) {
+	c.statsLock.Lock()
+	defer c.statsLock.Unlock()
+
+	if c.remoteHash == nil {
+		return hash, false
+	}
+
+	return *c.remoteHash, true
+}
+
+// RequestContacts asks the remote host for the endpoints of the hosts with the
+// specified certificate hashes.
+//
+// The remote host answers with the endpoints of the hosts it is connected to
+// and introduces this host to them, which makes both ends connect to one
+// another. Use Client.ConnectByHash to wait for such a connection.
+func (c *Conn) RequestContacts(hashes ...CertificateHash) error {
+	result := make(chan error, 1)
+
+	if err := c.do(func() { result <- c.sendContactRequest(hashes) }); err != nil {
+		return err
+	}
+
+	select {
+	case err := <-result:
+		return err
+	case <-c.closed:
+		return c.closeError
+	}
+}
+
+// do runs the specified function in the connection's goroutine.
+func (c *Conn) do(f func()) error {
+	select {
+	case c.actions <- f:
+		return nil
+	case <-c.closed:
+		return c.closeError
+	}
+}
+
+// isConnected tells whether a session was established with the remote host.
+func (c *Conn) isConnected() bool {
+	select {
+	case <-c.connected:
+		return true
+	default:
+		return false
+	}
+}
+
+// waitConnected waits for a session to be established with the remote host.
+func (c *Conn) waitConnected(ctx context.Context) error {
+	select {
+	case <-c.closed:
+		if c.closeError == ErrHandshakeTimeout {
+			return ErrHandshakeTimeout
+		}
+
+		return io.EOF
+	case <-c.connected:
+		return nil
+	case <-ctx.Done():
+		return ctx.Err()
+	}
+}
+
+// CompressionStats returns the compression statistics of the connection.
+func (c *Conn) CompressionStats() CompressionStats {
+	return c.compressionStats.snapshot()
+}
+
+// KeepAliveStats returns the keep-alive statistics of the connection.
+func (c *Conn) KeepAliveStats() KeepAliveStats {
+	c.statsLock.Lock()
+	defer c.statsLock.Unlock()
+
+	return c.keepAliveStats
+}
+
+// RTT returns the smoothed round-trip time to the remote host and its
+// variance, as measured by keep-alives.
+//
+// Both values are zero until a measurement was made.
+func (c *Conn) RTT() (srtt time.Duration, rttvar time.Duration) {
+	c.statsLock.Lock()
+	defer c.statsLock.Unlock()
+
+	return c.keepAliveStats.SmoothedRTT, c.keepAliveStats.RTTVariance
+}
+
+// LivenessStats returns the dead peer detection statistics of the
+// connection.
+func (c *Conn) LivenessStats() LivenessStats {
+	c.statsLock.Lock()
+	defer c.statsLock.Unlock()
+
+	return c.livenessStats
+}
+
+// features returns the features that are supported by both hosts.
+//
+// This method is not thread-safe.
+func (c *Conn) features() FeatureSet {
+	return c.config.features().Intersect(c.remoteFeatures)
+}
+
+// SetDeadline sets the deadline on the connection.
+func (c *Conn) SetDeadline(t time.Time) error {
+	// TODO: Implement.
+	return nil
+}
+
+// SetReadDeadline sets the deadline on the connection.
+func (c *Conn) SetReadDeadline(t time.Time) error {
+	// TODO: Implement.
+	return nil
+}
+
+// SetWriteDeadline sets the deadline on the connection.
+func (c *Conn) SetWriteDeadline(t time.Time) error {
+	// TODO: Implement.
+	return nil
+}
+
+func (c *Conn) writeMessage(messageType MessageType, message serializable) (err error) {
+	// FIXME: If we know for sure that no two writeMessage() calls ever happen
+	// concurrently, we can reuse the same buffer over and over (don't forget
+	// to Reset() it).
+
+	buf := &bytes.Buffer{}
+
+	if err = writeMessage(buf, messageType, message); err != nil {
+		return err
+	}
+
+	if buf.Len() != message.serializationSize()+4 {
+		panic(fmt.Errorf("expected buffer of size %d but was %d byte(s) long", message.serializationSize()+4, buf.Len()))
+	}
+
+	_, err = buf.WriteTo(c.writer)
+
+	return
+}
+
+func (c *Conn) sendHelloRequest(uniqueNumber UniqueNumber) (err error) {
+	msg := &messageHello{
+		UniqueNumber: uniqueNumber,
+	}
+
+	c.debugPrintf("Sending %s.\n", msg)
+
+	if err = c.writeMessage(MessageTypeHelloRequest, msg); err != nil {
+		return err
+	}
+
+	return nil
+}
+
+func (c *Conn) sendHelloResponse(uniqueNumber UniqueNumber) error {
+	msg := &messageHello{
+		UniqueNumber: uniqueNumber,
+	}
+
+	c.debugPrintf("Sending %s.\n", msg)
+
+	return c.writeMessage(MessageTypeHelloResponse, msg)
+}
+
+// sendPresentation sends our PRESENTATION until the remote host answers with
+// a SESSION REQUEST.
+func (c *Conn) sendPresentation() error {
+	msg := &messagePresentation{
+		Certificate: c.security.Certificate,
+	}
+
+	return c.sendDatagramsFlight(handshakePresentation, flightMessage{MessageTypePresentation, msg})
+}
+
+func (c *Conn) makeSessionRequest(security ClientSecurity, sessionNumber SessionNumber) (*messageSessionRequest, error) {
+	// The features we support are advertised as part of the cipher suites.
+	cipherSuites := append(CipherSuiteSlice{}, security.supportedCipherSuites()...)
+	cipherSuites = append(cipherSuites, c.config.features().cipherSuites()...)
+
+	msg := &messageSessionRequest{
+		CipherSuites:   cipherSuites,
+		EllipticCurves: security.supportedEllipticCurves(),
+		HostIdentifier: c.localHostIdentifier,
+		SessionNumber:  sessionNumber,
+	}
+
+	if err := msg.computeSignature(security); err != nil {
+		return nil, fmt.Errorf("failed to forge session request message: %s", err)
+	}
+
+	return msg, nil
+}
+
+// sendSessionRequest sends a SESSION REQUEST until a session gets
+// established.
+//
+// Our PRESENTATION is resent along with it, as the remote host cannot
+// authenticate the request without it and it may have been lost too.
+func (c *Conn) sendSessionRequest(sessionNumber SessionNumber) error {
+	msg, err := c.makeSessionRequest(c.security, sessionNumber)
+
+	if err != nil {
+		return err
+	}
+
+	presentation := &messagePresentation{
+		Certificate: c.security.Certificate,
+	}
+
+	reassembles := c.features().Has(FeatureFragmentation)
+	first, err := c.makeFlight([]flightMessage{{MessageTypeSessionRequest, msg}}, reassembles)
+
+	if err != nil {
+		return err
+	}
+
+	retries, err := c.makeFlight([]flightMessage{{MessageTypePresentation, presentation}, {MessageTypeSessionRequest, msg}}, reassembles)
+
+	if err != nil {
+		return err
+	}
+
+	attempts := 0
+
+	return c.sendFlight(handshakeSession, func() error {
+		attempts++
+
+		if attempts == 1 {
+			c.debugPrintf("Sending %s request.\n", msg)
+
+			return c.writeDatagrams(first.datagrams(attempts))
+		}
+
+		c.debugPrintf("Resending %s request.\n", msg)
+
+		return c.writeDatagrams(retries.datagrams(attempts - 1))
+	})
+}
+
+func (c *Conn) sendSession(session *Session) error {
+	msg := &messageSession{
+		CipherSuite:      session.CipherSuite,
+		EllipticCurve:    session.EllipticCurve,
+		HostIdentifier:   c.localHostIdentifier,
+		SessionNumber:    session.SessionNumber,
+		PublicKey:        session.PublicKey,
+		CompactPublicKey: c.features().Has(FeatureCompactKeys),
+	}
+
+	if err := msg.computeSignature(c.security); err != nil {
+		return fmt.Errorf("failed to forge session message: %s", err)
+	}
+
+	c.debugPrintf("Sending %s.\n", msg)
+
+	// Large SESSION messages are fragmented for the remote hosts that said
+	// they reassemble them.
+	if c.features().Has(FeatureFragmentation) {
+		f, err := c.makeFlight([]flightMessage{{MessageTypeSession, msg}}, true)
+
+		if err != nil {
+			return err
+		}
+
+		return c.writeDatagrams(f.datagrams(1))
+	}
+
+	return c.writeMessage(MessageTypeSession, msg)
+}
+
+func (c *Conn) sendData(channel uint8, cleartext []byte) error {
+	buf := &bytes.Buffer{}
+
+	// Encryption happens in place.
+	redundant := c.multipath() && c.config.Multipath.redundant(cleartext)
+	flow := c.flow(cleartext)
+
+	if err := c.appendData(buf, channel, cleartext); err != nil {
+		return err
+	}
+
+	// Traffic goes around degraded links, sealed with our own session.
+	if hop := c.meshDetour(); hop != nil {
+		hop.relayRouting(makeRoutedData(c.session.RemoteHostIdentifier, c.client.hostIdentifier, buf.Bytes()))
+
+		return nil
+	}
+
+	if c.multipath() {
+		return c.sendMultipath(buf.Bytes(), redundant)
+	}
+
+	if flow != nil {
+		_, err := flow.WriteTo(buf.Bytes(), c.RemoteAddr().(*Addr).TransportAddr)
+
+		return err
+	}
+
+	_, err := buf.WriteTo(c.writer)
+
+	return err
+}
+
+// appendData encrypts a DATA message and appends it to a buffer.
+func (c *Conn) appendData(buf *bytes.Buffer, channel uint8, cleartext []byte) error {
+	if c.features().Has(FeatureCompression) {
+		var compressionBuf *[]byte
+
+		if c.config.Compression.compresses(channel) {
+			cleartext, compressionBuf = c.compressor(channel).compress(cleartext)
+		}
+
+		if compressionBuf == nil {
+			cleartext, compressionBuf = prefixUncompressed(cleartext)
+		}
+
+		defer putCompressionBuffer(compressionBuf)
+	}
+
+	msg := c.session.Encrypt(cleartext)
+	msg.Channel = channel
+
+	c.debugPrintf("Sending %s.\n", msg)
+
+	c.lastSent = time.Now()
+
+	return writeMessage(buf, MessageTypeData+MessageType(channel), msg)
+}
+
+func (c *Conn) sendKeepAlive(now time.Time) error {
+	var payload []byte
+
+	if c.features().Has(FeatureKeepAliveEcho) {
+		payload = makeKeepAlivePayload(keepAliveKindRequest, c.keepAlive.sent(now))
+	} else {
+		payload = makeKeepAlivePayload(keepAliveKindPlain, 0)
+		c.keepAlive.sentPlain()
+	}
+
+	c.updateKeepAliveStats()
+
+	return c.sendEncrypted(MessageTypeKeepAlive, 0, payload)
+}
+
+// sendEncrypted sends a message that is encrypted with the current session.
+func (c *Conn) sendEncrypted(messageType MessageType, channel uint8, cleartext []byte) error {
+	msg := c.session.Encrypt(cleartext)
+	msg.Channel = channel
+
+	c.debugPrintf("Sending %s.\n", msg)
+
+	c.lastSent = time.Now()
+
+	return c.writeMessage(messageType, msg)
+}
+
+func (c *Conn) sendContactRequest(hashes []CertificateHash) error {
+	if c.session == nil {
+		return ErrNoSession
+	}
+
+	return c.sendEncrypted(MessageTypeContactRequest, 0, serializeContactRequest(hashes))
+}
+
+func (c *Conn) sendContacts(contacts []contact) error {
+	if c.session == nil {
+		return ErrNoSession
+	}
+
+	payload, err := serializeContacts(contacts)
+
+	if err != nil {
+		return err
+	}
+
+	return c.sendEncrypted(MessageTypeContact, 0, payload)
+}
+
+func (c *Conn) updateKeepAliveStats() {
+	c.statsLock.Lock()
+	c.keepAliveStats = c.keepAlive.stats
+	c.statsLock.Unlock()
+}
+
+// schedule the next timers check after the specified duration.
+//
+// Any previously scheduled check is cancelled.
+func (c *Conn) schedule(d time.Duration) {
+	if c.timer != nil {
+		c.timer.Stop()
+	}
+
+	c.timer = c.timers.AfterFunc(d, func() {
+		select {
+		case c.tick <- struct{}{}:
+		default:
+		}
+	})
+}
+
+// checkTimers handles the periodic tasks of the connection.
+func (c *Conn) checkTimers(now time.Time) error {
+	if c.session == nil {
+		// A session is being re-established with a dead peer: we give up if it
+		// takes too long.
+		if !c.handshakeDeadline.IsZero() {
+			if !now.Before(c.handshakeDeadline) {
+				return ErrPeerDead
+			}
+
+			c.schedule(c.handshakeDeadline.Sub(now))
+		}
+
+		return nil
+	}
+
+	if c.keepAlive.expire(now) {
+		c.debugPrintf("Keep-alive was lost (interval is now %s).\n", c.keepAlive.interval)
+		c.updateKeepAliveStats()
+	}
+
+	var probe, dead bool
+
+	if c.livenessEnabled() {
+		probe, dead = c.liveness.check(now, c.lastReceived)
+	}
+
+	if probe || dead {
+		c.statsLock.Lock()
+		c.livenessStats = c.liveness.stats
+		c.statsLock.Unlock()
+	}
+
+	if dead {
+		return c.peerDead(now)
+	}
+
+	// Keep-alives are only sent when no other message was sent for a while,
+	// as outgoing traffic is what keeps NAT bindings alive. Liveness probes
+	// are keep-alives too.
+	if probe || c.keepAlive.due(now, c.lastSent) {
+		if err := c.sendKeepAlive(now); err != nil {
+			return err
+		}
+	}
+
+	next := time.Duration(-1)
+
+	if !c.config.KeepAlive.Disabled {
+		next = c.keepAlive.next(now, c.lastSent)
+	}
+
+	if c.livenessEnabled() {
+		if d := c.liveness.next(now, c.lastReceived); next < 0 || d < next {
+			next = d
+		}
+	}
+
+	if c.meshEnabled() {
+		if !now.Before(c.meshNextAdvertise) {
+			if err := c.advertiseRoutes(now); err != nil {
+				return err
+			}
+		}
+
+		if d := c.meshNextAdvertise.Sub(now); next < 0 || d < next {
+			next = d
+		}
+	}
+
+	if c.paths.enabled() && c.session != nil && c.features().Has(FeatureKeepAliveEcho) {
+		if !now.Before(c.paths.nextProbe) {
+			if err := c.probePaths(now); err != nil {
+				return err
+			}
+		}
+
+		if d := c.paths.nextProbe.Sub(now); next < 0 || d < next {
+			next = d
+		}
+	}
+
+	if next >= 0 {
+		c.schedule(next)
+	}
+
+	return nil
+}
+
+// peerDead handles the detection of a dead peer.
+func (c *Conn) peerDead(now time.Time) error {
+	latency := now.Sub(c.lastReceived)
+
+	c.debugPrintf("Remote host is dead: nothing was received for %s.\n", latency)
+
+	if c.config.Liveness.OnDeadPeer != nil {
+		c.config.Liveness.OnDeadPeer(c, latency)
+	}
+
+	if !c.config.Liveness.Rehandshake {
+		return ErrPeerDead
+	}
+
+	if c.session != nil {
+		c.sessionNumberHint = c.session.SessionNumber + 1
+	}
+
+	// The remote host may have been restarted, in which case it has a new
+	// host identifier. Its certificate stays pinned: presenting another one
+	// does not get it a session.
+	c.session, c.nextSession, c.previousSession = nil, nil, nil
+	c.remoteHostIdentifier = nil
+	c.remoteFeatures = 0
+
+	c.handshakeDeadline = now.Add(c.config.Liveness.idleTimeout())
+	c.schedule(c.config.Liveness.idleTimeout())
+
+	return c.startHandshake()
+}
+
+// startHandshake starts a new handshake by sending HELLO requests until one
+// gets answered.
+func (c *Conn) startHandshake() error {
+	uniqueNumber := UniqueNumber(rand.Uint32())
+	c.uniqueNumber = uniqueNumber
+
+	resumeRequest := c.prepareResumeRequest()
+	attempts := 0
+
+	// The optimistic handshake messages are forged by the retrier, only when
+	// needed, with a snapshot of the state they depend on.
+	optimistic := c.optimistic()
+	reassembles := c.features().Has(FeatureFragmentation)
+	security := c.security
+	sessionNumber := c.sessionNumberHint
+
+	if c.nextSession != nil {
+		sessionNumber = c.nextSession.SessionNumber
+	}
+
+	var f *flight
+
+	return c.sendFlight(handshakeHello, func() error {
+		attempts++
+
+		// The first attempt resumes the previous session if we can: the
+		// following ones fall back to a full handshake.
+		if resumeRequest != nil && attempts == 1 {
+			c.debugPrintf("Sending %s request.\n", resumeRequest)
+
+			return c.writeMessage(MessageTypeResumeRequest, resumeRequest)
+		}
+
+		if !optimistic {
+			return c.sendHelloRequest(uniqueNumber)
+		}
+
+		if f == nil {
+			var err error
+
+			if f, err = c.optimisticHandshake(uniqueNumber, sessionNumber, security, reassembles); err != nil {
+				return err
+			}
+		}
+
+		attempt := attempts
+
+		if resumeRequest != nil {
+			attempt--
+		}
+
+		datagrams := f.datagrams(attempt)
+		c.debugPrintf("Sending optimistic handshake (%d datagram(s)).\n", len(datagrams))
+
+		return c.writeDatagrams(datagrams)
+	})
+}
+
+// prepareResumeRequest forges a request to resume the last session with the
+// remote host, if we have a ticket for it.
+func (c *Conn) prepareResumeRequest() *messageResume {
+	c.resumeTicket, c.resumeRequest = nil, nil
+
+	if c.config.Resumption.Disabled {
+		return nil
+	}
+
+	ticket := c.client.tickets.byAddress(c.RemoteAddr().String(), time.Now())
+
+	if ticket == nil || !c.acceptsTicket(ticket) {
+		return nil
+	}
+
+	nonce, err := newResumptionNonce()
+
+	if err != nil {
+		c.warning(err)
+		return nil
+	}
+
+	msg := &messageResume{
+		TicketID:       ticket.id,
+		HostIdentifier: c.localHostIdentifier,
+		SessionNumber:  ticket.sessionNumber + 1,
+		Nonce:          nonce,
+	}
+
+	if msg.SessionNumber < c.sessionNumberHint {
+		msg.SessionNumber = c.sessionNumberHint
+	}
+
+	msg.sign(ticket.secret, MessageTypeResumeRequest, nil)
+	c.resumeTicket, c.resumeRequest = ticket, msg
+
+	return msg
+}
+
+// acceptsTicket tells whether a ticket belongs to a host we accept.
+func (c *Conn) acceptsTicket(ticket *resumptionTicket) bool {
+	if c.expectedHash != nil && (ticket.remoteCertificate == nil || HashCertificate(ticket.remoteCertificate) != *c.expectedHash) {
+		return false
+	}
+
+	if c.remoteSecurityPreset {
+		if cert := c.security.RemoteClientSecurity.Certificate; cert != nil && (ticket.remoteCertificate == nil || !cert.Equal(ticket.remoteCertificate)) {
+			return false
+		}
+	}
+
+	return true
+}
+
+func (c *Conn) handleResumeRequest(msg *messageResume) error {
+	if c.lastResume != nil && msg.Nonce == c.lastResumeNonce {
+		c.debugPrintf("Resending %s as the last one was lost.\n", c.lastResume)
+
+		return c.writeMessage(MessageTypeResume, c.lastResume)
+	}
+
+	// Both hosts may try to resume the session at the same time: the request
+	// of the host with the lowest host identifier wins.
+	if c.resumeRequest != nil && bytes.Compare(c.localHostIdentifier[:], msg.HostIdentifier[:]) < 0 {
+		c.debugPrintf("Ignoring %s request as ours takes precedence.\n", msg)
+		return nil
+	}
+
+	var ticket *resumptionTicket
+
+	if !c.config.Resumption.Disabled {
+		ticket = c.client.tickets.byTicketID(msg.TicketID, time.Now())
+	}
+
+	if ticket == nil ||
+		!msg.verify(ticket.secret, MessageTypeResumeRequest, nil) ||
+		msg.HostIdentifier != ticket.remoteHostIdentifier ||
+		!c.acceptsTicket(ticket) ||
+		(c.session != nil && c.session.SessionNumber >= msg.SessionNumber) ||
+		!c.client.tickets.remove(ticket) {
+		return c.rejectResumeRequest(msg)
+	}
+
+	nonce, err := newResumptionNonce()
+
+	if err != nil {
+		return err
+	}
+
+	session, err := newResumedSession(c.localHostIdentifier, msg.HostIdentifier, msg.SessionNumber, ticket.cipherSuite, ticket.ellipticCurve, ticket.secret, msg.Nonce, nonce)
+
+	if err != nil {
+		c.warning(fmt.Errorf("failed to resume session: %s", err))
+		return c.rejectResumeRequest(msg)
+	}
+
+	response := &messageResume{
+		TicketID:       msg.TicketID,
+		HostIdentifier: c.localHostIdentifier,
+		SessionNumber:  msg.SessionNumber,
+		Nonce:          nonce,
+		Status:         ResumeAccepted,
+	}
+
+	response.sign(ticket.secret, MessageTypeResume, &msg.Nonce)
+	c.lastResume, c.lastResumeNonce = response, msg.Nonce
+
+	c.debugPrintf("Sending %s.\n", response)
+
+	if err := c.writeMessage(MessageTypeResume, response); err != nil {
+		return err
+	}
+
+	c.resumed(session, ticket)
+
+	return nil
+}
+
+// rejectResumeRequest tells the remote host to fall back to a full handshake.
+//
+// Rejections are not authenticated: forging one only forces a full
+// handshake, which dropping the request would do too.
+func (c *Conn) rejectResumeRequest(msg *messageResume) error {
+	atomic.AddUint64(&c.client.tickets.stats.Rejected, 1)
+
+	response := &messageResume{
+		TicketID:       msg.TicketID,
+		HostIdentifier: c.localHostIdentifier,
+		SessionNumber:  msg.SessionNumber,
+		Status:         ResumeRejected,
+	}
+
+	c.debugPrintf("Rejecting %s request.\n", msg)
+
+	return c.writeMessage(MessageTypeResume, response)
 }
 
-func newConn(localAddr *Addr, remoteAddr *Addr, w io.Writer, hostIdentifier HostIdentifier, security ClientSecurity) *Conn {
-	conn := &Conn{
-		writer:              w,
-		localAddr:           localAddr,
-		remoteAddr:          remoteAddr,
-		localHostIdentifier: hostIdentifier,
-		security:            security,
+func (c *Conn) handleResume(msg *messageResume) error {
+	if c.resumeRequest == nil || msg.TicketID != c.resumeRequest.TicketID || msg.SessionNumber != c.resumeRequest.SessionNumber {
+		c.debugPrintf("Ignoring unexpected %s.\n", msg)
+		return nil
+	}
 
-		incoming:  make(chan messageFrame, 10),
-		connected: make(chan struct{}),
-		closed:    make(chan struct{}),
+	ticket, request := c.resumeTicket, c.resumeRequest
 
-		incomingData: make(chan []byte, 100),
-		outgoingData: make(chan []byte, 100),
+	if msg.Status != ResumeAccepted {
+		c.debugPrintf("Resumption was rejected: falling back to a full handshake.\n")
+		c.client.tickets.remove(ticket)
+
+		return c.startHandshake()
 	}
 
-	go conn.dispatchLoop()
+	if !msg.verify(ticket.secret, MessageTypeResume, &request.Nonce) || msg.HostIdentifier != ticket.remoteHostIdentifier {
+		c.warning(fmt.Errorf("ignoring %s with an invalid MAC", msg))
+		return nil
+	}
 
-	return conn
-}
+	c.client.tickets.remove(ticket)
 
-func (c *Conn) Read(b []byte) (n int, err error) {
-	select {
-	case <-c.closed:
-		return 0, io.EOF
-	case buf := <-c.incomingData:
-		return copy(b, buf), nil
+	session, err := newResumedSession(c.localHostIdentifier, msg.HostIdentifier, msg.SessionNumber, ticket.cipherSuite, ticket.ellipticCurve, ticket.secret, request.Nonce, msg.Nonce)
+
+	if err != nil {
+		c.warning(fmt.Errorf("failed to resume session: %s", err))
+
+		return c.startHandshake()
 	}
+
+	c.resumed(session, ticket)
+
+	return nil
 }
 
-func (c *Conn) Write(p []byte) (n int, err error) {
-	select {
-	case <-c.connected:
-		// Implementations must not retain p.
-		b := make([]byte, len(p))
-		copy(b, p)
+// resumed makes a resumed session the current one.
+func (c *Conn) resumed(session *Session, ticket *resumptionTicket) {
+	c.resumeTicket, c.resumeRequest = nil, nil
 
-		select {
-		case <-c.closed:
-			return 0, io.ErrClosedPipe
+	c.remoteHostIdentifier = &session.RemoteHostIdentifier
+	c.remoteFeatures = ticket.remoteFeatures
 
-		case c.outgoingData <- b:
-			return len(b), nil
+	if !c.remoteSecurityPreset {
+		c.security.RemoteClientSecurity = &RemoteClientSecurity{
+			Certificate: ticket.remoteCertificate,
 		}
 
-	case <-c.closed:
-		return 0, io.ErrClosedPipe
+		if ticket.remoteCertificate != nil {
+			hash := HashCertificate(ticket.remoteCertificate)
+
+			c.statsLock.Lock()
+			c.remoteHash = &hash
+			c.statsLock.Unlock()
+		}
 	}
-}
 
-// Close closes the connection.
-func (c *Conn) Close() error {
-	return c.closeWithError(io.EOF)
-}
+	c.session, c.nextSession = session, nil
+	atomic.AddUint64(&c.client.tickets.stats.Resumed, 1)
 
-func (c *Conn) debugPrintf(msg string, args ...interface{}) {
-	debugPrintf("(%s <- %s) %s", c.LocalAddr(), c.RemoteAddr(), fmt.Sprintf(msg, args...))
+	c.debugPrintf("Session %d resumed.\n", session.SessionNumber)
+	c.sessionEstablished()
 }
 
-// closeWithError closes the connection with the specified error.
-func (c *Conn) closeWithError(err error) error {
-	c.once.Do(func() {
-		c.debugPrintf("closing connection: %s\n", err)
+// storeTicket stores the ticket that allows resuming the current session.
+func (c *Conn) storeTicket() {
+	if !c.features().Has(FeatureResumption) {
+		return
+	}
 
-		c.closeError = err
-		close(c.closed)
-	})
+	var cert *x509.Certificate
 
-	return c.closeError
-}
+	if c.security.RemoteClientSecurity != nil {
+		cert = c.security.RemoteClientSecurity.Certificate
+	}
 
-func (c *Conn) warning(err error) {
-	c.debugPrintf("Warning: %s\n", err.Error())
+	c.client.tickets.put(&resumptionTicket{
+		id:                   c.session.TicketID,
+		secret:               c.session.ResumptionSecret,
+		remoteAddr:           c.RemoteAddr().String(),
+		remoteHostIdentifier: c.session.RemoteHostIdentifier,
+		remoteCertificate:    cert,
+		remoteFeatures:       c.remoteFeatures,
+		sessionNumber:        c.session.SessionNumber,
+		cipherSuite:          c.session.CipherSuite,
+		ellipticCurve:        c.session.EllipticCurve,
+		expires:              time.Now().Add(c.config.Resumption.ticketLifetime()),
+	})
 }
 
-// LocalAddr returns the local address of the connection.
-func (c *Conn) LocalAddr() net.Addr { return c.localAddr }
+// sessionEstablished must be called whenever a new session becomes the
+// current one.
+func (c *Conn) sessionEstablished() {
+	c.debugPrintf("Session %d established.\n", c.session.SessionNumber)
 
-// RemoteAddr returns the remote address of the connection.
-func (c *Conn) RemoteAddr() net.Addr { return c.remoteAddr }
+	now := time.Now()
+	c.endHandshake(now)
+	c.storeTicket()
 
-// SetDeadline sets the deadline on the connection.
-func (c *Conn) SetDeadline(t time.Time) error {
-	// TODO: Implement.
-	return nil
-}
+	if c.remoteHash != nil {
+		c.client.registerConn(c, *c.remoteHash)
+	}
 
-// SetReadDeadline sets the deadline on the connection.
-func (c *Conn) SetReadDeadline(t time.Time) error {
-	// TODO: Implement.
-	return nil
+	// The first session completes the connection. Later ones, including those
+	// established with a restarted remote host, don't.
+	select {
+	case <-c.connected:
+	default:
+		close(c.connected)
+
+		if err := c.flushPendingWrites(); err != nil {
+			c.closeWithError(err)
+		}
+	}
+
+	c.lastSent, c.lastReceived = now, now
+	c.handshakeDeadline = time.Time{}
+	atomic.StoreUint32(&c.remoteSequenceHint, 0)
+	c.announceFlows()
+
+	if err := c.checkTimers(now); err != nil {
+		c.warning(err)
+	}
 }
 
-// SetWriteDeadline sets the deadline on the connection.
-func (c *Conn) SetWriteDeadline(t time.Time) error {
-	// TODO: Implement.
+func (c *Conn) handleKeepAlive(payload []byte) error {
+	kind, id, ok := parseKeepAlivePayload(payload)
+
+	if !ok {
+		return nil
+	}
+
+	switch kind {
+	case keepAliveKindRequest:
+		if c.features().Has(FeatureKeepAliveEcho) {
+			return c.sendEncrypted(MessageTypeKeepAlive, 0, makeKeepAlivePayload(keepAliveKindResponse, id))
+		}
+	case keepAliveKindResponse:
+		if id&probeIDFlag != 0 {
+			c.paths.answered(time.Now(), id)
+			c.updatePathsStats()
+		} else if c.keepAlive.echoed(time.Now(), id) {
+			c.updateKeepAliveStats()
+		}
+	}
+
 	return nil
 }
 
-func (c *Conn) writeMessage(messageType MessageType, message serializable) (err error) {
-	// FIXME: If we know for sure that no two writeMessage() calls ever happen
-	// concurrently, we can reuse the same buffer over and over (don't forget
-	// to Reset() it).
+// handleContactRequest answers a contact request with the endpoints of the
+// requested hosts we are connected to.
+func (c *Conn) handleContactRequest(payload []byte) error {
+	if c.config.Contacts.DisableContactRequests {
+		c.debugPrintf("Ignoring contact request as contact requests are disabled.\n")
+		return nil
+	}
 
-	buf := &bytes.Buffer{}
+	hashes, err := parseContactRequest(payload)
 
-	if err = writeMessage(buf, messageType, message); err != nil {
+	if err != nil {
+		c.warning(fmt.Errorf("invalid contact request: %s", err))
+		return nil
+	}
+
+	contacts, peers := c.client.findContacts(c, hashes)
+
+	if len(contacts) == 0 {
+		return nil
+	}
+
+	c.debugPrintf("Sending contacts: %v.\n", contacts)
+
+	if err := c.sendContacts(contacts); err != nil {
 		return err
 	}
 
-	if buf.Len() != message.serializationSize()+4 {
-		panic(fmt.Errorf("expected buffer of size %d but was %d byte(s) long", message.serializationSize()+4, buf.Len()))
+	// The requested hosts get introduced to the requesting one, so that both
+	// ends start their handshake at about the same time: that's what gets the
+	// handshake through NATs that only let in replies to outgoing traffic.
+	addr, ok := c.RemoteAddr().(*Addr).TransportAddr.(*net.UDPAddr)
+
+	if c.remoteHash == nil || !ok {
+		return nil
 	}
 
-	_, err = buf.WriteTo(c.writer)
+	introduction := []contact{{Hash: *c.remoteHash, Addr: addr}}
 
-	return
+	for _, peer := range peers {
+		peer := peer
+
+		// The peer's goroutine may be busy: we don't wait for it.
+		go peer.do(func() {
+			if err := peer.sendContacts(introduction); err != nil {
+				peer.warning(fmt.Errorf("failed to send introduction: %s", err))
+			}
+		})
+	}
+
+	return nil
 }
 
-func (c *Conn) sendHelloRequest(uniqueNumber UniqueNumber) (err error) {
-	msg := &messageHello{
-		UniqueNumber: uniqueNumber,
+// handleContacts connects to the hosts in a contact message.
+func (c *Conn) handleContacts(payload []byte) error {
+	if c.config.Contacts.DisableContacts {
+		c.debugPrintf("Ignoring contacts as contacts are disabled.\n")
+		return nil
 	}
 
-	c.debugPrintf("Sending %s.\n", msg)
+	contacts, err := parseContacts(payload)
 
-	if err = c.writeMessage(MessageTypeHelloRequest, msg); err != nil {
-		return err
+	if err != nil {
+		c.warning(fmt.Errorf("invalid contact message: %s", err))
+		return nil
+	}
+
+	c.debugPrintf("Received contacts: %v.\n", contacts)
+
+	for _, contact := range contacts {
+		c.client.introduce(contact)
 	}
 
 	return nil
 }
 
-func (c *Conn) sendHelloResponse(uniqueNumber UniqueNumber) error {
-	msg := &messageHello{
-		UniqueNumber: uniqueNumber,
+// decrypt decrypts a DATA message with the current session.
+//
+// Messages sent before the remote host switched to a renegotiated session may
+// still be in flight: until one decrypts with the current session, the
+// previous session is tried too.
+func (c *Conn) decrypt(msg *messageData) ([]byte, error) {
+	if c.previousSession == nil {
+		return c.session.Decrypt(msg)
 	}
 
-	c.debugPrintf("Sending %s.\n", msg)
+	// Decryption happens in place.
+	late := *msg
+	late.Ciphertext = append([]byte(nil), msg.Ciphertext...)
 
-	return c.writeMessage(MessageTypeHelloResponse, msg)
-}
+	data, err := c.session.Decrypt(msg)
 
-func (c *Conn) sendPresentation() error {
-	msg := &messagePresentation{
-		Certificate: c.security.Certificate,
+	if err == nil {
+		c.previousSession = nil
+
+		return data, nil
 	}
 
-	c.debugPrintf("Sending %s.\n", msg)
+	if data, lateErr := c.previousSession.Decrypt(&late); lateErr == nil {
+		return data, nil
+	}
 
-	return c.writeMessage(MessageTypePresentation, msg)
+	return nil, err
 }
 
-func (c *Conn) sendSessionRequest(sessionNumber SessionNumber) error {
-	msg := &messageSessionRequest{
-		CipherSuites:   c.security.supportedCipherSuites(),
-		EllipticCurves: c.security.supportedEllipticCurves(),
-		HostIdentifier: c.localHostIdentifier,
-		SessionNumber:  sessionNumber,
+// handleData handles a decrypted DATA, KEEP-ALIVE or CONTACT message.
+func (c *Conn) handleData(messageType MessageType, msg *messageData, data []byte) (err error) {
+	c.lastReceived = time.Now()
+	atomic.StoreUint32(&c.remoteSequenceHint, uint32(msg.SequenceNumber))
+
+	switch messageType {
+	case MessageTypeKeepAlive:
+		return c.handleKeepAlive(data)
+	case MessageTypeContactRequest:
+		return c.handleContactRequest(data)
+	case MessageTypeContact:
+		return c.handleContacts(data)
+	case MessageTypeRouting:
+		return c.handleRouting(data)
+	case MessageTypeStream:
+		return c.handleStream(data)
+	case MessageTypeRotation:
+		return c.handleRotation(data)
 	}
 
-	if err := msg.computeSignature(c.security); err != nil {
-		return fmt.Errorf("failed to forge session request message: %s", err)
+	if c.features().Has(FeatureCompression) {
+		var compressed bool
+
+		if data, compressed, err = decompress(data); err != nil {
+			c.warning(fmt.Errorf("failed to decompress DATA message (%d): %s", msg.SequenceNumber, err))
+			return nil
+		}
+
+		if compressed {
+			atomic.AddUint64(&c.compressionStats.Decompressed, 1)
+		}
+	}
+
+	if route := c.config.Relay.Route; route != nil {
+		if to := route(c, msg.Channel, data); to != nil {
+			to.relay(msg.Channel, data)
+
+			return nil
+		}
 	}
 
-	c.debugPrintf("Sending %s request.\n", msg)
+	select {
+	case c.incomingData <- data:
+	default:
+		c.warning(fmt.Errorf("dropping %d byte(s) of incoming data because reads are not happening fast enough", len(data)))
+	}
 
-	return c.writeMessage(MessageTypeSessionRequest, msg)
+	return nil
 }
 
-func (c *Conn) sendSession(session *Session) error {
-	msg := &messageSession{
-		CipherSuite:    session.CipherSuite,
-		EllipticCurve:  session.EllipticCurve,
-		HostIdentifier: c.localHostIdentifier,
-		SessionNumber:  session.SessionNumber,
-		PublicKey:      session.PublicKey,
+// tryRoam tells whether a message received from an unknown address belongs
+// to the current session, in which case the remote host is considered to have
+// moved to that address and the message is handled.
+//
+// It is called from the client's roaming goroutine.
+func (c *Conn) tryRoam(from *Addr, frame messageFrame) bool {
+	result := make(chan bool, 1)
+
+	if err := c.do(func() { result <- c.roam(from, frame) }); err != nil {
+		return false
 	}
 
-	if err := msg.computeSignature(c.security); err != nil {
-		return fmt.Errorf("failed to forge session message: %s", err)
+	select {
+	case ok := <-result:
+		return ok
+	case <-c.closed:
+		return false
 	}
+}
 
-	c.debugPrintf("Sending %s.\n", msg)
+func (c *Conn) roam(from *Addr, frame messageFrame) bool {
+	if c.session == nil {
+		return false
+	}
 
-	return c.writeMessage(MessageTypeSession, msg)
-}
+	// Failed decryptions alter the message, which other connections may have
+	// to try after us.
+	msg := frame.message.(*messageData).clone()
+	data, err := c.session.Decrypt(msg)
 
-func (c *Conn) sendData(channel uint8, cleartext []byte) error {
-	msg := c.session.Encrypt(cleartext)
+	if err != nil {
+		return false
+	}
 
-	// Channel handling is a real pain and doesn't fit well with the
-	// Reader/Writer pattern... Let's hardcode channel 1 for now.
-	msg.Channel = channel
+	// Hosts that spread their messages over several ports stay where they
+	// are.
+	announced := atomic.LoadInt32(&c.multiFlow) != 0 || isFlowAnnouncement(frame.messageType, data)
+
+	if c.features().Has(FeatureMultiFlow) && announced && sameHost(from, c.RemoteAddr().(*Addr)) {
+		c.debugPrintf("Remote host sends from %s too.\n", from)
+		c.client.addSources(c, from)
+		c.client.setMultiFlow(c)
+	} else {
+		c.debugPrintf("Remote host moved to %s.\n", from)
+		c.client.moveConn(c, from)
+	}
 
-	c.debugPrintf("Sending %s.\n", msg)
+	if err := c.handleData(frame.messageType, msg, data); err != nil {
+		c.closeWithError(err)
+	}
+
+	return true
+}
+
+func (c *Conn) compressor(channel uint8) *compressor {
+	if c.compressors[channel] == nil {
+		c.compressors[channel] = newCompressor(&c.config.Compression, &c.compressionStats)
+	}
 
-	return c.writeMessage(MessageTypeData, msg)
+	return c.compressors[channel]
 }
 
 func (c *Conn) dispatchLoop() {
-	uniqueNumber := UniqueNumber(rand.Uint32())
+	defer func() {
+		c.handshakeRetrier.Stop()
 
-	helloRequestRetrier := &Retrier{
-		Operation: func() error {
-			return c.sendHelloRequest(uniqueNumber)
-		},
-		OnFailure: func(err error) {
-			c.closeWithError(err)
-		},
-		Period: time.Second * 3,
-	}
+		if c.timer != nil {
+			c.timer.Stop()
+		}
+	}()
 
-	helloRequestRetrier.Start()
-	defer helloRequestRetrier.Stop()
+	if err := c.startHandshake(); err != nil {
+		return
+	}
 
 	for {
 		select {
 		case frame := <-c.incoming:
+			if fragment, ok := frame.message.(*messageFragment); ok {
+				if frame, ok = c.reassemble(fragment); !ok {
+					continue
+				}
+			}
+
 			switch imsg := frame.message.(type) {
 			case *messageHello:
 				switch frame.messageType {
@@ -269,17 +1392,20 @@ func (c *Conn) dispatchLoop() {
 				case MessageTypeHelloResponse:
 					c.debugPrintf("Received %s response.\n", imsg)
 
-					if imsg.UniqueNumber != uniqueNumber {
+					if imsg.UniqueNumber != c.uniqueNumber {
 						// The received response does not match the outstanding
 						// hello request. Ignoring.
 						continue
 					}
 
-					if !helloRequestRetrier.Stop() {
-						// The retrier was stopped already, so we do nothing.
+					if c.handshakeStage != handshakeHello {
+						// The HELLO request was answered already, so we do
+						// nothing.
 						continue
 					}
 
+					c.endHandshake(time.Now())
+
 					if err := c.sendPresentation(); err != nil {
 						c.closeWithError(err)
 						return
@@ -293,21 +1419,52 @@ func (c *Conn) dispatchLoop() {
 
 					//TODO: Check if the certificate is acceptable.
 
+					// The first presentation pins the remote security, which
+					// is kept across re-handshakes.
 					if c.security.RemoteClientSecurity == nil {
 						remoteClientSecurity := &RemoteClientSecurity{}
 
 						if imsg.Certificate != nil {
+							hash := HashCertificate(imsg.Certificate)
+
+							// Hosts we were introduced to must be the ones we
+							// were told about.
+							if c.expectedHash != nil && hash != *c.expectedHash {
+								c.closeWithError(fmt.Errorf("remote host presented a certificate with hash %s but %s was expected", hash, *c.expectedHash))
+								return
+							}
+
 							// If we receive a presentation message, store its
 							// certificate only if we don't have one already.
 							remoteClientSecurity.Certificate = imsg.Certificate
 							c.debugPrintf("Stored certificate (%s) for remote host.\n", imsg.Certificate.Subject)
+
+							c.statsLock.Lock()
+							c.remoteHash = &hash
+							c.statsLock.Unlock()
 						} else {
 							c.debugPrintf("Using pre-shared key for remote host.\n")
 						}
 
 						c.security.RemoteClientSecurity = remoteClientSecurity
+					} else if c.session != nil {
+						c.presented(imsg.Certificate)
+
+						continue
+					} else if !c.remoteSecurityPreset && !c.security.RemoteClientSecurity.matches(imsg.Certificate) {
+						c.warning(fmt.Errorf("ignoring presentation of a certificate that differs from the one of the remote host"))
+
+						continue
+					} else if !c.remoteSecurityPreset {
+						c.debugPrintf("Remote host presented its known certificate.\n")
 					} else {
-						c.debugPrintf("Ignoring repeated presentation for remote host.\n")
+						// The remote security was configured explicitly: we
+						// keep it but still answer with a session request.
+						c.debugPrintf("Using preconfigured security for remote host.\n")
+					}
+
+					if c.handshakeStage == handshakeSession {
+						c.debugPrintf("Session request is being sent already.\n")
 
 						continue
 					}
@@ -317,6 +1474,8 @@ func (c *Conn) dispatchLoop() {
 					// If we have an existing next session, use the next session number.
 					if c.nextSession != nil {
 						sessionNumber = c.nextSession.SessionNumber
+					} else {
+						sessionNumber = c.sessionNumberHint
 					}
 
 					if err := c.sendSessionRequest(sessionNumber); err != nil {
@@ -328,11 +1487,16 @@ func (c *Conn) dispatchLoop() {
 			case *messageSessionRequest:
 				c.debugPrintf("Received %s.\n", imsg)
 
-				if err := imsg.verifySignature(c.security); err != nil {
+				if err := c.verifySignature(imsg); err != nil {
 					c.warning(fmt.Errorf("session request signature verification failed: %s", err))
 					continue
 				}
 
+				// The remote host got our presentation.
+				if c.handshakeStage == handshakePresentation {
+					c.endHandshake(time.Now())
+				}
+
 				//TODO: Filter out some hosts based on a callback or other client logic.
 
 				if c.remoteHostIdentifier == nil {
@@ -343,9 +1507,20 @@ func (c *Conn) dispatchLoop() {
 					continue
 				}
 
+				if features := featuresFromCipherSuites(imsg.CipherSuites); features != c.remoteFeatures {
+					c.remoteFeatures = features
+					c.debugPrintf("Remote host supports features: %s.\n", features)
+				}
+
 				// If we already have a current session that is more recent
 				// than the requested one, we resend it.
 				if c.session != nil && c.session.SessionNumber >= imsg.SessionNumber {
+					// Resumed sessions have no public key to send.
+					if c.session.PublicKey == nil {
+						c.debugPrintf("Session request is for an outdated session (%d) but the current one was resumed: ignoring.\n", imsg.SessionNumber)
+						continue
+					}
+
 					c.debugPrintf("Session request is for an oudated session (%d): resending current session (%d).\n", imsg.SessionNumber, c.session.SessionNumber)
 
 					// The session request is oudated: we resend the current session.
@@ -397,7 +1572,7 @@ func (c *Conn) dispatchLoop() {
 			case *messageSession:
 				c.debugPrintf("Received %s.\n", imsg)
 
-				if err := imsg.verifySignature(c.security); err != nil {
+				if err := c.verifySignature(imsg); err != nil {
 					c.warning(fmt.Errorf("session request signature verification failed: %s", err))
 					continue
 				}
@@ -413,6 +1588,11 @@ func (c *Conn) dispatchLoop() {
 
 						continue
 					} else if c.session.SessionNumber > imsg.SessionNumber {
+						if c.session.PublicKey == nil {
+							c.debugPrintf("Session is outdated (%d) but the current one was resumed: ignoring.\n", imsg.SessionNumber)
+							continue
+						}
+
 						// The requested session is outdated: we resend our current one.
 						if err := c.sendSession(c.session); err != nil {
 							c.closeWithError(err)
@@ -432,12 +1612,9 @@ func (c *Conn) dispatchLoop() {
 							return
 						}
 
-						if c.session == nil {
-							close(c.connected)
-						}
-
+						c.previousSession = c.session
 						c.session, c.nextSession = c.nextSession, nil
-						c.debugPrintf("Session %d established.\n", c.session.SessionNumber)
+						c.sessionEstablished()
 
 						continue
 					} else if c.nextSession.SessionNumber > imsg.SessionNumber {
@@ -449,8 +1626,8 @@ func (c *Conn) dispatchLoop() {
 
 				// If we reach this point, we either have no next session or an outdated one.
 
-				cipherSuite := c.security.CipherSuites.FindCommon(CipherSuiteSlice{imsg.CipherSuite})
-				ellipticCurve := c.security.EllipticCurves.FindCommon(EllipticCurveSlice{imsg.EllipticCurve})
+				cipherSuite := c.security.supportedCipherSuites().FindCommon(CipherSuiteSlice{imsg.CipherSuite})
+				ellipticCurve := c.security.supportedEllipticCurves().FindCommon(EllipticCurveSlice{imsg.EllipticCurve})
 
 				session, err := NewSession(c.localHostIdentifier, imsg.SessionNumber, cipherSuite, ellipticCurve)
 
@@ -474,11 +1651,35 @@ func (c *Conn) dispatchLoop() {
 				c.debugPrintf("Selected cipher suite: %s.\n", session.CipherSuite)
 				c.debugPrintf("Selected elliptic curve: %s.\n", session.EllipticCurve)
 
+				if c.remoteHostIdentifier == nil {
+					c.remoteHostIdentifier = &imsg.HostIdentifier
+					c.debugPrintf("Setting remote host identifier: %s\n", imsg.HostIdentifier)
+				}
+
+				if err := session.SetRemote(*c.remoteHostIdentifier, imsg.PublicKey); err != nil {
+					c.closeWithError(fmt.Errorf("computing shared key for session %d: %s", session.SessionNumber, err))
+					return
+				}
+
+				c.previousSession = c.session
 				c.session, c.nextSession = session, nil
-				c.debugPrintf("Session %d established.\n", c.session.SessionNumber)
+				c.sessionEstablished()
 
-				if c.session == nil {
-					close(c.connected)
+			case *messageResume:
+				c.debugPrintf("Received %s.\n", imsg)
+
+				var err error
+
+				switch frame.messageType {
+				case MessageTypeResumeRequest:
+					err = c.handleResumeRequest(imsg)
+				case MessageTypeResume:
+					err = c.handleResume(imsg)
+				}
+
+				if err != nil {
+					c.closeWithError(err)
+					return
 				}
 
 			case *messageData:
@@ -489,27 +1690,36 @@ func (c *Conn) dispatchLoop() {
 					continue
 				}
 
-				data, err := c.session.Decrypt(imsg)
+				// Failed decryptions alter the message, which other
+				// connections may have to try after us.
+				var original *messageData
+
+				if frame.alias != nil {
+					original = imsg.clone()
+				}
+
+				data, err := c.decrypt(imsg)
 
 				if err != nil {
+					if frame.alias != nil {
+						c.client.reroute(roamingFrame{from: frame.alias, frame: messageFrame{messageType: frame.messageType, message: original}, tried: c})
+
+						continue
+					}
+
 					c.warning(fmt.Errorf("failed to decode DATA message (%d): %s", imsg.SequenceNumber, err))
 
 					continue
 				}
 
-				switch frame.messageType {
-				case MessageTypeKeepAlive:
-					// TODO: Handle keep alives.
-				case MessageTypeContact:
-					// TODO: Handle contacts.
-				case MessageTypeData:
-					select {
-					case c.incomingData <- data:
-					default:
-						c.warning(fmt.Errorf("dropping %d byte(s) of incoming data because reads are not happening fast enough", len(data)))
+				if frame.sibling != nil {
+					c.debugPrintf("Remote host sends from %s too.\n", frame.sibling)
+					c.client.addSources(c, frame.sibling)
+				}
 
-						continue
-					}
+				if err := c.handleData(frame.messageType, imsg, data); err != nil {
+					c.closeWithError(err)
+					return
 				}
 
 			default:
@@ -526,7 +1736,34 @@ func (c *Conn) dispatchLoop() {
 				continue
 			}
 
-			if err := c.sendData(1, data); err != nil {
+			if err := c.sendData(0, data); err != nil {
+				c.closeWithError(err)
+				return
+			}
+
+		case f := <-c.outgoingFrames:
+			if err := c.sendFrames(f); err != nil {
+				c.closeWithError(err)
+				return
+			}
+
+		case m := <-c.relayed:
+			if err := c.sendRelayed(m); err != nil {
+				c.closeWithError(err)
+				return
+			}
+
+		case m := <-c.streamSegments:
+			if err := c.sendSegments(m); err != nil {
+				c.closeWithError(err)
+				return
+			}
+
+		case f := <-c.actions:
+			f()
+
+		case <-c.tick:
+			if err := c.checkTimers(time.Now()); err != nil {
 				c.closeWithError(err)
 				return
 			}
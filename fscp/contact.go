@@ -0,0 +1,143 @@
+package fscp
+
+import (
+	"bytes"
+	"crypto/sha256"
+	"crypto/x509"
+	"encoding/binary"
+	"encoding/hex"
+	"fmt"
+	"net"
+)
+
+// A CertificateHash is the SHA-256 hash of a DER-encoded certificate.
+//
+// Hosts are designated by their certificate hash in contact exchanges.
+type CertificateHash [sha256.Size]byte
+
+// HashCertificate computes the hash of a certificate.
+func HashCertificate(cert *x509.Certificate) CertificateHash {
+	return sha256.Sum256(cert.Raw)
+}
+
+func (h CertificateHash) String() string {
+	return hex.EncodeToString(h[:])
+}
+
+// ContactConfig contains the contact exchange settings.
+type ContactConfig struct {
+	// DisableContactRequests prevents the client from answering contact
+	// requests, which are used by other hosts to get introduced to the hosts
+	// the client is connected to.
+	DisableContactRequests bool
+
+	// DisableContacts prevents the client from connecting to the hosts other
+	// hosts introduce it to.
+	DisableContacts bool
+}
+
+// A contact associates a certificate hash to the endpoint of the host it
+// belongs to.
+type contact struct {
+	Hash CertificateHash
+	Addr *net.UDPAddr
+}
+
+func (c contact) String() string {
+	return fmt.Sprintf("%s@%s", c.Hash, c.Addr)
+}
+
+// Endpoint types, as serialized in CONTACT messages.
+const (
+	endpointTypeIPv4 = 0x04
+	endpointTypeIPv6 = 0x06
+)
+
+// serializeContactRequest serializes the payload of a CONTACT REQUEST message,
+// which is a list of certificate hashes.
+func serializeContactRequest(hashes []CertificateHash) []byte {
+	b := make([]byte, 0, len(hashes)*sha256.Size)
+
+	for _, hash := range hashes {
+		b = append(b, hash[:]...)
+	}
+
+	return b
+}
+
+func parseContactRequest(b []byte) ([]CertificateHash, error) {
+	if len(b)%sha256.Size != 0 {
+		return nil, fmt.Errorf("contact request should be a multiple of %d bytes long but is %d", sha256.Size, len(b))
+	}
+
+	hashes := make([]CertificateHash, len(b)/sha256.Size)
+
+	for i := range hashes {
+		copy(hashes[i][:], b[i*sha256.Size:])
+	}
+
+	return hashes, nil
+}
+
+// serializeContacts serializes the payload of a CONTACT message, which is a
+// list of certificate hashes followed by the endpoint of their host.
+func serializeContacts(contacts []contact) ([]byte, error) {
+	buf := &bytes.Buffer{}
+
+	for _, contact := range contacts {
+		buf.Write(contact.Hash[:])
+
+		if ip := contact.Addr.IP.To4(); ip != nil {
+			buf.WriteByte(endpointTypeIPv4)
+			buf.Write(ip)
+		} else if ip := contact.Addr.IP.To16(); ip != nil {
+			buf.WriteByte(endpointTypeIPv6)
+			buf.Write(ip)
+		} else {
+			return nil, fmt.Errorf("invalid contact address: %s", contact.Addr)
+		}
+
+		binary.Write(buf, binary.BigEndian, uint16(contact.Addr.Port))
+	}
+
+	return buf.Bytes(), nil
+}
+
+func parseContacts(b []byte) (contacts []contact, err error) {
+	for len(b) > 0 {
+		if len(b) < sha256.Size+1 {
+			return nil, fmt.Errorf("truncated contact: %d byte(s) left", len(b))
+		}
+
+		var c contact
+		copy(c.Hash[:], b)
+		b = b[sha256.Size:]
+
+		var size int
+
+		switch b[0] {
+		case endpointTypeIPv4:
+			size = net.IPv4len
+		case endpointTypeIPv6:
+			size = net.IPv6len
+		default:
+			return nil, fmt.Errorf("unknown endpoint type: %02x", b[0])
+		}
+
+		b = b[1:]
+
+		if len(b) < size+2 {
+			return nil, fmt.Errorf("truncated endpoint: %d byte(s) left", len(b))
+		}
+
+		c.Addr = &net.UDPAddr{
+			IP:   append(net.IP{}, b[:size]...),
+			Port: int(binary.BigEndian.Uint16(b[size:])),
+		}
+		b = b[size+2:]
+
+		contacts = append(contacts, c)
+	}
+
+	return
+}
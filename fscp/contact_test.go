@@ -0,0 +1,156 @@
+package fscp
+
+import (
+	"context"
+	"net"
+	"reflect"
+	"testing"
+	"time"
+)
+
+func TestContactSerialization(t *testing.T) {
+	hashes := []CertificateHash{{1, 2, 3}, {4, 5, 6}}
+
+	parsedHashes, err := parseContactRequest(serializeContactRequest(hashes))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if !reflect.DeepEqual(parsedHashes, hashes) {
+		t.Errorf("expected %v but got %v", hashes, parsedHashes)
+	}
+
+	if _, err := parseContactRequest(make([]byte, 33)); err == nil {
+		t.Errorf("expected an error")
+	}
+
+	contacts := []contact{
+		{Hash: CertificateHash{1}, Addr: &net.UDPAddr{IP: net.IPv4(192, 168, 0, 1).To4(), Port: 12000}},
+		{Hash: CertificateHash{2}, Addr: &net.UDPAddr{IP: net.ParseIP("fe80::1"), Port: 12001}},
+	}
+
+	b, err := serializeContacts(contacts)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if len(b) != 32+1+4+2+32+1+16+2 {
+		t.Errorf("unexpected serialization size: %d", len(b))
+	}
+
+	parsedContacts, err := parseContacts(b)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if !reflect.DeepEqual(parsedContacts, contacts) {
+		t.Errorf("expected %v but got %v", contacts, parsedContacts)
+	}
+
+	for _, invalid := range [][]byte{b[:20], b[:40], append(append([]byte{}, b[:32]...), 0x05)} {
+		if _, err := parseContacts(invalid); err == nil {
+			t.Errorf("expected an error for %x", invalid)
+		}
+	}
+}
+
+// connectToHub connects a new client to the specified hub and waits for the
+// hub to accept the connection.
+func connectToHub(ctx context.Context, t *testing.T, hub *Client, config *ClientConfig) (*Client, *Conn) {
+	t.Helper()
+
+	client := listenTestClient(t, config)
+	conn, err := client.Connect(ctx, hub.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("client connecting to hub: %s", err)
+	}
+
+	if _, err := hub.Accept(); err != nil {
+		t.Fatalf("hub accepting a connection: %s", err)
+	}
+
+	return client, conn
+}
+
+func TestContactIntroduction(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	hub := listenTestClient(t, nil)
+	alice, aliceHubConn := connectToHub(ctx, t, hub, nil)
+	bob, _ := connectToHub(ctx, t, hub, nil)
+
+	bobHash := HashCertificate(bob.Security().Certificate)
+	aliceHash := HashCertificate(alice.Security().Certificate)
+
+	conn, err := alice.ConnectByHash(ctx, aliceHubConn, bobHash)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if conn.RemoteAddr().String() != bob.Addr().String() {
+		t.Errorf("expected a connection to %s but got one to %s", bob.Addr(), conn.RemoteAddr())
+	}
+
+	if hash, ok := conn.RemoteCertificateHash(); !ok || hash != bobHash {
+		t.Errorf("expected remote certificate hash %s but got %s", bobHash, hash)
+	}
+
+	// Bob was introduced to Alice too and gets the connection in its backlog.
+	bobConn, err := bob.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if bobConn.RemoteAddr().String() != alice.Addr().String() {
+		t.Errorf("expected a connection from %s but got one from %s", alice.Addr(), bobConn.RemoteAddr())
+	}
+
+	if hash, ok := bobConn.(*Conn).RemoteCertificateHash(); !ok || hash != aliceHash {
+		t.Errorf("expected remote certificate hash %s but got %s", aliceHash, hash)
+	}
+
+	if _, err := conn.Write([]byte("hello")); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	b := make([]byte, 10)
+	n, err := bobConn.Read(b)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if string(b[:n]) != "hello" {
+		t.Errorf("expected `hello` but got `%s`", b[:n])
+	}
+
+	// Connecting again returns the existing connection.
+	if again, err := alice.ConnectByHash(ctx, aliceHubConn, bobHash); err != nil || again != conn {
+		t.Errorf("expected the existing connection, got %p (%v)", again, err)
+	}
+}
+
+func TestContactRequestsDisabled(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	hub := listenTestClient(t, &ClientConfig{
+		Contacts: ContactConfig{DisableContactRequests: true},
+	})
+	alice, aliceHubConn := connectToHub(ctx, t, hub, nil)
+	bob, _ := connectToHub(ctx, t, hub, nil)
+
+	timeoutCtx, timeoutCancel := context.WithTimeout(ctx, time.Millisecond*500)
+	defer timeoutCancel()
+
+	if _, err := alice.ConnectByHash(timeoutCtx, aliceHubConn, HashCertificate(bob.Security().Certificate)); err != context.DeadlineExceeded {
+		t.Errorf("expected %s but got %v", context.DeadlineExceeded, err)
+	}
+}
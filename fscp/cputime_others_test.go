@@ -0,0 +1,12 @@
+//go:build !darwin && !linux
+// +build !darwin,!linux
+
+package fscp
+
+import "time"
+
+// processCPUTime returns zero, as the CPU time of the process is not measured
+// on this platform.
+func processCPUTime() time.Duration {
+	return 0
+}
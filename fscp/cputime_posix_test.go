@@ -0,0 +1,21 @@
+//go:build darwin || linux
+// +build darwin linux
+
+package fscp
+
+import (
+	"syscall"
+	"time"
+)
+
+// processCPUTime returns the CPU time the process has used so far, in user and
+// system mode.
+func processCPUTime() time.Duration {
+	var usage syscall.Rusage
+
+	if err := syscall.Getrusage(syscall.RUSAGE_SELF, &usage); err != nil {
+		return 0
+	}
+
+	return time.Duration(usage.Utime.Nano() + usage.Stime.Nano())
+}
@@ -0,0 +1,135 @@
+package fscp
+
+import (
+	"fmt"
+	"strings"
+)
+
+// A Feature is an optional protocol extension.
+//
+// Features are advertised by appending signaling values to the list of cipher
+// suites of SESSION REQUEST messages, much like TLS signaling cipher suite
+// values. As those values are not actual cipher suites, legacy hosts never
+// select them which keeps the handshake compatible. Because the list is
+// signed, features cannot be stripped by a man-in-the-middle.
+type Feature uint8
+
+const (
+	// FeatureCompression indicates support for compressed DATA payloads.
+	FeatureCompression Feature = 0xf0
+	// FeatureKeepAliveEcho indicates that keep-alive requests are answered,
+	// which allows measuring the round-trip time.
+	FeatureKeepAliveEcho Feature = 0xf1
+	// FeatureResumption indicates support for session resumption.
+	FeatureResumption Feature = 0xf2
+	// FeatureCompactKeys indicates support for public keys encoded as raw
+	// points in SESSION messages.
+	FeatureCompactKeys Feature = 0xf3
+	// FeatureFragmentation indicates that fragmented handshake messages are
+	// reassembled.
+	FeatureFragmentation Feature = 0xf4
+	// FeatureMultiFlow indicates that DATA messages coming from other ports
+	// of the remote host, once announced, belong to the same session.
+	FeatureMultiFlow Feature = 0xf5
+	// FeatureMesh indicates that routes are exchanged, and that data routed
+	// to other hosts of the mesh is relayed.
+	FeatureMesh Feature = 0xf6
+	// FeatureStreams indicates support for reliable streams multiplexed over
+	// the session.
+	FeatureStreams Feature = 0xf7
+	// FeatureRotation indicates that new certificates are announced over the
+	// current session before being presented.
+	FeatureRotation Feature = 0xf8
+	// FeatureCoalescing indicates that all the messages of a datagram are
+	// read, so that several DATA messages may be sent in a single one.
+	FeatureCoalescing Feature = 0xf9
+)
+
+// featureBase is the first cipher suite value reserved for features.
+const featureBase = 0xf0
+
+func (f Feature) String() string {
+	switch f {
+	case FeatureCompression:
+		return "compression"
+	case FeatureKeepAliveEcho:
+		return "keep-alive-echo"
+	case FeatureResumption:
+		return "resumption"
+	case FeatureCompactKeys:
+		return "compact-keys"
+	case FeatureFragmentation:
+		return "fragmentation"
+	case FeatureMultiFlow:
+		return "multi-flow"
+	case FeatureMesh:
+		return "mesh"
+	case FeatureStreams:
+		return "streams"
+	case FeatureRotation:
+		return "rotation"
+	case FeatureCoalescing:
+		return "coalescing"
+	default:
+		return fmt.Sprintf("Feature(%d)", uint8(f))
+	}
+}
+
+// A FeatureSet is a set of features.
+type FeatureSet uint16
+
+// Has tells whether the set contains the specified feature.
+func (s FeatureSet) Has(feature Feature) bool {
+	if feature < featureBase {
+		return false
+	}
+
+	return s&(1<<(feature-featureBase)) != 0
+}
+
+// With returns a copy of the set with the specified feature added.
+func (s FeatureSet) With(feature Feature) FeatureSet {
+	if feature < featureBase {
+		return s
+	}
+
+	return s | 1<<(feature-featureBase)
+}
+
+// Intersect returns the features that are in both sets.
+func (s FeatureSet) Intersect(other FeatureSet) FeatureSet {
+	return s & other
+}
+
+// cipherSuites returns the signaling cipher suite values for the set.
+func (s FeatureSet) cipherSuites() (result CipherSuiteSlice) {
+	for i := uint(0); i < 16; i++ {
+		if s&(1<<i) != 0 {
+			result = append(result, CipherSuite(featureBase+i))
+		}
+	}
+
+	return
+}
+
+func (s FeatureSet) String() string {
+	var strs []string
+
+	for _, value := range s.cipherSuites() {
+		strs = append(strs, Feature(value).String())
+	}
+
+	return strings.Join(strs, ",")
+}
+
+// featuresFromCipherSuites extracts the features signaled in a list of cipher
+// suites.
+func featuresFromCipherSuites(cipherSuites CipherSuiteSlice) (result FeatureSet) {
+	for _, cipherSuite := range cipherSuites {
+		if cipherSuite >= featureBase {
+			result = result.With(Feature(cipherSuite))
+		}
+	}
+
+	return
+}
@@ -0,0 +1,210 @@
+package fscp
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+	"math/rand"
+	"time"
+)
+
+const (
+	// DefaultMaxFragmentSize is the default maximum size of the datagrams
+	// that carry handshake message fragments. It fits in the minimum IPv6
+	// MTU, headers included.
+	DefaultMaxFragmentSize = 1200
+
+	// DefaultReassemblyTimeout is the default time after which incomplete
+	// fragmented messages are discarded.
+	DefaultReassemblyTimeout = time.Second * 5
+
+	// maxFragments is the maximum number of fragments of a message, which
+	// bounds the size of reassembled messages.
+	maxFragments = 32
+
+	// maxPendingReassemblies is the maximum number of messages a connection
+	// reassembles at the same time.
+	maxPendingReassemblies = 4
+)
+
+// fragmentHeaderSize is the size of the headers of a FRAGMENT message.
+const fragmentHeaderSize = 4 + 6
+
+// fragmentable tells whether messages of a given type may be fragmented.
+func fragmentable(messageType MessageType) bool {
+	switch messageType {
+	case MessageTypePresentation, MessageTypeSessionRequest, MessageTypeSession:
+		return true
+	}
+
+	return false
+}
+
+// fragmentMessage splits a serialized message into FRAGMENT datagrams of at
+// most maxSize bytes.
+func fragmentMessage(message []byte, maxSize int) ([][]byte, error) {
+	chunkSize := maxSize - fragmentHeaderSize
+
+	if chunkSize <= 0 {
+		return nil, fmt.Errorf("fragments of %d byte(s) are too small", maxSize)
+	}
+
+	count := (len(message) + chunkSize - 1) / chunkSize
+
+	if count > maxFragments {
+		return nil, fmt.Errorf("a message of %d byte(s) requires %d fragments but at most %d are allowed", len(message), count, maxFragments)
+	}
+
+	id := rand.Uint32()
+	datagrams := make([][]byte, 0, count)
+
+	for i := 0; i < count; i++ {
+		end := (i + 1) * chunkSize
+
+		if end > len(message) {
+			end = len(message)
+		}
+
+		buf := &bytes.Buffer{}
+		fragment := &messageFragment{
+			MessageID: id,
+			Index:     uint8(i),
+			Count:     uint8(count),
+			Data:      message[i*chunkSize : end],
+		}
+
+		if err := writeMessage(buf, MessageTypeFragment, fragment); err != nil {
+			return nil, err
+		}
+
+		datagrams = append(datagrams, buf.Bytes())
+	}
+
+	return datagrams, nil
+}
+
+// reassembly is a fragmented message being reassembled.
+type reassembly struct {
+	fragments [][]byte
+	received  int
+	expires   time.Time
+}
+
+// reassembler reassembles fragmented handshake messages.
+//
+// Its memory usage is bounded: it reassembles at most maxPendingReassemblies
+// messages of at most maxFragments fragments at the same time, and discards
+// incomplete ones after a timeout.
+//
+// It is not thread-safe.
+type reassembler struct {
+	timeout time.Duration
+	pending map[uint32]*reassembly
+}
+
+func newReassembler(timeout time.Duration) *reassembler {
+	return &reassembler{
+		timeout: timeout,
+		pending: map[uint32]*reassembly{},
+	}
+}
+
+// add adds a fragment and returns the reassembled message once all its
+// fragments were received.
+func (r *reassembler) add(fragment *messageFragment, now time.Time) ([]byte, error) {
+	if fragment.Count == 0 || fragment.Count > maxFragments || fragment.Index >= fragment.Count {
+		return nil, fmt.Errorf("invalid fragment %d/%d", fragment.Index, fragment.Count)
+	}
+
+	r.expire(now)
+
+	current, ok := r.pending[fragment.MessageID]
+
+	if !ok {
+		if len(r.pending) >= maxPendingReassemblies {
+			r.evictOldest()
+		}
+
+		current = &reassembly{
+			fragments: make([][]byte, fragment.Count),
+			expires:   now.Add(r.timeout),
+		}
+		r.pending[fragment.MessageID] = current
+	}
+
+	if len(current.fragments) != int(fragment.Count) {
+		delete(r.pending, fragment.MessageID)
+
+		return nil, errors.New("inconsistent fragment count")
+	}
+
+	if current.fragments[fragment.Index] == nil {
+		current.fragments[fragment.Index] = fragment.Data
+		current.received++
+	}
+
+	if current.received < len(current.fragments) {
+		return nil, nil
+	}
+
+	delete(r.pending, fragment.MessageID)
+
+	return bytes.Join(current.fragments, nil), nil
+}
+
+// expire discards the messages that took too long to reassemble.
+func (r *reassembler) expire(now time.Time) {
+	for id, current := range r.pending {
+		if !now.Before(current.expires) {
+			delete(r.pending, id)
+		}
+	}
+}
+
+func (r *reassembler) evictOldest() {
+	var oldest uint32
+	var expires time.Time
+
+	for id, current := range r.pending {
+		if expires.IsZero() || current.expires.Before(expires) {
+			oldest, expires = id, current.expires
+		}
+	}
+
+	delete(r.pending, oldest)
+}
+
+// reassemble adds a received fragment and returns the reassembled message
+// once it is complete.
+func (c *Conn) reassemble(fragment *messageFragment) (messageFrame, bool) {
+	c.debugPrintf("Received %s.\n", fragment)
+
+	if c.reassembler == nil {
+		c.reassembler = newReassembler(c.config.Handshake.reassemblyTimeout())
+	}
+
+	data, err := c.reassembler.add(fragment, time.Now())
+
+	if err != nil {
+		c.warning(fmt.Errorf("discarding fragment: %s", err))
+		return messageFrame{}, false
+	}
+
+	if data == nil {
+		return messageFrame{}, false
+	}
+
+	messageType, message, err := readMessage(bytes.NewReader(data))
+
+	if err != nil {
+		c.warning(fmt.Errorf("reading reassembled message: %s", err))
+		return messageFrame{}, false
+	}
+
+	if !fragmentable(messageType) {
+		c.warning(fmt.Errorf("discarding reassembled %s message", messageType))
+		return messageFrame{}, false
+	}
+
+	return messageFrame{messageType: messageType, message: message}, true
+}
@@ -0,0 +1,225 @@
+package fscp
+
+import (
+	"bytes"
+	"context"
+	"net"
+	"testing"
+	"time"
+)
+
+// readFragments reads the FRAGMENT messages of the specified datagrams.
+func readFragments(t *testing.T, datagrams [][]byte) []*messageFragment {
+	t.Helper()
+
+	var fragments []*messageFragment
+
+	for _, datagram := range datagrams {
+		_, msg, err := readMessage(bytes.NewReader(datagram))
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		fragments = append(fragments, msg.(*messageFragment))
+	}
+
+	return fragments
+}
+
+func TestFragmentation(t *testing.T) {
+	message := make([]byte, 1000)
+
+	for i := range message {
+		message[i] = byte(i)
+	}
+
+	datagrams, err := fragmentMessage(message, 300)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if len(datagrams) != 4 {
+		t.Fatalf("expected 4 fragments but got %d", len(datagrams))
+	}
+
+	for _, datagram := range datagrams {
+		if len(datagram) > 300 {
+			t.Errorf("expected fragments of at most 300 bytes but got %d", len(datagram))
+		}
+	}
+
+	fragments := readFragments(t, datagrams)
+	r := newReassembler(time.Second)
+	now := time.Now()
+
+	// Fragments may be duplicated and come in any order.
+	for _, i := range []int{3, 1, 1, 0} {
+		if data, err := r.add(fragments[i], now); err != nil || data != nil {
+			t.Fatalf("expected an incomplete message but got %v, %v", data, err)
+		}
+	}
+
+	data, err := r.add(fragments[2], now)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if !bytes.Equal(data, message) {
+		t.Errorf("the reassembled message differs from the original one")
+	}
+
+	if len(r.pending) != 0 {
+		t.Errorf("expected no pending reassemblies but got %d", len(r.pending))
+	}
+
+	if _, err := fragmentMessage(make([]byte, 100000), 300); err == nil {
+		t.Errorf("expected an error for a message requiring too many fragments")
+	}
+}
+
+func TestReassemblerBounds(t *testing.T) {
+	r := newReassembler(time.Second)
+	now := time.Now()
+
+	for _, fragment := range []*messageFragment{
+		{MessageID: 1, Index: 0, Count: 0},
+		{MessageID: 1, Index: 2, Count: 2},
+		{MessageID: 1, Index: 0, Count: maxFragments + 1},
+	} {
+		if _, err := r.add(fragment, now); err == nil {
+			t.Errorf("expected an error for %s", fragment)
+		}
+	}
+
+	for i := 0; i < maxPendingReassemblies+1; i++ {
+		r.add(&messageFragment{MessageID: uint32(i), Index: 0, Count: 2}, now.Add(time.Duration(i)))
+	}
+
+	if len(r.pending) != maxPendingReassemblies {
+		t.Errorf("expected %d pending reassemblies but got %d", maxPendingReassemblies, len(r.pending))
+	}
+
+	if _, ok := r.pending[0]; ok {
+		t.Errorf("expected the oldest reassembly to be evicted")
+	}
+
+	if _, err := r.add(&messageFragment{MessageID: 1, Index: 1, Count: 3}, now); err == nil {
+		t.Errorf("expected an error for an inconsistent fragment count")
+	}
+
+	// Incomplete messages expire.
+	if data, _ := r.add(&messageFragment{MessageID: 2, Index: 1, Count: 2}, now.Add(time.Second*2)); data != nil {
+		t.Errorf("expected the reassembly to have expired")
+	}
+
+	if len(r.pending) != 1 {
+		t.Errorf("expected 1 pending reassembly but got %d", len(r.pending))
+	}
+}
+
+// smallMTUPacketConn drops the outgoing datagrams that are larger than its
+// MTU, as would a path that drops IP fragments.
+type smallMTUPacketConn struct {
+	net.PacketConn
+	mtu int
+}
+
+func (c *smallMTUPacketConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	if len(b) > c.mtu {
+		return len(b), nil
+	}
+
+	return c.PacketConn.WriteTo(b, addr)
+}
+
+func TestFragmentedHandshake(t *testing.T) {
+	const mtu = 400
+
+	testCases := []struct {
+		name   string
+		config ClientConfig
+	}{
+		{
+			name: "full",
+			config: ClientConfig{
+				Handshake: HandshakeConfig{DisableOptimistic: true, MaxFragmentSize: mtu},
+			},
+		},
+		{
+			name: "optimistic",
+			config: ClientConfig{
+				Handshake: HandshakeConfig{Coalesce: true, MaxFragmentSize: mtu},
+			},
+		},
+	}
+
+	for _, testCase := range testCases {
+		t.Run(testCase.name, func(t *testing.T) {
+			ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+			defer cancel()
+
+			keyA, certA, err := GenerateLocalCertificate()
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			keyB, certB, err := GenerateLocalCertificate()
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			clients := make([]*Client, 2)
+
+			for i, security := range []*ClientSecurity{
+				{Certificate: certA, PrivateKey: keyA, RemoteClientSecurity: &RemoteClientSecurity{Certificate: certB}},
+				{Certificate: certB, PrivateKey: keyB, RemoteClientSecurity: &RemoteClientSecurity{Certificate: certA}},
+			} {
+				socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+				if err != nil {
+					t.Fatalf("expected no error: %s", err)
+				}
+
+				config := testCase.config
+
+				if clients[i], err = NewClientWithConfig(&smallMTUPacketConn{socket, mtu}, security, &config); err != nil {
+					t.Fatalf("expected no error: %s", err)
+				}
+
+				defer clients[i].Close()
+			}
+
+			conn, err := clients[0].Connect(ctx, clients[1].Addr().(*Addr))
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			serverConn, err := clients[1].Accept()
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			if _, err := conn.Write([]byte("fragmented")); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			b := make([]byte, 16)
+			n, err := serverConn.Read(b)
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			if string(b[:n]) != "fragmented" {
+				t.Errorf("expected `fragmented` but got `%s`", b[:n])
+			}
+		})
+	}
+}
@@ -0,0 +1,135 @@
+package fscp
+
+import (
+	"encoding/binary"
+	"errors"
+	"io"
+	"time"
+)
+
+const (
+	// DataHeadroom is the number of bytes that WriteFrame needs before the
+	// data, where it writes the header of the DATA message.
+	DataHeadroom = 4 + 4 + 16 + 2
+
+	// DataTailroom is the capacity that WriteFrame needs past the data, where
+	// the GCM tag is computed.
+	DataTailroom = 16
+)
+
+// ErrNoFrameRoom is returned by WriteFrame when the frame has no room for the
+// header or the GCM tag.
+var ErrNoFrameRoom = errors.New("the frame has no room for the header or the GCM tag")
+
+// outgoingFrame is a frame passed to WriteFrame.
+type outgoingFrame struct {
+	frame []byte
+	done  func([]byte)
+}
+
+// WriteFrame sends data on the default channel, like Write does, but without
+// copying it.
+//
+// The data starts at DataHeadroom in frame, and frame must have a capacity of
+// at least DataTailroom bytes past its end. The header is written before the
+// data and the data is encrypted in place, so that the same buffer goes from
+// the caller to the socket.
+//
+// frame belongs to the connection until done is called with it, once it was
+// sent or dropped. done is not called if an error is returned.
+func (c *Conn) WriteFrame(frame []byte, done func([]byte)) error {
+	if len(frame) < DataHeadroom || cap(frame)-len(frame) < DataTailroom {
+		return ErrNoFrameRoom
+	}
+
+	// Writes that happen before a session is established are copied.
+	if !c.isConnected() {
+		if _, err := c.Write(frame[DataHeadroom:]); err != nil {
+			return err
+		}
+
+		done(frame)
+
+		return nil
+	}
+
+	select {
+	case c.outgoingFrames <- outgoingFrame{frame: frame, done: done}:
+		return nil
+	case <-c.closed:
+		return io.ErrClosedPipe
+	}
+}
+
+// sendFrames sends a frame along with the ones queued after it, in as few
+// system calls as possible.
+func (c *Conn) sendFrames(first outgoingFrame) error {
+	batch := append(c.frameBatch[:0], first)
+
+	for len(batch) < c.config.Relay.batchSize() {
+		select {
+		case f := <-c.outgoingFrames:
+			batch = append(batch, f)
+			continue
+		default:
+		}
+
+		break
+	}
+
+	defer func() {
+		for i, f := range batch {
+			f.done(f.frame)
+			batch[i] = outgoingFrame{}
+		}
+
+		c.frameBatch = batch[:0]
+	}()
+
+	if c.session == nil {
+		c.warning(errors.New("dropping frames because no session is currently active"))
+
+		return nil
+	}
+
+	// Frames that are not sent as they are take the regular path.
+	if c.multipath() || c.meshDetour() != nil || (len(c.flows) > 0 && c.features().Has(FeatureMultiFlow)) || c.features().Has(FeatureCompression) {
+		for _, f := range batch {
+			if err := c.sendData(0, f.frame[DataHeadroom:]); err != nil {
+				return err
+			}
+		}
+
+		return nil
+	}
+
+	datagrams := c.relayDatagrams[:0]
+
+	for _, f := range batch {
+		datagrams = append(datagrams, c.sealFrame(f.frame))
+	}
+
+	c.relayDatagrams = datagrams[:0]
+
+	return c.client.batchWriter.writeBatch(datagrams, c.RemoteAddr().(*Addr).TransportAddr)
+}
+
+// sealFrame encrypts the data of a frame in place and writes the header of
+// the DATA message before it.
+func (c *Conn) sealFrame(frame []byte) []byte {
+	msg := c.session.Encrypt(frame[DataHeadroom:])
+
+	c.debugPrintf("Sending %s.\n", msg)
+
+	c.lastSent = time.Now()
+
+	// The GCM tag comes before the ciphertext.
+	frame[0] = byte(MessageVersion3)
+	frame[1] = byte(MessageTypeData)
+	binary.BigEndian.PutUint16(frame[2:], uint16(msg.serializationSize()))
+	binary.BigEndian.PutUint32(frame[4:], uint32(msg.SequenceNumber))
+	copy(frame[8:24], msg.GCMTag)
+	binary.BigEndian.PutUint16(frame[24:], uint16(len(msg.Ciphertext)))
+
+	return frame
+}
@@ -0,0 +1,59 @@
+package fscp
+
+import (
+	"context"
+	"testing"
+	"time"
+)
+
+func TestWriteFrame(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	server := listenTestClient(t, nil)
+	client := listenTestClient(t, nil)
+	conn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if err := conn.WriteFrame(make([]byte, DataHeadroom+4), nil); err != ErrNoFrameRoom {
+		t.Errorf("expected %s but got %v", ErrNoFrameRoom, err)
+	}
+
+	buf := make([]byte, DataHeadroom+5, DataHeadroom+5+DataTailroom)
+	copy(buf[DataHeadroom:], "frame")
+	done := make(chan []byte, 1)
+
+	if err := conn.WriteFrame(buf, func(frame []byte) { done <- frame }); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	// The buffer is handed back once sent.
+	select {
+	case frame := <-done:
+		if &frame[0] != &buf[0] {
+			t.Errorf("expected the same buffer to be handed back")
+		}
+	case <-ctx.Done():
+		t.Fatalf("expected the frame to be sent")
+	}
+
+	remoteConn, err := server.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	b := make([]byte, 16)
+	n, err := remoteConn.Read(b)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if string(b[:n]) != "frame" {
+		t.Errorf("expected `frame` but got `%s`", b[:n])
+	}
+}
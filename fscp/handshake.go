@@ -0,0 +1,394 @@
+package fscp
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+	"time"
+)
+
+const (
+	// DefaultMaxCoalescedSize is the default maximum size of datagrams that
+	// contain several handshake messages.
+	DefaultMaxCoalescedSize = 1200
+
+	// DefaultHandshakeInitialTimeout is the default retransmission timeout of
+	// handshake messages when the round-trip time is unknown.
+	DefaultHandshakeInitialTimeout = time.Millisecond * 500
+	// DefaultHandshakeMinTimeout is the default minimum retransmission timeout
+	// of handshake messages.
+	DefaultHandshakeMinTimeout = time.Millisecond * 100
+	// DefaultHandshakeMaxTimeout is the default maximum delay between two
+	// retransmissions of handshake messages.
+	DefaultHandshakeMaxTimeout = time.Second * 10
+	// DefaultHandshakeMaxRetries is the default number of retransmissions
+	// after which a handshake is abandoned.
+	DefaultHandshakeMaxRetries = 8
+)
+
+// ErrHandshakeTimeout is the error used to close connections whose handshake
+// went unanswered.
+var ErrHandshakeTimeout = errors.New("the handshake timed out")
+
+// HandshakeConfig contains the handshake settings.
+type HandshakeConfig struct {
+	// DisableOptimistic disables optimistic handshakes.
+	//
+	// When the security of the remote host is known in advance, because it
+	// was configured explicitly or because a pre-shared key is used, the
+	// PRESENTATION and SESSION REQUEST messages are sent right after the
+	// HELLO request rather than after the HELLO response and the remote
+	// host's PRESENTATION. This saves about two round-trips. The regular
+	// sequence still takes place, which makes hosts that ignore
+	// out-of-sequence messages fall back to it.
+	DisableOptimistic bool
+
+	// Coalesce sends the messages of optimistic handshakes in a single
+	// datagram when they fit in MaxCoalescedSize bytes, which is typically
+	// the case with pre-shared keys.
+	//
+	// Legacy hosts only read the first message of a datagram: they still
+	// complete the handshake, but without saving any round-trip.
+	Coalesce bool
+
+	// MaxCoalescedSize is the maximum size of coalesced datagrams.
+	MaxCoalescedSize int
+
+	// DisableCompactKeys disables the compact encoding of the public keys of
+	// SESSION messages. Without it, public keys are always PEM-encoded, as
+	// legacy hosts expect, which makes SESSION messages about 120 bytes
+	// larger and slower to both write and parse.
+	DisableCompactKeys bool
+
+	// InitialTimeout is the retransmission timeout of handshake messages
+	// until the round-trip time to the remote host was measured. Afterwards,
+	// the timeout derives from the measurements and is bounded by MinTimeout
+	// and MaxTimeout.
+	//
+	// Retransmissions back off exponentially with random jitter, up to
+	// MaxTimeout between two of them.
+	InitialTimeout time.Duration
+	MinTimeout     time.Duration
+	MaxTimeout     time.Duration
+
+	// MaxRetries is the number of retransmissions after which the connection
+	// is closed with ErrHandshakeTimeout. A negative value means no limit.
+	MaxRetries int
+
+	// DisableFragmentation disables the fragmentation of handshake messages.
+	//
+	// Handshake messages that don't fit in MaxFragmentSize bytes, typically
+	// PRESENTATION messages with large certificates, are split into FRAGMENT
+	// messages rather than relying on IP fragmentation, which many NATs
+	// drop. Until the remote host advertises that it reassembles fragments,
+	// retransmissions alternate with whole messages, which legacy hosts
+	// expect.
+	DisableFragmentation bool
+
+	// MaxFragmentSize is the maximum size of the datagrams that carry
+	// fragments.
+	MaxFragmentSize int
+
+	// ReassemblyTimeout is the time after which incomplete fragmented
+	// messages are discarded.
+	ReassemblyTimeout time.Duration
+}
+
+func (c *HandshakeConfig) maxCoalescedSize() int {
+	if c.MaxCoalescedSize <= 0 {
+		return DefaultMaxCoalescedSize
+	}
+
+	return c.MaxCoalescedSize
+}
+
+func (c *HandshakeConfig) initialTimeout() time.Duration {
+	if c.InitialTimeout <= 0 {
+		return DefaultHandshakeInitialTimeout
+	}
+
+	return c.InitialTimeout
+}
+
+func (c *HandshakeConfig) minTimeout() time.Duration {
+	if c.MinTimeout <= 0 {
+		return DefaultHandshakeMinTimeout
+	}
+
+	return c.MinTimeout
+}
+
+func (c *HandshakeConfig) maxTimeout() time.Duration {
+	if c.MaxTimeout <= 0 {
+		return DefaultHandshakeMaxTimeout
+	}
+
+	return c.MaxTimeout
+}
+
+func (c *HandshakeConfig) maxFragmentSize() int {
+	if c.MaxFragmentSize <= 0 {
+		return DefaultMaxFragmentSize
+	}
+
+	return c.MaxFragmentSize
+}
+
+func (c *HandshakeConfig) reassemblyTimeout() time.Duration {
+	if c.ReassemblyTimeout <= 0 {
+		return DefaultReassemblyTimeout
+	}
+
+	return c.ReassemblyTimeout
+}
+
+// maxRetries returns the maximum number of retries, or zero if there is no
+// limit.
+func (c *HandshakeConfig) maxRetries() int {
+	if c.MaxRetries < 0 {
+		return 0
+	}
+
+	if c.MaxRetries == 0 {
+		return DefaultHandshakeMaxRetries
+	}
+
+	return c.MaxRetries
+}
+
+// handshakeStage is the stage of the handshake we initiated.
+type handshakeStage int
+
+const (
+	// handshakeDone means no handshake is in progress.
+	handshakeDone handshakeStage = iota
+	// handshakeHello means a HELLO request, a RESUME REQUEST or an optimistic
+	// handshake awaits an answer.
+	handshakeHello
+	// handshakePresentation means our PRESENTATION awaits a SESSION REQUEST.
+	handshakePresentation
+	// handshakeSession means our SESSION REQUEST awaits a SESSION.
+	handshakeSession
+	// handshakeRekey means our SESSION REQUEST with new credentials awaits a
+	// SESSION while the current session keeps being used.
+	handshakeRekey
+)
+
+// flightMessage is a message that is part of a handshake flight.
+type flightMessage struct {
+	messageType MessageType
+	message     serializable
+}
+
+// A flight contains the datagrams of a handshake stage.
+type flight struct {
+	whole      [][]byte
+	fragmented [][]byte
+	alternate  bool
+}
+
+// datagrams returns the datagrams to send on the specified attempt.
+//
+// Messages that are too large for a single datagram are sent as fragments.
+// Unless the remote host is known to reassemble them, attempts alternate with
+// whole messages, that legacy hosts may still get through IP fragmentation.
+func (f *flight) datagrams(attempt int) [][]byte {
+	if f.fragmented == nil || (f.alternate && attempt%2 == 0) {
+		return f.whole
+	}
+
+	return f.fragmented
+}
+
+// sendFlight sends the messages of a handshake stage and keeps resending them
+// until the next stage begins or a session gets established.
+//
+// The operation is called from the retrier's goroutine, so it must only use
+// immutable connection state.
+func (c *Conn) sendFlight(stage handshakeStage, operation func() error) error {
+	if c.handshakeRetrier != nil {
+		c.handshakeRetrier.Stop()
+	}
+
+	retrier := &Retrier{
+		Operation: operation,
+		Backoff: &Backoff{
+			Base: c.handshakeTimeout(),
+			Max:  c.config.Handshake.maxTimeout(),
+		},
+		MaxRetries: c.config.Handshake.maxRetries(),
+	}
+
+	retrier.OnFailure = func(err error) {
+		if err == ErrTooManyRetries {
+			// An unanswered rekey leaves the current session untouched.
+			if stage == handshakeRekey {
+				c.do(func() { c.rekeyFailed(retrier) })
+				return
+			}
+
+			err = ErrHandshakeTimeout
+		}
+
+		c.closeWithError(err)
+	}
+
+	c.handshakeStage = stage
+	c.handshakeSentAt = time.Now()
+	c.handshakeRetrier = retrier
+
+	// The first operation happens synchronously: if it failed, the connection
+	// is closed already.
+	c.handshakeRetrier.Start()
+
+	select {
+	case <-c.closed:
+		return c.closeError
+	default:
+		return nil
+	}
+}
+
+// sendDatagramsFlight sends pre-serialized datagrams as a handshake flight.
+func (c *Conn) sendDatagramsFlight(stage handshakeStage, messages ...flightMessage) error {
+	f, err := c.makeFlight(messages, c.features().Has(FeatureFragmentation))
+
+	if err != nil {
+		return err
+	}
+
+	attempts := 0
+
+	return c.sendFlight(stage, func() error {
+		attempts++
+
+		for _, m := range messages {
+			c.debugPrintf("Sending %s.\n", m.message)
+		}
+
+		return c.writeDatagrams(f.datagrams(attempts))
+	})
+}
+
+// endHandshake stops resending the messages of the current handshake stage.
+//
+// It is called once the stage got answered: unless its messages had to be
+// resent, which makes the answer ambiguous, this measures the round-trip time
+// to the remote host.
+func (c *Conn) endHandshake(now time.Time) {
+	if c.handshakeStage == handshakeDone {
+		return
+	}
+
+	if c.handshakeRetrier.Stop() && c.handshakeRetrier.Attempts() == 1 {
+		c.handshakeRTT.update(now.Sub(c.handshakeSentAt))
+	}
+
+	c.handshakeStage = handshakeDone
+}
+
+// handshakeTimeout returns the retransmission timeout of handshake messages.
+func (c *Conn) handshakeTimeout() time.Duration {
+	rtt := &c.handshakeRTT
+
+	// Keep-alives measure the round-trip time more often, which helps when a
+	// session gets re-established.
+	if c.keepAlive.rtt.valid() {
+		rtt = &c.keepAlive.rtt
+	}
+
+	return rtt.rto(c.config.Handshake.initialTimeout(), c.config.Handshake.minTimeout(), c.config.Handshake.maxTimeout())
+}
+
+// makeFlight serializes handshake messages into a flight. Small messages are
+// coalesced if the configuration allows it, and large ones are fragmented.
+//
+// reassembles tells whether the remote host is known to reassemble
+// fragments.
+//
+// It only uses immutable connection state, so that it can be called from the
+// retrier's goroutine.
+func (c *Conn) makeFlight(messages []flightMessage, reassembles bool) (*flight, error) {
+	f := &flight{alternate: !reassembles}
+	maxFragmentSize := c.config.Handshake.maxFragmentSize()
+	oversized := false
+	size := 0
+
+	for _, m := range messages {
+		buf := &bytes.Buffer{}
+
+		if err := writeMessage(buf, m.messageType, m.message); err != nil {
+			return nil, err
+		}
+
+		f.whole = append(f.whole, buf.Bytes())
+		size += buf.Len()
+
+		if buf.Len() > maxFragmentSize && fragmentable(m.messageType) {
+			oversized = true
+		}
+	}
+
+	if oversized && !c.config.Handshake.DisableFragmentation {
+		for i, datagram := range f.whole {
+			if len(datagram) <= maxFragmentSize || !fragmentable(messages[i].messageType) {
+				f.fragmented = append(f.fragmented, datagram)
+				continue
+			}
+
+			fragments, err := fragmentMessage(datagram, maxFragmentSize)
+
+			if err != nil {
+				c.warning(fmt.Errorf("sending %s whole: %s", messages[i].messageType, err))
+				f.fragmented = nil
+				break
+			}
+
+			f.fragmented = append(f.fragmented, fragments...)
+		}
+	}
+
+	if len(f.whole) > 1 && c.config.Handshake.Coalesce && size <= c.config.Handshake.maxCoalescedSize() {
+		f.whole = [][]byte{bytes.Join(f.whole, nil)}
+	}
+
+	return f, nil
+}
+
+func (c *Conn) writeDatagrams(datagrams [][]byte) error {
+	for _, datagram := range datagrams {
+		if _, err := c.writer.Write(datagram); err != nil {
+			return err
+		}
+	}
+
+	return nil
+}
+
+// optimisticHandshake returns the flight that starts an optimistic handshake.
+//
+// It only uses immutable connection state and the specified security, so
+// that it can be called from the retrier's goroutine.
+func (c *Conn) optimisticHandshake(uniqueNumber UniqueNumber, sessionNumber SessionNumber, security ClientSecurity, reassembles bool) (*flight, error) {
+	sessionRequest, err := c.makeSessionRequest(security, sessionNumber)
+
+	if err != nil {
+		return nil, err
+	}
+
+	return c.makeFlight([]flightMessage{
+		{MessageTypeHelloRequest, &messageHello{UniqueNumber: uniqueNumber}},
+		{MessageTypePresentation, &messagePresentation{Certificate: security.Certificate}},
+		{MessageTypeSessionRequest, sessionRequest},
+	}, reassembles)
+}
+
+// optimistic tells whether the handshake can be optimistic, which requires
+// knowing how to authenticate the remote host.
+func (c *Conn) optimistic() bool {
+	if c.config.Handshake.DisableOptimistic {
+		return false
+	}
+
+	return c.remoteSecurityPreset || c.security.usesPresharedKeyOnly()
+}
@@ -0,0 +1,316 @@
+package fscp
+
+import (
+	"bytes"
+	"context"
+	"net"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+// delayedPacketConn delays outgoing datagrams, which simulates latency.
+type delayedPacketConn struct {
+	net.PacketConn
+	delay time.Duration
+}
+
+func (c *delayedPacketConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	b = append([]byte{}, b...)
+	time.AfterFunc(c.delay, func() { c.PacketConn.WriteTo(b, addr) })
+
+	return len(b), nil
+}
+
+// listenDelayedTestClient instantiates a new client whose outgoing datagrams
+// are delayed.
+func listenDelayedTestClient(t *testing.T, delay time.Duration, security *ClientSecurity, config *ClientConfig) *Client {
+	t.Helper()
+
+	conn, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	client, err := NewClientWithConfig(&delayedPacketConn{conn, delay}, security, config)
+
+	if err != nil {
+		conn.Close()
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	t.Cleanup(func() { client.Close() })
+
+	return client
+}
+
+func TestOptimisticHandshake(t *testing.T) {
+	const delay = time.Millisecond * 100
+	const rtt = delay * 2
+
+	keyA, certA, err := GenerateLocalCertificate()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	keyB, certB, err := GenerateLocalCertificate()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	presharedKey := []byte("some pre-shared key")
+
+	testCases := []struct {
+		name           string
+		clientSecurity ClientSecurity
+		serverSecurity ClientSecurity
+		config         ClientConfig
+		minRoundTrips  float64
+		maxRoundTrips  float64
+	}{
+		{
+			name:           "certificates",
+			clientSecurity: ClientSecurity{Certificate: certA, PrivateKey: keyA, RemoteClientSecurity: &RemoteClientSecurity{Certificate: certB}},
+			serverSecurity: ClientSecurity{Certificate: certB, PrivateKey: keyB, RemoteClientSecurity: &RemoteClientSecurity{Certificate: certA}},
+			maxRoundTrips:  1.75,
+		},
+		{
+			name:           "certificates-legacy",
+			clientSecurity: ClientSecurity{Certificate: certA, PrivateKey: keyA, RemoteClientSecurity: &RemoteClientSecurity{Certificate: certB}},
+			serverSecurity: ClientSecurity{Certificate: certB, PrivateKey: keyB, RemoteClientSecurity: &RemoteClientSecurity{Certificate: certA}},
+			config:         ClientConfig{Handshake: HandshakeConfig{DisableOptimistic: true}},
+			minRoundTrips:  2.5,
+			maxRoundTrips:  4,
+		},
+		{
+			name:           "pre-shared-key",
+			clientSecurity: ClientSecurity{PresharedKey: presharedKey},
+			serverSecurity: ClientSecurity{PresharedKey: presharedKey},
+			maxRoundTrips:  1.75,
+		},
+		{
+			name:           "pre-shared-key-coalesced",
+			clientSecurity: ClientSecurity{PresharedKey: presharedKey},
+			serverSecurity: ClientSecurity{PresharedKey: presharedKey},
+			config:         ClientConfig{Handshake: HandshakeConfig{Coalesce: true}},
+			maxRoundTrips:  1.75,
+		},
+	}
+
+	for _, testCase := range testCases {
+		t.Run(testCase.name, func(t *testing.T) {
+			ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+			defer cancel()
+
+			config := testCase.config
+			server := listenDelayedTestClient(t, delay, &testCase.serverSecurity, &config)
+			client := listenDelayedTestClient(t, delay, &testCase.clientSecurity, &config)
+
+			start := time.Now()
+			conn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			elapsed := time.Since(start)
+
+			if elapsed < time.Duration(testCase.minRoundTrips*float64(rtt)) || elapsed > time.Duration(testCase.maxRoundTrips*float64(rtt)) {
+				t.Errorf("expected the handshake to take between %.2f and %.2f round-trips but it took %.2f", testCase.minRoundTrips, testCase.maxRoundTrips, float64(elapsed)/float64(rtt))
+			}
+
+			serverConn, err := server.Accept()
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			if _, err := conn.Write([]byte("first")); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			b := make([]byte, 16)
+			n, err := serverConn.Read(b)
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			if string(b[:n]) != "first" {
+				t.Errorf("expected `first` but got `%s`", b[:n])
+			}
+		})
+	}
+}
+
+// lossyPacketConn drops the first outgoing datagram that starts with a
+// message of the specified type.
+type lossyPacketConn struct {
+	net.PacketConn
+	messageType MessageType
+	dropped     int32
+}
+
+func (c *lossyPacketConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	if len(b) > 1 && MessageType(b[1]) == c.messageType && atomic.CompareAndSwapInt32(&c.dropped, 0, 1) {
+		return len(b), nil
+	}
+
+	return c.PacketConn.WriteTo(b, addr)
+}
+
+func TestHandshakeRetransmission(t *testing.T) {
+	config := &ClientConfig{
+		Handshake: HandshakeConfig{
+			DisableOptimistic: true,
+			InitialTimeout:    time.Millisecond * 50,
+			MinTimeout:        time.Millisecond * 10,
+			MaxTimeout:        time.Millisecond * 200,
+			MaxRetries:        4,
+		},
+	}
+
+	t.Run("losses", func(t *testing.T) {
+		ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+		defer cancel()
+
+		server := listenTestClient(t, config)
+
+		// Every stage of the handshake gets resent.
+		for _, messageType := range []MessageType{MessageTypeHelloRequest, MessageTypePresentation, MessageTypeSessionRequest} {
+			socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			client, err := NewClientWithConfig(&lossyPacketConn{PacketConn: socket, messageType: messageType}, nil, config)
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			defer client.Close()
+
+			start := time.Now()
+
+			if _, err := client.Connect(ctx, server.Addr().(*Addr)); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			if elapsed := time.Since(start); elapsed > time.Second {
+				t.Errorf("expected the lost %s to be resent quickly but the handshake took %s", messageType, elapsed)
+			}
+		}
+	})
+
+	t.Run("unanswered", func(t *testing.T) {
+		ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+		defer cancel()
+
+		// This socket never answers.
+		blackhole, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		defer blackhole.Close()
+
+		client := listenTestClient(t, config)
+
+		if _, err := client.Connect(ctx, &Addr{TransportAddr: blackhole.LocalAddr()}); err != ErrHandshakeTimeout {
+			t.Errorf("expected %s but got: %v", ErrHandshakeTimeout, err)
+		}
+	})
+}
+
+// sessionRecorder records whether the SESSION messages sent through it use
+// compact public keys.
+type sessionRecorder struct {
+	net.PacketConn
+	lock    sync.Mutex
+	compact []bool
+}
+
+func (c *sessionRecorder) WriteTo(b []byte, addr net.Addr) (int, error) {
+	r := bytes.NewReader(b)
+
+	for r.Len() > 0 {
+		_, msg, err := readMessage(r)
+
+		if err != nil {
+			break
+		}
+
+		if session, ok := msg.(*messageSession); ok {
+			c.lock.Lock()
+			c.compact = append(c.compact, session.CompactPublicKey)
+			c.lock.Unlock()
+		}
+	}
+
+	return c.PacketConn.WriteTo(b, addr)
+}
+
+func TestCompactPublicKeys(t *testing.T) {
+	testCases := []struct {
+		name         string
+		serverConfig ClientConfig
+		compact      bool
+	}{
+		{
+			name:    "negotiated",
+			compact: true,
+		},
+		{
+			name:         "legacy",
+			serverConfig: ClientConfig{Handshake: HandshakeConfig{DisableCompactKeys: true}},
+			compact:      false,
+		},
+	}
+
+	for _, testCase := range testCases {
+		t.Run(testCase.name, func(t *testing.T) {
+			ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+			defer cancel()
+
+			server := listenTestClient(t, &testCase.serverConfig)
+			socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			recorder := &sessionRecorder{PacketConn: socket}
+			client, err := NewClient(recorder, nil)
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			defer client.Close()
+
+			if _, err := client.Connect(ctx, server.Addr().(*Addr)); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			recorder.lock.Lock()
+			defer recorder.lock.Unlock()
+
+			if len(recorder.compact) == 0 {
+				t.Fatalf("expected a SESSION message to be sent")
+			}
+
+			for _, compact := range recorder.compact {
+				if compact != testCase.compact {
+					t.Errorf("expected compact public keys to be %t", testCase.compact)
+				}
+			}
+		})
+	}
+}
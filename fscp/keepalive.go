@@ -0,0 +1,289 @@
+package fscp
+
+import (
+	"encoding/binary"
+	"time"
+)
+
+const (
+	// DefaultKeepAliveInterval is the default initial interval between two
+	// keep-alives.
+	DefaultKeepAliveInterval = time.Second * 10
+
+	// DefaultKeepAliveMinInterval is the default lower bound of the keep-alive
+	// interval.
+	DefaultKeepAliveMinInterval = time.Second * 5
+
+	// DefaultKeepAliveMaxInterval is the default upper bound of the keep-alive
+	// interval.
+	DefaultKeepAliveMaxInterval = time.Second * 120
+
+	// DefaultKeepAliveTimeout is the time after which an unanswered keep-alive
+	// is considered lost when no round-trip time measurement exists yet.
+	DefaultKeepAliveTimeout = time.Second * 3
+
+	// minKeepAliveTimeout is the lower bound of the keep-alive timeout.
+	minKeepAliveTimeout = time.Millisecond * 200
+
+	// keepAliveLossThreshold is the number of consecutive lost keep-alives
+	// after which a NAT binding is deemed to have expired.
+	keepAliveLossThreshold = 3
+
+	// keepAliveReprobeEchoes is the number of consecutive answered keep-alives
+	// after which a learned interval is forgotten, so that a larger one is
+	// tried again.
+	keepAliveReprobeEchoes = 32
+)
+
+// KeepAliveConfig contains the keep-alive settings.
+type KeepAliveConfig struct {
+	// Disabled disables keep-alives entirely.
+	Disabled bool
+
+	// Interval is the initial time after which a keep-alive is sent if no
+	// other message was.
+	Interval time.Duration
+
+	// Adaptive makes the interval grow as long as keep-alives are answered,
+	// and shrink when several in a row are lost, as it is likely the result
+	// of an expired NAT binding. This helps finding the largest interval that
+	// keeps NAT bindings alive. The learned interval is probed again after a
+	// while, as NAT timeouts may change.
+	Adaptive bool
+
+	// MinInterval is the lower bound of an adaptive interval.
+	MinInterval time.Duration
+
+	// MaxInterval is the upper bound of an adaptive interval.
+	MaxInterval time.Duration
+}
+
+func (c *KeepAliveConfig) interval() time.Duration {
+	if c.Interval <= 0 {
+		return DefaultKeepAliveInterval
+	}
+
+	return c.Interval
+}
+
+func (c *KeepAliveConfig) minInterval() time.Duration {
+	if c.MinInterval <= 0 {
+		if c.interval() < DefaultKeepAliveMinInterval {
+			return c.interval()
+		}
+
+		return DefaultKeepAliveMinInterval
+	}
+
+	return c.MinInterval
+}
+
+func (c *KeepAliveConfig) maxInterval() time.Duration {
+	if c.MaxInterval <= 0 {
+		if c.interval() > DefaultKeepAliveMaxInterval {
+			return c.interval()
+		}
+
+		return DefaultKeepAliveMaxInterval
+	}
+
+	return c.MaxInterval
+}
+
+// KeepAliveStats contains the keep-alive statistics of a connection.
+type KeepAliveStats struct {
+	// Sent is the number of keep-alives that were sent.
+	Sent uint64
+
+	// Echoed is the number of keep-alives that were answered.
+	Echoed uint64
+
+	// Lost is the number of keep-alives that were not answered in time.
+	Lost uint64
+
+	// Interval is the current keep-alive interval.
+	Interval time.Duration
+
+	// LearnedInterval is the largest interval that is known to keep the path
+	// alive, or zero if it is unknown.
+	LearnedInterval time.Duration
+
+	// SmoothedRTT is the smoothed round-trip time, or zero if it is unknown.
+	SmoothedRTT time.Duration
+
+	// RTTVariance is the round-trip time variance.
+	RTTVariance time.Duration
+}
+
+// Keep-alive payloads start with their kind, followed by an identifier.
+//
+// Legacy hosts send random payloads and ignore the ones they receive. Echo
+// requests are only sent to hosts that advertise FeatureKeepAliveEcho, which
+// are the only ones that answer them. Flow announcements are only sent to
+// hosts that advertise FeatureMultiFlow.
+const (
+	keepAliveKindPlain    = 0x00
+	keepAliveKindRequest  = 0x01
+	keepAliveKindResponse = 0x02
+	keepAliveKindFlow     = 0x03
+
+	keepAlivePayloadSize = 5
+)
+
+func makeKeepAlivePayload(kind uint8, id uint32) []byte {
+	payload := make([]byte, keepAlivePayloadSize, keepAlivePayloadSize+16)
+	payload[0] = kind
+	binary.BigEndian.PutUint32(payload[1:], id)
+
+	return payload
+}
+
+func parseKeepAlivePayload(payload []byte) (kind uint8, id uint32, ok bool) {
+	if len(payload) != keepAlivePayloadSize {
+		return 0, 0, false
+	}
+
+	return payload[0], binary.BigEndian.Uint32(payload[1:]), true
+}
+
+// keepAliveState tracks the keep-alives of a connection.
+//
+// It is not thread-safe.
+type keepAliveState struct {
+	config   *KeepAliveConfig
+	interval time.Duration
+	learned  time.Duration
+	losses   int
+	echoes   int
+	rtt      rttEstimator
+	stats    KeepAliveStats
+
+	nextID      uint32
+	probeID     uint32
+	probeSentAt time.Time
+}
+
+func newKeepAliveState(config *KeepAliveConfig) *keepAliveState {
+	s := &keepAliveState{
+		config:   config,
+		interval: config.interval(),
+	}
+	s.stats.Interval = s.interval
+
+	return s
+}
+
+// due tells whether a keep-alive must be sent.
+func (s *keepAliveState) due(now time.Time, lastSent time.Time) bool {
+	return !s.config.Disabled && now.Sub(lastSent) >= s.interval
+}
+
+// timeout returns the time after which an unanswered keep-alive is lost.
+func (s *keepAliveState) timeout() time.Duration {
+	return s.rtt.rto(DefaultKeepAliveTimeout, minKeepAliveTimeout, s.interval)
+}
+
+// next returns the time to wait before the keep-alive state must be checked
+// again.
+func (s *keepAliveState) next(now time.Time, lastSent time.Time) time.Duration {
+	d := lastSent.Add(s.interval).Sub(now)
+
+	if !s.probeSentAt.IsZero() {
+		if e := s.probeSentAt.Add(s.timeout()).Sub(now); e < d {
+			d = e
+		}
+	}
+
+	return d
+}
+
+// sent registers a keep-alive echo request and returns its identifier.
+func (s *keepAliveState) sent(now time.Time) uint32 {
+	s.nextID++
+	s.probeID = s.nextID
+	s.probeSentAt = now
+	s.stats.Sent++
+
+	return s.probeID
+}
+
+// sentPlain registers a keep-alive that will not be answered.
+func (s *keepAliveState) sentPlain() {
+	s.stats.Sent++
+}
+
+// echoed registers a keep-alive echo response and tells whether it matched
+// the outstanding request.
+func (s *keepAliveState) echoed(now time.Time, id uint32) bool {
+	if s.probeSentAt.IsZero() || id != s.probeID {
+		return false
+	}
+
+	s.rtt.update(now.Sub(s.probeSentAt))
+	s.probeSentAt = time.Time{}
+	s.losses = 0
+	s.stats.Echoed++
+
+	if s.config.Adaptive {
+		// The learned interval has held for a while: it is forgotten, so that
+		// a larger one is tried again.
+		if s.learned != 0 {
+			if s.echoes++; s.echoes >= keepAliveReprobeEchoes {
+				s.learned, s.echoes = 0, 0
+			}
+		}
+
+		// The path survived a full interval of silence: if we are still
+		// looking for the largest working interval, we try a larger one.
+		if s.learned == 0 {
+			s.setInterval(s.interval + s.interval/4)
+		}
+	}
+
+	s.updateStats()
+
+	return true
+}
+
+// expire checks whether the outstanding keep-alive is lost.
+func (s *keepAliveState) expire(now time.Time) bool {
+	if s.probeSentAt.IsZero() || now.Sub(s.probeSentAt) < s.timeout() {
+		return false
+	}
+
+	s.probeSentAt = time.Time{}
+	s.losses++
+	s.stats.Lost++
+
+	// Several keep-alives lost in a row after a long silence likely mean that
+	// a NAT binding expired: the previous interval is the largest one known
+	// to work. A single loss is just packet loss.
+	if s.config.Adaptive && s.losses >= keepAliveLossThreshold {
+		s.learned = s.interval * 4 / 5
+		s.losses, s.echoes = 0, 0
+		s.setInterval(s.learned)
+	}
+
+	s.updateStats()
+
+	return true
+}
+
+func (s *keepAliveState) setInterval(interval time.Duration) {
+	if min := s.config.minInterval(); interval < min {
+		interval = min
+	}
+
+	if max := s.config.maxInterval(); interval > max {
+		interval = max
+	}
+
+	s.interval = interval
+}
+
+func (s *keepAliveState) updateStats() {
+	s.stats.Interval = s.interval
+	s.stats.LearnedInterval = s.learned
+	s.stats.SmoothedRTT = s.rtt.srtt
+	s.stats.RTTVariance = s.rtt.rttvar
+}
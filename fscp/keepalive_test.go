@@ -0,0 +1,156 @@
+package fscp
+
+import (
+	"context"
+	"testing"
+	"time"
+)
+
+func TestRTTEstimator(t *testing.T) {
+	e := &rttEstimator{}
+
+	if rto := e.rto(time.Second, time.Millisecond, time.Minute); rto != time.Second {
+		t.Errorf("expected %s but got %s", time.Second, rto)
+	}
+
+	e.update(time.Millisecond * 100)
+
+	if e.srtt != time.Millisecond*100 || e.rttvar != time.Millisecond*50 {
+		t.Errorf("unexpected estimation: %s/%s", e.srtt, e.rttvar)
+	}
+
+	e.update(time.Millisecond * 200)
+
+	if e.srtt != time.Millisecond*112500/1000 || e.rttvar != time.Millisecond*62500/1000 {
+		t.Errorf("unexpected estimation: %s/%s", e.srtt, e.rttvar)
+	}
+
+	if rto := e.rto(time.Second, time.Millisecond, time.Minute); rto != e.srtt+4*e.rttvar {
+		t.Errorf("expected %s but got %s", e.srtt+4*e.rttvar, rto)
+	}
+
+	if rto := e.rto(time.Second, time.Millisecond, time.Millisecond*100); rto != time.Millisecond*100 {
+		t.Errorf("expected %s but got %s", time.Millisecond*100, rto)
+	}
+}
+
+func TestKeepAliveState(t *testing.T) {
+	config := &KeepAliveConfig{
+		Interval:    time.Second * 10,
+		Adaptive:    true,
+		MinInterval: time.Second * 5,
+		MaxInterval: time.Second * 20,
+	}
+	s := newKeepAliveState(config)
+	now := time.Now()
+
+	if s.due(now, now) {
+		t.Fatalf("no keep-alive should be due right after a message was sent")
+	}
+
+	now = now.Add(time.Second * 10)
+
+	if !s.due(now, now.Add(-time.Second*10)) {
+		t.Fatalf("a keep-alive should be due")
+	}
+
+	id := s.sent(now)
+
+	if s.echoed(now, id+1) {
+		t.Errorf("an unexpected echo should not match")
+	}
+
+	if !s.echoed(now.Add(time.Millisecond*50), id) {
+		t.Fatalf("the echo should match")
+	}
+
+	if s.stats.SmoothedRTT != time.Millisecond*50 {
+		t.Errorf("expected a RTT of %s but got %s", time.Millisecond*50, s.stats.SmoothedRTT)
+	}
+
+	if s.interval != time.Millisecond*12500 {
+		t.Errorf("expected the interval to grow to %s but got %s", time.Millisecond*12500, s.interval)
+	}
+
+	id = s.sent(now)
+
+	if s.expire(now.Add(s.timeout() - time.Millisecond)) {
+		t.Fatalf("the keep-alive should not be lost yet")
+	}
+
+	if !s.expire(now.Add(s.timeout())) {
+		t.Fatalf("the keep-alive should be lost")
+	}
+
+	if s.interval != time.Millisecond*12500 || s.learned != 0 {
+		t.Errorf("expected a single loss to keep the interval but got %s", s.interval)
+	}
+
+	for i := 1; i < keepAliveLossThreshold; i++ {
+		s.sent(now)
+		s.expire(now.Add(s.timeout()))
+	}
+
+	if s.interval != time.Second*10 || s.learned != time.Second*10 {
+		t.Errorf("expected the interval to shrink to %s but got %s", time.Second*10, s.interval)
+	}
+
+	id = s.sent(now)
+	s.echoed(now, id)
+
+	if s.interval != time.Second*10 {
+		t.Errorf("expected the learned interval to be kept but got %s", s.interval)
+	}
+
+	if s.stats.Sent != 5 || s.stats.Echoed != 2 || s.stats.Lost != 3 {
+		t.Errorf("unexpected statistics: %#v", s.stats)
+	}
+
+	// The learned interval is eventually probed again.
+	for i := 1; i < keepAliveReprobeEchoes; i++ {
+		id = s.sent(now)
+		s.echoed(now, id)
+	}
+
+	if s.learned != 0 || s.interval != time.Millisecond*12500 {
+		t.Errorf("expected the learned interval to be forgotten but got %s", s.interval)
+	}
+}
+
+func TestKeepAliveConnection(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	config := &ClientConfig{
+		KeepAlive: KeepAliveConfig{Interval: time.Millisecond * 200},
+	}
+	clientConn, serverConn := connectTestClients(ctx, t, config, config)
+
+	for {
+		if stats := clientConn.KeepAliveStats(); stats.Echoed > 0 {
+			break
+		}
+
+		select {
+		case <-ctx.Done():
+			t.Fatalf("no keep-alive was echoed: %#v", clientConn.KeepAliveStats())
+		case <-time.After(time.Millisecond * 50):
+		}
+	}
+
+	if srtt, _ := clientConn.RTT(); srtt <= 0 {
+		t.Errorf("expected a RTT measurement")
+	}
+
+	// Data flowing suppresses keep-alives.
+	sent := serverConn.(*Conn).KeepAliveStats().Sent
+
+	for i := 0; i < 10; i++ {
+		serverConn.Write([]byte("data"))
+		time.Sleep(time.Millisecond * 50)
+	}
+
+	if stats := serverConn.(*Conn).KeepAliveStats(); stats.Sent > sent+1 {
+		t.Errorf("expected keep-alives to be suppressed: %d were sent", stats.Sent-sent)
+	}
+}
@@ -0,0 +1,170 @@
+package fscp
+
+import (
+	"errors"
+	"time"
+)
+
+// ErrPeerDead is the error used to close connections whose remote host
+// stopped responding.
+var ErrPeerDead = errors.New("remote host is not responding")
+
+// Aggressiveness defines how fast dead peers are detected.
+type Aggressiveness int
+
+const (
+	// LivenessDisabled disables dead peer detection. This is the default.
+	LivenessDisabled Aggressiveness = iota
+	// LivenessNormal detects dead peers in about 20 seconds.
+	LivenessNormal
+	// LivenessRelaxed detects dead peers in about 90 seconds.
+	LivenessRelaxed
+	// LivenessAggressive detects dead peers in about 5 seconds.
+	LivenessAggressive
+)
+
+type livenessPreset struct {
+	idleTimeout   time.Duration
+	probeInterval time.Duration
+	probes        int
+}
+
+// Legacy hosts neither send nor answer keep-alives, so they are never probed:
+// they would look dead as soon as they are idle.
+var livenessPresets = map[Aggressiveness]livenessPreset{
+	LivenessNormal:     {time.Second * 15, time.Second * 2, 3},
+	LivenessRelaxed:    {time.Second * 60, time.Second * 10, 3},
+	LivenessAggressive: {time.Second * 3, time.Millisecond * 500, 3},
+}
+
+// LivenessConfig contains the dead peer detection settings.
+//
+// Dead peer detection is opt-in, and only applies to the remote hosts that
+// answer keep-alives.
+type LivenessConfig struct {
+	// Aggressiveness selects a preset for the settings below.
+	Aggressiveness Aggressiveness
+
+	// IdleTimeout is the time without receiving anything from the remote host
+	// after which it gets probed.
+	IdleTimeout time.Duration
+
+	// ProbeInterval is the interval between two probes.
+	ProbeInterval time.Duration
+
+	// Probes is the number of unanswered probes after which the remote host is
+	// declared dead.
+	Probes int
+
+	// Rehandshake makes connections to dead peers try to establish a new
+	// session rather than being closed right away. Connections that fail to do
+	// so within IdleTimeout are closed.
+	Rehandshake bool
+
+	// OnDeadPeer, if set, is called whenever a dead peer is detected with the
+	// time elapsed since something was last received from it.
+	//
+	// It is called from the connection's goroutine and must not block.
+	OnDeadPeer func(conn *Conn, latency time.Duration)
+}
+
+func (c *LivenessConfig) enabled() bool {
+	return c.Aggressiveness != LivenessDisabled
+}
+
+func (c *LivenessConfig) idleTimeout() time.Duration {
+	if c.IdleTimeout <= 0 {
+		return livenessPresets[c.Aggressiveness].idleTimeout
+	}
+
+	return c.IdleTimeout
+}
+
+func (c *LivenessConfig) probeInterval() time.Duration {
+	if c.ProbeInterval <= 0 {
+		return livenessPresets[c.Aggressiveness].probeInterval
+	}
+
+	return c.ProbeInterval
+}
+
+func (c *LivenessConfig) probes() int {
+	if c.Probes <= 0 {
+		return livenessPresets[c.Aggressiveness].probes
+	}
+
+	return c.Probes
+}
+
+// LivenessStats contains the dead peer detection statistics of a connection.
+type LivenessStats struct {
+	// Probes is the number of probes that were sent.
+	Probes uint64
+
+	// DeadPeers is the number of times the remote host was declared dead.
+	DeadPeers uint64
+
+	// LastDetectionLatency is the time that elapsed between the last message
+	// received from the remote host and it being declared dead.
+	LastDetectionLatency time.Duration
+}
+
+// livenessState tracks the liveness of a remote host.
+//
+// It is not thread-safe.
+type livenessState struct {
+	config     *LivenessConfig
+	probesSent int
+	nextProbe  time.Time
+	stats      LivenessStats
+}
+
+func newLivenessState(config *LivenessConfig) *livenessState {
+	return &livenessState{
+		config: config,
+	}
+}
+
+// check tells whether the remote host must be probed or is dead.
+func (s *livenessState) check(now time.Time, lastReceived time.Time) (probe bool, dead bool) {
+	if !s.config.enabled() {
+		return false, false
+	}
+
+	if now.Sub(lastReceived) < s.config.idleTimeout() {
+		s.probesSent = 0
+		return false, false
+	}
+
+	if now.Before(s.nextProbe) {
+		return false, false
+	}
+
+	if s.probesSent >= s.config.probes() {
+		s.probesSent = 0
+		s.stats.DeadPeers++
+		s.stats.LastDetectionLatency = now.Sub(lastReceived)
+
+		return false, true
+	}
+
+	s.probesSent++
+	s.nextProbe = now.Add(s.config.probeInterval())
+	s.stats.Probes++
+
+	return true, false
+}
+
+// next returns the time to wait before the liveness must be checked again.
+func (s *livenessState) next(now time.Time, lastReceived time.Time) time.Duration {
+	if s.probesSent > 0 {
+		return s.nextProbe.Sub(now)
+	}
+
+	return lastReceived.Add(s.config.idleTimeout()).Sub(now)
+}
+
+// livenessEnabled tells whether the remote host is checked for liveness.
+func (c *Conn) livenessEnabled() bool {
+	return c.config.Liveness.enabled() && c.features().Has(FeatureKeepAliveEcho)
+}
@@ -0,0 +1,274 @@
+package fscp
+
+import (
+	"context"
+	"net"
+	"testing"
+	"time"
+)
+
+func TestLivenessState(t *testing.T) {
+	config := &LivenessConfig{
+		Aggressiveness: LivenessNormal,
+		IdleTimeout:    time.Second,
+		ProbeInterval:  time.Millisecond * 100,
+		Probes:         2,
+	}
+	s := newLivenessState(config)
+	lastReceived := time.Now()
+	now := lastReceived
+
+	if probe, dead := s.check(now, lastReceived); probe || dead {
+		t.Fatalf("expected no probe")
+	}
+
+	if d := s.next(now, lastReceived); d != time.Second {
+		t.Errorf("expected %s but got %s", time.Second, d)
+	}
+
+	now = now.Add(time.Second)
+
+	for i := 0; i < 2; i++ {
+		if probe, dead := s.check(now, lastReceived); !probe || dead {
+			t.Fatalf("expected probe %d", i)
+		}
+
+		if probe, _ := s.check(now, lastReceived); probe {
+			t.Fatalf("expected no probe before the interval elapsed")
+		}
+
+		now = now.Add(s.next(now, lastReceived))
+	}
+
+	if _, dead := s.check(now, lastReceived); !dead {
+		t.Fatalf("expected the peer to be dead")
+	}
+
+	if s.stats.LastDetectionLatency != time.Millisecond*1200 {
+		t.Errorf("expected a detection latency of %s but got %s", time.Millisecond*1200, s.stats.LastDetectionLatency)
+	}
+
+	// Receiving something resets the detection.
+	s.check(now, now.Add(-time.Second))
+
+	if probe, dead := s.check(now, now); probe || dead {
+		t.Fatalf("expected no probe")
+	}
+
+	if s.probesSent != 0 {
+		t.Errorf("expected probes to be reset")
+	}
+}
+
+func TestDeadPeerDetection(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	detected := make(chan time.Duration, 1)
+	config := &ClientConfig{
+		Liveness: LivenessConfig{
+			Aggressiveness: LivenessNormal,
+			IdleTimeout:    time.Millisecond * 300,
+			ProbeInterval:  time.Millisecond * 100,
+			Probes:         2,
+			OnDeadPeer: func(conn *Conn, latency time.Duration) {
+				detected <- latency
+			},
+		},
+	}
+	clientConn, serverConn := connectTestClients(ctx, t, config, &ClientConfig{})
+
+	// Closing the connection makes the server silent.
+	serverConn.Close()
+
+	select {
+	case latency := <-detected:
+		if latency < time.Millisecond*500 || latency > time.Second*2 {
+			t.Errorf("unexpected detection latency: %s", latency)
+		}
+	case <-ctx.Done():
+		t.Fatalf("dead peer was not detected")
+	}
+
+	select {
+	case <-clientConn.closed:
+	case <-ctx.Done():
+		t.Fatalf("connection was not closed")
+	}
+
+	if clientConn.closeError != ErrPeerDead {
+		t.Errorf("expected the connection to be closed with: %s", ErrPeerDead)
+	}
+
+	if stats := clientConn.LivenessStats(); stats.DeadPeers != 1 || stats.Probes != 2 {
+		t.Errorf("unexpected statistics: %#v", stats)
+	}
+}
+
+func TestDeadPeerRehandshake(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	config := &ClientConfig{
+		Liveness: LivenessConfig{
+			Aggressiveness: LivenessNormal,
+			IdleTimeout:    time.Millisecond * 300,
+			ProbeInterval:  time.Millisecond * 100,
+			Probes:         2,
+			Rehandshake:    true,
+		},
+	}
+	server := listenTestClient(t, &ClientConfig{})
+	client := listenTestClient(t, config)
+
+	go func() {
+		// The server first accepts the connection, and then its replacement.
+		for {
+			conn, err := server.Accept()
+
+			if err != nil {
+				return
+			}
+
+			go func() {
+				b := make([]byte, 16)
+				n, _ := conn.Read(b)
+				conn.Write(b[:n])
+				conn.Close()
+			}()
+		}
+	}()
+
+	clientConn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("client connecting to %s: %s", server.Addr(), err)
+	}
+
+	// The server closes its end once it echoed our message, and then the peer
+	// looks dead.
+	clientConn.Write([]byte("ping"))
+	clientConn.Read(make([]byte, 16))
+
+	for clientConn.LivenessStats().DeadPeers == 0 {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("dead peer was not detected")
+		case <-time.After(time.Millisecond * 50):
+		}
+	}
+
+	// A new session gets established with the server.
+	for {
+		clientConn.Write([]byte("pong"))
+
+		if clientConn.LivenessStats().DeadPeers > 1 {
+			t.Fatalf("the new session failed")
+		}
+
+		select {
+		case <-ctx.Done():
+			t.Fatalf("session was not re-established")
+		case <-clientConn.closed:
+			t.Fatalf("connection was closed: %s", clientConn.closeError)
+		case <-clientConn.incomingData:
+			return
+		case <-time.After(time.Millisecond * 50):
+		}
+	}
+}
+
+func TestDeadPeerRehandshakeCertificate(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	config := &ClientConfig{
+		Liveness: LivenessConfig{
+			Aggressiveness: LivenessNormal,
+			IdleTimeout:    time.Millisecond * 300,
+			ProbeInterval:  time.Millisecond * 100,
+			Probes:         2,
+			Rehandshake:    true,
+		},
+	}
+	socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	server, err := NewClient(socket, nil)
+
+	if err != nil {
+		socket.Close()
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	client := listenTestClient(t, config)
+	clientConn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		server.Close()
+		t.Fatalf("client connecting to %s: %s", server.Addr(), err)
+	}
+
+	hash, _ := clientConn.RemoteCertificateHash()
+	server.Close()
+
+	// Another host takes over the address of the dead one, with a different
+	// certificate: it must not get a session.
+	listenTestClientAt(t, socket.LocalAddr().(*net.UDPAddr), nil)
+
+	select {
+	case <-ctx.Done():
+		t.Fatalf("the connection was not closed")
+	case <-clientConn.closed:
+	}
+
+	if remoteHash, _ := clientConn.RemoteCertificateHash(); remoteHash != hash {
+		t.Errorf("expected the certificate of the remote host to stay pinned")
+	}
+
+	if stats := clientConn.LivenessStats(); stats.DeadPeers != 1 {
+		t.Errorf("unexpected statistics: %#v", stats)
+	}
+}
+
+func TestSilentPeer(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	// Dead peer detection is opt-in.
+	config := &ClientConfig{
+		Liveness: LivenessConfig{
+			IdleTimeout:   time.Millisecond * 300,
+			ProbeInterval: time.Millisecond * 100,
+			Probes:        2,
+		},
+	}
+	clientConn, serverConn := connectTestClients(ctx, t, config, &ClientConfig{})
+
+	// A legacy host never sends keep-alives.
+	serverConn.Close()
+
+	select {
+	case <-clientConn.closed:
+		t.Fatalf("expected the connection to survive but it was closed: %s", clientConn.closeError)
+	case <-time.After(time.Second):
+	}
+
+	// Hosts that do not answer keep-alives are not probed, even when asked
+	// to.
+	config.Liveness.Aggressiveness = LivenessAggressive
+	conn := &Conn{config: *config}
+
+	if conn.livenessEnabled() {
+		t.Errorf("expected no dead peer detection for a legacy host")
+	}
+
+	conn.remoteFeatures = conn.remoteFeatures.With(FeatureKeepAliveEcho)
+
+	if !conn.livenessEnabled() {
+		t.Errorf("expected dead peer detection")
+	}
+}
@@ -0,0 +1,661 @@
+package fscp
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"math"
+	"sort"
+	"sync"
+	"time"
+)
+
+const (
+	// DefaultMeshAdvertiseInterval is the default interval between two
+	// advertisements of the routing table to the neighbors.
+	DefaultMeshAdvertiseInterval = time.Second * 5
+
+	// DefaultMeshHysteresis is the default fraction by which a route must
+	// beat the current one to replace it.
+	DefaultMeshHysteresis = 0.2
+
+	// meshUnreachable is the cost of the destinations that cannot be
+	// reached. Costs are in microseconds.
+	meshUnreachable = math.MaxUint32
+
+	// meshMaxCost is the cost above which destinations are deemed
+	// unreachable, which bounds the counting to infinity.
+	meshMaxCost = uint32(time.Minute / time.Microsecond)
+
+	// meshMaxHops is the number of times a routed message may be relayed.
+	meshMaxHops = 16
+
+	// meshEntriesPerMessage is the maximum number of routes in a ROUTING
+	// message, which keeps it within the minimum IPv6 MTU.
+	meshEntriesPerMessage = 32
+)
+
+// ROUTING payloads start with their kind.
+//
+// Advertisements are followed by entries of a host identifier and a 32-bit
+// cost in microseconds. Routed data is followed by the remaining hop count,
+// the destination and source host identifiers, and a DATA message that the
+// source sealed with its session with the destination.
+const (
+	routingKindAdvertisement = 0x00
+	routingKindData          = 0x01
+
+	meshEntrySize      = 32 + 4
+	meshDataHeaderSize = 1 + 1 + 32 + 32
+)
+
+// ErrNoRoute is returned when a host of the mesh cannot be reached.
+var ErrNoRoute = errors.New("no route to host")
+
+// MeshConfig contains the settings of the routing between the peers of a
+// mesh.
+//
+// Peers advertise the cost of their routes to their neighbors, which is the
+// sum of the smoothed round-trip times of the links, inflated by their loss
+// rates, and every peer picks the cheapest next hop to each destination. When
+// a direct connection is degraded, its traffic goes through the best
+// intermediate peer instead.
+//
+// Costs are not authenticated beyond the neighbor that advertises them, so
+// detoured traffic stays sealed with the session between its ends: the peers
+// on the way can drop it, but neither read nor forge it.
+type MeshConfig struct {
+	// Enabled enables the exchange of routes with the peers that support it.
+	Enabled bool
+
+	// AdvertiseInterval is the interval between two advertisements of the
+	// routing table to every neighbor, which also measure the links.
+	AdvertiseInterval time.Duration
+
+	// RouteTimeout is the time after which the routes that a neighbor
+	// stopped advertising are forgotten. Defaults to three advertisement
+	// intervals.
+	RouteTimeout time.Duration
+
+	// Hysteresis is the fraction by which the cost of a route must be lower
+	// than the one of the current route for it to replace it. It avoids
+	// flapping between similar routes.
+	Hysteresis float64
+}
+
+func (c *MeshConfig) advertiseInterval() time.Duration {
+	if c.AdvertiseInterval <= 0 {
+		return DefaultMeshAdvertiseInterval
+	}
+
+	return c.AdvertiseInterval
+}
+
+func (c *MeshConfig) routeTimeout() time.Duration {
+	if c.RouteTimeout <= 0 {
+		return c.advertiseInterval() * 3
+	}
+
+	return c.RouteTimeout
+}
+
+func (c *MeshConfig) hysteresis() float64 {
+	if c.Hysteresis <= 0 {
+		return DefaultMeshHysteresis
+	}
+
+	return c.Hysteresis
+}
+
+// MeshRoute is a route to a host of the mesh.
+type MeshRoute struct {
+	// Destination is the host the route leads to.
+	Destination HostIdentifier
+
+	// NextHop is the neighbor the traffic to the destination goes through,
+	// which is the destination itself for direct routes.
+	NextHop HostIdentifier
+
+	// Cost is the cost of the route.
+	Cost time.Duration
+}
+
+// meshEntry is a route that a neighbor advertised.
+type meshEntry struct {
+	cost    uint32
+	expires time.Time
+}
+
+// meshNeighbor is a peer the client has a connection to.
+type meshNeighbor struct {
+	id      HostIdentifier
+	conn    *Conn
+	link    uint32
+	entries map[HostIdentifier]meshEntry
+}
+
+// meshRoute is the best known route to a destination.
+type meshRoute struct {
+	via         *meshNeighbor
+	cost        uint32
+	unreachable time.Time
+}
+
+// meshState is the routing table of a client.
+//
+// It is thread-safe.
+type meshState struct {
+	config    MeshConfig
+	self      HostIdentifier
+	lock      sync.Mutex
+	neighbors map[HostIdentifier]*meshNeighbor
+	routes    map[HostIdentifier]*meshRoute
+}
+
+func newMeshState(self HostIdentifier, config MeshConfig) *meshState {
+	return &meshState{
+		config:    config,
+		self:      self,
+		neighbors: map[HostIdentifier]*meshNeighbor{},
+		routes:    map[HostIdentifier]*meshRoute{},
+	}
+}
+
+// setLink registers a neighbor along with the cost of the link to it.
+func (s *meshState) setLink(id HostIdentifier, conn *Conn, cost uint32, now time.Time) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	affected := map[HostIdentifier]bool{id: true}
+
+	// A restarted remote host comes back with another identifier.
+	for otherID, n := range s.neighbors {
+		if n.conn == conn && otherID != id {
+			s.removeNeighbor(n, affected)
+		}
+	}
+
+	n, ok := s.neighbors[id]
+
+	if !ok {
+		n = &meshNeighbor{id: id, entries: map[HostIdentifier]meshEntry{}}
+		s.neighbors[id] = n
+	}
+
+	n.conn, n.link = conn, cost
+
+	for dest := range n.entries {
+		affected[dest] = true
+	}
+
+	s.expire(now, affected)
+	s.recompute(affected, now)
+}
+
+// update registers routes that a neighbor advertised.
+func (s *meshState) update(id HostIdentifier, entries map[HostIdentifier]uint32, now time.Time) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	n, ok := s.neighbors[id]
+
+	if !ok {
+		return
+	}
+
+	affected := map[HostIdentifier]bool{}
+	expires := now.Add(s.config.routeTimeout())
+
+	for dest, cost := range entries {
+		if dest == s.self {
+			continue
+		}
+
+		if previous, ok := n.entries[dest]; !ok || previous.cost != cost {
+			affected[dest] = true
+		}
+
+		n.entries[dest] = meshEntry{cost: cost, expires: expires}
+	}
+
+	s.expire(now, affected)
+	s.recompute(affected, now)
+}
+
+// remove unregisters the neighbor at the end of a connection.
+func (s *meshState) remove(conn *Conn, now time.Time) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	affected := map[HostIdentifier]bool{}
+
+	for _, n := range s.neighbors {
+		if n.conn == conn {
+			s.removeNeighbor(n, affected)
+		}
+	}
+
+	s.recompute(affected, now)
+}
+
+// removeNeighbor unregisters a neighbor and adds the destinations it
+// advertised to affected.
+//
+// The mutex *MUST* be held before calling this method.
+func (s *meshState) removeNeighbor(n *meshNeighbor, affected map[HostIdentifier]bool) {
+	delete(s.neighbors, n.id)
+	affected[n.id] = true
+
+	for dest := range n.entries {
+		affected[dest] = true
+	}
+}
+
+// expire forgets the routes that neighbors stopped advertising, and adds
+// their destinations to affected.
+//
+// The mutex *MUST* be held before calling this method.
+func (s *meshState) expire(now time.Time, affected map[HostIdentifier]bool) {
+	for _, n := range s.neighbors {
+		for dest, entry := range n.entries {
+			if !now.Before(entry.expires) {
+				delete(n.entries, dest)
+				affected[dest] = true
+			}
+		}
+	}
+
+	for dest, route := range s.routes {
+		if route.via == nil {
+			affected[dest] = true
+		}
+	}
+}
+
+// costVia returns the cost of the route to a destination through a neighbor.
+func (s *meshState) costVia(n *meshNeighbor, dest HostIdentifier) uint32 {
+	cost := uint64(meshUnreachable)
+
+	if dest == n.id {
+		cost = uint64(n.link)
+	} else if entry, ok := n.entries[dest]; ok && entry.cost < meshMaxCost {
+		cost = uint64(n.link) + uint64(entry.cost)
+	}
+
+	if cost >= uint64(meshMaxCost) {
+		return meshUnreachable
+	}
+
+	return uint32(cost)
+}
+
+// recompute updates the routes to the affected destinations only.
+//
+// The mutex *MUST* be held before calling this method.
+func (s *meshState) recompute(affected map[HostIdentifier]bool, now time.Time) {
+	for dest := range affected {
+		if dest == s.self {
+			continue
+		}
+
+		var best *meshNeighbor
+		bestCost := uint32(meshUnreachable)
+
+		for _, n := range s.neighbors {
+			if cost := s.costVia(n, dest); cost < bestCost {
+				best, bestCost = n, cost
+			}
+		}
+
+		route, ok := s.routes[dest]
+
+		if !ok {
+			route = &meshRoute{}
+			s.routes[dest] = route
+		}
+
+		// The current route stays unless the new one is significantly
+		// cheaper.
+		if route.via != nil && route.via != best && s.neighbors[route.via.id] == route.via {
+			if cost := s.costVia(route.via, dest); cost != meshUnreachable && float64(bestCost) >= float64(cost)*(1-s.config.hysteresis()) {
+				best, bestCost = route.via, cost
+			}
+		}
+
+		// Unreachable destinations are advertised for a while, so that the
+		// neighbors forget them quickly.
+		if best != nil {
+			route.unreachable = time.Time{}
+		} else if route.unreachable.IsZero() {
+			route.unreachable = now
+		} else if now.Sub(route.unreachable) >= s.config.routeTimeout() {
+			delete(s.routes, dest)
+			continue
+		}
+
+		route.via, route.cost = best, bestCost
+	}
+}
+
+// nextHop returns the connection to send the traffic to a destination
+// through, or nil if it cannot be reached.
+func (s *meshState) nextHop(dest HostIdentifier) *Conn {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	if route, ok := s.routes[dest]; ok && route.via != nil {
+		return route.via.conn
+	}
+
+	return nil
+}
+
+// neighbor returns the connection to a neighbor, or nil if there is none.
+func (s *meshState) neighbor(id HostIdentifier) *Conn {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	if n, ok := s.neighbors[id]; ok {
+		return n.conn
+	}
+
+	return nil
+}
+
+// advertisement returns the routes to advertise to a neighbor.
+//
+// The routes that go through the neighbor are advertised as unreachable, so
+// that it never routes back through us.
+func (s *meshState) advertisement(to HostIdentifier) map[HostIdentifier]uint32 {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	entries := make(map[HostIdentifier]uint32, len(s.routes))
+
+	for dest, route := range s.routes {
+		if dest == to {
+			continue
+		}
+
+		if route.via == nil || route.via.id == to {
+			entries[dest] = meshUnreachable
+		} else {
+			entries[dest] = route.cost
+		}
+	}
+
+	return entries
+}
+
+// snapshot returns the routes to the reachable destinations.
+func (s *meshState) snapshot() []MeshRoute {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	routes := make([]MeshRoute, 0, len(s.routes))
+
+	for dest, route := range s.routes {
+		if route.via != nil {
+			routes = append(routes, MeshRoute{
+				Destination: dest,
+				NextHop:     route.via.id,
+				Cost:        time.Duration(route.cost) * time.Microsecond,
+			})
+		}
+	}
+
+	sort.Slice(routes, func(i, j int) bool { return routes[i].Cost < routes[j].Cost })
+
+	return routes
+}
+
+// serializeAdvertisements serializes the payloads of the ROUTING messages
+// that advertise routes.
+func serializeAdvertisements(entries map[HostIdentifier]uint32) [][]byte {
+	var payloads [][]byte
+	var b []byte
+
+	for dest, cost := range entries {
+		if b == nil {
+			b = make([]byte, 1, 1+meshEntriesPerMessage*meshEntrySize+16)
+			b[0] = routingKindAdvertisement
+		}
+
+		b = append(b, dest[:]...)
+		b = append(b, 0, 0, 0, 0)
+		binary.BigEndian.PutUint32(b[len(b)-4:], cost)
+
+		if len(b) == 1+meshEntriesPerMessage*meshEntrySize {
+			payloads, b = append(payloads, b), nil
+		}
+	}
+
+	if b != nil {
+		payloads = append(payloads, b)
+	}
+
+	return payloads
+}
+
+func parseAdvertisement(b []byte) (map[HostIdentifier]uint32, error) {
+	if len(b)%meshEntrySize != 0 {
+		return nil, fmt.Errorf("advertisement should be a multiple of %d bytes long but is %d", meshEntrySize, len(b))
+	}
+
+	entries := make(map[HostIdentifier]uint32, len(b)/meshEntrySize)
+
+	for ; len(b) > 0; b = b[meshEntrySize:] {
+		var dest HostIdentifier
+		copy(dest[:], b)
+		entries[dest] = binary.BigEndian.Uint32(b[32:])
+	}
+
+	return entries, nil
+}
+
+// makeRoutedData makes the payload of a ROUTING message that carries a sealed
+// DATA message to another host of the mesh, with room for the GCM tag.
+func makeRoutedData(dest HostIdentifier, src HostIdentifier, message []byte) []byte {
+	b := make([]byte, meshDataHeaderSize, meshDataHeaderSize+len(message)+16)
+	b[0] = routingKindData
+	b[1] = meshMaxHops
+	copy(b[2:], dest[:])
+	copy(b[34:], src[:])
+
+	return append(b, message...)
+}
+
+// HostIdentifier returns the identifier of the client, which designates it in
+// the mesh.
+func (c *Client) HostIdentifier() HostIdentifier {
+	return c.hostIdentifier
+}
+
+// Routes returns the routes to the reachable hosts of the mesh, cheapest
+// first.
+func (c *Client) Routes() []MeshRoute {
+	return c.mesh.snapshot()
+}
+
+// SendTo sends data to a host of the mesh, through the best route.
+//
+// The data is sealed with the session with the host, which the client must
+// have a connection to.
+func (c *Client) SendTo(dest HostIdentifier, channel uint8, b []byte) error {
+	if !c.mesh.config.Enabled {
+		return errors.New("mesh routing is disabled")
+	}
+
+	conn := c.mesh.neighbor(dest)
+
+	if conn == nil {
+		return ErrNoRoute
+	}
+
+	// Implementations must not retain b.
+	data := make([]byte, len(b))
+	copy(data, b)
+
+	return conn.do(func() {
+		if conn.session == nil {
+			return
+		}
+
+		if err := conn.sendData(channel, data); err != nil {
+			conn.closeWithError(err)
+		}
+	})
+}
+
+// meshEnabled tells whether the connection exchanges routes.
+func (c *Conn) meshEnabled() bool {
+	return c.config.Mesh.Enabled && c.session != nil && c.features().Has(FeatureMesh)
+}
+
+// linkCost returns the cost of the link to the remote host.
+func (c *Conn) linkCost() uint32 {
+	rtt := &c.keepAlive.rtt
+
+	if !rtt.valid() {
+		rtt = &c.handshakeRTT
+	}
+
+	if !rtt.valid() {
+		return meshUnreachable
+	}
+
+	cost := float64(rtt.srtt/time.Microsecond) * (1 + pathLossPenalty*c.meshLoss)
+
+	if cost >= float64(meshMaxCost) {
+		return meshUnreachable
+	}
+
+	return uint32(cost)
+}
+
+// advertiseRoutes measures the link to the remote host and sends it the
+// routing table.
+func (c *Conn) advertiseRoutes(now time.Time) error {
+	stats := c.keepAlive.stats
+
+	if echoed, lost := stats.Echoed-c.meshEchoed, stats.Lost-c.meshLost; echoed+lost > 0 {
+		c.meshLoss = (7*c.meshLoss + float64(lost)/float64(echoed+lost)) / 8
+	}
+
+	c.meshEchoed, c.meshLost = stats.Echoed, stats.Lost
+
+	id := c.session.RemoteHostIdentifier
+	c.client.mesh.setLink(id, c, c.linkCost(), now)
+
+	for _, payload := range serializeAdvertisements(c.client.mesh.advertisement(id)) {
+		if err := c.sendEncrypted(MessageTypeRouting, 0, payload); err != nil {
+			return err
+		}
+	}
+
+	// Links are measured even when traffic delays keep-alives.
+	if c.features().Has(FeatureKeepAliveEcho) && c.keepAlive.probeSentAt.IsZero() {
+		if err := c.sendKeepAlive(now); err != nil {
+			return err
+		}
+	}
+
+	c.meshNextAdvertise = now.Add(c.config.Mesh.advertiseInterval())
+
+	return nil
+}
+
+// meshDetour returns the connection that the traffic to the remote host goes
+// through instead, if the direct link is degraded.
+//
+// Detoured traffic *MUST* be sealed with the session of the connection.
+func (c *Conn) meshDetour() *Conn {
+	if !c.meshEnabled() {
+		return nil
+	}
+
+	if hop := c.client.mesh.nextHop(c.session.RemoteHostIdentifier); hop != nil && hop != c {
+		return hop
+	}
+
+	return nil
+}
+
+// handleRouting handles a ROUTING message.
+func (c *Conn) handleRouting(payload []byte) error {
+	if !c.meshEnabled() || len(payload) == 0 {
+		return nil
+	}
+
+	switch payload[0] {
+	case routingKindAdvertisement:
+		entries, err := parseAdvertisement(payload[1:])
+
+		if err != nil {
+			c.warning(fmt.Errorf("invalid route advertisement: %s", err))
+			return nil
+		}
+
+		c.client.mesh.update(c.session.RemoteHostIdentifier, entries, time.Now())
+
+	case routingKindData:
+		if len(payload) < meshDataHeaderSize {
+			c.warning(fmt.Errorf("invalid routed data of %d byte(s)", len(payload)))
+			return nil
+		}
+
+		c.forwardRouted(payload)
+	}
+
+	return nil
+}
+
+// forwardRouted delivers routed data, or relays it to the next hop.
+func (c *Conn) forwardRouted(payload []byte) {
+	var dest, src HostIdentifier
+	copy(dest[:], payload[2:])
+	copy(src[:], payload[34:])
+
+	if dest == c.client.hostIdentifier {
+		// The source identifier is only a hint: the message must still be
+		// opened by the session with the source.
+		if conn := c.client.mesh.neighbor(src); conn != nil {
+			conn.receiveRouted(payload[meshDataHeaderSize:])
+		}
+
+		return
+	}
+
+	if payload[1] == 0 {
+		c.warning(fmt.Errorf("dropping routed data to %s as it was relayed too many times", dest))
+		return
+	}
+
+	payload[1]--
+
+	if hop := c.client.mesh.nextHop(dest); hop != nil && hop != c {
+		hop.relayRouting(payload)
+	}
+}
+
+// receiveRouted handles a DATA message that another connection received, as
+// if it came from the remote host directly.
+func (c *Conn) receiveRouted(b []byte) {
+	messageType, message, err := readMessage(bytes.NewReader(b))
+
+	if err != nil {
+		c.warning(fmt.Errorf("invalid routed message: %s", err))
+		return
+	}
+
+	if _, ok := message.(*messageData); !ok || messageType&0xf0 != MessageTypeData {
+		c.warning(fmt.Errorf("dropping routed %s message", messageType))
+		return
+	}
+
+	select {
+	case c.incoming <- messageFrame{messageType: messageType, message: message}:
+	default:
+	}
+}
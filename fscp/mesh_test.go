@@ -0,0 +1,209 @@
+package fscp
+
+import (
+	"bytes"
+	"context"
+	"net"
+	"testing"
+	"time"
+)
+
+func TestMeshRouting(t *testing.T) {
+	a, b, c := HostIdentifier{1}, HostIdentifier{2}, HostIdentifier{3}
+	connB, connC := &Conn{}, &Conn{}
+
+	state := newMeshState(a, MeshConfig{})
+	now := time.Now()
+
+	state.setLink(b, connB, 10000, now)
+	state.setLink(c, connC, 100000, now)
+
+	if hop := state.nextHop(c); hop != connC {
+		t.Errorf("expected a direct route")
+	}
+
+	// The direct link is much slower than the one through b.
+	state.update(b, map[HostIdentifier]uint32{c: 10000, a: 10000}, now)
+
+	if hop := state.nextHop(c); hop != connB {
+		t.Errorf("expected a route through b")
+	}
+
+	if routes := state.snapshot(); len(routes) != 2 || routes[1].Destination != c || routes[1].NextHop != b || routes[1].Cost != time.Millisecond*20 {
+		t.Errorf("unexpected routes: %v", routes)
+	}
+
+	// Routes through a neighbor are not advertised back to it.
+	if cost := state.advertisement(b)[c]; cost != meshUnreachable {
+		t.Errorf("expected the route to be poisoned but got %d", cost)
+	}
+
+	if cost := state.advertisement(c)[b]; cost != 10000 {
+		t.Errorf("expected a cost of 10000 but got %d", cost)
+	}
+
+	// Slightly better routes don't replace the current one.
+	state.setLink(b, connB, 95000, now)
+
+	if hop := state.nextHop(c); hop != connB {
+		t.Errorf("expected the route through b to stay")
+	}
+
+	state.setLink(b, connB, 200000, now)
+
+	if hop := state.nextHop(c); hop != connC {
+		t.Errorf("expected a direct route")
+	}
+
+	state.setLink(b, connB, 10000, now)
+	state.setLink(b, connB, 10000, now.Add(time.Second*5))
+
+	if hop := state.nextHop(c); hop != connB {
+		t.Errorf("expected a route through b")
+	}
+
+	// Routes that are no longer advertised expire.
+	state.setLink(b, connB, 10000, now.Add(DefaultMeshAdvertiseInterval*3))
+
+	if hop := state.nextHop(c); hop != connC {
+		t.Errorf("expected a direct route")
+	}
+
+	state.remove(connC, now)
+
+	if hop := state.nextHop(c); hop != nil {
+		t.Errorf("expected no route")
+	}
+
+	if routes := state.snapshot(); len(routes) != 1 || routes[0].Destination != b {
+		t.Errorf("unexpected routes: %v", routes)
+	}
+}
+
+// slowLinkPacketConn delays the datagrams it sends to an address, which
+// simulates a degraded link.
+type slowLinkPacketConn struct {
+	net.PacketConn
+	addr  string
+	delay time.Duration
+}
+
+func (c *slowLinkPacketConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	if addr.String() != c.addr {
+		return c.PacketConn.WriteTo(b, addr)
+	}
+
+	b = append([]byte{}, b...)
+	time.AfterFunc(c.delay, func() { c.PacketConn.WriteTo(b, addr) })
+
+	return len(b), nil
+}
+
+func TestMeshDetour(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	config := &ClientConfig{
+		Mesh: MeshConfig{
+			Enabled:           true,
+			AdvertiseInterval: time.Millisecond * 50,
+		},
+	}
+
+	b := listenTestClient(t, config)
+	c := listenTestClient(t, config)
+
+	// The link from a to c is degraded.
+	socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	a, err := NewClientWithConfig(&slowLinkPacketConn{PacketConn: socket, addr: c.Addr().String(), delay: time.Millisecond * 100}, nil, config)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer a.Close()
+
+	connect := func(from *Client, to *Client) *Conn {
+		conn, err := from.Connect(ctx, to.Addr().(*Addr))
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		return conn
+	}
+
+	connect(a, b)
+	connect(b, c)
+	conn := connect(a, c)
+
+	// nextHop returns the next hop of the route of a client to another one.
+	nextHop := func(from *Client, to *Client) (nextHop HostIdentifier) {
+		for _, route := range from.Routes() {
+			if route.Destination == to.HostIdentifier() {
+				nextHop = route.NextHop
+			}
+		}
+
+		return
+	}
+
+	// Routed data is only read from connections that are established at
+	// both ends.
+	for nextHop(a, c) != b.HostIdentifier() || c.mesh.neighbor(a.HostIdentifier()) == nil {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected the traffic to c to go through b: %v", a.Routes())
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+
+	// Hosts on the way cannot inject data on behalf of the source.
+	forged := &bytes.Buffer{}
+	err = writeMessage(forged, MessageTypeData, &messageData{
+		SequenceNumber: 1 << 20,
+		GCMTag:         make([]byte, 16),
+		Ciphertext:     []byte("forged"),
+	})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	c.mesh.neighbor(b.HostIdentifier()).forwardRouted(makeRoutedData(c.HostIdentifier(), a.HostIdentifier(), forged.Bytes()))
+
+	if _, err := conn.Write([]byte("detour")); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	// The data is read from the connection to a, whatever its route.
+	for {
+		remoteConn, err := c.Accept()
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if remoteConn.RemoteAddr().String() != a.Addr().String() {
+			continue
+		}
+
+		buf := make([]byte, 16)
+		n, err := remoteConn.Read(buf)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if string(buf[:n]) != "detour" {
+			t.Errorf("expected `detour` but got `%s`", buf[:n])
+		}
+
+		break
+	}
+}
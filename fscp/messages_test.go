@@ -66,6 +66,7 @@ func makePEMPublicKey(key *ecdsa.PublicKey) []byte {
 
 var SomePublicKey = makeECDSAPublicKey()
 var SomePEMPublicKey = makePEMPublicKey(SomePublicKey)
+var SomeCompactPublicKey = elliptic.Marshal(SomePublicKey.Curve, SomePublicKey.X, SomePublicKey.Y)
 
 func TestSerialization(t *testing.T) {
 	type msgImpl interface {
@@ -205,6 +206,63 @@ func TestSerialization(t *testing.T) {
 			),
 			ExpectedString: "SESSION [sid:22446688,hid:0102030400000000000000000000000000000000000000000000000000000000,cipher:ECDHERSAAES128GCMSHA256,curve:SECP384R1]",
 		},
+		{
+			Message: &messageSession{
+				SessionNumber:    0x22446688,
+				HostIdentifier:   SomeHostIdentifier,
+				CipherSuite:      ECDHERSAAES128GCMSHA256,
+				EllipticCurve:    SECP384R1,
+				PublicKey:        SomePublicKey,
+				Signature:        []byte{0xaa, 0xbb},
+				CompactPublicKey: true,
+			},
+			MessageType: MessageTypeSession,
+			Expected: bytes.Join([][]byte{
+				{0x03, 0x04, 0x00, 0x8f},
+				{0x22, 0x44, 0x66, 0x88},
+				SomeHostIdentifier[:],
+				{0x01, 0x02, 0x00, 0x00},
+				{0x00, byte(len(SomeCompactPublicKey))},
+				SomeCompactPublicKey,
+				{0x00, 0x02, 0xaa, 0xbb},
+			}, nil),
+			ExpectedString: "SESSION [sid:22446688,hid:0102030400000000000000000000000000000000000000000000000000000000,cipher:ECDHERSAAES128GCMSHA256,curve:SECP384R1]",
+		},
+		{
+			Message: &messageResume{
+				TicketID:       TicketID{0x01},
+				HostIdentifier: SomeHostIdentifier,
+				SessionNumber:  0x22446688,
+				Status:         ResumeRejected,
+			},
+			MessageType: MessageTypeResume,
+			Expected: bytes.Join([][]byte{
+				{0x03, 0x06, 0x00, 0x75},
+				append([]byte{0x01}, make([]byte, 15)...),
+				SomeHostIdentifier[:],
+				{0x22, 0x44, 0x66, 0x88},
+				make([]byte, 32),
+				{0x01},
+				make([]byte, 32),
+			}, nil),
+			ExpectedString: "RESUME [ticket:01000000000000000000000000000000,hid:0102030400000000000000000000000000000000000000000000000000000000,sid:22446688,status:1]",
+		},
+		{
+			Message: &messageFragment{
+				MessageID: 0x12345678,
+				Index:     1,
+				Count:     3,
+				Data:      []byte{0xaa, 0xbb},
+			},
+			MessageType: MessageTypeFragment,
+			Expected: []byte{
+				0x03, 0x07, 0x00, 0x08,
+				0x12, 0x34, 0x56, 0x78,
+				0x01, 0x03,
+				0xaa, 0xbb,
+			},
+			ExpectedString: "FRAGMENT [id:12345678,index:1/3,len:2]",
+		},
 		{
 			Message: &messageData{
 				Channel:        0x02,
@@ -274,3 +332,41 @@ func TestSerialization(t *testing.T) {
 		})
 	}
 }
+
+func BenchmarkSessionSerialization(b *testing.B) {
+	for _, compact := range []bool{false, true} {
+		msg := &messageSession{
+			SessionNumber:    0x22446688,
+			HostIdentifier:   SomeHostIdentifier,
+			CipherSuite:      ECDHERSAAES128GCMSHA256,
+			EllipticCurve:    SECP384R1,
+			PublicKey:        SomePublicKey,
+			Signature:        make([]byte, 256),
+			CompactPublicKey: compact,
+		}
+
+		buf := &bytes.Buffer{}
+		writeMessage(buf, MessageTypeSession, msg)
+		data := buf.Bytes()
+
+		b.Run(fmt.Sprintf("compact=%t/write", compact), func(b *testing.B) {
+			b.ReportAllocs()
+
+			for i := 0; i < b.N; i++ {
+				buf.Reset()
+				writeMessage(buf, MessageTypeSession, msg)
+			}
+		})
+
+		b.Run(fmt.Sprintf("compact=%t/read", compact), func(b *testing.B) {
+			b.ReportAllocs()
+			b.SetBytes(int64(len(data)))
+
+			for i := 0; i < b.N; i++ {
+				if _, _, err := readMessage(bytes.NewReader(data)); err != nil {
+					b.Fatalf("expected no error: %s", err)
+				}
+			}
+		})
+	}
+}
@@ -0,0 +1,235 @@
+package fscp
+
+import (
+	"bytes"
+	"errors"
+	"hash/fnv"
+	"net"
+	"sync/atomic"
+)
+
+// MultiFlowConfig contains the settings of the spreading of DATA messages
+// over several source ports.
+//
+// A single UDP flow between two hosts gets pinned to one NIC queue, one ECMP
+// route and one CPU core on its way. Spreading the tunnel over several flows
+// lifts that limit.
+type MultiFlowConfig struct {
+	// Flows is the number of source ports DATA messages are spread over,
+	// including the one of the client's socket. The other sockets are bound
+	// to the same address. Values below 2 disable spreading.
+	//
+	// Spreading only happens with remote hosts that support it.
+	Flows int
+}
+
+func (c *MultiFlowConfig) enabled() bool {
+	return c.Flows > 1
+}
+
+// openFlowSockets opens the additional sockets of a client that spreads its
+// DATA messages over several source ports.
+func openFlowSockets(conn net.PacketConn, count int) ([]net.PacketConn, error) {
+	laddr, ok := conn.LocalAddr().(*net.UDPAddr)
+
+	if !ok {
+		return nil, errors.New("spreading over several flows requires a UDP socket")
+	}
+
+	flows := make([]net.PacketConn, 0, count)
+
+	for i := 0; i < count; i++ {
+		flow, err := net.ListenUDP("udp", &net.UDPAddr{IP: laddr.IP, Zone: laddr.Zone})
+
+		if err != nil {
+			for _, flow := range flows {
+				flow.Close()
+			}
+
+			return nil, err
+		}
+
+		flows = append(flows, flow)
+	}
+
+	return flows, nil
+}
+
+// flowHash hashes the addresses, protocol and ports of an IP packet so that
+// all the packets of an inner flow go through the same source port and stay
+// in order.
+//
+// Payloads that are not IP packets hash to zero.
+func flowHash(b []byte) uint32 {
+	var addrs []byte
+	var protocol byte
+	var transport []byte
+
+	switch {
+	case len(b) >= 20 && b[0]>>4 == 4:
+		headerSize := int(b[0]&0x0f) * 4
+		addrs, protocol = b[12:20], b[9]
+
+		// Only the first fragment has the transport header.
+		if fragmentOffset := (uint16(b[6])<<8 | uint16(b[7])) & 0x1fff; fragmentOffset == 0 && headerSize >= 20 && len(b) >= headerSize {
+			transport = b[headerSize:]
+		}
+	case len(b) >= 40 && b[0]>>4 == 6:
+		addrs, protocol, transport = b[8:40], b[6], b[40:]
+	default:
+		return 0
+	}
+
+	h := fnv.New32a()
+	h.Write(addrs)
+	h.Write([]byte{protocol})
+
+	switch protocol {
+	case 6, 17, 132:
+		// TCP, UDP and SCTP start with the ports.
+		if len(transport) >= 4 {
+			h.Write(transport[:4])
+		}
+	}
+
+	return h.Sum32()
+}
+
+// flow returns the socket to send a DATA message with the specified payload
+// through, or nil for the client's socket.
+func (c *Conn) flow(cleartext []byte) net.PacketConn {
+	if len(c.flows) == 0 || !c.features().Has(FeatureMultiFlow) {
+		return nil
+	}
+
+	i := flowHash(cleartext) % uint32(len(c.flows)+1)
+
+	if i == 0 {
+		return nil
+	}
+
+	return c.flows[i-1]
+}
+
+// announceFlows sends a flow announcement through every additional flow
+// socket, so that the remote host knows their ports belong to the session,
+// rather than thinking it moved.
+func (c *Conn) announceFlows() {
+	if len(c.flows) == 0 || !c.features().Has(FeatureMultiFlow) {
+		return
+	}
+
+	remoteAddr := c.RemoteAddr().(*Addr)
+
+	for _, flow := range c.flows {
+		buf := &bytes.Buffer{}
+
+		if err := writeMessage(buf, MessageTypeKeepAlive, c.session.Encrypt(makeKeepAlivePayload(keepAliveKindFlow, 0))); err != nil {
+			c.warning(err)
+			return
+		}
+
+		if _, err := flow.WriteTo(buf.Bytes(), remoteAddr.TransportAddr); err != nil {
+			c.warning(err)
+		}
+	}
+}
+
+// isFlowAnnouncement tells whether a decrypted message announces another port
+// of the remote host.
+func isFlowAnnouncement(messageType MessageType, data []byte) bool {
+	kind, _, ok := parseKeepAlivePayload(data)
+
+	return messageType == MessageTypeKeepAlive && ok && kind == keepAliveKindFlow
+}
+
+// getSiblingConn returns the connection to the host at the specified address,
+// on another port, if that host announced that it spreads its messages over
+// several ports and is the only one at that address.
+func (c *Client) getSiblingConn(remoteAddr *Addr) *Conn {
+	key, ok := hostKey(remoteAddr)
+
+	if !ok {
+		return nil
+	}
+
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if conns := c.connsByHost[key]; len(conns) == 1 {
+		return conns[0]
+	}
+
+	return nil
+}
+
+// setMultiFlow marks a connection as one whose remote host spreads its
+// messages over several ports.
+func (c *Client) setMultiFlow(conn *Conn) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if atomic.SwapInt32(&conn.multiFlow, 1) == 0 {
+		c.addMultiFlowConn(conn)
+	}
+}
+
+// addMultiFlowConn indexes a connection whose remote host spreads its messages
+// over several ports by the address of that host.
+//
+// The mutex *MUST* be held before calling this method.
+func (c *Client) addMultiFlowConn(conn *Conn) {
+	if key, ok := hostKey(conn.RemoteAddr().(*Addr)); ok {
+		c.connsByHost[key] = append(c.connsByHost[key], conn)
+	}
+}
+
+// removeMultiFlowConn unindexes a connection whose remote host spreads its
+// messages over several ports.
+//
+// The mutex *MUST* be held before calling this method.
+func (c *Client) removeMultiFlowConn(conn *Conn) {
+	key, ok := hostKey(conn.RemoteAddr().(*Addr))
+
+	if !ok {
+		return
+	}
+
+	conns := c.connsByHost[key][:0]
+
+	for _, other := range c.connsByHost[key] {
+		if other != conn {
+			conns = append(conns, other)
+		}
+	}
+
+	if len(conns) == 0 {
+		delete(c.connsByHost, key)
+	} else {
+		c.connsByHost[key] = conns
+	}
+}
+
+// hostKey returns the address of a host regardless of its port.
+func hostKey(addr *Addr) (string, bool) {
+	udpAddr, ok := addr.TransportAddr.(*net.UDPAddr)
+
+	if !ok {
+		return "", false
+	}
+
+	return (&net.IPAddr{IP: udpAddr.IP, Zone: udpAddr.Zone}).String(), true
+}
+
+// sameHost tells whether two addresses only differ by their ports.
+func sameHost(a, b *Addr) bool {
+	ua, ok := a.TransportAddr.(*net.UDPAddr)
+
+	if !ok {
+		return false
+	}
+
+	ub, ok := b.TransportAddr.(*net.UDPAddr)
+
+	return ok && ua.IP.Equal(ub.IP) && ua.Zone == ub.Zone
+}
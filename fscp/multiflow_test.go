@@ -0,0 +1,201 @@
+package fscp
+
+import (
+	"context"
+	"net"
+	"sync"
+	"testing"
+	"time"
+)
+
+// makeUDPPacket makes an IPv4 UDP packet with the specified source port and
+// payload.
+func makeUDPPacket(sourcePort uint16, payload ...byte) []byte {
+	b := make([]byte, 28, 28+len(payload))
+	b[0], b[9] = 0x45, 17
+	copy(b[12:], []byte{10, 0, 0, 1, 10, 0, 0, 2})
+	b[20], b[21] = byte(sourcePort>>8), byte(sourcePort)
+	b[22], b[23] = 0x12, 0x34
+
+	return append(b, payload...)
+}
+
+func TestFlowHash(t *testing.T) {
+	if flowHash(makeUDPPacket(1000, 1)) != flowHash(makeUDPPacket(1000, 2, 3)) {
+		t.Errorf("expected the packets of a flow to hash the same")
+	}
+
+	if flowHash(makeUDPPacket(1000)) == flowHash(makeUDPPacket(1001)) {
+		t.Errorf("expected the packets of different flows to hash differently")
+	}
+
+	if h := flowHash([]byte("not an IP packet")); h != 0 {
+		t.Errorf("expected zero but got %d", h)
+	}
+}
+
+// sourceRecorder records the addresses datagrams come from.
+type sourceRecorder struct {
+	net.PacketConn
+	lock    sync.Mutex
+	sources map[string]bool
+}
+
+func (c *sourceRecorder) ReadFrom(b []byte) (int, net.Addr, error) {
+	n, addr, err := c.PacketConn.ReadFrom(b)
+
+	if err == nil {
+		c.lock.Lock()
+		c.sources[addr.String()] = true
+		c.lock.Unlock()
+	}
+
+	return n, addr, err
+}
+
+func TestMultiFlow(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	recorder := &sourceRecorder{PacketConn: socket, sources: map[string]bool{}}
+	server, err := NewClient(recorder, nil)
+
+	if err != nil {
+		socket.Close()
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer server.Close()
+
+	client := listenTestClient(t, &ClientConfig{MultiFlow: MultiFlowConfig{Flows: 4}})
+	conn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	serverConn, err := server.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	// The flows are announced right after the handshake.
+	for aliases := 0; aliases != 3; {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected the flows to be announced")
+		case <-time.After(time.Millisecond * 10):
+		}
+
+		server.lock.Lock()
+		aliases = len(server.connsBySource)
+		server.lock.Unlock()
+	}
+
+	const flows = 8
+	const count = 10
+
+	for i := 0; i < count; i++ {
+		for flow := 0; flow < flows; flow++ {
+			if _, err := conn.Write(makeUDPPacket(uint16(1000+flow), byte(flow), byte(i))); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+		}
+	}
+
+	var next [flows]byte
+
+	for received := 0; received < flows*count; received++ {
+		b := make([]byte, 64)
+		n, err := serverConn.Read(b)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		flow, i := b[n-2], b[n-1]
+
+		if i != next[flow] {
+			t.Fatalf("expected packet %d of flow %d but got %d", next[flow], flow, i)
+		}
+
+		next[flow]++
+	}
+
+	recorder.lock.Lock()
+	sources := len(recorder.sources)
+	recorder.lock.Unlock()
+
+	if sources < 2 {
+		t.Errorf("expected DATA messages to come from several ports but got %d", sources)
+	}
+
+	if addr := serverConn.RemoteAddr().String(); addr != client.Addr().String() {
+		t.Errorf("expected the connection to stay on %s but it moved to %s", client.Addr(), addr)
+	}
+
+	if n := countConns(server); n != 1 {
+		t.Errorf("expected a single connection but got %d", n)
+	}
+
+	// Another host at the same address that moves to another port is not
+	// mistaken for the spreading one.
+	other, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	transport := &switchablePacketConn{conn: other}
+	otherClient, err := NewClient(transport, nil)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer otherClient.Close()
+
+	otherConn, err := otherClient.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	otherServerConn, err := server.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	transport.switchSocket(t)
+
+	if _, err := otherConn.Write([]byte("moved")); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	b := make([]byte, 16)
+	n, err := otherServerConn.Read(b)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if string(b[:n]) != "moved" {
+		t.Errorf("expected `moved` but got `%s`", b[:n])
+	}
+
+	if addr := otherServerConn.RemoteAddr().String(); addr != transport.LocalAddr().String() {
+		t.Errorf("expected the connection to move to %s but it is on %s", transport.LocalAddr(), addr)
+	}
+
+	if addr := serverConn.RemoteAddr().String(); addr != client.Addr().String() {
+		t.Errorf("expected the connection to stay on %s but it moved to %s", client.Addr(), addr)
+	}
+}
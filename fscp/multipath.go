@@ -0,0 +1,255 @@
+package fscp
+
+import (
+	"io"
+	"net"
+)
+
+// MultipathScheduler selects the paths DATA messages are sent over, when a
+// client has several uplinks.
+type MultipathScheduler int
+
+const (
+	// WeightedRoundRobin spreads DATA messages over the paths in proportion
+	// to the weights of their uplinks.
+	WeightedRoundRobin MultipathScheduler = iota
+
+	// LowestLatency sends DATA messages over the path with the lowest
+	// round-trip time and loss rate.
+	LowestLatency
+)
+
+// pathDownLoss is the loss rate above which a path no longer carries DATA
+// messages, unless all of them are that lossy.
+const pathDownLoss = 0.5
+
+// MultipathConfig contains the settings of the connections of a client that
+// has several uplinks.
+//
+// Every uplink is probed like a candidate endpoint, so the remote hosts must
+// support keep-alive echoes for the measurements to happen.
+type MultipathConfig struct {
+	// Scheduler selects the paths DATA messages are sent over.
+	Scheduler MultipathScheduler
+
+	// Weight is the weight of the client's socket. Uplinks get theirs when
+	// they are added. Defaults to 1.
+	Weight int
+
+	// Redundant, if set, tells which outgoing data is critical enough to be
+	// sent over all the paths at once. The remote host discards the
+	// duplicates.
+	Redundant func(b []byte) bool
+}
+
+func (c *MultipathConfig) weight() int {
+	if c.Weight <= 0 {
+		return 1
+	}
+
+	return c.Weight
+}
+
+func (c *MultipathConfig) redundant(b []byte) bool {
+	return c.Redundant != nil && c.Redundant(b)
+}
+
+// uplink is an additional socket of a client.
+type uplink struct {
+	conn   net.PacketConn
+	weight int
+}
+
+// localAddr returns the local address of an uplink, which is nil for the
+// client's socket.
+func (u *uplink) localAddr() net.Addr {
+	if u == nil {
+		return nil
+	}
+
+	return u.conn.LocalAddr()
+}
+
+// AddUplink adds a socket, typically bound to another local interface, that
+// the connections of the client send DATA messages through along with the
+// client's own socket.
+//
+// The client reads from the socket and closes it when it is closed.
+func (c *Client) AddUplink(conn net.PacketConn, weight int) error {
+	if weight <= 0 {
+		weight = 1
+	}
+
+	c.lock.Lock()
+
+	if c.uplinksClosed {
+		c.lock.Unlock()
+		return io.EOF
+	}
+
+	c.uplinks = append(c.uplinks, &uplink{conn: conn, weight: weight})
+	uplinks := c.connUplinks()
+	conns := make([]*Conn, 0, len(c.connsByAddr))
+
+	for _, conn := range c.connsByAddr {
+		conns = append(conns, conn)
+	}
+
+	c.readers.Add(1)
+	c.lock.Unlock()
+
+	go func() {
+		defer c.readers.Done()
+		c.readLoop(conn)
+	}()
+
+	for _, conn := range conns {
+		conn := conn
+		conn.do(func() {
+			conn.uplinks = uplinks
+			conn.refreshPaths()
+			conn.updatePathsStats()
+		})
+	}
+
+	return nil
+}
+
+// connUplinks returns the uplinks of new connections, the first of which is
+// the client's socket.
+//
+// The mutex *MUST* be held before calling this method.
+func (c *Client) connUplinks() []*uplink {
+	return append([]*uplink{nil}, c.uplinks...)
+}
+
+// closeUplinks closes the uplinks and the flow sockets, and waits for their
+// reads to stop.
+func (c *Client) closeUplinks() {
+	c.lock.Lock()
+	c.uplinksClosed = true
+
+	for _, uplink := range c.uplinks {
+		uplink.conn.Close()
+	}
+
+	for _, flow := range c.flows {
+		flow.Close()
+	}
+
+	c.lock.Unlock()
+
+	c.readers.Wait()
+}
+
+// multipath tells whether the connection uses several uplinks.
+func (c *Conn) multipath() bool {
+	return len(c.uplinks) > 1
+}
+
+// sendOverPath sends a datagram over a path.
+func (c *Conn) sendOverPath(p *path, b []byte) error {
+	transportConn := c.client.transportConn
+
+	if p.uplink != nil {
+		transportConn = p.uplink.conn
+	}
+
+	_, err := transportConn.WriteTo(b, p.addr.TransportAddr)
+
+	return err
+}
+
+// sendMultipath sends a DATA datagram over the paths picked by the
+// scheduler, or over all of them if it is redundant.
+func (c *Conn) sendMultipath(b []byte, redundant bool) error {
+	paths := c.paths.schedule(c.config.Multipath.Scheduler, c.config.Multipath.weight(), redundant)
+	sent := false
+
+	for _, p := range paths {
+		if err := c.sendOverPath(p, b); err != nil {
+			c.warning(err)
+			continue
+		}
+
+		p.dataSent++
+		sent = true
+	}
+
+	if !sent {
+		// The client's socket reports the errors that matter.
+		_, err := c.writer.Write(b)
+
+		return err
+	}
+
+	return nil
+}
+
+// up tells whether a path may carry DATA messages.
+func (p *path) up() bool {
+	return p.sent < minPathSamples || p.loss <= pathDownLoss
+}
+
+// weight returns the weight of the uplink of a path.
+func (p *path) weight(primaryWeight int) int {
+	if p.uplink == nil {
+		return primaryWeight
+	}
+
+	return p.uplink.weight
+}
+
+// schedule returns the paths to send a DATA message over.
+func (s *pathState) schedule(scheduler MultipathScheduler, primaryWeight int, redundant bool) []*path {
+	var up []*path
+
+	for _, p := range s.paths {
+		if p.up() {
+			up = append(up, p)
+		}
+	}
+
+	if len(up) == 0 {
+		up = s.paths
+	}
+
+	if redundant || len(up) < 2 {
+		return up
+	}
+
+	if scheduler == LowestLatency {
+		var best *path
+
+		for _, p := range up {
+			if p.answered > 0 && (best == nil || p.score() < best.score()) {
+				best = p
+			}
+		}
+
+		if best == nil {
+			best = up[0]
+		}
+
+		return []*path{best}
+	}
+
+	// Smooth weighted round-robin: every path earns its weight in credit
+	// and the richest one pays for the others, which interleaves the paths
+	// rather than sending bursts over each.
+	var best *path
+	total := 0
+
+	for _, p := range up {
+		p.credit += p.weight(primaryWeight)
+		total += p.weight(primaryWeight)
+
+		if best == nil || p.credit > best.credit {
+			best = p
+		}
+	}
+
+	best.credit -= total
+
+	return []*path{best}
+}
@@ -0,0 +1,184 @@
+package fscp
+
+import (
+	"context"
+	"fmt"
+	"net"
+	"testing"
+	"time"
+)
+
+func TestMultipathScheduling(t *testing.T) {
+	addr := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1), Port: 1}}
+	fast := &uplink{weight: 3}
+	lossy := &uplink{weight: 1}
+
+	state := newPathState(&PathsConfig{})
+	state.setPaths([]*Addr{addr}, []*uplink{nil, fast, lossy})
+	primary := state.find(addr, nil)
+
+	counts := map[*path]int{}
+
+	for i := 0; i < 50; i++ {
+		for _, p := range state.schedule(WeightedRoundRobin, 1, false) {
+			counts[p]++
+		}
+	}
+
+	if counts[primary] != 10 || counts[state.find(addr, fast)] != 30 || counts[state.find(addr, lossy)] != 10 {
+		t.Errorf("expected DATA messages to be spread by weight: %v", counts)
+	}
+
+	now := time.Now()
+
+	for i := 0; i < 10; i++ {
+		ids := state.probe(now)
+		state.answered(now.Add(time.Millisecond*20), ids[0])
+		state.answered(now.Add(time.Millisecond*10), ids[1])
+		now = now.Add(time.Second)
+	}
+
+	if paths := state.schedule(WeightedRoundRobin, 1, false); len(paths) != 1 || paths[0] == state.find(addr, lossy) {
+		t.Errorf("expected the lossy path not to be used")
+	}
+
+	if paths := state.schedule(LowestLatency, 1, false); len(paths) != 1 || paths[0] != state.find(addr, fast) {
+		t.Errorf("expected the fastest path to be used")
+	}
+
+	if paths := state.schedule(LowestLatency, 1, true); len(paths) != 2 {
+		t.Errorf("expected a redundant message to be sent over the 2 working paths but got %d", len(paths))
+	}
+}
+
+func TestMultipath(t *testing.T) {
+	testCases := []struct {
+		name      string
+		redundant bool
+	}{
+		{name: "weighted"},
+		{name: "redundant", redundant: true},
+	}
+
+	for _, testCase := range testCases {
+		t.Run(testCase.name, func(t *testing.T) {
+			ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+			defer cancel()
+
+			server := listenTestClient(t, nil)
+			config := &ClientConfig{
+				Paths: PathsConfig{ProbeInterval: time.Millisecond * 50},
+				Multipath: MultipathConfig{
+					Redundant: func([]byte) bool { return testCase.redundant },
+				},
+			}
+			client := listenTestClient(t, config)
+
+			// The uplink is slower, which reorders DATA messages.
+			socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			if err := client.AddUplink(&delayedPacketConn{socket, time.Millisecond * 20}, 3); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			conn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			serverConn, err := server.Accept()
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			// The remote host learns the address of the uplink from the
+			// first probe sent through it.
+			for stats := conn.PathsStats(); len(stats.Paths) != 2 || stats.Paths[1].ProbesAnswered == 0; stats = conn.PathsStats() {
+				select {
+				case <-ctx.Done():
+					t.Fatalf("expected the uplink to be probed: %+v", stats)
+				case <-time.After(time.Millisecond * 10):
+				}
+			}
+
+			const count = 40
+			received := map[string]bool{}
+
+			for i := 0; i < count; i++ {
+				if _, err := conn.Write([]byte(fmt.Sprintf("message %d", i))); err != nil {
+					t.Fatalf("expected no error: %s", err)
+				}
+			}
+
+			for len(received) < count {
+				b := make([]byte, 32)
+				n, err := serverConn.Read(b)
+
+				if err != nil {
+					t.Fatalf("expected no error: %s", err)
+				}
+
+				if received[string(b[:n])] {
+					t.Fatalf("received `%s` twice", b[:n])
+				}
+
+				received[string(b[:n])] = true
+			}
+
+			// Duplicates would arrive over the slow uplink.
+			extra := make(chan []byte, 1)
+
+			go func() {
+				b := make([]byte, 32)
+
+				if n, err := serverConn.Read(b); err == nil {
+					extra <- b[:n]
+				}
+			}()
+
+			select {
+			case b := <-extra:
+				t.Errorf("received an unexpected `%s`", b)
+			case <-time.After(time.Millisecond * 200):
+			}
+
+			stats := conn.PathsStats()
+
+			if len(stats.Paths) != 2 {
+				t.Fatalf("expected 2 paths: %+v", stats)
+			}
+
+			primary, uplink := stats.Paths[0].DataSent, stats.Paths[1].DataSent
+
+			if testCase.redundant {
+				if primary != count || uplink != count {
+					t.Errorf("expected every message to be sent over both paths: %+v", stats)
+				}
+			} else if primary+uplink != count || uplink <= primary {
+				t.Errorf("expected the messages to be spread by weight: %+v", stats)
+			}
+
+			// The remote host answers whatever path it last heard from.
+			if _, err := serverConn.Write([]byte("reply")); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			b := make([]byte, 16)
+			n, err := conn.Read(b)
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			if string(b[:n]) != "reply" {
+				t.Errorf("expected `reply` but got `%s`", b[:n])
+			}
+		})
+	}
+}
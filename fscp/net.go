@@ -2,8 +2,11 @@ package fscp
 
 import (
 	"context"
+	"crypto/sha256"
+	"encoding/binary"
 	"fmt"
 	"net"
+	"sync"
 	"time"
 )
 
@@ -49,6 +52,46 @@ func ResolveFSCPAddr(network, address string) (*Addr, error) {
 	}
 }
 
+// ResolveFSCPAddrs resolves a FSCP address to all the endpoints of its host,
+// ordered so that address families alternate.
+func ResolveFSCPAddrs(network, address string) ([]*Addr, error) {
+	switch network {
+	case Network:
+		host, port, err := net.SplitHostPort(address)
+
+		if err != nil {
+			return nil, fmt.Errorf("parsing FSCP address: %s", err)
+		}
+
+		// Unspecified hosts have a single endpoint.
+		if host == "" {
+			addr, err := ResolveFSCPAddr(network, address)
+
+			if err != nil {
+				return nil, err
+			}
+
+			return []*Addr{addr}, nil
+		}
+
+		portNumber, err := net.LookupPort("udp", port)
+
+		if err != nil {
+			return nil, fmt.Errorf("parsing FSCP address: %s", err)
+		}
+
+		ips, err := net.DefaultResolver.LookupIPAddr(context.Background(), host)
+
+		if err != nil {
+			return nil, fmt.Errorf("parsing FSCP address: %s", err)
+		}
+
+		return makeFSCPAddrs(ips, portNumber), nil
+	default:
+		return nil, fmt.Errorf("unsupported network: %s", network)
+	}
+}
+
 // Listen listens to a FSCP address.
 func Listen(network string, addr string) (net.Listener, error) {
 	switch network {
@@ -86,10 +129,242 @@ func ListenFSCP(network string, addr *Addr, security *ClientSecurity) (*Client,
 	}
 }
 
+// A ClientPool shares clients between dialers.
+//
+// Dialers that use the same local address and security profile share a
+// client, whether or not they use the same ClientSecurity value, and
+// therefore its socket and its host identifier.
+//
+// A connection is only ever handed to one dialer, so that dialers never read
+// the data of one another: dialing a host that another dialer is connected to
+// takes another client, on an ephemeral port of the same local address.
+// Clients are closed once none of their connections is open anymore.
+type ClientPool struct {
+	lock    sync.Mutex
+	clients map[clientPoolKey][]*Client
+	dialed  map[*Conn]bool
+}
+
+// DefaultClientPool is the pool of the dialers that don't specify one.
+var DefaultClientPool = &ClientPool{}
+
+type clientPoolKey struct {
+	laddr    string
+	identity string
+}
+
+// poolIdentity returns a digest of a security profile, so that identical
+// profiles get the same client.
+func poolIdentity(security *ClientSecurity) string {
+	if security == nil {
+		return ""
+	}
+
+	h := sha256.New()
+	write := func(b []byte) {
+		binary.Write(h, binary.BigEndian, uint32(len(b)))
+		h.Write(b)
+	}
+
+	if security.Certificate != nil {
+		write(security.Certificate.Raw)
+	} else {
+		write(nil)
+	}
+
+	write(security.PresharedKey)
+
+	suites := make([]byte, len(security.CipherSuites))
+
+	for i, suite := range security.CipherSuites {
+		suites[i] = byte(suite)
+	}
+
+	write(suites)
+
+	curves := make([]byte, len(security.EllipticCurves))
+
+	for i, curve := range security.EllipticCurves {
+		curves[i] = byte(curve)
+	}
+
+	write(curves)
+
+	if remote := security.RemoteClientSecurity; remote != nil && remote.Certificate != nil {
+		write(remote.Certificate.Raw)
+	} else {
+		write(nil)
+	}
+
+	return string(h.Sum(nil))
+}
+
+// get returns a client of the pool for the specified local address and
+// security that has no connection to the specified hosts handed to a dialer
+// yet, creating it if needed.
+func (p *ClientPool) get(network string, laddr *Addr, security *ClientSecurity, raddrs []*Addr) (*Client, error) {
+	key := clientPoolKey{laddr: laddr.String(), identity: poolIdentity(security)}
+
+	p.lock.Lock()
+	defer p.lock.Unlock()
+
+	if p.clients == nil {
+		p.clients = map[clientPoolKey][]*Client{}
+	}
+
+	clients := p.clients[key][:0]
+
+	for _, client := range p.clients[key] {
+		if !client.isClosed() {
+			clients = append(clients, client)
+		}
+	}
+
+	p.clients[key] = clients
+
+	for _, client := range clients {
+		if !p.hasDialed(client, raddrs) {
+			return client, nil
+		}
+	}
+
+	// The local address is taken by the first client already.
+	if udpAddr, ok := laddr.TransportAddr.(*net.UDPAddr); ok && len(clients) > 0 {
+		laddr = &Addr{TransportAddr: &net.UDPAddr{IP: udpAddr.IP, Zone: udpAddr.Zone}}
+	}
+
+	client, err := ListenFSCP(network, laddr, security)
+
+	if err != nil {
+		return nil, err
+	}
+
+	p.clients[key] = append(clients, client)
+
+	return client, nil
+}
+
+// hasDialed tells whether a client has a connection to one of the specified
+// hosts that was handed to a dialer.
+//
+// The mutex *MUST* be held before calling this method.
+func (p *ClientPool) hasDialed(client *Client, raddrs []*Addr) bool {
+	for _, raddr := range raddrs {
+		if conn := client.getConn(raddr); conn != nil && p.dialed[conn] {
+			return true
+		}
+	}
+
+	return false
+}
+
+// claim hands a connection to a dialer, and tells whether no other dialer has
+// it already.
+func (p *ClientPool) claim(client *Client, conn *Conn) bool {
+	p.lock.Lock()
+	defer p.lock.Unlock()
+
+	if p.dialed[conn] {
+		return false
+	}
+
+	if p.dialed == nil {
+		p.dialed = map[*Conn]bool{}
+	}
+
+	p.dialed[conn] = true
+
+	go func() {
+		<-conn.closed
+
+		p.lock.Lock()
+		delete(p.dialed, conn)
+		p.lock.Unlock()
+
+		p.reap(client)
+	}()
+
+	return true
+}
+
+// dial dials a connection from a pooled client, which no other dialer has.
+func (p *ClientPool) dial(network string, laddr *Addr, security *ClientSecurity, raddrs []*Addr, dial func(*Client) (*Conn, error)) (*Conn, error) {
+	for {
+		client, err := p.get(network, laddr, security, raddrs)
+
+		if err != nil {
+			return nil, err
+		}
+
+		conn, err := dial(client)
+
+		if err != nil {
+			p.reap(client)
+
+			return nil, err
+		}
+
+		// Another dialer may have raced us to the same host.
+		if p.claim(client, conn) {
+			return conn, nil
+		}
+	}
+}
+
+// reap closes a pooled client if it has no open connection left.
+func (p *ClientPool) reap(client *Client) {
+	p.lock.Lock()
+	defer p.lock.Unlock()
+
+	if client.openConns() > 0 {
+		return
+	}
+
+	for key, clients := range p.clients {
+		for i, other := range clients {
+			if other == client {
+				p.clients[key] = append(clients[:i:i], clients[i+1:]...)
+				client.Close()
+
+				break
+			}
+		}
+	}
+}
+
+// Close closes all the clients of the pool.
+func (p *ClientPool) Close() error {
+	p.lock.Lock()
+	defer p.lock.Unlock()
+
+	var err error
+
+	for key, clients := range p.clients {
+		for _, client := range clients {
+			if closeErr := client.Close(); closeErr != nil && err == nil {
+				err = closeErr
+			}
+		}
+
+		delete(p.clients, key)
+	}
+
+	return err
+}
+
 // A Dialer offers connection dialing primitives.
 type Dialer struct {
 	Timeout  time.Duration
 	Security *ClientSecurity
+
+	// Pool is the pool of clients that the dialer shares with others. If nil,
+	// DefaultClientPool is used.
+	Pool *ClientPool
+
+	// Resolver, if set, resolves and caches the addresses that Dial is given,
+	// and keeps the candidate endpoints of the connections it returns in sync
+	// with them.
+	Resolver *Resolver
 }
 
 // DefaultTimeout is the default time to wait for dialing connections.
@@ -99,29 +374,73 @@ const DefaultTimeout = time.Second * 5
 var DefaultDialer = &Dialer{}
 
 func (d Dialer) getTimeout() time.Duration {
-	if d.Timeout < 0 {
+	if d.Timeout <= 0 {
 		return DefaultTimeout
 	}
 
 	return d.Timeout
 }
 
+func (d Dialer) getPool() *ClientPool {
+	if d.Pool == nil {
+		return DefaultClientPool
+	}
+
+	return d.Pool
+}
+
 // Dial dials a new connection.
 func (d *Dialer) Dial(network, addr string) (net.Conn, error) {
 	switch network {
 	case Network:
-		addr, err := ResolveFSCPAddr(network, addr)
+		if d.Resolver != nil {
+			return d.dialResolved(network, addr)
+		}
+
+		addrs, err := ResolveFSCPAddrs(network, addr)
 
 		if err != nil {
 			return nil, &net.OpError{Op: "dial", Net: network, Err: err}
 		}
 
-		return d.DialFSCP(network, nil, addr)
+		conn, _, err := d.DialFSCPAny(network, nil, addrs)
+
+		if err != nil {
+			return nil, err
+		}
+
+		return conn, nil
 	default:
 		return net.Dial(network, addr)
 	}
 }
 
+// dialResolved dials a new connection to an address resolved by the resolver
+// of the dialer, which then watches it.
+func (d *Dialer) dialResolved(network, addr string) (net.Conn, error) {
+	ctx, cancel := context.WithTimeout(context.Background(), d.getTimeout())
+	addrs, err := d.Resolver.ResolveFSCPAddrs(ctx, network, addr)
+	cancel()
+
+	if err != nil {
+		return nil, &net.OpError{Op: "dial", Net: network, Err: err}
+	}
+
+	conn, _, err := d.DialFSCPAny(network, nil, addrs)
+
+	if err != nil {
+		return nil, err
+	}
+
+	if err := d.Resolver.Watch(context.Background(), conn, network, addr); err != nil {
+		conn.Close()
+
+		return nil, &net.OpError{Op: "dial", Net: network, Err: err}
+	}
+
+	return conn, nil
+}
+
 // DialFSCP dials a new FSCP connection.
 func (d *Dialer) DialFSCP(network string, laddr *Addr, raddr *Addr) (*Conn, error) {
 	switch network {
@@ -130,18 +449,40 @@ func (d *Dialer) DialFSCP(network string, laddr *Addr, raddr *Addr) (*Conn, erro
 			laddr = DefaultAddr
 		}
 
-		client, err := ListenFSCP(network, laddr, d.Security)
+		ctx, cancel := context.WithTimeout(context.Background(), d.getTimeout())
+		defer cancel()
 
-		if err != nil {
-			return nil, err
+		return d.getPool().dial(network, laddr, d.Security, []*Addr{raddr}, func(client *Client) (*Conn, error) {
+			return client.dial(ctx, raddr)
+		})
+	default:
+		return nil, &net.OpError{Op: "dial", Net: network, Addr: raddr, Err: fmt.Errorf("unsupported network: %s", network)}
+	}
+}
+
+// DialFSCPAny dials a FSCP connection to a host that has several candidate
+// endpoints, which are raced against one another.
+func (d *Dialer) DialFSCPAny(network string, laddr *Addr, raddrs []*Addr) (*Conn, RaceResult, error) {
+	switch network {
+	case Network:
+		if laddr == nil {
+			laddr = DefaultAddr
 		}
 
 		ctx, cancel := context.WithTimeout(context.Background(), d.getTimeout())
 		defer cancel()
 
-		return client.Connect(ctx, raddr)
+		var result RaceResult
+
+		conn, err := d.getPool().dial(network, laddr, d.Security, raddrs, func(client *Client) (conn *Conn, err error) {
+			conn, result, err = client.ConnectAny(ctx, raddrs)
+
+			return conn, err
+		})
+
+		return conn, result, err
 	default:
-		return nil, &net.OpError{Op: "dial", Net: network, Addr: raddr, Err: fmt.Errorf("unsupported network: %s", network)}
+		return nil, RaceResult{}, &net.OpError{Op: "dial", Net: network, Err: fmt.Errorf("unsupported network: %s", network)}
 	}
 }
 
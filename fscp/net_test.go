@@ -1,7 +1,9 @@
 package fscp
 
 import (
+	"bytes"
 	"context"
+	"net"
 	"testing"
 	"time"
 )
@@ -112,3 +114,273 @@ func TestConnection(t *testing.T) {
 		t.Errorf("expected `%s`, got `%s`", "world", string(msg))
 	}
 }
+
+// connectTestClients connects two clients listening on the loopback interface
+// and returns both ends of the connection.
+//
+// The clients are closed when the test completes.
+func connectTestClients(ctx context.Context, t *testing.T, clientConfig *ClientConfig, serverConfig *ClientConfig) (*Conn, net.Conn) {
+	t.Helper()
+
+	server := listenTestClient(t, serverConfig)
+	client := listenTestClient(t, clientConfig)
+
+	accepted := make(chan net.Conn, 1)
+
+	go func() {
+		conn, _ := server.Accept()
+		accepted <- conn
+	}()
+
+	clientConn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("client connecting to %s: %s", server.Addr(), err)
+	}
+
+	select {
+	case serverConn := <-accepted:
+		if serverConn == nil {
+			t.Fatalf("server failed to accept a connection")
+		}
+
+		return clientConn, serverConn
+	case <-ctx.Done():
+		t.Fatalf("server accepting a connection: %s", ctx.Err())
+	}
+
+	return nil, nil
+}
+
+// listenTestClient instantiates a new client on a random port of the loopback
+// interface.
+//
+// The client is closed when the test completes.
+func listenTestClient(t *testing.T, config *ClientConfig) *Client {
+	t.Helper()
+
+	return listenTestClientAt(t, &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)}, config)
+}
+
+// listenTestClientAt instantiates a new client on the specified address.
+//
+// The client is closed when the test completes.
+func listenTestClientAt(t *testing.T, addr *net.UDPAddr, config *ClientConfig) *Client {
+	t.Helper()
+
+	conn, err := net.ListenUDP("udp", addr)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	client, err := NewClientWithConfig(conn, nil, config)
+
+	if err != nil {
+		conn.Close()
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	t.Cleanup(func() { client.Close() })
+
+	return client
+}
+
+func TestDialerPool(t *testing.T) {
+	pool := &ClientPool{}
+	defer pool.Close()
+
+	dialer := &Dialer{Pool: pool}
+	laddr := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)}}
+	serverA := listenTestClient(t, nil)
+	serverB := listenTestClient(t, nil)
+
+	connA, err := dialer.DialFSCP(Network, laddr, serverA.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	connB, err := dialer.DialFSCP(Network, laddr, serverB.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if connA.client != connB.client {
+		t.Errorf("expected the dialers to share a client")
+	}
+
+	// Connections are only handed to one dialer.
+	conn, err := (&Dialer{Pool: pool}).DialFSCP(Network, laddr, serverA.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if conn == connA || conn.client == connA.client {
+		t.Errorf("expected another client")
+	}
+
+	// Another security profile gets another client.
+	conn, err = (&Dialer{Pool: pool, Security: &ClientSecurity{}}).DialFSCP(Network, laddr, serverA.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if conn.client == connA.client {
+		t.Errorf("expected another client")
+	}
+
+	// Identical security profiles share their client.
+	other, err := (&Dialer{Pool: pool, Security: &ClientSecurity{}}).DialFSCP(Network, laddr, serverB.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if other.client != conn.client {
+		t.Errorf("expected identical security profiles to share a client")
+	}
+
+	// Closed clients are replaced.
+	connA.client.Close()
+
+	for !connA.client.isClosed() {
+		time.Sleep(time.Millisecond * 10)
+	}
+
+	conn, err = dialer.DialFSCP(Network, laddr, serverA.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if conn.client == connA.client {
+		t.Errorf("expected the closed client to be replaced")
+	}
+}
+
+func TestDialerPoolReaping(t *testing.T) {
+	pool := &ClientPool{}
+	defer pool.Close()
+
+	dialer := &Dialer{Pool: pool}
+	laddr := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)}}
+	server := listenTestClient(t, nil)
+
+	connA, err := dialer.DialFSCP(Network, laddr, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	connB, err := dialer.DialFSCP(Network, laddr, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	// Each dialer reads its own data.
+	for i := 0; i < 2; i++ {
+		serverConn, err := server.Accept()
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if _, err := serverConn.Write([]byte(serverConn.RemoteAddr().String())); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+	}
+
+	for _, conn := range []*Conn{connA, connB} {
+		b := make([]byte, 64)
+		n, err := conn.Read(b)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if value := string(b[:n]); value != conn.LocalAddr().String() {
+			t.Errorf("expected %q but got %q", conn.LocalAddr(), value)
+		}
+	}
+
+	// Clients are closed along with their last connection.
+	connA.Close()
+	connB.Close()
+
+	for !connA.client.isClosed() || !connB.client.isClosed() {
+		time.Sleep(time.Millisecond * 10)
+	}
+
+	for {
+		pool.lock.Lock()
+		clients := 0
+
+		for _, list := range pool.clients {
+			clients += len(list)
+		}
+
+		pool.lock.Unlock()
+
+		if clients == 0 {
+			break
+		}
+
+		time.Sleep(time.Millisecond * 10)
+	}
+}
+
+func TestSessionKeys(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	clientConn, serverConn := connectTestClients(ctx, t, nil, nil)
+
+	session := func(conn *Conn) *Session {
+		if err := conn.waitConnected(ctx); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		result := make(chan *Session, 1)
+		conn.do(func() { result <- conn.session })
+
+		return <-result
+	}
+
+	// A SESSION that was not requested makes the remote host start a session
+	// of its own, whose keys it must derive as well.
+	current := session(clientConn)
+	clientConn.do(func() {
+		next, err := NewSession(clientConn.localHostIdentifier, current.SessionNumber+1, current.CipherSuite, current.EllipticCurve)
+
+		if err != nil {
+			t.Errorf("expected no error: %s", err)
+			return
+		}
+
+		clientConn.nextSession = next
+		clientConn.sendSession(next)
+	})
+
+	for session(clientConn).SessionNumber == current.SessionNumber {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected a new session to be established")
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+
+	client, server := session(clientConn), session(serverConn.(*Conn))
+
+	if client.SessionNumber != server.SessionNumber || server.RemotePublicKey == nil {
+		t.Fatalf("expected both ends to have established the new session")
+	}
+
+	if !bytes.Equal(client.LocalSessionKey, server.RemoteSessionKey) || !bytes.Equal(client.RemoteSessionKey, server.LocalSessionKey) {
+		t.Errorf("expected both ends to derive matching session keys")
+	}
+}
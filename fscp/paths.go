@@ -0,0 +1,340 @@
+package fscp
+
+import (
+	"bytes"
+	"net"
+	"time"
+)
+
+const (
+	// DefaultProbeInterval is the default interval between two probes of
+	// the candidate endpoints of a connection.
+	DefaultProbeInterval = time.Second * 5
+
+	// DefaultPathHysteresis is the default fraction by which a candidate
+	// endpoint must beat the current one for the connection to switch to it.
+	DefaultPathHysteresis = 0.2
+
+	// minPathSamples is the number of answered probes required to consider a
+	// candidate endpoint.
+	minPathSamples = 3
+
+	// pathLossPenalty is how much a loss rate of 100% increases the score of
+	// an endpoint, relatively to its round-trip time.
+	pathLossPenalty = 10
+
+	// probeIDFlag marks the keep-alive identifiers of path probes, which
+	// lets them share the keep-alive echo mechanism.
+	probeIDFlag = 1 << 31
+)
+
+// PathsConfig contains the settings of the selection among the candidate
+// endpoints of a connection.
+type PathsConfig struct {
+	// ProbeInterval is the interval between two probes of every candidate.
+	// A probe that is not answered by the next one is lost.
+	ProbeInterval time.Duration
+
+	// Hysteresis is the fraction by which the score of a candidate must be
+	// lower than the one of the current endpoint for the connection to
+	// switch to it. It avoids flapping between similar endpoints.
+	Hysteresis float64
+}
+
+func (c *PathsConfig) probeInterval() time.Duration {
+	if c.ProbeInterval <= 0 {
+		return DefaultProbeInterval
+	}
+
+	return c.ProbeInterval
+}
+
+func (c *PathsConfig) hysteresis() float64 {
+	if c.Hysteresis <= 0 {
+		return DefaultPathHysteresis
+	}
+
+	return c.Hysteresis
+}
+
+// PathStats contains the statistics of a path to a candidate endpoint.
+type PathStats struct {
+	Addr *Addr
+
+	// LocalAddr is the address of the uplink the path goes through.
+	LocalAddr net.Addr
+
+	// Active tells whether the endpoint is the one the connection uses.
+	Active bool
+
+	// DataSent is the number of DATA messages sent over the path, when the
+	// connection uses several paths.
+	DataSent uint64
+
+	// ProbesSent is the number of probes sent to the endpoint.
+	ProbesSent uint64
+
+	// ProbesAnswered is the number of probes that were answered.
+	ProbesAnswered uint64
+
+	// Loss is the smoothed loss rate of the probes, between 0 and 1.
+	Loss float64
+
+	// SmoothedRTT is the smoothed round-trip time, or zero if it is unknown.
+	SmoothedRTT time.Duration
+}
+
+// PathsStats contains the statistics of the candidate endpoints of a
+// connection.
+type PathsStats struct {
+	Paths []PathStats
+
+	// Switches is the number of times the connection switched endpoints.
+	Switches uint64
+}
+
+// path is a candidate endpoint of a connection, reached through an uplink.
+type path struct {
+	addr        *Addr
+	uplink      *uplink
+	dataSent    uint64
+	credit      int
+	rtt         rttEstimator
+	loss        float64
+	sent        uint64
+	answered    uint64
+	probeID     uint32
+	probeSentAt time.Time
+}
+
+// usable tells whether enough probes were answered to judge the endpoint.
+func (p *path) usable() bool {
+	return p.answered >= minPathSamples
+}
+
+// score rates the endpoint: the lower, the better.
+func (p *path) score() float64 {
+	return float64(p.rtt.srtt) * (1 + pathLossPenalty*p.loss)
+}
+
+// pathState tracks the candidate endpoints of a connection.
+//
+// It is not thread-safe.
+type pathState struct {
+	config    *PathsConfig
+	paths     []*path
+	nextID    uint32
+	nextProbe time.Time
+	switches  uint64
+}
+
+func newPathState(config *PathsConfig) *pathState {
+	return &pathState{config: config}
+}
+
+// setPaths replaces the paths with the ones to the specified endpoints
+// through the specified uplinks, keeping the measurements of the ones that
+// remain.
+//
+// A nil uplink stands for the client's socket.
+func (s *pathState) setPaths(addrs []*Addr, uplinks []*uplink) {
+	paths := make([]*path, 0, len(addrs)*len(uplinks))
+
+	for _, addr := range addrs {
+		for _, uplink := range uplinks {
+			p := s.find(addr, uplink)
+
+			if p == nil {
+				p = &path{addr: addr, uplink: uplink}
+			}
+
+			paths = append(paths, p)
+		}
+	}
+
+	s.paths = paths
+}
+
+func (s *pathState) find(addr *Addr, uplink *uplink) *path {
+	for _, p := range s.paths {
+		if p.uplink == uplink && p.addr.String() == addr.String() {
+			return p
+		}
+	}
+
+	return nil
+}
+
+// enabled tells whether there is a choice to make.
+func (s *pathState) enabled() bool {
+	return len(s.paths) > 1
+}
+
+// probe registers a new round of probes and returns their identifiers, one
+// per endpoint. Probes of the previous round that were not answered are lost,
+// which is accounted for in the loss rate once per round.
+func (s *pathState) probe(now time.Time) []uint32 {
+	ids := make([]uint32, len(s.paths))
+
+	for i, p := range s.paths {
+		lost := 0.0
+
+		if !p.probeSentAt.IsZero() {
+			lost = 1
+		}
+
+		if p.sent > 0 {
+			p.loss = (7*p.loss + lost) / 8
+		}
+
+		s.nextID++
+		p.probeID = s.nextID | probeIDFlag
+		p.probeSentAt = now
+		p.sent++
+		ids[i] = p.probeID
+	}
+
+	s.nextProbe = now.Add(s.config.probeInterval())
+
+	return ids
+}
+
+// answered registers the answer to a probe.
+func (s *pathState) answered(now time.Time, id uint32) {
+	for _, p := range s.paths {
+		if !p.probeSentAt.IsZero() && p.probeID == id {
+			p.rtt.update(now.Sub(p.probeSentAt))
+			p.probeSentAt = time.Time{}
+			p.answered++
+
+			return
+		}
+	}
+}
+
+// best returns the endpoint that the connection should switch to, or nil if
+// the active one should be kept.
+func (s *pathState) best(active *Addr) *Addr {
+	current := s.find(active, nil)
+	var best *path
+
+	for _, p := range s.paths {
+		if p != current && p.usable() && (best == nil || p.score() < best.score()) {
+			best = p
+		}
+	}
+
+	if best == nil {
+		return nil
+	}
+
+	if current == nil || !current.usable() || best.score() < current.score()*(1-s.config.hysteresis()) {
+		return best.addr
+	}
+
+	return nil
+}
+
+func (s *pathState) stats(active *Addr) PathsStats {
+	stats := PathsStats{
+		Paths:    make([]PathStats, len(s.paths)),
+		Switches: s.switches,
+	}
+
+	for i, p := range s.paths {
+		stats.Paths[i] = PathStats{
+			Addr:           p.addr,
+			LocalAddr:      p.uplink.localAddr(),
+			Active:         p.uplink == nil && p.addr.String() == active.String(),
+			DataSent:       p.dataSent,
+			ProbesSent:     p.sent,
+			ProbesAnswered: p.answered,
+			Loss:           p.loss,
+			SmoothedRTT:    p.rtt.srtt,
+		}
+	}
+
+	return stats
+}
+
+// SetCandidates sets the candidate endpoints of the remote host.
+//
+// The candidates, and the endpoint in use, are probed periodically and the
+// connection switches to the one with the lowest round-trip time and loss
+// rate, if it is significantly better than the current one. Probes are
+// authenticated keep-alive echoes, so the remote host must support them.
+func (c *Conn) SetCandidates(addrs []*Addr) error {
+	return c.do(func() {
+		c.candidates = addrs
+		c.refreshPaths()
+		c.client.setCandidates(c, addrs)
+		c.updatePathsStats()
+
+		if err := c.checkTimers(time.Now()); err != nil {
+			c.closeWithError(err)
+		}
+	})
+}
+
+// PathsStats returns the statistics of the candidate endpoints of the
+// connection.
+func (c *Conn) PathsStats() PathsStats {
+	c.statsLock.Lock()
+	defer c.statsLock.Unlock()
+
+	return c.pathsStats
+}
+
+// refreshPaths updates the paths after a change of endpoints or uplinks.
+func (c *Conn) refreshPaths() {
+	remoteAddr := c.RemoteAddr().(*Addr)
+	addrs := []*Addr{remoteAddr}
+
+	for _, addr := range c.candidates {
+		if addr.String() != remoteAddr.String() {
+			addrs = append(addrs, addr)
+		}
+	}
+
+	c.paths.setPaths(addrs, c.uplinks)
+}
+
+func (c *Conn) updatePathsStats() {
+	stats := c.paths.stats(c.RemoteAddr().(*Addr))
+
+	c.statsLock.Lock()
+	c.pathsStats = stats
+	c.statsLock.Unlock()
+}
+
+// probePaths probes every path and switches to the best endpoint, unless
+// several uplinks are used at once.
+func (c *Conn) probePaths(now time.Time) error {
+	if !c.multipath() {
+		if best := c.paths.best(c.RemoteAddr().(*Addr)); best != nil {
+			c.debugPrintf("Switching to a better endpoint: %s.\n", best)
+			c.client.moveConn(c, best)
+			c.paths.switches++
+		}
+	}
+
+	c.refreshPaths()
+
+	for i, id := range c.paths.probe(now) {
+		msg := c.session.Encrypt(makeKeepAlivePayload(keepAliveKindRequest, id))
+		buf := &bytes.Buffer{}
+
+		if err := writeMessage(buf, MessageTypeKeepAlive, msg); err != nil {
+			return err
+		}
+
+		// An unreachable candidate must not break the connection.
+		if err := c.sendOverPath(c.paths.paths[i], buf.Bytes()); err != nil {
+			c.warning(err)
+		}
+	}
+
+	c.updatePathsStats()
+
+	return nil
+}
@@ -0,0 +1,222 @@
+package fscp
+
+import (
+	"context"
+	"net"
+	"testing"
+	"time"
+)
+
+func TestPathSelection(t *testing.T) {
+	a := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1), Port: 1}}
+	b := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 2), Port: 1}}
+
+	state := newPathState(&PathsConfig{})
+	state.setPaths([]*Addr{a, b}, []*uplink{nil})
+	now := time.Now()
+
+	// probes runs a round of probes, which are answered after the specified
+	// round-trip times, or lost if negative.
+	probes := func(rtts ...time.Duration) {
+		ids := state.probe(now)
+
+		for i, rtt := range rtts {
+			if rtt >= 0 {
+				state.answered(now.Add(rtt), ids[i])
+			}
+		}
+
+		now = now.Add(time.Second)
+	}
+
+	probes(time.Millisecond*100, time.Millisecond*90)
+	probes(time.Millisecond*100, time.Millisecond*90)
+
+	if best := state.best(a); best != nil {
+		t.Errorf("expected no switch before enough samples but got %s", best)
+	}
+
+	probes(time.Millisecond*100, time.Millisecond*90)
+
+	if best := state.best(a); best != nil {
+		t.Errorf("expected the hysteresis to prevent a switch but got %s", best)
+	}
+
+	for i := 0; i < 10; i++ {
+		probes(time.Millisecond*100, time.Millisecond*50)
+	}
+
+	if best := state.best(a); best != b {
+		t.Errorf("expected a switch to %s but got %v", b, best)
+	}
+
+	// Losses count against an endpoint, however low its round-trip time.
+	for i := 0; i < 20; i++ {
+		probes(time.Millisecond*100, -1)
+	}
+
+	if best := state.best(b); best != a {
+		t.Errorf("expected a switch to %s but got %v", a, best)
+	}
+
+	stats := state.stats(a)
+
+	if len(stats.Paths) != 2 || !stats.Paths[0].Active || stats.Paths[1].ProbesAnswered != 13 || stats.Paths[1].Loss < 0.5 {
+		t.Errorf("unexpected stats: %+v", stats)
+	}
+}
+
+func TestPathLoss(t *testing.T) {
+	a := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1), Port: 1}}
+
+	state := newPathState(&PathsConfig{})
+	state.setPaths([]*Addr{a}, []*uplink{nil})
+	now := time.Now()
+
+	state.answered(now, state.probe(now)[0])
+	state.probe(now)
+	state.answered(now, state.probe(now)[0])
+	state.probe(now)
+
+	// The loss rate is updated exactly once per round: lost, then answered.
+	if loss, expected := state.stats(a).Paths[0].Loss, 7.0/64; loss != expected {
+		t.Errorf("expected a loss rate of %f but got %f", expected, loss)
+	}
+}
+
+// slowPathPacketConn delays the outgoing datagrams sent to a given address.
+type slowPathPacketConn struct {
+	net.PacketConn
+	slow  string
+	delay time.Duration
+}
+
+func (c *slowPathPacketConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	if addr.String() != c.slow {
+		return c.PacketConn.WriteTo(b, addr)
+	}
+
+	b = append([]byte{}, b...)
+	time.AfterFunc(c.delay, func() { c.PacketConn.WriteTo(b, addr) })
+
+	return len(b), nil
+}
+
+func TestCandidateEndpoints(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4zero})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	server, err := NewClient(socket, nil)
+
+	if err != nil {
+		socket.Close()
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer server.Close()
+
+	port := socket.LocalAddr().(*net.UDPAddr).Port
+	slow := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1), Port: port}}
+	fast := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 2), Port: port}}
+
+	socket, err = net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	config := &ClientConfig{Paths: PathsConfig{ProbeInterval: time.Millisecond * 50}}
+	client, err := NewClientWithConfig(&slowPathPacketConn{socket, slow.String(), time.Millisecond * 50}, nil, config)
+
+	if err != nil {
+		socket.Close()
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer client.Close()
+
+	conn, err := client.Connect(ctx, slow)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	serverConn, err := server.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if err := conn.SetCandidates([]*Addr{fast}); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	for conn.PathsStats().Switches == 0 {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected a switch to the fast endpoint: %+v", conn.PathsStats())
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+
+	if addr := conn.RemoteAddr().String(); addr != fast.String() {
+		t.Errorf("expected %s but got %s", fast, addr)
+	}
+
+	for _, pair := range [][2]net.Conn{{conn, serverConn}, {serverConn, conn}} {
+		if _, err := pair[0].Write([]byte("fast")); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		b := make([]byte, 16)
+		n, err := pair[1].Read(b)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if string(b[:n]) != "fast" {
+			t.Errorf("expected `fast` but got `%s`", b[:n])
+		}
+	}
+
+	// The measurements keep confirming the choice.
+	time.Sleep(time.Millisecond * 300)
+
+	if stats := conn.PathsStats(); stats.Switches != 1 {
+		t.Errorf("expected a single switch: %+v", stats)
+	}
+
+	// New candidates replace the previous ones.
+	stale := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(127, 0, 0, 3), Port: port}}
+
+	if err := conn.SetCandidates([]*Addr{stale}); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	for client.getConnByAlias(stale) == nil {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected %s to be a candidate", stale)
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+
+	if err := conn.SetCandidates([]*Addr{fast}); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	for client.getConnByAlias(stale) != nil {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected %s to be replaced", stale)
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+}
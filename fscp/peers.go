@@ -0,0 +1,287 @@
+package fscp
+
+import (
+	"context"
+	"fmt"
+	"io"
+	"sync"
+	"time"
+)
+
+const (
+	// DefaultMaxConcurrentDials is the default maximum number of peers that
+	// SetPeers connects to at the same time.
+	DefaultMaxConcurrentDials = 64
+	// DefaultDialInterval is the default interval between the starts of two
+	// connections by SetPeers.
+	DefaultDialInterval = time.Millisecond * 5
+	// DefaultDialTimeout is the default time after which SetPeers gives up
+	// connecting to a peer.
+	DefaultDialTimeout = time.Second * 30
+)
+
+// PeersConfig contains the settings of the peer set reconciliation.
+type PeersConfig struct {
+	// MaxConcurrentDials is the maximum number of handshakes in progress at
+	// the same time.
+	MaxConcurrentDials int
+
+	// DialInterval is the minimum interval between the starts of two
+	// handshakes, which spreads them over time.
+	DialInterval time.Duration
+
+	// DialTimeout is the time after which connecting to a peer fails.
+	DialTimeout time.Duration
+
+	// OnProgress, if set, is called whenever the state of a peer changes.
+	//
+	// It may be called from several goroutines at once.
+	OnProgress func(PeerProgress)
+}
+
+func (c *PeersConfig) maxConcurrentDials() int {
+	if c.MaxConcurrentDials <= 0 {
+		return DefaultMaxConcurrentDials
+	}
+
+	return c.MaxConcurrentDials
+}
+
+func (c *PeersConfig) dialInterval() time.Duration {
+	if c.DialInterval < 0 {
+		return 0
+	}
+
+	if c.DialInterval == 0 {
+		return DefaultDialInterval
+	}
+
+	return c.DialInterval
+}
+
+func (c *PeersConfig) dialTimeout() time.Duration {
+	if c.DialTimeout <= 0 {
+		return DefaultDialTimeout
+	}
+
+	return c.DialTimeout
+}
+
+// PeerState is the state of a peer during a reconciliation.
+type PeerState int
+
+const (
+	// PeerConnecting means a handshake with the peer is in progress.
+	PeerConnecting PeerState = iota
+	// PeerConnected means a session is established with the peer.
+	PeerConnected
+	// PeerFailed means connecting to the peer failed.
+	PeerFailed
+	// PeerRemoved means the connection to the peer was closed.
+	PeerRemoved
+)
+
+func (s PeerState) String() string {
+	switch s {
+	case PeerConnecting:
+		return "connecting"
+	case PeerConnected:
+		return "connected"
+	case PeerFailed:
+		return "failed"
+	case PeerRemoved:
+		return "removed"
+	}
+
+	return fmt.Sprintf("PeerState(%d)", int(s))
+}
+
+// PeerProgress reports a change in the state of a peer.
+type PeerProgress struct {
+	Addr  *Addr
+	State PeerState
+
+	// Err is the reason why connecting to the peer failed.
+	Err error
+
+	// Elapsed is the time since the reconciliation started.
+	Elapsed time.Duration
+}
+
+// PeersResult summarizes a reconciliation.
+type PeersResult struct {
+	// Connected is the number of peers that got connected.
+	Connected int
+	// AlreadyConnected is the number of desired peers that were connected
+	// already.
+	AlreadyConnected int
+	// Failed is the number of peers that could not be connected.
+	Failed int
+	// Removed is the number of peers whose connections were closed.
+	Removed int
+
+	// Duration is the time it took for the peer set to converge.
+	Duration time.Duration
+}
+
+// SetPeers reconciles the connections of the client with a desired set of
+// peers.
+//
+// Connections to the peers of the previous call that are not desired anymore
+// are closed. The desired peers that are not connected yet are connected to,
+// with a bounded number of handshakes in progress at the same time and
+// staggered starts, as set in the peers settings. Connections that remote
+// hosts initiated are left alone.
+//
+// SetPeers returns once every desired peer is either connected or failed, or
+// when the context expires. Calls are serialized.
+func (c *Client) SetPeers(ctx context.Context, desired []*Addr) (PeersResult, error) {
+	c.peersLock.Lock()
+	defer c.peersLock.Unlock()
+
+	start := time.Now()
+	config := c.Config().Peers
+	var result PeersResult
+	var resultLock sync.Mutex
+
+	report := func(addr *Addr, state PeerState, err error) {
+		resultLock.Lock()
+
+		switch state {
+		case PeerConnected:
+			result.Connected++
+		case PeerFailed:
+			result.Failed++
+		case PeerRemoved:
+			result.Removed++
+		}
+
+		resultLock.Unlock()
+
+		if config.OnProgress != nil {
+			config.OnProgress(PeerProgress{Addr: addr, State: state, Err: err, Elapsed: time.Since(start)})
+		}
+	}
+
+	peers := make(map[string]*Addr, len(desired))
+
+	for _, addr := range desired {
+		peers[addr.String()] = addr
+	}
+
+	var removed []*Addr
+	var dials []*Addr
+
+	c.lock.Lock()
+
+	if c.closed {
+		c.lock.Unlock()
+		return result, io.EOF
+	}
+
+	for key, addr := range c.peers {
+		if _, ok := peers[key]; ok {
+			continue
+		}
+
+		if conn, ok := c.connsByAddr[key]; ok {
+			conn.Close()
+			delete(c.connsByAddr, key)
+			removed = append(removed, addr)
+
+			for hash, other := range c.connsByHash {
+				if other == conn {
+					delete(c.connsByHash, hash)
+				}
+			}
+		}
+	}
+
+	for key, addr := range peers {
+		if conn, ok := c.connsByAddr[key]; ok && conn.isConnected() {
+			result.AlreadyConnected++
+			continue
+		}
+
+		dials = append(dials, addr)
+	}
+
+	c.peers = peers
+	c.lock.Unlock()
+
+	for _, addr := range removed {
+		report(addr, PeerRemoved, nil)
+	}
+
+	var wg sync.WaitGroup
+	slots := make(chan struct{}, config.maxConcurrentDials())
+	interval := config.dialInterval()
+	timer := time.NewTimer(0)
+	defer timer.Stop()
+
+	for i, addr := range dials {
+		select {
+		case <-timer.C:
+		case <-ctx.Done():
+		}
+
+		select {
+		case slots <- struct{}{}:
+		case <-ctx.Done():
+		}
+
+		if err := ctx.Err(); err != nil {
+			for _, addr := range dials[i:] {
+				report(addr, PeerFailed, err)
+			}
+
+			break
+		}
+
+		timer.Reset(interval)
+		wg.Add(1)
+		report(addr, PeerConnecting, nil)
+
+		go func(addr *Addr) {
+			defer wg.Done()
+			defer func() { <-slots }()
+
+			dialCtx, cancel := context.WithTimeout(ctx, config.dialTimeout())
+			defer cancel()
+
+			if _, err := c.dial(dialCtx, addr); err != nil {
+				report(addr, PeerFailed, err)
+			} else {
+				report(addr, PeerConnected, nil)
+			}
+		}(addr)
+	}
+
+	wg.Wait()
+	result.Duration = time.Since(start)
+
+	return result, ctx.Err()
+}
+
+// dial connects to the specified host and waits for the session to be
+// established, even if the connection existed already.
+//
+// A connection that it started is closed if the session can't be established
+// in time, so that its handshake doesn't keep going in the background.
+func (c *Client) dial(ctx context.Context, remoteAddr *Addr) (*Conn, error) {
+	conn, created := c.addConn(remoteAddr, nil)
+
+	if conn == nil {
+		return nil, io.EOF
+	}
+
+	if err := conn.waitConnected(ctx); err != nil {
+		if created {
+			conn.Close()
+		}
+
+		return nil, err
+	}
+
+	return conn, nil
+}
@@ -0,0 +1,129 @@
+package fscp
+
+import (
+	"context"
+	"net"
+	"sync"
+	"testing"
+	"time"
+)
+
+// progressRecorder records the progress of reconciliations.
+type progressRecorder struct {
+	lock           sync.Mutex
+	states         map[string]PeerState
+	dialing        int
+	maxDialing     int
+	lastConnecting time.Duration
+}
+
+func (r *progressRecorder) record(progress PeerProgress) {
+	r.lock.Lock()
+	defer r.lock.Unlock()
+
+	switch progress.State {
+	case PeerConnecting:
+		r.dialing++
+		r.lastConnecting = progress.Elapsed
+
+		if r.dialing > r.maxDialing {
+			r.maxDialing = r.dialing
+		}
+	case PeerConnected, PeerFailed:
+		if r.states[progress.Addr.String()] == PeerConnecting {
+			r.dialing--
+		}
+	}
+
+	r.states[progress.Addr.String()] = progress.State
+}
+
+func TestSetPeers(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	const interval = time.Millisecond * 20
+
+	recorder := &progressRecorder{states: map[string]PeerState{}}
+	client := listenTestClient(t, &ClientConfig{
+		Peers: PeersConfig{
+			MaxConcurrentDials: 2,
+			DialInterval:       interval,
+			DialTimeout:        time.Millisecond * 300,
+			OnProgress:         recorder.record,
+		},
+	})
+
+	var peers []*Addr
+
+	for i := 0; i < 5; i++ {
+		peers = append(peers, listenTestClient(t, nil).Addr().(*Addr))
+	}
+
+	result, err := client.SetPeers(ctx, peers)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if result.Connected != len(peers) || result.Failed != 0 {
+		t.Errorf("unexpected result: %+v", result)
+	}
+
+	if recorder.maxDialing > 2 {
+		t.Errorf("expected at most 2 concurrent dials but got %d", recorder.maxDialing)
+	}
+
+	if min := interval * time.Duration(len(peers)-1); recorder.lastConnecting < min {
+		t.Errorf("expected the dials to be staggered over %s but they took %s", min, recorder.lastConnecting)
+	}
+
+	for _, peer := range peers {
+		if state := recorder.states[peer.String()]; state != PeerConnected {
+			t.Errorf("expected %s to be connected but it is %s", peer, state)
+		}
+	}
+
+	// This socket never answers.
+	blackhole, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer blackhole.Close()
+
+	unreachable := &Addr{TransportAddr: blackhole.LocalAddr()}
+	result, err = client.SetPeers(ctx, append(peers[:2:2], unreachable))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if result.AlreadyConnected != 2 || result.Removed != 3 || result.Failed != 1 || result.Connected != 0 {
+		t.Errorf("unexpected result: %+v", result)
+	}
+
+	if state := recorder.states[unreachable.String()]; state != PeerFailed {
+		t.Errorf("expected %s to have failed but it is %s", unreachable, state)
+	}
+
+	// The failed dial doesn't keep handshaking in the background.
+	for client.getConn(unreachable) != nil {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected the connection to %s to be closed", unreachable)
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+
+	for _, peer := range peers[2:] {
+		if state := recorder.states[peer.String()]; state != PeerRemoved {
+			t.Errorf("expected %s to be removed but it is %s", peer, state)
+		}
+
+		if client.getConn(peer) != nil {
+			t.Errorf("expected the connection to %s to be closed", peer)
+		}
+	}
+}
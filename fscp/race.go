@@ -0,0 +1,192 @@
+package fscp
+
+import (
+	"context"
+	"errors"
+	"io"
+	"net"
+	"time"
+)
+
+// DefaultAttemptDelay is the default delay between the starts of two
+// connection attempts of a race.
+const DefaultAttemptDelay = time.Millisecond * 250
+
+// ErrNoCandidates is returned when connecting to an empty set of endpoints.
+var ErrNoCandidates = errors.New("no candidate endpoints")
+
+// RaceConfig contains the settings of the races between the endpoints of a
+// host.
+//
+// Hosts that have several endpoints, typically an IPv4 and an IPv6 one, are
+// connected to by starting a handshake with each endpoint in turn, without
+// waiting for the previous ones to fail, and keeping the first that succeeds
+// ("Happy Eyeballs", as described in RFC 8305).
+type RaceConfig struct {
+	// AttemptDelay is the delay after which the next endpoint is tried if
+	// the previous ones didn't succeed or fail yet.
+	AttemptDelay time.Duration
+}
+
+func (c *RaceConfig) attemptDelay() time.Duration {
+	if c.AttemptDelay <= 0 {
+		return DefaultAttemptDelay
+	}
+
+	return c.AttemptDelay
+}
+
+// RaceResult reports the outcome of a race.
+type RaceResult struct {
+	// Addr is the endpoint that won the race.
+	Addr *Addr
+	// Elapsed is the time it took to win the race.
+	Elapsed time.Duration
+	// Attempts is the number of endpoints that were tried.
+	Attempts int
+}
+
+// ConnectAny connects to a host that has several candidate endpoints.
+//
+// Handshakes are started with the candidates in order, the next one starting
+// as soon as the previous one fails or after a delay, as set in the race
+// settings. The first connection that gets established is returned and the
+// attempts that are still in progress are cancelled.
+func (c *Client) ConnectAny(ctx context.Context, candidates []*Addr) (*Conn, RaceResult, error) {
+	start := time.Now()
+	result := RaceResult{}
+
+	if len(candidates) == 0 {
+		return nil, result, ErrNoCandidates
+	}
+
+	ctx, cancel := context.WithCancel(ctx)
+	defer cancel()
+
+	type attempt struct {
+		addr *Addr
+		conn *Conn
+		err  error
+	}
+
+	config := c.Config()
+	attempts := make(chan attempt, len(candidates))
+	delay := config.Race.attemptDelay()
+	created := map[*Conn]bool{}
+	pending := 0
+	var lastErr error
+
+	startNext := func() {
+		addr := candidates[result.Attempts]
+		result.Attempts++
+		pending++
+
+		conn, ok := c.addConn(addr, nil)
+
+		if conn == nil {
+			attempts <- attempt{addr, nil, io.EOF}
+			return
+		}
+
+		if ok {
+			created[conn] = true
+		}
+
+		go func() {
+			attempts <- attempt{addr, conn, conn.waitConnected(ctx)}
+		}()
+	}
+
+	// The attempts we started and that lost the race are cancelled.
+	cancelOthers := func(winner *Conn) {
+		for conn := range created {
+			if conn != winner {
+				conn.Close()
+			}
+		}
+	}
+
+	timer := time.NewTimer(0)
+	defer timer.Stop()
+
+	for {
+		select {
+		case <-timer.C:
+			startNext()
+
+			if result.Attempts < len(candidates) {
+				timer.Reset(delay)
+			}
+
+		case a := <-attempts:
+			pending--
+
+			if a.err == nil {
+				cancelOthers(a.conn)
+				result.Addr, result.Elapsed = a.addr, time.Since(start)
+
+				return a.conn, result, nil
+			}
+
+			lastErr = a.err
+
+			// A failure starts the next attempt right away.
+			if result.Attempts < len(candidates) {
+				if !timer.Stop() {
+					select {
+					case <-timer.C:
+					default:
+					}
+				}
+
+				timer.Reset(0)
+			} else if pending == 0 {
+				result.Elapsed = time.Since(start)
+
+				return nil, result, lastErr
+			}
+
+		case <-ctx.Done():
+			cancelOthers(nil)
+			result.Elapsed = time.Since(start)
+
+			return nil, result, ctx.Err()
+		}
+	}
+}
+
+// interleaveFamilies orders addresses so that address families alternate,
+// starting with the family of the first one.
+func interleaveFamilies(addrs []*Addr) []*Addr {
+	var first, second []*Addr
+
+	for _, addr := range addrs {
+		if isIPv4(addr) == isIPv4(addrs[0]) {
+			first = append(first, addr)
+		} else {
+			second = append(second, addr)
+		}
+	}
+
+	result := make([]*Addr, 0, len(addrs))
+
+	for i := 0; i < len(first) || i < len(second); i++ {
+		if i < len(first) {
+			result = append(result, first[i])
+		}
+
+		if i < len(second) {
+			result = append(result, second[i])
+		}
+	}
+
+	return result
+}
+
+func isIPv4(addr *Addr) bool {
+	if udpAddr, ok := addr.TransportAddr.(*net.UDPAddr); ok {
+		return udpAddr.IP.To4() != nil
+	}
+
+	return false
+}
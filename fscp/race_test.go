@@ -0,0 +1,74 @@
+package fscp
+
+import (
+	"context"
+	"net"
+	"reflect"
+	"testing"
+	"time"
+)
+
+func TestInterleaveFamilies(t *testing.T) {
+	v4a := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(10, 0, 0, 1)}}
+	v4b := &Addr{TransportAddr: &net.UDPAddr{IP: net.IPv4(10, 0, 0, 2)}}
+	v6a := &Addr{TransportAddr: &net.UDPAddr{IP: net.ParseIP("fd00::1")}}
+	v6b := &Addr{TransportAddr: &net.UDPAddr{IP: net.ParseIP("fd00::2")}}
+
+	result := interleaveFamilies([]*Addr{v6a, v6b, v4a, v4b})
+	expected := []*Addr{v6a, v4a, v6b, v4b}
+
+	if !reflect.DeepEqual(result, expected) {
+		t.Errorf("expected %v but got %v", expected, result)
+	}
+}
+
+func TestConnectAny(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	const delay = time.Millisecond * 100
+
+	// This socket never answers, like an endpoint of a broken family.
+	blackhole, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer blackhole.Close()
+
+	unreachable := &Addr{TransportAddr: blackhole.LocalAddr()}
+	server := listenTestClient(t, nil)
+	client := listenTestClient(t, &ClientConfig{Race: RaceConfig{AttemptDelay: delay}})
+
+	conn, result, err := client.ConnectAny(ctx, []*Addr{unreachable, server.Addr().(*Addr)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if conn.RemoteAddr().String() != server.Addr().String() || result.Addr.String() != server.Addr().String() {
+		t.Errorf("expected %s to win the race but got %s", server.Addr(), result.Addr)
+	}
+
+	if result.Attempts != 2 {
+		t.Errorf("expected 2 attempts but got %d", result.Attempts)
+	}
+
+	if result.Elapsed < delay || result.Elapsed > delay+time.Second {
+		t.Errorf("expected the second attempt to start after %s but the race took %s", delay, result.Elapsed)
+	}
+
+	// The losing attempt is cancelled.
+	for client.getConn(unreachable) != nil {
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected the losing attempt to be cancelled")
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+
+	if _, _, err := client.ConnectAny(ctx, nil); err != ErrNoCandidates {
+		t.Errorf("expected %s but got: %v", ErrNoCandidates, err)
+	}
+}
@@ -0,0 +1,351 @@
+package fscp
+
+import (
+	"bytes"
+	"net"
+	"sync/atomic"
+	"time"
+
+	"golang.org/x/net/ipv4"
+	"golang.org/x/net/ipv6"
+)
+
+const (
+	// DefaultRelayQueueSize is the default number of relayed messages that a
+	// connection buffers.
+	DefaultRelayQueueSize = 256
+
+	// DefaultRelayBatchSize is the default maximum number of relayed messages
+	// that a connection sends at once.
+	DefaultRelayBatchSize = 32
+)
+
+// RelayConfig contains the settings of the forwarding of DATA messages
+// between the connections of a client, as hubs do.
+//
+// Relayed messages are decrypted by the connection that receives them and
+// encrypted again in the same buffer by the one that sends them, so that the
+// work is spread over the goroutines of the destinations and never goes
+// through Read and Write.
+type RelayConfig struct {
+	// Route, if set, is called with the payload of every DATA message that a
+	// connection receives, and returns the connection to forward it to, or
+	// nil to deliver it locally.
+	//
+	// It is called concurrently by the connections: it must not block, nor
+	// retain b.
+	Route func(from *Conn, channel uint8, b []byte) *Conn
+
+	// QueueSize is the number of relayed messages that a connection buffers
+	// before it drops them. Defaults to DefaultRelayQueueSize.
+	QueueSize int
+
+	// BatchSize is the maximum number of relayed messages that a connection
+	// sends at once. Defaults to DefaultRelayBatchSize.
+	BatchSize int
+}
+
+func (c *RelayConfig) queueSize() int {
+	if c.QueueSize <= 0 {
+		return DefaultRelayQueueSize
+	}
+
+	return c.QueueSize
+}
+
+func (c *RelayConfig) batchSize() int {
+	if c.BatchSize <= 0 {
+		return DefaultRelayBatchSize
+	}
+
+	return c.BatchSize
+}
+
+// RelayStats contains the statistics of the messages relayed to a remote
+// host.
+type RelayStats struct {
+	// Relayed is the number of messages from other connections that were
+	// sent to the remote host.
+	Relayed uint64
+
+	// Dropped is the number of messages from other connections that were
+	// dropped, because the queue was full or no session was established.
+	Dropped uint64
+
+	// Batches is the number of batches the relayed messages were sent in.
+	Batches uint64
+}
+
+func (s *RelayStats) snapshot() RelayStats {
+	return RelayStats{
+		Relayed: atomic.LoadUint64(&s.Relayed),
+		Dropped: atomic.LoadUint64(&s.Dropped),
+		Batches: atomic.LoadUint64(&s.Batches),
+	}
+}
+
+// relayedMessage is the payload of a DATA message that another connection
+// received, of a ROUTING message that carries data to another host of the
+// mesh, or of a STREAM message.
+type relayedMessage struct {
+	messageType MessageType
+	channel     uint8
+	data        []byte
+
+	// pooled, if set, is the pooled buffer that holds data, which is
+	// released once the message is sent.
+	pooled *[]byte
+}
+
+// RelayStats returns the statistics of the messages relayed to the remote
+// host.
+func (c *Conn) RelayStats() RelayStats {
+	return c.relayStats.snapshot()
+}
+
+// relay queues the payload of a DATA message that another connection
+// received, to be sent to the remote host.
+//
+// Payloads that have room for the GCM tag past their end, as decrypted ones
+// do, are encrypted in place.
+func (c *Conn) relay(channel uint8, data []byte) {
+	select {
+	case c.relayed <- relayedMessage{messageType: MessageTypeData, channel: channel, data: data}:
+	default:
+		atomic.AddUint64(&c.relayStats.Dropped, 1)
+	}
+}
+
+// relayRouting queues the payload of a ROUTING message that carries data to
+// another host of the mesh, to be sent to the remote host.
+func (c *Conn) relayRouting(data []byte) {
+	select {
+	case c.relayed <- relayedMessage{messageType: MessageTypeRouting, data: data}:
+	default:
+		atomic.AddUint64(&c.relayStats.Dropped, 1)
+	}
+}
+
+// sendRelayed sends a relayed message along with the ones queued after it, in
+// as few system calls as possible.
+func (c *Conn) sendRelayed(first relayedMessage) error {
+	batch := c.collectBatch(c.relayed, first)
+
+	if c.session == nil {
+		atomic.AddUint64(&c.relayStats.Dropped, uint64(len(batch)))
+
+		return nil
+	}
+
+	batches, err := c.sendBatch(batch)
+
+	if err != nil {
+		return err
+	}
+
+	atomic.AddUint64(&c.relayStats.Relayed, uint64(len(batch)))
+	atomic.AddUint64(&c.relayStats.Batches, uint64(batches))
+
+	return nil
+}
+
+// collectBatch returns a message along with the ones queued after it, up to
+// the batch size.
+//
+// The batch is only valid until the next call.
+func (c *Conn) collectBatch(queue chan relayedMessage, first relayedMessage) []relayedMessage {
+	batch := append(c.relayBatch[:0], first)
+
+	for len(batch) < c.config.Relay.batchSize() {
+		select {
+		case m := <-queue:
+			batch = append(batch, m)
+			continue
+		default:
+		}
+
+		break
+	}
+
+	c.relayBatch = batch[:0]
+
+	return batch
+}
+
+// sendBatch sends queued messages and returns the number of batches they were
+// sent in.
+//
+// A session must be established.
+func (c *Conn) sendBatch(batch []relayedMessage) (int, error) {
+	defer releaseBatch(batch)
+
+	// Paths and flows are picked message by message.
+	if c.multipath() || (len(c.flows) > 0 && c.features().Has(FeatureMultiFlow)) {
+		for _, m := range batch {
+			if m.messageType != MessageTypeData {
+				if err := c.sendEncrypted(m.messageType, 0, m.data); err != nil {
+					return 0, err
+				}
+			} else if err := c.sendData(m.channel, m.data); err != nil {
+				return 0, err
+			}
+		}
+
+		return len(batch), nil
+	}
+
+	c.relayBuf.Reset()
+	offsets := c.relayOffsets[:0]
+
+	for _, m := range batch {
+		if err := c.appendRelayed(&c.relayBuf, m); err != nil {
+			return 0, err
+		}
+
+		offsets = append(offsets, c.relayBuf.Len())
+	}
+
+	c.relayOffsets = offsets
+	datagrams := c.relayDatagrams[:0]
+	b := c.relayBuf.Bytes()
+	start := 0
+
+	for _, end := range offsets {
+		datagrams = append(datagrams, b[start:end])
+		start = end
+	}
+
+	c.relayDatagrams = datagrams[:0]
+
+	if err := c.client.batchWriter.writeBatch(datagrams, c.RemoteAddr().(*Addr).TransportAddr); err != nil {
+		return 0, err
+	}
+
+	return 1, nil
+}
+
+// releaseBatch releases the pooled buffers of queued messages.
+func releaseBatch(batch []relayedMessage) {
+	for _, m := range batch {
+		if m.pooled != nil {
+			putStreamBuffer(m.pooled)
+		}
+	}
+}
+
+// appendRelayed encrypts a relayed message and appends it to a buffer.
+func (c *Conn) appendRelayed(buf *bytes.Buffer, m relayedMessage) error {
+	if m.messageType == MessageTypeData {
+		return c.appendData(buf, m.channel, m.data)
+	}
+
+	msg := c.session.Encrypt(m.data)
+
+	c.debugPrintf("Sending %s.\n", msg)
+
+	c.lastSent = time.Now()
+
+	return writeMessage(buf, m.messageType, msg)
+}
+
+// batchWriter sends several datagrams to the same address in as few system
+// calls as the platform allows.
+//
+// It is thread-safe.
+type batchWriter struct {
+	conn net.PacketConn
+	v4   *ipv4.PacketConn
+	v6   *ipv6.PacketConn
+
+	// unsupported is set once batches were found not to be supported.
+	unsupported int32
+}
+
+func newBatchWriter(conn net.PacketConn) *batchWriter {
+	w := &batchWriter{conn: conn}
+
+	// Batches require the system calls of a real socket.
+	if udpConn, ok := conn.(*net.UDPConn); ok {
+		if laddr, ok := udpConn.LocalAddr().(*net.UDPAddr); ok && laddr.IP.To4() != nil {
+			w.v4 = ipv4.NewPacketConn(udpConn)
+		} else {
+			w.v6 = ipv6.NewPacketConn(udpConn)
+		}
+	}
+
+	return w
+}
+
+// writeBatch sends datagrams to the specified address.
+func (w *batchWriter) writeBatch(datagrams [][]byte, addr net.Addr) error {
+	if len(datagrams) > 1 && w.batches(addr) {
+		sent, err := w.tryWriteBatch(datagrams, addr)
+
+		if err == nil {
+			return nil
+		}
+
+		if sent == 0 {
+			atomic.StoreInt32(&w.unsupported, 1)
+			debugPrintf("sending batches is not supported: %s\n", err)
+		}
+
+		// The datagrams that were not sent are sent one at a time, which
+		// reports the errors.
+		datagrams = datagrams[sent:]
+	}
+
+	for _, datagram := range datagrams {
+		if _, err := w.conn.WriteTo(datagram, addr); err != nil {
+			return err
+		}
+	}
+
+	return nil
+}
+
+// batches tells whether datagrams to the specified address may be sent in
+// batches.
+func (w *batchWriter) batches(addr net.Addr) bool {
+	if atomic.LoadInt32(&w.unsupported) != 0 {
+		return false
+	}
+
+	udpAddr, ok := addr.(*net.UDPAddr)
+
+	if !ok {
+		return false
+	}
+
+	// IPv6 sockets take IPv4-mapped addresses, which the IPv6 package does
+	// not make.
+	return w.v4 != nil || (w.v6 != nil && udpAddr.IP.To4() == nil)
+}
+
+// tryWriteBatch sends datagrams in batches and returns the number of
+// datagrams it sent.
+func (w *batchWriter) tryWriteBatch(datagrams [][]byte, addr net.Addr) (sent int, err error) {
+	messages := make([]ipv4.Message, len(datagrams))
+
+	for i, datagram := range datagrams {
+		messages[i] = ipv4.Message{Buffers: [][]byte{datagram}, Addr: addr}
+	}
+
+	for sent < len(messages) {
+		var n int
+
+		if w.v4 != nil {
+			n, err = w.v4.WriteBatch(messages[sent:], 0)
+		} else {
+			n, err = w.v6.WriteBatch(messages[sent:], 0)
+		}
+
+		if err != nil {
+			return sent, err
+		}
+
+		sent += n
+	}
+
+	return sent, nil
+}
@@ -0,0 +1,494 @@
+package fscp
+
+import (
+	"context"
+	cryptorand "crypto/rand"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"net"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/google/gopacket"
+	"github.com/google/gopacket/layers"
+)
+
+const (
+	// DefaultResolverTTL is the time for which the addresses returned by the
+	// system resolver, which does not expose the TTL of the records, are
+	// cached.
+	DefaultResolverTTL = time.Minute
+
+	// DefaultResolverMinTTL is the default minimum time for which resolved
+	// addresses are cached.
+	DefaultResolverMinTTL = time.Second * 5
+
+	// DefaultResolverMaxTTL is the default maximum time for which resolved
+	// addresses are cached.
+	DefaultResolverMaxTTL = time.Hour
+
+	// DefaultResolverStaleTTL is the default time for which expired addresses
+	// are still served while they are refreshed.
+	DefaultResolverStaleTTL = time.Hour
+
+	// DefaultResolverTimeout is the default timeout of DNS queries.
+	DefaultResolverTimeout = time.Second * 5
+)
+
+// ErrNoAddresses is returned when a host name has no addresses.
+var ErrNoAddresses = errors.New("no addresses")
+
+// A Resolver resolves host names to FSCP addresses and caches the results.
+//
+// Cached addresses are served until their TTL expires, and then for StaleTTL
+// more while they are refreshed in the background, so that reconnections do
+// not wait for slow DNS servers. The A and AAAA records are looked up in
+// parallel.
+//
+// The zero value is a valid resolver that uses the default settings.
+type Resolver struct {
+	// Servers are the addresses of the DNS servers to query directly, which
+	// exposes the TTL of the records. If empty, the system resolver is used
+	// and addresses are cached for DefaultResolverTTL.
+	Servers []string
+
+	// MinTTL and MaxTTL bound the time for which addresses are cached.
+	MinTTL time.Duration
+	MaxTTL time.Duration
+
+	// StaleTTL is the time for which expired addresses are still served,
+	// while they are refreshed in the background.
+	StaleTTL time.Duration
+
+	// Timeout is the timeout of the DNS queries.
+	Timeout time.Duration
+
+	lock    sync.Mutex
+	entries map[string]*resolverEntry
+}
+
+// resolverEntry contains the cached addresses of a host.
+type resolverEntry struct {
+	ips        []net.IPAddr
+	expires    time.Time
+	refreshing bool
+
+	// ready is closed once the first lookup completes, with err set if it
+	// failed.
+	ready chan struct{}
+	err   error
+}
+
+func (r *Resolver) minTTL() time.Duration {
+	if r.MinTTL <= 0 {
+		return DefaultResolverMinTTL
+	}
+
+	return r.MinTTL
+}
+
+func (r *Resolver) maxTTL() time.Duration {
+	if r.MaxTTL <= 0 {
+		return DefaultResolverMaxTTL
+	}
+
+	return r.MaxTTL
+}
+
+func (r *Resolver) staleTTL() time.Duration {
+	if r.StaleTTL <= 0 {
+		return DefaultResolverStaleTTL
+	}
+
+	return r.StaleTTL
+}
+
+func (r *Resolver) timeout() time.Duration {
+	if r.Timeout <= 0 {
+		return DefaultResolverTimeout
+	}
+
+	return r.Timeout
+}
+
+// LookupIPAddr returns the addresses of a host.
+func (r *Resolver) LookupIPAddr(ctx context.Context, host string) ([]net.IPAddr, error) {
+	if ip, zone := parseIPZone(host); ip != nil {
+		return []net.IPAddr{{IP: ip, Zone: zone}}, nil
+	}
+
+	now := time.Now()
+
+	r.lock.Lock()
+
+	if r.entries == nil {
+		r.entries = map[string]*resolverEntry{}
+	}
+
+	entry, ok := r.entries[host]
+
+	if ok {
+		select {
+		case <-entry.ready:
+			if entry.err == nil && now.Before(entry.expires.Add(r.staleTTL())) {
+				if !now.Before(entry.expires) && !entry.refreshing {
+					entry.refreshing = true
+					go r.refresh(host, entry)
+				}
+
+				ips := entry.ips
+				r.lock.Unlock()
+
+				return ips, nil
+			}
+
+			ok = false
+		default:
+		}
+	}
+
+	if !ok {
+		entry = &resolverEntry{ready: make(chan struct{})}
+		r.entries[host] = entry
+
+		go r.refresh(host, entry)
+	}
+
+	r.lock.Unlock()
+
+	select {
+	case <-entry.ready:
+		return entry.ips, entry.err
+	case <-ctx.Done():
+		return nil, ctx.Err()
+	}
+}
+
+// ResolveFSCPAddrs resolves a FSCP address to all the endpoints of its host,
+// ordered so that address families alternate.
+func (r *Resolver) ResolveFSCPAddrs(ctx context.Context, network, address string) ([]*Addr, error) {
+	if network != Network {
+		return nil, fmt.Errorf("unsupported network: %s", network)
+	}
+
+	host, port, err := net.SplitHostPort(address)
+
+	if err != nil {
+		return nil, fmt.Errorf("parsing FSCP address: %s", err)
+	}
+
+	portNumber, err := net.LookupPort("udp", port)
+
+	if err != nil {
+		return nil, fmt.Errorf("parsing FSCP address: %s", err)
+	}
+
+	// Unspecified hosts have a single endpoint.
+	if host == "" {
+		return []*Addr{{TransportAddr: &net.UDPAddr{Port: portNumber}}}, nil
+	}
+
+	ips, err := r.LookupIPAddr(ctx, host)
+
+	if err != nil {
+		return nil, fmt.Errorf("parsing FSCP address: %s", err)
+	}
+
+	return makeFSCPAddrs(ips, portNumber), nil
+}
+
+// Watch keeps the candidate endpoints of a connection in sync with the
+// addresses of a host, which is useful with dynamic DNS, until the context is
+// done or the connection is closed.
+//
+// The addresses are resolved again whenever their TTL expires.
+func (r *Resolver) Watch(ctx context.Context, conn *Conn, network, address string) error {
+	addrs, err := r.ResolveFSCPAddrs(ctx, network, address)
+
+	if err != nil {
+		return err
+	}
+
+	if err := conn.SetCandidates(addrs); err != nil {
+		return err
+	}
+
+	host, _, _ := net.SplitHostPort(address)
+
+	go func() {
+		for {
+			select {
+			case <-time.After(r.untilExpiry(host)):
+			case <-conn.closed:
+				return
+			case <-ctx.Done():
+				return
+			}
+
+			latest, err := r.ResolveFSCPAddrs(ctx, network, address)
+
+			if err != nil || sameAddrs(latest, addrs) {
+				continue
+			}
+
+			addrs = latest
+
+			if err := conn.SetCandidates(addrs); err != nil {
+				return
+			}
+		}
+	}()
+
+	return nil
+}
+
+// untilExpiry returns the time after which the cached addresses of a host
+// should be refreshed.
+func (r *Resolver) untilExpiry(host string) time.Duration {
+	r.lock.Lock()
+	defer r.lock.Unlock()
+
+	if entry, ok := r.entries[host]; ok {
+		select {
+		case <-entry.ready:
+			if d := time.Until(entry.expires); d > 0 {
+				return d
+			}
+		default:
+		}
+	}
+
+	return r.minTTL()
+}
+
+// refresh looks up the addresses of a host and updates its cache entry.
+//
+// A failed refresh keeps serving the previous addresses until they are too
+// stale.
+func (r *Resolver) refresh(host string, entry *resolverEntry) {
+	ctx, cancel := context.WithTimeout(context.Background(), r.timeout())
+	defer cancel()
+
+	ips, ttl, err := r.lookup(ctx, host)
+
+	if ttl < r.minTTL() {
+		ttl = r.minTTL()
+	} else if ttl > r.maxTTL() {
+		ttl = r.maxTTL()
+	}
+
+	r.lock.Lock()
+	defer r.lock.Unlock()
+
+	select {
+	case <-entry.ready:
+		entry.refreshing = false
+
+		if err == nil {
+			entry.ips, entry.expires = ips, time.Now().Add(ttl)
+		}
+	default:
+		entry.ips, entry.err, entry.expires = ips, err, time.Now().Add(ttl)
+		close(entry.ready)
+
+		// Failures are not cached.
+		if err != nil && r.entries[host] == entry {
+			delete(r.entries, host)
+		}
+	}
+}
+
+// lookup looks up the addresses of a host, and the time for which they may be
+// cached.
+func (r *Resolver) lookup(ctx context.Context, host string) ([]net.IPAddr, time.Duration, error) {
+	if len(r.Servers) == 0 {
+		ips, err := net.DefaultResolver.LookupIPAddr(ctx, host)
+
+		return ips, DefaultResolverTTL, err
+	}
+
+	var err error
+
+	for _, server := range r.Servers {
+		var ips []net.IPAddr
+		var ttl time.Duration
+
+		if ips, ttl, err = queryIPAddrs(ctx, server, host); err == nil {
+			return ips, ttl, nil
+		}
+	}
+
+	return nil, 0, err
+}
+
+// queryIPAddrs queries a DNS server for the A and AAAA records of a host, in
+// parallel.
+func queryIPAddrs(ctx context.Context, server string, host string) ([]net.IPAddr, time.Duration, error) {
+	type result struct {
+		ips []net.IPAddr
+		ttl time.Duration
+		err error
+	}
+
+	results := make(chan result, 2)
+
+	for _, qtype := range []layers.DNSType{layers.DNSTypeA, layers.DNSTypeAAAA} {
+		qtype := qtype
+
+		go func() {
+			ips, ttl, err := queryDNS(ctx, server, host, qtype)
+			results <- result{ips, ttl, err}
+		}()
+	}
+
+	var ips []net.IPAddr
+	var ttl time.Duration
+	var err error
+
+	for i := 0; i < 2; i++ {
+		result := <-results
+
+		if result.err != nil {
+			err = result.err
+			continue
+		}
+
+		if len(result.ips) > 0 && (ttl == 0 || result.ttl < ttl) {
+			ttl = result.ttl
+		}
+
+		ips = append(ips, result.ips...)
+	}
+
+	if len(ips) == 0 {
+		if err == nil {
+			err = ErrNoAddresses
+		}
+
+		return nil, 0, fmt.Errorf("looking up %s: %s", host, err)
+	}
+
+	return ips, ttl, nil
+}
+
+// queryDNS queries a DNS server for the records of the specified type of a
+// host, and returns the addresses they contain along with their smallest TTL.
+func queryDNS(ctx context.Context, server string, host string, qtype layers.DNSType) ([]net.IPAddr, time.Duration, error) {
+	conn, err := (&net.Dialer{}).DialContext(ctx, "udp", server)
+
+	if err != nil {
+		return nil, 0, err
+	}
+
+	defer conn.Close()
+
+	if deadline, ok := ctx.Deadline(); ok {
+		conn.SetDeadline(deadline)
+	}
+
+	// Unpredictable identifiers make spoofed answers harder.
+	var id uint16
+
+	if err := binary.Read(cryptorand.Reader, binary.BigEndian, &id); err != nil {
+		return nil, 0, err
+	}
+
+	query := &layers.DNS{
+		ID: id,
+		RD: true,
+		Questions: []layers.DNSQuestion{
+			{Name: []byte(strings.TrimSuffix(host, ".")), Type: qtype, Class: layers.DNSClassIN},
+		},
+	}
+
+	buf := gopacket.NewSerializeBuffer()
+
+	if err := query.SerializeTo(buf, gopacket.SerializeOptions{FixLengths: true}); err != nil {
+		return nil, 0, err
+	}
+
+	if _, err := conn.Write(buf.Bytes()); err != nil {
+		return nil, 0, err
+	}
+
+	b := make([]byte, 4096)
+
+	for {
+		n, err := conn.Read(b)
+
+		if err != nil {
+			return nil, 0, err
+		}
+
+		response := &layers.DNS{}
+
+		// Stray and malformed datagrams are ignored.
+		if err := response.DecodeFromBytes(b[:n], gopacket.NilDecodeFeedback); err != nil || !response.QR || response.ID != query.ID {
+			continue
+		}
+
+		if response.ResponseCode != layers.DNSResponseCodeNoErr {
+			return nil, 0, fmt.Errorf("%s query failed: %s", qtype, response.ResponseCode)
+		}
+
+		var ips []net.IPAddr
+		var ttl time.Duration
+
+		for _, answer := range response.Answers {
+			if answer.Type != qtype || answer.IP == nil {
+				continue
+			}
+
+			if d := time.Duration(answer.TTL) * time.Second; len(ips) == 0 || d < ttl {
+				ttl = d
+			}
+
+			ips = append(ips, net.IPAddr{IP: answer.IP})
+		}
+
+		return ips, ttl, nil
+	}
+}
+
+// sameAddrs tells whether two lists contain the same addresses, in the same
+// order.
+func sameAddrs(a, b []*Addr) bool {
+	if len(a) != len(b) {
+		return false
+	}
+
+	for i := range a {
+		if a[i].String() != b[i].String() {
+			return false
+		}
+	}
+
+	return true
+}
+
+// parseIPZone parses an IP address with an optional zone.
+func parseIPZone(host string) (net.IP, string) {
+	zone := ""
+
+	if i := strings.LastIndexByte(host, '%'); i >= 0 {
+		host, zone = host[:i], host[i+1:]
+	}
+
+	return net.ParseIP(host), zone
+}
+
+// makeFSCPAddrs makes the FSCP addresses of a host, ordered so that address
+// families alternate.
+func makeFSCPAddrs(ips []net.IPAddr, port int) []*Addr {
+	addrs := make([]*Addr, len(ips))
+
+	for i, ip := range ips {
+		addrs[i] = &Addr{
+			TransportAddr: &net.UDPAddr{IP: ip.IP, Port: port, Zone: ip.Zone},
+		}
+	}
+
+	return interleaveFamilies(addrs)
+}
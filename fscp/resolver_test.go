@@ -0,0 +1,241 @@
+package fscp
+
+import (
+	"context"
+	"fmt"
+	"net"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/google/gopacket"
+	"github.com/google/gopacket/layers"
+)
+
+// stubDNSServer is a DNS server that answers with the records it is given.
+type stubDNSServer struct {
+	conn    net.PacketConn
+	lock    sync.Mutex
+	ips     []net.IP
+	ttl     uint32
+	queries int
+}
+
+func listenStubDNSServer(t *testing.T, ttl uint32, ips ...net.IP) *stubDNSServer {
+	t.Helper()
+
+	conn, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	server := &stubDNSServer{conn: conn, ips: ips, ttl: ttl}
+	t.Cleanup(func() { conn.Close() })
+
+	go server.serve()
+
+	return server
+}
+
+func (s *stubDNSServer) serve() {
+	b := make([]byte, 4096)
+
+	for {
+		n, addr, err := s.conn.ReadFrom(b)
+
+		if err != nil {
+			return
+		}
+
+		query := &layers.DNS{}
+
+		if err := query.DecodeFromBytes(b[:n], gopacket.NilDecodeFeedback); err != nil || len(query.Questions) != 1 {
+			continue
+		}
+
+		question := query.Questions[0]
+		response := &layers.DNS{
+			ID:        query.ID,
+			QR:        true,
+			RD:        query.RD,
+			RA:        true,
+			Questions: query.Questions,
+		}
+
+		s.lock.Lock()
+		s.queries++
+
+		for _, ip := range s.ips {
+			if (ip.To4() != nil) == (question.Type == layers.DNSTypeA) {
+				response.Answers = append(response.Answers, layers.DNSResourceRecord{
+					Name:  question.Name,
+					Type:  question.Type,
+					Class: layers.DNSClassIN,
+					TTL:   s.ttl,
+					IP:    ip,
+				})
+			}
+		}
+
+		s.lock.Unlock()
+
+		buf := gopacket.NewSerializeBuffer()
+
+		if err := response.SerializeTo(buf, gopacket.SerializeOptions{FixLengths: true}); err != nil {
+			continue
+		}
+
+		s.conn.WriteTo(buf.Bytes(), addr)
+	}
+}
+
+func (s *stubDNSServer) setIPs(ips ...net.IP) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	s.ips = ips
+}
+
+func (s *stubDNSServer) queryCount() int {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	return s.queries
+}
+
+func TestResolverCache(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	server := listenStubDNSServer(t, 60, net.IPv4(127, 0, 0, 1), net.IPv6loopback)
+	resolver := &Resolver{Servers: []string{server.conn.LocalAddr().String()}}
+
+	addrs, err := resolver.ResolveFSCPAddrs(ctx, Network, "peer.test:12000")
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	found := map[string]bool{}
+
+	for _, addr := range addrs {
+		found[addr.String()] = true
+	}
+
+	if len(addrs) != 2 || !found["127.0.0.1:12000"] || !found["[::1]:12000"] {
+		t.Errorf("expected the A and AAAA records but got %v", addrs)
+	}
+
+	if n := server.queryCount(); n != 2 {
+		t.Errorf("expected 2 queries but got %d", n)
+	}
+
+	if _, err := resolver.ResolveFSCPAddrs(ctx, Network, "peer.test:12001"); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if n := server.queryCount(); n != 2 {
+		t.Errorf("expected the addresses to be cached but got %d queries", n)
+	}
+
+	// IP literals are never looked up.
+	if _, err := resolver.ResolveFSCPAddrs(ctx, Network, "127.0.0.1:12000"); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if n := server.queryCount(); n != 2 {
+		t.Errorf("expected no lookup of an IP literal but got %d queries", n)
+	}
+}
+
+func TestResolverStale(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	server := listenStubDNSServer(t, 0, net.IPv4(127, 0, 0, 1))
+	resolver := &Resolver{
+		Servers: []string{server.conn.LocalAddr().String()},
+		MinTTL:  time.Millisecond * 50,
+	}
+
+	if _, err := resolver.LookupIPAddr(ctx, "peer.test"); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	server.setIPs(net.IPv4(127, 0, 0, 2))
+	time.Sleep(time.Millisecond * 100)
+
+	// The expired addresses are served while they are refreshed.
+	ips, err := resolver.LookupIPAddr(ctx, "peer.test")
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if len(ips) != 1 || !ips[0].IP.Equal(net.IPv4(127, 0, 0, 1)) {
+		t.Errorf("expected the stale address but got %v", ips)
+	}
+
+	for {
+		ips, err := resolver.LookupIPAddr(ctx, "peer.test")
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if len(ips) == 1 && ips[0].IP.Equal(net.IPv4(127, 0, 0, 2)) {
+			break
+		}
+
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected the addresses to be refreshed but got %v", ips)
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+}
+
+func TestResolverWatch(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	dns := listenStubDNSServer(t, 0, net.IPv4(127, 0, 0, 1))
+	resolver := &Resolver{
+		Servers: []string{dns.conn.LocalAddr().String()},
+		MinTTL:  time.Millisecond * 50,
+	}
+
+	server := listenTestClient(t, nil)
+	port := server.Addr().(*Addr).TransportAddr.(*net.UDPAddr).Port
+	address := fmt.Sprintf("peer.test:%d", port)
+
+	client := listenTestClient(t, nil)
+	conn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if err := resolver.Watch(ctx, conn, Network, address); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	// The host moves to another address, which becomes a candidate.
+	dns.setIPs(net.IPv4(127, 0, 0, 2))
+	expected := fmt.Sprintf("127.0.0.2:%d", port)
+
+	for {
+		for _, stats := range conn.PathsStats().Paths {
+			if stats.Addr.String() == expected {
+				return
+			}
+		}
+
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected %s to become a candidate but got %v", expected, conn.PathsStats().Paths)
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+}
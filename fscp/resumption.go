@@ -0,0 +1,246 @@
+package fscp
+
+import (
+	"container/list"
+	"crypto/rand"
+	"crypto/x509"
+	"encoding/hex"
+	"fmt"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+const (
+	// DefaultTicketLifetime is the default lifetime of resumption tickets.
+	DefaultTicketLifetime = time.Hour
+	// DefaultTicketCacheSize is the default maximum number of resumption
+	// tickets a client keeps.
+	DefaultTicketCacheSize = 1024
+)
+
+// A TicketID identifies a resumption ticket.
+type TicketID [16]byte
+
+func (i TicketID) String() string {
+	return hex.EncodeToString(i[:])
+}
+
+// A ResumptionNonce is a random value that makes the keys of every resumed
+// session unique.
+type ResumptionNonce [32]byte
+
+// ResumptionConfig contains the session resumption settings.
+//
+// After a full handshake, both hosts derive a resumption secret and a ticket
+// from it. Reconnecting within the lifetime of the ticket takes a single
+// round-trip and only symmetric cryptography: a RESUME REQUEST authenticated
+// with the secret, answered by a RESUME message. Tickets are single-use: every
+// resumed session yields a new one.
+type ResumptionConfig struct {
+	// Disabled disables session resumption.
+	Disabled bool
+
+	// TicketLifetime is the time after which tickets expire.
+	TicketLifetime time.Duration
+
+	// CacheSize is the maximum number of tickets to keep. The least recently
+	// issued tickets are evicted first.
+	CacheSize int
+}
+
+func (c *ResumptionConfig) ticketLifetime() time.Duration {
+	if c.TicketLifetime <= 0 {
+		return DefaultTicketLifetime
+	}
+
+	return c.TicketLifetime
+}
+
+func (c *ResumptionConfig) cacheSize() int {
+	if c.CacheSize <= 0 {
+		return DefaultTicketCacheSize
+	}
+
+	return c.CacheSize
+}
+
+// ResumptionStats contains the session resumption statistics of a client.
+type ResumptionStats struct {
+	// Issued is the number of tickets that were issued.
+	Issued uint64
+
+	// Resumed is the number of sessions that were resumed, either as the
+	// requesting or the answering host.
+	Resumed uint64
+
+	// Rejected is the number of resumption requests that were rejected.
+	Rejected uint64
+
+	// Evicted is the number of tickets that were evicted from the cache
+	// before they expired.
+	Evicted uint64
+}
+
+// A resumptionTicket contains what is needed to resume a session with a
+// remote host.
+type resumptionTicket struct {
+	id                   TicketID
+	secret               []byte
+	remoteAddr           string
+	remoteHostIdentifier HostIdentifier
+	remoteCertificate    *x509.Certificate
+	remoteFeatures       FeatureSet
+	sessionNumber        SessionNumber
+	cipherSuite          CipherSuite
+	ellipticCurve        EllipticCurve
+	expires              time.Time
+}
+
+// ticketCache is a bounded cache of resumption tickets, indexed by their
+// identifier and by the address of their remote host.
+//
+// It is thread-safe.
+type ticketCache struct {
+	config ResumptionConfig
+	stats  ResumptionStats
+
+	lock   sync.Mutex
+	order  *list.List
+	byID   map[TicketID]*list.Element
+	byAddr map[string]*list.Element
+}
+
+func newTicketCache(config ResumptionConfig) *ticketCache {
+	return &ticketCache{
+		config: config,
+		order:  list.New(),
+		byID:   map[TicketID]*list.Element{},
+		byAddr: map[string]*list.Element{},
+	}
+}
+
+// put adds a ticket to the cache, replacing any ticket for the same remote
+// host.
+func (c *ticketCache) put(ticket *resumptionTicket) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if element, ok := c.byAddr[ticket.remoteAddr]; ok {
+		c.removeElement(element)
+	}
+
+	if element, ok := c.byID[ticket.id]; ok {
+		c.removeElement(element)
+	}
+
+	element := c.order.PushBack(ticket)
+	c.byID[ticket.id] = element
+	c.byAddr[ticket.remoteAddr] = element
+
+	for c.order.Len() > c.config.cacheSize() {
+		c.removeElement(c.order.Front())
+		atomic.AddUint64(&c.stats.Evicted, 1)
+	}
+
+	atomic.AddUint64(&c.stats.Issued, 1)
+}
+
+// byAddress returns the ticket for the remote host at the specified address,
+// if any.
+func (c *ticketCache) byAddress(remoteAddr string, now time.Time) *resumptionTicket {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if element, ok := c.byAddr[remoteAddr]; ok {
+		return c.valid(element, now)
+	}
+
+	return nil
+}
+
+// byTicketID returns the ticket with the specified identifier, if any.
+func (c *ticketCache) byTicketID(id TicketID, now time.Time) *resumptionTicket {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if element, ok := c.byID[id]; ok {
+		return c.valid(element, now)
+	}
+
+	return nil
+}
+
+// remove removes a ticket from the cache, which makes it unusable.
+//
+// It returns false if the ticket was removed already.
+func (c *ticketCache) remove(ticket *resumptionTicket) bool {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if element, ok := c.byID[ticket.id]; ok && element.Value == ticket {
+		c.removeElement(element)
+		return true
+	}
+
+	return false
+}
+
+// clear removes all the tickets.
+func (c *ticketCache) clear() {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	c.order.Init()
+	c.byID = map[TicketID]*list.Element{}
+	c.byAddr = map[string]*list.Element{}
+}
+
+func (c *ticketCache) snapshot() ResumptionStats {
+	return ResumptionStats{
+		Issued:   atomic.LoadUint64(&c.stats.Issued),
+		Resumed:  atomic.LoadUint64(&c.stats.Resumed),
+		Rejected: atomic.LoadUint64(&c.stats.Rejected),
+		Evicted:  atomic.LoadUint64(&c.stats.Evicted),
+	}
+}
+
+// valid returns the ticket of an element, unless it expired in which case it
+// is removed.
+//
+// The lock *MUST* be held before calling this method.
+func (c *ticketCache) valid(element *list.Element, now time.Time) *resumptionTicket {
+	ticket := element.Value.(*resumptionTicket)
+
+	if !now.Before(ticket.expires) {
+		c.removeElement(element)
+		return nil
+	}
+
+	return ticket
+}
+
+// removeElement removes an element from the cache.
+//
+// The lock *MUST* be held before calling this method.
+func (c *ticketCache) removeElement(element *list.Element) {
+	ticket := element.Value.(*resumptionTicket)
+
+	c.order.Remove(element)
+
+	if c.byID[ticket.id] == element {
+		delete(c.byID, ticket.id)
+	}
+
+	if c.byAddr[ticket.remoteAddr] == element {
+		delete(c.byAddr, ticket.remoteAddr)
+	}
+}
+
+func newResumptionNonce() (nonce ResumptionNonce, err error) {
+	if _, err = rand.Read(nonce[:]); err != nil {
+		err = fmt.Errorf("generating a resumption nonce: %s", err)
+	}
+
+	return
+}
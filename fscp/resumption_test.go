@@ -0,0 +1,217 @@
+package fscp
+
+import (
+	"bytes"
+	"context"
+	"net"
+	"testing"
+	"time"
+)
+
+func TestTicketCache(t *testing.T) {
+	cache := newTicketCache(ResumptionConfig{CacheSize: 2})
+	now := time.Now()
+
+	a := &resumptionTicket{id: TicketID{1}, remoteAddr: "a", expires: now.Add(time.Minute)}
+	b := &resumptionTicket{id: TicketID{2}, remoteAddr: "b", expires: now.Add(time.Second)}
+	c := &resumptionTicket{id: TicketID{3}, remoteAddr: "c", expires: now.Add(time.Minute)}
+
+	cache.put(a)
+	cache.put(b)
+
+	if ticket := cache.byAddress("a", now); ticket != a {
+		t.Errorf("expected %v but got %v", a, ticket)
+	}
+
+	if ticket := cache.byTicketID(b.id, now); ticket != b {
+		t.Errorf("expected %v but got %v", b, ticket)
+	}
+
+	if ticket := cache.byTicketID(b.id, now.Add(time.Second)); ticket != nil {
+		t.Errorf("expected the ticket to have expired but got %v", ticket)
+	}
+
+	cache.put(b)
+	cache.put(c)
+
+	if ticket := cache.byAddress("a", now); ticket != nil {
+		t.Errorf("expected the oldest ticket to be evicted but got %v", ticket)
+	}
+
+	// A new ticket for the same host replaces the previous one.
+	d := &resumptionTicket{id: TicketID{4}, remoteAddr: "c", expires: now.Add(time.Minute)}
+	cache.put(d)
+
+	if ticket := cache.byTicketID(c.id, now); ticket != nil {
+		t.Errorf("expected the ticket to be replaced but got %v", ticket)
+	}
+
+	if !cache.remove(d) {
+		t.Errorf("expected the ticket to be removed")
+	}
+
+	if cache.remove(d) {
+		t.Errorf("expected the ticket to be removed already")
+	}
+
+	stats := cache.snapshot()
+
+	if stats.Issued != 5 || stats.Evicted != 1 {
+		t.Errorf("unexpected stats: %+v", stats)
+	}
+}
+
+func TestResumedSession(t *testing.T) {
+	hostA, hostB := HostIdentifier{1}, HostIdentifier{2}
+	sessionA, _ := NewSession(hostA, 1, ECDHERSAAES256GCMSHA384, SECP384R1)
+	sessionB, _ := NewSession(hostB, 1, ECDHERSAAES256GCMSHA384, SECP384R1)
+
+	if err := sessionA.SetRemote(hostB, sessionB.PublicKey); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if err := sessionB.SetRemote(hostA, sessionA.PublicKey); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if sessionA.TicketID != sessionB.TicketID || !bytes.Equal(sessionA.ResumptionSecret, sessionB.ResumptionSecret) {
+		t.Fatalf("expected both hosts to derive the same ticket")
+	}
+
+	requestNonce, _ := newResumptionNonce()
+	responseNonce, _ := newResumptionNonce()
+
+	resumedA, err := newResumedSession(hostA, hostB, 2, sessionA.CipherSuite, sessionA.EllipticCurve, sessionA.ResumptionSecret, requestNonce, responseNonce)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	resumedB, err := newResumedSession(hostB, hostA, 2, sessionB.CipherSuite, sessionB.EllipticCurve, sessionB.ResumptionSecret, requestNonce, responseNonce)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if bytes.Equal(resumedA.LocalSessionKey, sessionA.LocalSessionKey) {
+		t.Errorf("expected the resumed session to have new keys")
+	}
+
+	if resumedA.TicketID == sessionA.TicketID {
+		t.Errorf("expected the resumed session to have a new ticket")
+	}
+
+	data, err := resumedB.Decrypt(resumedA.Encrypt([]byte("resumed")))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if string(data) != "resumed" {
+		t.Errorf("expected `resumed` but got `%s`", data)
+	}
+}
+
+// reconnect closes a connection and connects again to the same host.
+func reconnect(ctx context.Context, t *testing.T, client *Client, conn *Conn) *Conn {
+	t.Helper()
+
+	conn.Close()
+
+	for countConns(client) != 0 {
+		time.Sleep(time.Millisecond * 10)
+	}
+
+	conn, err := client.Connect(ctx, conn.RemoteAddr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	return conn
+}
+
+func TestSessionResumption(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	server := listenTestClient(t, nil)
+	client := listenTestClient(t, nil)
+
+	clientConn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	serverConn, err := server.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if stats := client.ResumptionStats(); stats.Issued != 1 {
+		t.Errorf("expected a ticket to be issued: %+v", stats)
+	}
+
+	clientConn = reconnect(ctx, t, client, clientConn)
+
+	if stats := client.ResumptionStats(); stats.Resumed != 1 || stats.Issued != 2 {
+		t.Errorf("expected the session to be resumed: %+v", stats)
+	}
+
+	if stats := server.ResumptionStats(); stats.Resumed != 1 {
+		t.Errorf("expected the session to be resumed: %+v", stats)
+	}
+
+	for _, pair := range [][2]net.Conn{{clientConn, serverConn}, {serverConn, clientConn}} {
+		if _, err := pair[0].Write([]byte("resumed")); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		b := make([]byte, 16)
+		n, err := pair[1].Read(b)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if string(b[:n]) != "resumed" {
+			t.Errorf("expected `resumed` but got `%s`", b[:n])
+		}
+	}
+
+	// A restarted host has no ticket: resumption is rejected and a full
+	// handshake takes place right away.
+	serverAddr := server.Addr().(*Addr).TransportAddr.(*net.UDPAddr)
+	server.Close()
+
+	for countConns(server) != 0 {
+		time.Sleep(time.Millisecond * 10)
+	}
+
+	socket, err := net.ListenUDP("udp", serverAddr)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	server, err = NewClient(socket, nil)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer server.Close()
+
+	start := time.Now()
+	clientConn = reconnect(ctx, t, client, clientConn)
+
+	if elapsed := time.Since(start); elapsed > time.Second*2 {
+		t.Errorf("expected an immediate fallback to a full handshake but it took %s", elapsed)
+	}
+
+	if stats := server.ResumptionStats(); stats.Rejected != 1 {
+		t.Errorf("expected the resumption to be rejected: %+v", stats)
+	}
+}
@@ -1,29 +1,48 @@
 package fscp
 
 import (
+	cryptorand "crypto/rand"
+	"encoding/binary"
+	"errors"
+	"math/rand"
 	"sync"
+	"sync/atomic"
 	"time"
 )
 
+// ErrTooManyRetries is passed to the failure callback of a Retrier that
+// reached its maximum number of retries.
+var ErrTooManyRetries = errors.New("too many retries")
+
 // A Retrier retries a given operation until it is satisfied.
 type Retrier struct {
 	Operation func() error
 	OnFailure func(error)
 	Period    time.Duration
-	once      sync.Once
-	closed    chan struct{}
+
+	// Backoff, if set, computes the delays between attempts instead of using
+	// a fixed Period.
+	Backoff *Backoff
+
+	// MaxRetries, if positive, is the number of retries after which the
+	// retrier gives up with ErrTooManyRetries.
+	MaxRetries int
+
+	attempts int32
+	once     sync.Once
+	closed   chan struct{}
 }
 
 // Start the retrier.
 func (r *Retrier) Start() {
 	r.closed = make(chan struct{})
 
-	if err := r.Operation(); err != nil {
+	if err := r.attempt(); err != nil {
 		r.OnFailure(err)
 		return
 	}
 
-	timer := time.NewTimer(r.Period)
+	timer := time.NewTimer(r.delay())
 
 	go func() {
 		defer timer.Stop()
@@ -36,13 +55,19 @@ func (r *Retrier) Start() {
 					return
 				}
 			case <-timer.C:
-				if err := r.Operation(); err != nil {
+				if r.MaxRetries > 0 && r.Attempts() > r.MaxRetries {
+					r.OnFailure(ErrTooManyRetries)
+					r.Stop()
+					continue
+				}
+
+				if err := r.attempt(); err != nil {
 					r.OnFailure(err)
 					r.Stop()
 					continue
 				}
 
-				timer.Reset(r.Period)
+				timer.Reset(r.delay())
 			}
 		}
 	}()
@@ -59,3 +84,74 @@ func (r *Retrier) Stop() bool {
 
 	return closed
 }
+
+// Attempts returns the number of times the operation was attempted so far.
+func (r *Retrier) Attempts() int {
+	return int(atomic.LoadInt32(&r.attempts))
+}
+
+func (r *Retrier) attempt() error {
+	atomic.AddInt32(&r.attempts, 1)
+
+	return r.Operation()
+}
+
+func (r *Retrier) delay() time.Duration {
+	if r.Backoff != nil {
+		return r.Backoff.next()
+	}
+
+	return r.Period
+}
+
+// A Backoff computes exponentially growing delays with decorrelated jitter:
+// every delay is picked randomly between Base and three times the previous
+// one, and capped at Max.
+//
+// The randomness prevents hosts that started retrying at the same time, like
+// all the peers of a restarted host, from retrying in lockstep.
+//
+// It is not thread-safe.
+type Backoff struct {
+	Base time.Duration
+	Max  time.Duration
+
+	previous time.Duration
+	rand     *rand.Rand
+}
+
+func (b *Backoff) next() time.Duration {
+	if b.rand == nil {
+		b.rand = newJitterSource()
+	}
+
+	if b.previous < b.Base {
+		b.previous = b.Base
+	}
+
+	d := b.Base
+
+	if spread := 3*b.previous - b.Base; spread > 0 {
+		d += time.Duration(b.rand.Int63n(int64(spread)))
+	}
+
+	if b.Max > 0 && d > b.Max {
+		d = b.Max
+	}
+
+	b.previous = d
+
+	return d
+}
+
+// newJitterSource returns a randomly seeded source, as the default one is
+// seeded identically on every host.
+func newJitterSource() *rand.Rand {
+	var seed int64
+
+	if err := binary.Read(cryptorand.Reader, binary.BigEndian, &seed); err != nil {
+		seed = time.Now().UnixNano()
+	}
+
+	return rand.New(rand.NewSource(seed))
+}
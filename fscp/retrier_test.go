@@ -120,3 +120,64 @@ func TestRetrierFailure(t *testing.T) {
 		t.Errorf("expected an error")
 	}
 }
+
+func TestRetrierMaxRetries(t *testing.T) {
+	failed := make(chan error, 1)
+	a := 0
+
+	retrier := &Retrier{
+		Operation: func() error {
+			a++
+			return nil
+		},
+		OnFailure: func(err error) {
+			failed <- err
+		},
+		Period:     time.Millisecond,
+		MaxRetries: 3,
+	}
+
+	retrier.Start()
+	defer retrier.Stop()
+
+	select {
+	case err := <-failed:
+		if err != ErrTooManyRetries {
+			t.Errorf("expected %s but got: %s", ErrTooManyRetries, err)
+		}
+	case <-time.After(time.Second):
+		t.Fatalf("expected the retrier to give up")
+	}
+
+	if a != 4 || retrier.Attempts() != 4 {
+		t.Errorf("4 was expected but got %d", a)
+	}
+}
+
+func TestBackoff(t *testing.T) {
+	const base = time.Millisecond * 100
+	const max = time.Second
+
+	a := &Backoff{Base: base, Max: max}
+	b := &Backoff{Base: base, Max: max}
+	previous := base
+	same := true
+
+	for i := 0; i < 20; i++ {
+		d := a.next()
+
+		if d < base || d > 3*previous || d > max {
+			t.Fatalf("delay %s is out of bounds (previous was %s)", d, previous)
+		}
+
+		if d != b.next() {
+			same = false
+		}
+
+		previous = d
+	}
+
+	if same {
+		t.Errorf("expected two backoffs to use different delays")
+	}
+}
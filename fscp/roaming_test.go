@@ -0,0 +1,278 @@
+package fscp
+
+import (
+	"bytes"
+	"context"
+	"net"
+	"sync"
+	"testing"
+	"time"
+)
+
+// switchablePacketConn is a packet connection whose underlying socket can be
+// replaced, which simulates a change of address.
+type switchablePacketConn struct {
+	lock   sync.Mutex
+	conn   net.PacketConn
+	closed bool
+}
+
+func (c *switchablePacketConn) current() (net.PacketConn, bool) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	return c.conn, c.closed
+}
+
+func (c *switchablePacketConn) switchSocket(t *testing.T) {
+	c.switchSocketTo(t, &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+}
+
+func (c *switchablePacketConn) switchSocketTo(t *testing.T, laddr *net.UDPAddr) {
+	conn, err := net.ListenUDP("udp", laddr)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	c.lock.Lock()
+	old := c.conn
+	c.conn = conn
+	c.lock.Unlock()
+
+	old.Close()
+}
+
+func (c *switchablePacketConn) ReadFrom(b []byte) (int, net.Addr, error) {
+	for {
+		conn, _ := c.current()
+		n, addr, err := conn.ReadFrom(b)
+
+		if err != nil {
+			if current, closed := c.current(); current != conn && !closed {
+				continue
+			}
+		}
+
+		return n, addr, err
+	}
+}
+
+func (c *switchablePacketConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	conn, _ := c.current()
+	return conn.WriteTo(b, addr)
+}
+
+func (c *switchablePacketConn) Close() error {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	c.closed = true
+
+	return c.conn.Close()
+}
+
+func (c *switchablePacketConn) LocalAddr() net.Addr {
+	conn, _ := c.current()
+	return conn.LocalAddr()
+}
+
+func (c *switchablePacketConn) SetDeadline(t time.Time) error      { return nil }
+func (c *switchablePacketConn) SetReadDeadline(t time.Time) error  { return nil }
+func (c *switchablePacketConn) SetWriteDeadline(t time.Time) error { return nil }
+
+func countConns(client *Client) int {
+	client.lock.Lock()
+	defer client.lock.Unlock()
+
+	return len(client.connsByAddr)
+}
+
+func TestRoaming(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	server := listenTestClient(t, nil)
+	socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	transport := &switchablePacketConn{conn: socket}
+	client, err := NewClient(transport, nil)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer client.Close()
+
+	clientConn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	serverConn, err := server.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	transport.switchSocket(t)
+	newAddr := transport.LocalAddr().String()
+
+	if _, err := clientConn.Write([]byte("moved")); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	b := make([]byte, 16)
+	n, err := serverConn.Read(b)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if !bytes.Equal(b[:n], []byte("moved")) {
+		t.Errorf("expected `moved` but got `%s`", b[:n])
+	}
+
+	if serverConn.RemoteAddr().String() != newAddr {
+		t.Errorf("expected remote address to be %s but got %s", newAddr, serverConn.RemoteAddr())
+	}
+
+	if n := countConns(server); n != 1 {
+		t.Errorf("expected the server to have 1 connection but got %d", n)
+	}
+
+	// Replies go to the new address.
+	if _, err := serverConn.Write([]byte("reply")); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if n, err = clientConn.Read(b); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if !bytes.Equal(b[:n], []byte("reply")) {
+		t.Errorf("expected `reply` but got `%s`", b[:n])
+	}
+
+	// Encrypted messages that match no session neither move a connection nor
+	// create a new one.
+	intruder, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	defer intruder.Close()
+
+	buf := &bytes.Buffer{}
+	writeMessage(buf, MessageTypeData, &messageData{
+		SequenceNumber: 1000,
+		GCMTag:         make([]byte, 16),
+		Ciphertext:     []byte("forged"),
+	})
+	intruder.WriteTo(buf.Bytes(), server.Addr().(*Addr).TransportAddr)
+
+	time.Sleep(time.Millisecond * 100)
+
+	if serverConn.RemoteAddr().String() != newAddr {
+		t.Errorf("expected remote address to stay %s but got %s", newAddr, serverConn.RemoteAddr())
+	}
+
+	if n := countConns(server); n != 1 {
+		t.Errorf("expected the server to have 1 connection but got %d", n)
+	}
+}
+
+func TestRoamingOntoReusedAddress(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	server := listenTestClient(t, nil)
+
+	connect := func() (*switchablePacketConn, *Conn, net.Conn) {
+		socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		transport := &switchablePacketConn{conn: socket}
+		client, err := NewClient(transport, nil)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		t.Cleanup(func() { client.Close() })
+
+		clientConn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		serverConn, err := server.Accept()
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		return transport, clientConn, serverConn
+	}
+
+	exchange := func(clientConn *Conn, serverConn net.Conn, message string) {
+		if _, err := clientConn.Write([]byte(message)); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		b := make([]byte, 16)
+		n, err := serverConn.Read(b)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if !bytes.Equal(b[:n], []byte(message)) {
+			t.Errorf("expected `%s` but got `%s`", message, b[:n])
+		}
+	}
+
+	firstTransport, firstConn, firstServerConn := connect()
+	secondTransport, secondConn, secondServerConn := connect()
+
+	// The first host moves away, and its previous address remains a source
+	// of its connection.
+	oldAddr := firstTransport.LocalAddr().(*net.UDPAddr)
+	firstTransport.switchSocket(t)
+	exchange(firstConn, firstServerConn, "moved")
+
+	// The second host then gets that address.
+	secondTransport.switchSocketTo(t, oldAddr)
+	exchange(secondConn, secondServerConn, "reused")
+
+	if secondServerConn.RemoteAddr().String() != oldAddr.String() {
+		t.Errorf("expected remote address to be %s but got %s", oldAddr, secondServerConn.RemoteAddr())
+	}
+
+	exchange(firstConn, firstServerConn, "still there")
+
+	// Sources are forgotten once no message comes from them anymore.
+	server.lock.Lock()
+	defer server.lock.Unlock()
+
+	if _, ok := server.connsBySource[oldAddr.String()]; ok {
+		t.Errorf("expected the reused address not to be a source anymore")
+	}
+
+	server.connsBySource["127.0.0.1:1"] = &source{conn: firstServerConn.(*Conn), lastSeen: time.Now().Add(-sourceTimeout * 2)}
+	server.expireSources(time.Now())
+
+	if _, ok := server.connsBySource["127.0.0.1:1"]; ok {
+		t.Errorf("expected the stale source to expire")
+	}
+}
@@ -0,0 +1,340 @@
+package fscp
+
+import (
+	"crypto/x509"
+	"errors"
+	"fmt"
+	"time"
+)
+
+// DefaultRotationRate is the default number of connections migrated to new
+// credentials per second.
+const DefaultRotationRate = 20
+
+// RotationConfig contains the credential rotation settings.
+//
+// When the security of a client changes, its existing connections keep their
+// sessions and migrate to the new credentials by negotiating a new session
+// with them: the hash of the new certificate is announced over the current
+// session, followed by a PRESENTATION of the new certificate and a SESSION
+// REQUEST signed with the new key. Migrations are spread over time so that a
+// host with many peers doesn't perform all the key exchanges at once.
+//
+// Only the remote hosts that advertise FeatureRotation can migrate: the
+// others keep the current session until it expires.
+type RotationConfig struct {
+	// Rate is the number of connections migrated per second.
+	Rate float64
+}
+
+func (c *RotationConfig) interval() time.Duration {
+	rate := c.Rate
+
+	if rate <= 0 {
+		rate = DefaultRotationRate
+	}
+
+	return time.Duration(float64(time.Second) / rate)
+}
+
+// errRekeyTimeout is reported when the remote host never answered a rekey.
+var errRekeyTimeout = errors.New("rekey timed out")
+
+// currentSecurity returns the security of the client and its generation,
+// which changes every time it is set.
+func (c *Client) currentSecurity() (uint64, ClientSecurity) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	return c.securityGeneration, c.security
+}
+
+// rotateConns migrates the existing connections to the current security of
+// the client, one at a time. A rotation that is still in progress is
+// superseded.
+//
+// The mutex *MUST* be held before calling this method.
+func (c *Client) rotateConns() {
+	if c.rotation != nil {
+		close(c.rotation)
+	}
+
+	stop := make(chan struct{})
+	c.rotation = stop
+
+	conns := make([]*Conn, 0, len(c.connsByAddr))
+
+	for _, conn := range c.connsByAddr {
+		conns = append(conns, conn)
+	}
+
+	interval := c.config.Rotation.interval()
+
+	go func() {
+		timer := time.NewTimer(0)
+		defer timer.Stop()
+
+		for _, conn := range conns {
+			select {
+			case <-stop:
+				return
+			case <-timer.C:
+			}
+
+			conn := conn
+
+			// A closed connection has nothing to migrate and doesn't count
+			// against the rate.
+			if conn.do(func() { conn.rekey() }) != nil {
+				timer.Reset(0)
+				continue
+			}
+
+			timer.Reset(interval)
+		}
+	}()
+}
+
+// rekey migrates the connection to the current security of the client, if it
+// changed, by negotiating a new session with it.
+//
+// The current session keeps being used until the new one is established. If
+// the remote host doesn't answer, it stays the current one.
+func (c *Conn) rekey() {
+	generation, security := c.client.currentSecurity()
+
+	if generation == c.securityGeneration {
+		return
+	}
+
+	// What we know about the remote host doesn't change, unless it was
+	// configured explicitly.
+	if security.RemoteClientSecurity == nil {
+		security.RemoteClientSecurity = c.security.RemoteClientSecurity
+	} else {
+		c.remoteSecurityPreset = true
+	}
+
+	previous := c.security
+	c.previousSecurity = &previous
+	c.security = security
+	c.securityGeneration = generation
+
+	c.debugPrintf("Migrating to new credentials.\n")
+
+	// A handshake in progress uses the new credentials for its next stages.
+	if c.session == nil || c.handshakeStage != handshakeDone {
+		return
+	}
+
+	sessionNumber := c.session.SessionNumber + 1
+
+	if c.nextSession != nil && c.nextSession.SessionNumber >= sessionNumber {
+		sessionNumber = c.nextSession.SessionNumber + 1
+	}
+
+	sessionRequest, err := c.makeSessionRequest(c.security, sessionNumber)
+
+	if err != nil {
+		c.warning(fmt.Errorf("migrating to new credentials: %s", err))
+		return
+	}
+
+	if err := c.sendRekeyFlight(sessionRequest); err != nil {
+		c.warning(fmt.Errorf("migrating to new credentials: %s", err))
+	}
+}
+
+// sendRekeyFlight sends the PRESENTATION of the new certificate and the
+// SESSION REQUEST of a rekey until they get answered.
+//
+// Every attempt announces the new certificate over the current session first,
+// as a PRESENTATION alone could come from anyone.
+func (c *Conn) sendRekeyFlight(sessionRequest *messageSessionRequest) error {
+	messages := []flightMessage{
+		{MessageTypePresentation, &messagePresentation{Certificate: c.security.Certificate}},
+		{MessageTypeSessionRequest, sessionRequest},
+	}
+
+	f, err := c.makeFlight(messages, c.features().Has(FeatureFragmentation))
+
+	if err != nil {
+		return err
+	}
+
+	attempts := 0
+
+	send := func() error {
+		if err := c.announceCertificate(); err != nil {
+			return err
+		}
+
+		for _, m := range messages {
+			c.debugPrintf("Sending %s.\n", m.message)
+		}
+
+		return c.writeDatagrams(f.datagrams(attempts))
+	}
+
+	return c.sendFlight(handshakeRekey, func() error {
+		attempts++
+
+		// Retries happen outside of the dispatch loop, which owns the
+		// session.
+		if attempts == 1 {
+			return send()
+		}
+
+		result := make(chan error, 1)
+
+		if err := c.do(func() { result <- send() }); err != nil {
+			return err
+		}
+
+		select {
+		case err := <-result:
+			return err
+		case <-c.closed:
+			return c.closeError
+		}
+	})
+}
+
+// announceCertificate announces the hash of the local certificate over the
+// current session.
+func (c *Conn) announceCertificate() error {
+	if c.session == nil || c.security.Certificate == nil || !c.features().Has(FeatureRotation) {
+		return nil
+	}
+
+	hash := HashCertificate(c.security.Certificate)
+
+	return c.sendEncrypted(MessageTypeRotation, 0, hash[:])
+}
+
+// handleRotation handles the announcement of the certificate that the remote
+// host is about to present.
+func (c *Conn) handleRotation(payload []byte) error {
+	var hash CertificateHash
+
+	if len(payload) != len(hash) {
+		c.warning(fmt.Errorf("ignoring ROTATION message of %d byte(s)", len(payload)))
+		return nil
+	}
+
+	copy(hash[:], payload)
+	c.announcedHash = &hash
+	c.debugPrintf("Remote host announced a new certificate (%s).\n", hash)
+
+	return nil
+}
+
+// rekeyFailed handles a rekey that was never answered.
+func (c *Conn) rekeyFailed(retrier *Retrier) {
+	if c.handshakeRetrier != retrier || c.handshakeStage != handshakeRekey {
+		return
+	}
+
+	c.handshakeStage = handshakeDone
+	c.warning(fmt.Errorf("keeping the current session: %s", errRekeyTimeout))
+}
+
+// presented handles a certificate that the remote host presented while a
+// session is established, as it does when it rotates its credentials.
+//
+// PRESENTATION messages are not authenticated: the certificate is only
+// considered if it was announced over the current session, and is only
+// adopted once a message signed with it verifies.
+func (c *Conn) presented(cert *x509.Certificate) {
+	if cert == nil || c.remoteSecurityPreset {
+		c.debugPrintf("Ignoring repeated presentation for remote host.\n")
+		return
+	}
+
+	if current := c.security.RemoteClientSecurity.Certificate; current != nil && current.Equal(cert) {
+		c.debugPrintf("Ignoring repeated presentation for remote host.\n")
+		return
+	}
+
+	hash := HashCertificate(cert)
+
+	if c.announcedHash == nil || hash != *c.announcedHash {
+		c.warning(fmt.Errorf("ignoring presentation of a certificate (%s) that was not announced", hash))
+		return
+	}
+
+	if c.expectedHash != nil && hash != *c.expectedHash {
+		c.warning(fmt.Errorf("remote host presented a certificate with hash %s but %s was expected", hash, *c.expectedHash))
+		return
+	}
+
+	c.debugPrintf("Remote host presented a new certificate (%s).\n", cert.Subject)
+	c.presentedSecurity = &RemoteClientSecurity{Certificate: cert}
+}
+
+// signedMessage is a handshake message with a signature.
+type signedMessage interface {
+	verifySignature(verifier Verifier) error
+}
+
+// verifySignature verifies the signature of a handshake message.
+//
+// While credentials are being rotated, the message may have been signed with
+// credentials that the connection doesn't use: a certificate that the remote
+// host just presented, or a pre-shared key that either host is migrating to
+// or from. A presented certificate that verifies gets adopted.
+func (c *Conn) verifySignature(msg signedMessage) error {
+	err := msg.verifySignature(c.security)
+
+	if err == nil {
+		return nil
+	}
+
+	if c.presentedSecurity != nil {
+		security := c.security
+		security.RemoteClientSecurity = c.presentedSecurity
+
+		if msg.verifySignature(security) == nil {
+			c.adoptPresentedSecurity()
+			return nil
+		}
+	}
+
+	if c.security.RemoteClientSecurity == nil || c.security.RemoteClientSecurity.Certificate != nil {
+		return err
+	}
+
+	candidates := []*ClientSecurity{c.previousSecurity}
+
+	if generation, security := c.client.currentSecurity(); generation != c.securityGeneration {
+		candidates = append(candidates, &security)
+	}
+
+	for _, candidate := range candidates {
+		// Without a pre-shared key, anyone could compute the signature.
+		if candidate == nil || candidate.PresharedKey == nil {
+			continue
+		}
+
+		security := *candidate
+		security.RemoteClientSecurity = c.security.RemoteClientSecurity
+
+		if msg.verifySignature(security) == nil {
+			return nil
+		}
+	}
+
+	return err
+}
+
+func (c *Conn) adoptPresentedSecurity() {
+	hash := HashCertificate(c.presentedSecurity.Certificate)
+	c.debugPrintf("Adopting new certificate (%s) for remote host.\n", c.presentedSecurity.Certificate.Subject)
+
+	c.security.RemoteClientSecurity = c.presentedSecurity
+	c.presentedSecurity, c.announcedHash = nil, nil
+
+	c.statsLock.Lock()
+	c.remoteHash = &hash
+	c.statsLock.Unlock()
+}
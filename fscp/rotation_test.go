@@ -0,0 +1,220 @@
+package fscp
+
+import (
+	"context"
+	"net"
+	"testing"
+	"time"
+)
+
+// exchange checks that data flows both ways between two connections.
+func exchange(t *testing.T, a, b net.Conn, data string) {
+	t.Helper()
+
+	for _, pair := range [][2]net.Conn{{a, b}, {b, a}} {
+		if _, err := pair[0].Write([]byte(data)); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		buf := make([]byte, 32)
+		n, err := pair[1].Read(buf)
+
+		if err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if string(buf[:n]) != data {
+			t.Errorf("expected `%s` but got `%s`", data, buf[:n])
+		}
+	}
+}
+
+// waitForHash waits until the remote host of a connection presented the
+// certificate with the specified hash.
+func waitForHash(ctx context.Context, t *testing.T, conn *Conn, hash CertificateHash) {
+	t.Helper()
+
+	for {
+		if remoteHash, ok := conn.RemoteCertificateHash(); ok && remoteHash == hash {
+			return
+		}
+
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected the remote host to present %s", hash)
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+}
+
+// waitForSession waits until a connection established a session with at
+// least the specified number.
+func waitForSession(ctx context.Context, t *testing.T, conn *Conn, sessionNumber SessionNumber) {
+	t.Helper()
+
+	for {
+		current := make(chan SessionNumber, 1)
+
+		if err := conn.do(func() {
+			if conn.session != nil {
+				current <- conn.session.SessionNumber
+			} else {
+				current <- 0
+			}
+		}); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if <-current >= sessionNumber {
+			return
+		}
+
+		select {
+		case <-ctx.Done():
+			t.Fatalf("expected session %d to be established", sessionNumber)
+		case <-time.After(time.Millisecond * 10):
+		}
+	}
+}
+
+func TestCredentialRotation(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	const rate = 5
+
+	server := listenTestClient(t, &ClientConfig{Rotation: RotationConfig{Rate: rate}})
+	clients := make([]*Client, 3)
+	clientConns := make([]*Conn, len(clients))
+	serverConns := make([]net.Conn, len(clients))
+
+	for i := range clients {
+		clients[i] = listenTestClient(t, nil)
+
+		var err error
+
+		if clientConns[i], err = clients[i].Connect(ctx, server.Addr().(*Addr)); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if serverConns[i], err = server.Accept(); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+	}
+
+	key, cert, err := GenerateLocalCertificate()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	hash := HashCertificate(cert)
+	start := time.Now()
+	server.SetSecurity(ClientSecurity{Certificate: cert, PrivateKey: key})
+
+	// Existing connections survive the rotation and migrate one by one.
+	for i := range clients {
+		waitForHash(ctx, t, clientConns[i], hash)
+		exchange(t, clientConns[i], serverConns[i], "rotated")
+	}
+
+	if elapsed, min := time.Since(start), time.Duration(len(clients)-1)*time.Second/rate; elapsed < min {
+		t.Errorf("expected the migration to take at least %s but it took %s", min, elapsed)
+	}
+
+	// New connections use the new credentials right away.
+	client := listenTestClient(t, nil)
+	conn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if remoteHash, _ := conn.RemoteCertificateHash(); remoteHash != hash {
+		t.Errorf("expected the new certificate to be presented")
+	}
+}
+
+func TestPresharedKeyRotation(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	security := ClientSecurity{PresharedKey: []byte("old key")}
+	server := listenDelayedTestClient(t, 0, &security, nil)
+
+	client := listenDelayedTestClient(t, 0, &security, nil)
+
+	clientConn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	serverConn, err := server.Accept()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	// Hosts migrate to the new key one after the other.
+	rotated := ClientSecurity{PresharedKey: []byte("new key")}
+	server.SetSecurity(rotated)
+	time.Sleep(time.Millisecond * 100)
+	client.SetSecurity(rotated)
+
+	// The hosts renegotiated a session once both had the new key.
+	waitForSession(ctx, t, clientConn, 1)
+	waitForSession(ctx, t, serverConn.(*Conn), 1)
+	exchange(t, clientConn, serverConn, "rotated")
+
+	for _, c := range []*Client{client, server} {
+		c.lock.Lock()
+		conns := len(c.connsByAddr)
+		c.lock.Unlock()
+
+		if conns != 1 {
+			t.Errorf("expected the connection to survive the rotation")
+		}
+	}
+
+	// A host that only knows the new key can connect.
+	newcomer := listenDelayedTestClient(t, 0, &rotated, nil)
+
+	if _, err := newcomer.Connect(ctx, server.Addr().(*Addr)); err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+}
+
+func TestUnannouncedPresentation(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+
+	clientConn, _ := connectTestClients(ctx, t, nil, nil)
+	_, cert, err := GenerateLocalCertificate()
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	hash := HashCertificate(cert)
+	presented := make(chan bool, 2)
+
+	// PRESENTATION messages can be spoofed: only certificates that were
+	// announced over the session are considered.
+	clientConn.do(func() {
+		clientConn.presented(cert)
+		presented <- clientConn.presentedSecurity != nil
+
+		clientConn.handleRotation(hash[:])
+		clientConn.presented(cert)
+		presented <- clientConn.presentedSecurity != nil
+	})
+
+	if <-presented {
+		t.Errorf("expected an unannounced certificate to be ignored")
+	}
+
+	if !<-presented {
+		t.Errorf("expected an announced certificate to be considered")
+	}
+}
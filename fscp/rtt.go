@@ -0,0 +1,62 @@
+package fscp
+
+import "time"
+
+// rttEstimator estimates the round-trip time to a remote host, as described
+// in RFC 6298.
+//
+// It is not thread-safe.
+type rttEstimator struct {
+	srtt    time.Duration
+	rttvar  time.Duration
+	samples int
+}
+
+// update the estimation with a new measurement.
+func (e *rttEstimator) update(sample time.Duration) {
+	if sample < 0 {
+		return
+	}
+
+	if e.samples == 0 {
+		e.srtt = sample
+		e.rttvar = sample / 2
+	} else {
+		delta := e.srtt - sample
+
+		if delta < 0 {
+			delta = -delta
+		}
+
+		e.rttvar = (3*e.rttvar + delta) / 4
+		e.srtt = (7*e.srtt + sample) / 8
+	}
+
+	e.samples++
+}
+
+// valid tells whether at least one measurement was made.
+func (e *rttEstimator) valid() bool {
+	return e.samples > 0
+}
+
+// rto returns the retransmission timeout, bounded by min and max.
+//
+// If no measurement was made yet, initial is returned instead.
+func (e *rttEstimator) rto(initial, min, max time.Duration) time.Duration {
+	rto := initial
+
+	if e.samples > 0 {
+		rto = e.srtt + 4*e.rttvar
+	}
+
+	if rto < min {
+		rto = min
+	}
+
+	if rto > max {
+		rto = max
+	}
+
+	return rto
+}
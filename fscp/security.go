@@ -210,6 +210,16 @@ type RemoteClientSecurity struct {
 	Certificate *x509.Certificate
 }
 
+// matches tells whether the specified certificate is the one of the remote
+// client, a nil certificate matching pre-shared key authentication.
+func (s *RemoteClientSecurity) matches(cert *x509.Certificate) bool {
+	if s.Certificate == nil || cert == nil {
+		return s.Certificate == cert
+	}
+
+	return s.Certificate.Equal(cert)
+}
+
 // DefaultPresharedKeyPassphrase is the default preshared key passphrase.
 const DefaultPresharedKeyPassphrase = ""
 
@@ -264,6 +274,12 @@ func (s *ClientSecurity) supportedEllipticCurves() EllipticCurveSlice {
 	return s.EllipticCurves
 }
 
+// usesPresharedKeyOnly tells whether a pre-shared key is used and no
+// certificate.
+func (s *ClientSecurity) usesPresharedKeyOnly() bool {
+	return s.Certificate == nil && s.PresharedKey != nil
+}
+
 // Sign a message.
 func (s ClientSecurity) Sign(cleartext []byte) ([]byte, error) {
 	if s.PrivateKey != nil {
@@ -1,6 +1,7 @@
 package fscp
 
 import (
+	"bytes"
 	"crypto/aes"
 	"crypto/cipher"
 	"crypto/ecdsa"
@@ -29,6 +30,67 @@ type Session struct {
 	RemoteIV             []byte
 	LocalAEAD            cipher.AEAD
 	RemoteAEAD           cipher.AEAD
+	ResumptionSecret     []byte
+	TicketID             TicketID
+
+	replay replayWindow
+}
+
+// replayWindowSize is the number of sequence numbers below the highest one
+// received within which messages are still accepted, once. Messages sent over
+// several paths arrive out of order.
+const replayWindowSize = 1024
+
+// replayWindow records which of the last sequence numbers were received, in
+// a bitmap indexed by the sequence numbers modulo its size.
+type replayWindow [replayWindowSize / 64]uint64
+
+func (w *replayWindow) has(sequenceNumber SequenceNumber) bool {
+	i := sequenceNumber % replayWindowSize
+
+	return w[i/64]&(1<<(i%64)) != 0
+}
+
+func (w *replayWindow) set(sequenceNumber SequenceNumber) {
+	i := sequenceNumber % replayWindowSize
+	w[i/64] |= 1 << (i % 64)
+}
+
+func (w *replayWindow) clear(sequenceNumber SequenceNumber) {
+	i := sequenceNumber % replayWindowSize
+	w[i/64] &^= 1 << (i % 64)
+}
+
+// accepts tells whether a message with the specified sequence number may be
+// decrypted.
+func (s *Session) accepts(sequenceNumber SequenceNumber) bool {
+	if sequenceNumber > s.RemoteSequenceNumber {
+		return true
+	}
+
+	if sequenceNumber == s.RemoteSequenceNumber || s.RemoteSequenceNumber-sequenceNumber >= replayWindowSize {
+		return false
+	}
+
+	return !s.replay.has(sequenceNumber)
+}
+
+// received records that a message with the specified sequence number was
+// decrypted.
+func (s *Session) received(sequenceNumber SequenceNumber) {
+	if sequenceNumber > s.RemoteSequenceNumber {
+		if sequenceNumber-s.RemoteSequenceNumber >= replayWindowSize {
+			s.replay = replayWindow{}
+		} else {
+			for n := s.RemoteSequenceNumber + 1; n != sequenceNumber; n++ {
+				s.replay.clear(n)
+			}
+		}
+
+		s.RemoteSequenceNumber = sequenceNumber
+	}
+
+	s.replay.set(sequenceNumber)
 }
 
 // NewSession instantiate a new session.
@@ -93,11 +155,35 @@ func (s *Session) SetRemote(hostIdentifier HostIdentifier, publicKey *ecdsa.Publ
 
 	s.RemotePublicKey = publicKey
 
+	return s.deriveKeys(k.Bytes())
+}
+
+// newResumedSession instantiates a session whose keys derive from the
+// resumption secret of a previous session, rather than from an ECDHE
+// exchange.
+func newResumedSession(localHostIdentifier HostIdentifier, remoteHostIdentifier HostIdentifier, sessionNumber SessionNumber, cipherSuite CipherSuite, ellipticCurve EllipticCurve, resumptionSecret []byte, requestNonce ResumptionNonce, responseNonce ResumptionNonce) (*Session, error) {
+	s := &Session{
+		LocalHostIdentifier:  localHostIdentifier,
+		RemoteHostIdentifier: remoteHostIdentifier,
+		SessionNumber:        sessionNumber,
+		CipherSuite:          cipherSuite,
+		EllipticCurve:        ellipticCurve,
+	}
+
+	k := make([]byte, 48)
+	prf12(k, resumptionSecret, []byte("resumed session"), append(requestNonce[:], responseNonce[:]...))
+
+	return s, s.deriveKeys(k)
+}
+
+// deriveKeys derives the session keys from the shared secret k, as well as
+// the secret and ticket that allow resuming the session later.
+func (s *Session) deriveKeys(k []byte) error {
 	s.LocalSessionKey = make([]byte, s.CipherSuite.BlockSize())
 	s.RemoteSessionKey = make([]byte, s.CipherSuite.BlockSize())
 
-	prf12(s.LocalSessionKey, k.Bytes(), []byte("session key"), s.LocalHostIdentifier[:])
-	prf12(s.RemoteSessionKey, k.Bytes(), []byte("session key"), s.RemoteHostIdentifier[:])
+	prf12(s.LocalSessionKey, k, []byte("session key"), s.LocalHostIdentifier[:])
+	prf12(s.RemoteSessionKey, k, []byte("session key"), s.RemoteHostIdentifier[:])
 
 	localBlock, err := aes.NewCipher(s.LocalSessionKey)
 
@@ -126,14 +212,27 @@ func (s *Session) SetRemote(hostIdentifier HostIdentifier, publicKey *ecdsa.Publ
 	s.LocalIV = make([]byte, 8, 12)
 	s.RemoteIV = make([]byte, 8, 12)
 
-	prf12(s.LocalIV, k.Bytes(), []byte("nonce prefix"), s.LocalHostIdentifier[:])
-	prf12(s.RemoteIV, k.Bytes(), []byte("nonce prefix"), s.RemoteHostIdentifier[:])
+	prf12(s.LocalIV, k, []byte("nonce prefix"), s.LocalHostIdentifier[:])
+	prf12(s.RemoteIV, k, []byte("nonce prefix"), s.RemoteHostIdentifier[:])
 
 	// Preallocate the buffers so we can simply copy the sequence numbers
 	// without any allocation later on.
 	s.LocalIV = append(s.LocalIV, 0x00, 0x00, 0x00, 0x00)
 	s.RemoteIV = append(s.RemoteIV, 0x00, 0x00, 0x00, 0x00)
 
+	// Both hosts must derive the same resumption secret and ticket, so the
+	// host identifiers are ordered.
+	seed := append(s.LocalHostIdentifier[:], s.RemoteHostIdentifier[:]...)
+
+	if bytes.Compare(s.LocalHostIdentifier[:], s.RemoteHostIdentifier[:]) > 0 {
+		seed = append(s.RemoteHostIdentifier[:], s.LocalHostIdentifier[:]...)
+	}
+
+	s.ResumptionSecret = make([]byte, 32)
+
+	prf12(s.ResumptionSecret, k, []byte("resumption secret"), seed)
+	prf12(s.TicketID[:], k, []byte("resumption ticket"), seed)
+
 	return nil
 }
 
@@ -143,8 +242,8 @@ func (s *Session) SetRemote(hostIdentifier HostIdentifier, publicKey *ecdsa.Publ
 //
 // ciphertext will be modified after the call, regardless of the outcome.
 func (s *Session) Decrypt(msg *messageData) ([]byte, error) {
-	if msg.SequenceNumber <= s.RemoteSequenceNumber {
-		return nil, fmt.Errorf("outdated message: expected %d but got %d", s.RemoteSequenceNumber, msg.SequenceNumber)
+	if !s.accepts(msg.SequenceNumber) {
+		return nil, fmt.Errorf("outdated or replayed message: expected %d but got %d", s.RemoteSequenceNumber, msg.SequenceNumber)
 	}
 
 	// Sadly, the initial protocol design separates the GCM tag with the
@@ -159,7 +258,7 @@ func (s *Session) Decrypt(msg *messageData) ([]byte, error) {
 		return nil, err
 	}
 
-	s.RemoteSequenceNumber = msg.SequenceNumber
+	s.received(msg.SequenceNumber)
 
 	return data, nil
 }
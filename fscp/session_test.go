@@ -0,0 +1,38 @@
+package fscp
+
+import "testing"
+
+func TestReplayWindow(t *testing.T) {
+	session := &Session{}
+
+	testCases := []struct {
+		sequenceNumber SequenceNumber
+		accepted       bool
+	}{
+		{0, false},
+		{3, true},
+		{3, false},
+		{1, true},
+		{2, true},
+		{1, false},
+		{replayWindowSize + 2, true},
+		{2, false},
+		{4, true},
+		{4, false},
+		{replayWindowSize*3 + 1, true},
+		{replayWindowSize + 2, false},
+		{replayWindowSize*2 + 2, true},
+	}
+
+	for _, testCase := range testCases {
+		accepted := session.accepts(testCase.sequenceNumber)
+
+		if accepted != testCase.accepted {
+			t.Errorf("expected %d to be accepted: %t", testCase.sequenceNumber, testCase.accepted)
+		}
+
+		if accepted {
+			session.received(testCase.sequenceNumber)
+		}
+	}
+}
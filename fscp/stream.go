@@ -0,0 +1,1184 @@
+package fscp
+
+import (
+	"context"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"math"
+	"sort"
+	"sync"
+	"time"
+)
+
+const (
+	// DefaultStreamWindow is the default number of bytes that a stream
+	// buffers in each direction.
+	DefaultStreamWindow = 1 << 20
+
+	// DefaultStreamBacklog is the default number of streams opened by the
+	// remote host that wait to be accepted.
+	DefaultStreamBacklog = 16
+)
+
+// ErrStreamsDisabled is returned when opening a stream to a remote host that
+// does not support them, or when streams are disabled locally.
+var ErrStreamsDisabled = errors.New("streams are not supported by both hosts")
+
+// ErrStreamReset is returned by the operations on a stream that the remote
+// host reset.
+var ErrStreamReset = errors.New("the stream was reset")
+
+// ErrStreamClosed is returned by the operations on a closed stream.
+var ErrStreamClosed = errors.New("the stream is closed")
+
+// StreamConfig contains the settings of the reliable streams multiplexed over
+// connections.
+//
+// Streams carry ordered bytes over STREAM messages of the session. Losses are
+// recovered from the selective acknowledgements of the receiver, the sending
+// rate follows a NewReno congestion window and the receiver advertises the
+// room left in its buffers.
+type StreamConfig struct {
+	// Enabled tells whether streams may be opened to and accepted from
+	// remote hosts that support them.
+	Enabled bool
+
+	// Window is the number of bytes that a stream buffers in each
+	// direction: it bounds both the data written ahead of its
+	// acknowledgement and the data received ahead of reads. Defaults to
+	// DefaultStreamWindow.
+	Window int
+
+	// Backlog is the number of streams opened by the remote host that wait
+	// to be accepted, beyond which new ones are reset. Defaults to
+	// DefaultStreamBacklog.
+	Backlog int
+}
+
+func (c *StreamConfig) window() int {
+	if c.Window <= 0 {
+		return DefaultStreamWindow
+	}
+
+	return c.Window
+}
+
+func (c *StreamConfig) backlog() int {
+	if c.Backlog <= 0 {
+		return DefaultStreamBacklog
+	}
+
+	return c.Backlog
+}
+
+const (
+	// streamSegmentSize is the maximum number of bytes of data in a
+	// segment, which keeps STREAM messages within a typical MTU.
+	streamSegmentSize = 1200
+
+	// streamHeaderSize is the size of the header of segments, SACK blocks
+	// excluded.
+	streamHeaderSize = 26
+
+	// streamMaxSACKBlocks is the maximum number of SACK blocks in a segment.
+	streamMaxSACKBlocks = 3
+
+	// streamBufferSize is the size of the pooled buffers, which leaves room
+	// for the GCM tag.
+	streamBufferSize = streamHeaderSize + 16*streamMaxSACKBlocks + streamSegmentSize + 16
+
+	// streamQueueSize is the number of segments that a connection buffers
+	// before it drops them.
+	streamQueueSize = 1024
+
+	// streamMaxGaps is the maximum number of stream identifiers skipped by
+	// the remote host that are remembered, as their first segments may
+	// still come.
+	streamMaxGaps = 64
+
+	streamInitialWindow = 10 * streamSegmentSize
+	streamMinWindow     = 2 * streamSegmentSize
+	streamDupThreshold  = 3
+	streamInitialRTO    = time.Second
+	streamMinRTO        = time.Millisecond * 200
+	streamMaxRTO        = time.Second * 60
+	streamMaxBackoff    = 6
+)
+
+const (
+	// streamFlagFin marks the last segment of a direction.
+	streamFlagFin = 0x01
+	// streamFlagReset aborts a stream.
+	streamFlagReset = 0x02
+	// streamFlagInitiator is set when the sender opened the stream.
+	streamFlagInitiator = 0x80
+)
+
+var streamBufferPool = sync.Pool{
+	New: func() interface{} {
+		buf := make([]byte, streamBufferSize)
+		return &buf
+	},
+}
+
+func getStreamBuffer() *[]byte {
+	return streamBufferPool.Get().(*[]byte)
+}
+
+func putStreamBuffer(buf *[]byte) {
+	streamBufferPool.Put(buf)
+}
+
+// streamKey identifies a stream within a connection.
+type streamKey struct {
+	id uint32
+
+	// local is set for the streams opened by the local host.
+	local bool
+}
+
+// streamRange is a range of sequence numbers.
+type streamRange struct {
+	start uint64
+	end   uint64
+}
+
+// streamHeader is the header of a segment.
+//
+// Segments are encoded as:
+//
+//	flags (1) | stream id (4) | sequence number (8) | acknowledgement (8) |
+//	window (4) | SACK block count (1) | SACK blocks (16 each) | data
+type streamHeader struct {
+	flags      uint8
+	id         uint32
+	seq        uint64
+	ack        uint64
+	window     uint32
+	sacks      [streamMaxSACKBlocks]streamRange
+	sacksCount int
+}
+
+func parseStreamSegment(b []byte) (h streamHeader, data []byte, err error) {
+	if len(b) < streamHeaderSize {
+		return h, nil, fmt.Errorf("segment of %d byte(s) is too short", len(b))
+	}
+
+	h.flags = b[0]
+	h.id = binary.BigEndian.Uint32(b[1:])
+	h.seq = binary.BigEndian.Uint64(b[5:])
+	h.ack = binary.BigEndian.Uint64(b[13:])
+	h.window = binary.BigEndian.Uint32(b[21:])
+	h.sacksCount = int(b[25])
+	b = b[streamHeaderSize:]
+
+	if h.sacksCount > streamMaxSACKBlocks || len(b) < 16*h.sacksCount {
+		return h, nil, fmt.Errorf("invalid SACK block count: %d", h.sacksCount)
+	}
+
+	for i := 0; i < h.sacksCount; i++ {
+		h.sacks[i].start = binary.BigEndian.Uint64(b[16*i:])
+		h.sacks[i].end = binary.BigEndian.Uint64(b[16*i+8:])
+	}
+
+	return h, b[16*h.sacksCount:], nil
+}
+
+// writeStreamHeader writes a header at the start of a buffer large enough and
+// returns its size.
+func writeStreamHeader(b []byte, h *streamHeader) int {
+	b[0] = h.flags
+	binary.BigEndian.PutUint32(b[1:], h.id)
+	binary.BigEndian.PutUint64(b[5:], h.seq)
+	binary.BigEndian.PutUint64(b[13:], h.ack)
+	binary.BigEndian.PutUint32(b[21:], h.window)
+	b[25] = byte(h.sacksCount)
+
+	for i := 0; i < h.sacksCount; i++ {
+		binary.BigEndian.PutUint64(b[streamHeaderSize+16*i:], h.sacks[i].start)
+		binary.BigEndian.PutUint64(b[streamHeaderSize+16*i+8:], h.sacks[i].end)
+	}
+
+	return streamHeaderSize + 16*h.sacksCount
+}
+
+// streamSegment is a segment of written data, kept until it is acknowledged.
+type streamSegment struct {
+	seq uint64
+	buf *[]byte
+	n   int
+	fin bool
+
+	sent          bool
+	sentAt        time.Time
+	order         uint64
+	retransmitted bool
+	sacked        bool
+	lost          bool
+}
+
+// seqLen returns the number of sequence numbers the segment spans: the FIN
+// takes one, so that it is acknowledged like data.
+func (s *streamSegment) seqLen() int {
+	if s.fin {
+		return s.n + 1
+	}
+
+	return s.n
+}
+
+func (s *streamSegment) end() uint64 {
+	return s.seq + uint64(s.seqLen())
+}
+
+// streamChunk is received data that came ahead of the data before it.
+type streamChunk struct {
+	seq  uint64
+	data []byte
+	fin  bool
+}
+
+func (c *streamChunk) end() uint64 {
+	return c.seq + uint64(len(c.data))
+}
+
+// StreamStats contains the statistics of a stream.
+type StreamStats struct {
+	// Sent is the number of data segments sent, retransmissions included.
+	Sent uint64
+
+	// Retransmitted is the number of segments that were retransmitted.
+	Retransmitted uint64
+
+	// Timeouts is the number of retransmission timeouts.
+	Timeouts uint64
+
+	// CongestionWindow is the number of bytes that may be in flight.
+	CongestionWindow int
+
+	// SRTT is the smoothed round-trip time measured on the stream.
+	SRTT time.Duration
+}
+
+// A Stream is a reliable, ordered and bidirectional stream of bytes
+// multiplexed over a connection.
+//
+// It is thread-safe.
+type Stream struct {
+	conn   *Conn
+	key    streamKey
+	window int
+
+	lock       sync.Mutex
+	readReady  chan struct{}
+	writeReady chan struct{}
+	err        error
+	stats      StreamStats
+	rtt        rttEstimator
+	backoff    uint
+	timer      *wheelTimer
+	sendCount  uint64
+
+	// sendQueue holds the written segments that were not acknowledged, the
+	// ones before sendUnsent having been sent.
+	sendQueue    []*streamSegment
+	sendUnsent   int
+	sendUna      uint64
+	sendEnd      uint64
+	sendBuffered int
+	sendLost     int
+	inFlight     int
+	peerRight    uint64
+	cwnd         int
+	ssthresh     int
+	recovering   bool
+	recoverySeq  uint64
+	writeClosed  bool
+	finAcked     bool
+
+	recvNext        uint64
+	readable        [][]byte
+	readableBytes   int
+	outOfOrder      []streamChunk
+	advertisedRight uint64
+	remoteFin       bool
+	readClosed      bool
+}
+
+func newStream(conn *Conn, key streamKey) *Stream {
+	return &Stream{
+		conn:       conn,
+		key:        key,
+		window:     conn.config.Streams.window(),
+		readReady:  make(chan struct{}, 1),
+		writeReady: make(chan struct{}, 1),
+		peerRight:  streamInitialWindow,
+		cwnd:       streamInitialWindow,
+		ssthresh:   math.MaxInt32,
+	}
+}
+
+// ID returns the identifier of the stream, which is unique among the streams
+// opened by the same host on a connection.
+func (s *Stream) ID() uint32 {
+	return s.key.id
+}
+
+// Stats returns the statistics of the stream.
+func (s *Stream) Stats() StreamStats {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	stats := s.stats
+	stats.CongestionWindow = s.cwnd
+	stats.SRTT = s.rtt.srtt
+
+	return stats
+}
+
+// Read reads data from the stream.
+//
+// It returns io.EOF once the remote host closed the stream and all its data
+// was read.
+func (s *Stream) Read(b []byte) (n int, err error) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	for len(s.readable) == 0 {
+		if s.remoteFin {
+			return 0, io.EOF
+		}
+
+		if s.err != nil {
+			return 0, s.err
+		}
+
+		if s.readClosed {
+			return 0, ErrStreamClosed
+		}
+
+		s.lock.Unlock()
+		err = s.wait(s.readReady, io.ErrUnexpectedEOF)
+		s.lock.Lock()
+
+		if err != nil {
+			return 0, err
+		}
+	}
+
+	for len(b) > 0 && len(s.readable) > 0 {
+		k := copy(b, s.readable[0])
+		b = b[k:]
+		n += k
+
+		if k == len(s.readable[0]) {
+			s.readable[0] = nil
+			s.readable = s.readable[1:]
+		} else {
+			s.readable[0] = s.readable[0][k:]
+		}
+	}
+
+	s.readableBytes -= n
+	s.updateWindow()
+
+	return n, nil
+}
+
+// Write writes data to the stream.
+//
+// It blocks while the data not yet acknowledged by the remote host fills the
+// window.
+func (s *Stream) Write(p []byte) (n int, err error) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	for len(p) > 0 {
+		for s.err == nil && !s.writeClosed && s.sendBuffered >= s.window {
+			s.lock.Unlock()
+			err = s.wait(s.writeReady, io.ErrClosedPipe)
+			s.lock.Lock()
+
+			if err != nil {
+				return n, err
+			}
+		}
+
+		if s.err != nil {
+			return n, s.err
+		}
+
+		if s.writeClosed {
+			return n, ErrStreamClosed
+		}
+
+		for len(p) > 0 && s.sendBuffered < s.window {
+			k := s.appendSendData(p[:minInt(len(p), s.window-s.sendBuffered)])
+			p = p[k:]
+			n += k
+		}
+
+		s.push(time.Now())
+	}
+
+	return n, nil
+}
+
+// CloseWrite closes the sending direction of the stream: the remote host reads
+// io.EOF once it got all the written data.
+func (s *Stream) CloseWrite() error {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	s.closeWrite()
+
+	return nil
+}
+
+// Close closes both directions of the stream.
+//
+// Written data is still delivered, but data from the remote host is
+// discarded.
+func (s *Stream) Close() error {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	s.closeWrite()
+
+	if !s.readClosed {
+		s.readClosed = true
+		s.readable = nil
+		s.readableBytes = 0
+		s.updateWindow()
+		notify(s.readReady)
+	}
+
+	return nil
+}
+
+func (s *Stream) closeWrite() {
+	if s.writeClosed || s.err != nil {
+		return
+	}
+
+	s.writeClosed = true
+	s.sendQueue = append(s.sendQueue, &streamSegment{seq: s.sendEnd, fin: true})
+	s.sendEnd++
+	s.push(time.Now())
+	s.checkDone()
+	notify(s.writeReady)
+}
+
+// wait waits for a notification, or for the connection to be closed.
+func (s *Stream) wait(ready chan struct{}, closedErr error) error {
+	select {
+	case <-ready:
+		return nil
+	case <-s.conn.closed:
+		return closedErr
+	}
+}
+
+func notify(ready chan struct{}) {
+	select {
+	case ready <- struct{}{}:
+	default:
+	}
+}
+
+// appendSendData appends data to the segments to send and returns the number
+// of bytes it appended, up to a segment.
+func (s *Stream) appendSendData(p []byte) int {
+	var seg *streamSegment
+
+	if len(s.sendQueue) > s.sendUnsent {
+		if last := s.sendQueue[len(s.sendQueue)-1]; last.n < streamSegmentSize {
+			seg = last
+		}
+	}
+
+	if seg == nil {
+		seg = &streamSegment{seq: s.sendEnd, buf: getStreamBuffer()}
+		s.sendQueue = append(s.sendQueue, seg)
+	}
+
+	k := copy((*seg.buf)[seg.n:streamSegmentSize], p)
+	seg.n += k
+	s.sendEnd += uint64(k)
+	s.sendBuffered += k
+
+	return k
+}
+
+// push sends the lost segments then the new ones, as long as the congestion
+// and the receive windows allow.
+func (s *Stream) push(now time.Time) {
+	if s.err != nil {
+		return
+	}
+
+	for i := 0; s.sendLost > 0 && i < s.sendUnsent && s.inFlight < s.cwnd; i++ {
+		if seg := s.sendQueue[i]; seg.lost {
+			seg.lost = false
+			seg.retransmitted = true
+			s.sendLost--
+			s.stats.Retransmitted++
+			s.transmit(seg, now)
+		}
+	}
+
+	for s.sendUnsent < len(s.sendQueue) && s.inFlight < s.cwnd {
+		seg := s.sendQueue[s.sendUnsent]
+
+		if seg.seq+uint64(seg.n) > s.peerRight {
+			break
+		}
+
+		s.sendUnsent++
+		s.transmit(seg, now)
+	}
+
+	s.armTimer()
+}
+
+// transmit sends a segment.
+func (s *Stream) transmit(seg *streamSegment, now time.Time) {
+	s.sendCount++
+	seg.sent = true
+	seg.sentAt = now
+	seg.order = s.sendCount
+	s.inFlight += seg.seqLen()
+	s.stats.Sent++
+
+	var flags uint8
+
+	if seg.fin {
+		flags |= streamFlagFin
+	}
+
+	var data []byte
+
+	if seg.buf != nil {
+		data = (*seg.buf)[:seg.n]
+	}
+
+	s.sendSegment(flags, seg.seq, data)
+}
+
+// sendSegment sends a segment that acknowledges the received data.
+func (s *Stream) sendSegment(flags uint8, seq uint64, data []byte) {
+	h := streamHeader{
+		flags: flags,
+		id:    s.key.id,
+		seq:   seq,
+		ack:   s.recvNext,
+	}
+
+	if s.key.local {
+		h.flags |= streamFlagInitiator
+	}
+
+	window := s.receiveWindow()
+	h.window = uint32(window)
+	s.advertisedRight = s.recvNext + uint64(window)
+
+	// The first blocks of out of order data are the ones that reveal the
+	// losses.
+	for _, chunk := range s.outOfOrder {
+		if h.sacksCount > 0 && chunk.seq <= h.sacks[h.sacksCount-1].end {
+			if end := chunk.end(); end > h.sacks[h.sacksCount-1].end {
+				h.sacks[h.sacksCount-1].end = end
+			}
+
+			continue
+		}
+
+		if h.sacksCount == streamMaxSACKBlocks {
+			break
+		}
+
+		h.sacks[h.sacksCount] = streamRange{start: chunk.seq, end: chunk.end()}
+		h.sacksCount++
+	}
+
+	buf := getStreamBuffer()
+	n := writeStreamHeader(*buf, &h)
+	n += copy((*buf)[n:], data)
+
+	s.conn.queueSegment(buf, n)
+}
+
+// receiveWindow returns the number of bytes the remote host may send past
+// the received ones.
+//
+// Data received out of order is within the window, so it does not shrink it.
+func (s *Stream) receiveWindow() int {
+	if window := s.window - s.readableBytes; window > 0 {
+		return window
+	}
+
+	return 0
+}
+
+// updateWindow tells the remote host that reads made room, once the room
+// makes a difference.
+func (s *Stream) updateWindow() {
+	if s.err != nil || s.remoteFin {
+		return
+	}
+
+	if s.recvNext+uint64(s.receiveWindow()) >= s.advertisedRight+uint64(s.window/4) {
+		s.sendSegment(0, s.sendEnd, nil)
+	}
+}
+
+// receive handles a segment from the remote host.
+func (s *Stream) receive(h *streamHeader, data []byte, now time.Time) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	if s.err != nil {
+		return
+	}
+
+	if h.flags&streamFlagReset != 0 {
+		s.fail(ErrStreamReset)
+		return
+	}
+
+	s.handleAck(h, now)
+
+	fin := h.flags&streamFlagFin != 0
+
+	if len(data) > 0 || fin {
+		s.handleData(h.seq, data, fin)
+	}
+
+	sent := s.stats.Sent
+	s.push(now)
+
+	// Data is acknowledged right away, which the segments sent in the
+	// meantime did.
+	if (len(data) > 0 || fin) && s.stats.Sent == sent {
+		s.sendSegment(0, s.sendEnd, nil)
+	}
+
+	s.checkDone()
+}
+
+// handleAck handles the acknowledgements of a segment.
+func (s *Stream) handleAck(h *streamHeader, now time.Time) {
+	if h.ack < s.sendUna || h.ack > s.sendEnd {
+		return
+	}
+
+	s.peerRight = h.ack + uint64(h.window)
+
+	acked := 0
+	popped := 0
+	var sample *streamSegment
+
+	for _, seg := range s.sendQueue[:s.sendUnsent] {
+		if seg.end() > h.ack {
+			break
+		}
+
+		if seg.lost {
+			s.sendLost--
+		} else if !seg.sacked {
+			s.inFlight -= seg.seqLen()
+
+			// Karn's algorithm: retransmitted segments are ambiguous.
+			if !seg.retransmitted {
+				sample = seg
+			}
+		}
+
+		if seg.buf != nil {
+			putStreamBuffer(seg.buf)
+		}
+
+		if seg.fin {
+			s.finAcked = true
+		}
+
+		acked += seg.n
+		popped++
+	}
+
+	if popped > 0 {
+		for i := range s.sendQueue[:popped] {
+			s.sendQueue[i] = nil
+		}
+
+		s.sendQueue = s.sendQueue[popped:]
+		s.sendUnsent -= popped
+		s.sendUna = h.ack
+		s.sendBuffered -= acked
+		s.backoff = 0
+
+		if sample != nil {
+			s.rtt.update(now.Sub(sample.sentAt))
+		}
+
+		notify(s.writeReady)
+	}
+
+	if h.sacksCount > 0 {
+		s.handleSACK(h)
+	}
+
+	if acked == 0 {
+		return
+	}
+
+	if s.recovering {
+		if h.ack >= s.recoverySeq {
+			s.recovering = false
+			s.cwnd = s.ssthresh
+		}
+	} else if s.cwnd < s.ssthresh {
+		s.cwnd += acked
+	} else {
+		s.cwnd += maxInt(streamSegmentSize*acked/s.cwnd, 1)
+	}
+
+	// Growing past what may be buffered is pointless.
+	if s.cwnd > s.window {
+		s.cwnd = s.window
+	}
+}
+
+// handleSACK marks the segments that the remote host received out of order,
+// and the ones that were lost before them.
+func (s *Stream) handleSACK(h *streamHeader) {
+	sent := s.sendQueue[:s.sendUnsent]
+
+	for _, block := range h.sacks[:h.sacksCount] {
+		i := sort.Search(len(sent), func(i int) bool { return sent[i].seq >= block.start })
+
+		for ; i < len(sent) && sent[i].end() <= block.end; i++ {
+			if seg := sent[i]; !seg.sacked {
+				seg.sacked = true
+
+				if seg.lost {
+					seg.lost = false
+					s.sendLost--
+				} else {
+					s.inFlight -= seg.seqLen()
+				}
+			}
+		}
+	}
+
+	// A segment is lost once enough segments sent after it were received,
+	// which also applies to retransmissions: latest holds the send orders of
+	// the last segments received past the current one.
+	flight := s.inFlight
+	lost := false
+	var latest [streamDupThreshold]uint64
+
+	for i := len(sent) - 1; i >= 0; i-- {
+		seg := sent[i]
+
+		if seg.sacked {
+			for j := range latest {
+				if seg.order > latest[j] {
+					copy(latest[j+1:], latest[j:])
+					latest[j] = seg.order
+					break
+				}
+			}
+		} else if latest[streamDupThreshold-1] > seg.order && !seg.lost {
+			seg.lost = true
+			s.sendLost++
+			s.inFlight -= seg.seqLen()
+			lost = true
+		}
+	}
+
+	if lost && !s.recovering {
+		s.recovering = true
+		s.recoverySeq = sent[len(sent)-1].end()
+		s.ssthresh = maxInt(flight/2, streamMinWindow)
+		s.cwnd = s.ssthresh
+	}
+}
+
+// handleData handles the data of a segment.
+func (s *Stream) handleData(seq uint64, data []byte, fin bool) {
+	if s.remoteFin {
+		return
+	}
+
+	end := seq + uint64(len(data))
+
+	if end < s.recvNext || (end == s.recvNext && !fin) {
+		return
+	}
+
+	// The remote host is not supposed to send past the window.
+	if end > s.recvNext+uint64(s.receiveWindow()) {
+		return
+	}
+
+	if seq > s.recvNext {
+		i := sort.Search(len(s.outOfOrder), func(i int) bool { return s.outOfOrder[i].seq >= seq })
+
+		if i < len(s.outOfOrder) && s.outOfOrder[i].seq == seq {
+			return
+		}
+
+		s.outOfOrder = append(s.outOfOrder, streamChunk{})
+		copy(s.outOfOrder[i+1:], s.outOfOrder[i:])
+		s.outOfOrder[i] = streamChunk{seq: seq, data: data, fin: fin}
+
+		return
+	}
+
+	s.deliver(streamChunk{seq: seq, data: data, fin: fin})
+
+	for len(s.outOfOrder) > 0 && s.outOfOrder[0].seq <= s.recvNext {
+		chunk := s.outOfOrder[0]
+		s.outOfOrder[0] = streamChunk{}
+		s.outOfOrder = s.outOfOrder[1:]
+
+		if !s.remoteFin {
+			s.deliver(chunk)
+		}
+	}
+
+	notify(s.readReady)
+}
+
+// deliver makes the part of a chunk past the received data readable.
+func (s *Stream) deliver(chunk streamChunk) {
+	if end := chunk.end(); end > s.recvNext {
+		data := chunk.data[s.recvNext-chunk.seq:]
+		s.recvNext = end
+
+		if !s.readClosed {
+			s.readable = append(s.readable, data)
+			s.readableBytes += len(data)
+		}
+	}
+
+	if chunk.fin && chunk.end() == s.recvNext {
+		s.recvNext++
+		s.remoteFin = true
+	}
+}
+
+// armTimer schedules the retransmission timeout, if segments are in flight or
+// wait for the receive window to open.
+func (s *Stream) armTimer() {
+	if s.timer != nil || s.err != nil {
+		return
+	}
+
+	if s.inFlight == 0 && s.sendLost == 0 && s.sendUnsent == len(s.sendQueue) {
+		return
+	}
+
+	s.timer = s.conn.timers.AfterFunc(s.rto(), s.expire)
+}
+
+func (s *Stream) rto() time.Duration {
+	rto := s.rtt.rto(streamInitialRTO, streamMinRTO, streamMaxRTO) << s.backoff
+
+	if rto > streamMaxRTO {
+		return streamMaxRTO
+	}
+
+	return rto
+}
+
+// expire handles the retransmission timeout.
+func (s *Stream) expire() {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	s.timer = nil
+
+	select {
+	case <-s.conn.closed:
+		return
+	default:
+	}
+
+	if s.err != nil {
+		return
+	}
+
+	now := time.Now()
+	var oldest time.Time
+
+	for _, seg := range s.sendQueue[:s.sendUnsent] {
+		if !seg.sacked && !seg.lost && (oldest.IsZero() || seg.sentAt.Before(oldest)) {
+			oldest = seg.sentAt
+		}
+	}
+
+	if oldest.IsZero() {
+		// Nothing is in flight, which happens when the receive window is
+		// closed: a segment probes it.
+		if s.sendLost == 0 && s.sendUnsent < len(s.sendQueue) {
+			s.sendUnsent++
+			s.transmit(s.sendQueue[s.sendUnsent-1], now)
+			s.backoff = minUint(s.backoff+1, streamMaxBackoff)
+		}
+
+		s.push(now)
+
+		return
+	}
+
+	if wait := oldest.Add(s.rto()).Sub(now); wait > 0 {
+		s.timer = s.conn.timers.AfterFunc(wait, s.expire)
+		return
+	}
+
+	// Everything in flight is considered lost.
+	s.ssthresh = maxInt(s.inFlight/2, streamMinWindow)
+	s.cwnd = streamSegmentSize
+	s.recovering = false
+
+	for _, seg := range s.sendQueue[:s.sendUnsent] {
+		if !seg.sacked && !seg.lost {
+			seg.lost = true
+			s.sendLost++
+			s.inFlight -= seg.seqLen()
+		}
+	}
+
+	s.backoff = minUint(s.backoff+1, streamMaxBackoff)
+	s.stats.Timeouts++
+	s.push(now)
+}
+
+// fail aborts the stream.
+func (s *Stream) fail(err error) {
+	s.err = err
+
+	for _, seg := range s.sendQueue {
+		if seg.buf != nil {
+			putStreamBuffer(seg.buf)
+		}
+	}
+
+	s.sendQueue = nil
+	s.sendUnsent = 0
+	s.checkDone()
+	notify(s.readReady)
+	notify(s.writeReady)
+}
+
+// checkDone forgets the stream once both directions are closed.
+func (s *Stream) checkDone() {
+	if s.err == nil && !(s.finAcked && s.remoteFin) {
+		return
+	}
+
+	if s.timer != nil {
+		s.timer.Stop()
+		s.timer = nil
+	}
+
+	s.conn.removeStream(s.key)
+}
+
+// OpenStream opens a stream to the remote host.
+//
+// It waits for a session to be established.
+func (c *Conn) OpenStream(ctx context.Context) (*Stream, error) {
+	if c.streams == nil {
+		return nil, ErrStreamsDisabled
+	}
+
+	if err := c.waitConnected(ctx); err != nil {
+		return nil, err
+	}
+
+	result := make(chan bool, 1)
+
+	if err := c.do(func() { result <- c.streamsEnabled() }); err != nil {
+		return nil, err
+	}
+
+	select {
+	case enabled := <-result:
+		if !enabled {
+			return nil, ErrStreamsDisabled
+		}
+	case <-c.closed:
+		return nil, io.EOF
+	}
+
+	c.streamsLock.Lock()
+	defer c.streamsLock.Unlock()
+
+	c.streamsNextID++
+	s := newStream(c, streamKey{id: c.streamsNextID, local: true})
+	c.streams[s.key] = s
+
+	return s, nil
+}
+
+// AcceptStream waits for the remote host to open a stream.
+func (c *Conn) AcceptStream() (*Stream, error) {
+	if c.accepted == nil {
+		return nil, ErrStreamsDisabled
+	}
+
+	select {
+	case s := <-c.accepted:
+		return s, nil
+	case <-c.closed:
+		return nil, io.EOF
+	}
+}
+
+// streamsEnabled tells whether streams are multiplexed over the session.
+func (c *Conn) streamsEnabled() bool {
+	return c.streams != nil && c.session != nil && c.features().Has(FeatureStreams)
+}
+
+// handleStream handles a STREAM message.
+func (c *Conn) handleStream(payload []byte) error {
+	if !c.streamsEnabled() {
+		return nil
+	}
+
+	h, data, err := parseStreamSegment(payload)
+
+	if err != nil {
+		c.warning(fmt.Errorf("invalid stream segment: %s", err))
+		return nil
+	}
+
+	key := streamKey{id: h.id, local: h.flags&streamFlagInitiator == 0}
+	reset := h.flags&streamFlagReset != 0
+
+	c.streamsLock.Lock()
+	s := c.streams[key]
+
+	if s == nil && !key.local && !reset && c.acceptsRemoteStream(h.id) {
+		s = newStream(c, key)
+
+		select {
+		case c.accepted <- s:
+			c.streams[key] = s
+		default:
+			c.warning(fmt.Errorf("resetting stream %d as too many streams wait to be accepted", h.id))
+			s = nil
+		}
+	}
+
+	c.streamsLock.Unlock()
+
+	if s == nil {
+		if !reset {
+			c.resetStream(key)
+		}
+
+		return nil
+	}
+
+	s.receive(&h, data, time.Now())
+
+	return nil
+}
+
+// acceptsRemoteStream tells whether a stream identifier was never used by the
+// remote host.
+//
+// The streams lock must be held.
+func (c *Conn) acceptsRemoteStream(id uint32) bool {
+	if id > c.streamsRemoteMax {
+		for gap := c.streamsRemoteMax + 1; gap < id && len(c.streamsRemoteGaps) < streamMaxGaps; gap++ {
+			c.streamsRemoteGaps[gap] = struct{}{}
+		}
+
+		c.streamsRemoteMax = id
+
+		return true
+	}
+
+	if _, ok := c.streamsRemoteGaps[id]; ok {
+		delete(c.streamsRemoteGaps, id)
+
+		return true
+	}
+
+	return false
+}
+
+// resetStream tells the remote host that a stream is unknown.
+func (c *Conn) resetStream(key streamKey) {
+	h := streamHeader{flags: streamFlagReset, id: key.id}
+
+	if key.local {
+		h.flags |= streamFlagInitiator
+	}
+
+	buf := getStreamBuffer()
+	c.queueSegment(buf, writeStreamHeader(*buf, &h))
+}
+
+func (c *Conn) removeStream(key streamKey) {
+	c.streamsLock.Lock()
+	defer c.streamsLock.Unlock()
+
+	delete(c.streams, key)
+}
+
+// queueSegment queues a segment to be sent to the remote host, or drops it if
+// too many segments are queued.
+func (c *Conn) queueSegment(buf *[]byte, n int) {
+	select {
+	case c.streamSegments <- relayedMessage{messageType: MessageTypeStream, data: (*buf)[:n], pooled: buf}:
+	default:
+		putStreamBuffer(buf)
+	}
+}
+
+// sendSegments sends a queued segment along with the ones queued after it.
+func (c *Conn) sendSegments(first relayedMessage) error {
+	batch := c.collectBatch(c.streamSegments, first)
+
+	if c.session == nil {
+		releaseBatch(batch)
+
+		return nil
+	}
+
+	_, err := c.sendBatch(batch)
+
+	return err
+}
+
+func minInt(a, b int) int {
+	if a < b {
+		return a
+	}
+
+	return b
+}
+
+func maxInt(a, b int) int {
+	if a > b {
+		return a
+	}
+
+	return b
+}
+
+func minUint(a, b uint) uint {
+	if a < b {
+		return a
+	}
+
+	return b
+}
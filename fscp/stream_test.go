@@ -0,0 +1,200 @@
+package fscp
+
+import (
+	"bytes"
+	"context"
+	"crypto/rand"
+	"io"
+	"io/ioutil"
+	"net"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+// streamLossPacketConn drops one in every n of the STREAM messages it sends.
+type streamLossPacketConn struct {
+	net.PacketConn
+	n     uint64
+	count uint64
+}
+
+func (c *streamLossPacketConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	if len(b) > 1 && MessageType(b[1]) == MessageTypeStream && atomic.AddUint64(&c.count, 1)%c.n == 0 {
+		return len(b), nil
+	}
+
+	return c.PacketConn.WriteTo(b, addr)
+}
+
+// streamTestPair opens a stream between two clients, the first of which drops
+// one in every loss of its STREAM messages, if loss is not zero.
+func streamTestPair(tb testing.TB, loss uint64) (local *Stream, remote *Stream) {
+	tb.Helper()
+
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	config := &ClientConfig{Streams: StreamConfig{Enabled: true}}
+
+	listen := func(loss uint64) *Client {
+		var socket net.PacketConn
+		socket, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+		if err != nil {
+			tb.Fatalf("expected no error: %s", err)
+		}
+
+		if loss > 0 {
+			socket = &streamLossPacketConn{PacketConn: socket, n: loss}
+		}
+
+		client, err := NewClientWithConfig(socket, nil, config)
+
+		if err != nil {
+			socket.Close()
+			tb.Fatalf("expected no error: %s", err)
+		}
+
+		tb.Cleanup(func() { client.Close() })
+
+		return client
+	}
+
+	server := listen(0)
+	conn, err := listen(loss).Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	if local, err = conn.OpenStream(ctx); err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	// Streams are only known to the remote host once data is sent.
+	if _, err := local.Write([]byte("hello")); err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	remoteConn, err := server.Accept()
+
+	if err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	if remote, err = remoteConn.(*Conn).AcceptStream(); err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	b := make([]byte, 5)
+
+	if _, err := io.ReadFull(remote, b); err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	if string(b) != "hello" {
+		tb.Fatalf("expected `hello` but got `%s`", b)
+	}
+
+	return local, remote
+}
+
+// testStreamTransfer writes random data to a stream and checks that the other
+// end reads it all, in order.
+func testStreamTransfer(t *testing.T, local *Stream, remote *Stream, size int) {
+	t.Helper()
+
+	data := make([]byte, size)
+	rand.Read(data)
+
+	errs := make(chan error, 1)
+
+	go func() {
+		_, err := local.Write(data)
+		local.Close()
+		errs <- err
+	}()
+
+	received, err := ioutil.ReadAll(remote)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if err := <-errs; err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if !bytes.Equal(received, data) {
+		t.Fatalf("expected %d byte(s) but got %d different one(s)", len(data), len(received))
+	}
+
+	if _, err := remote.Write([]byte("more")); err != nil {
+		t.Errorf("expected the other direction to stay open but got: %s", err)
+	}
+}
+
+func TestStream(t *testing.T) {
+	local, remote := streamTestPair(t, 0)
+
+	testStreamTransfer(t, local, remote, 4<<20)
+
+	if stats := local.Stats(); stats.Sent < 4<<20/streamSegmentSize || stats.SRTT == 0 {
+		t.Errorf("unexpected statistics: %+v", stats)
+	}
+}
+
+func TestStreamLoss(t *testing.T) {
+	local, remote := streamTestPair(t, 50)
+
+	testStreamTransfer(t, local, remote, 1<<20)
+
+	if stats := local.Stats(); stats.Retransmitted == 0 {
+		t.Errorf("expected retransmissions: %+v", stats)
+	}
+}
+
+func TestStreamsDisabled(t *testing.T) {
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	server := listenTestClient(t, nil)
+	client := listenTestClient(t, &ClientConfig{Streams: StreamConfig{Enabled: true}})
+	conn, err := client.Connect(ctx, server.Addr().(*Addr))
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if _, err := conn.OpenStream(ctx); err != ErrStreamsDisabled {
+		t.Errorf("expected %s but got %v", ErrStreamsDisabled, err)
+	}
+}
+
+// BenchmarkStream measures the throughput of a bulk transfer over a stream.
+func BenchmarkStream(b *testing.B) {
+	local, remote := streamTestPair(b, 0)
+	payload := make([]byte, 64<<10)
+	done := make(chan error, 1)
+
+	go func() {
+		_, err := io.Copy(ioutil.Discard, remote)
+		done <- err
+	}()
+
+	b.SetBytes(int64(len(payload)))
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		if _, err := local.Write(payload); err != nil {
+			b.Fatalf("expected no error: %s", err)
+		}
+	}
+
+	local.CloseWrite()
+
+	if err := <-done; err != nil {
+		b.Fatalf("expected no error: %s", err)
+	}
+}
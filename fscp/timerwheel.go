@@ -0,0 +1,139 @@
+package fscp
+
+import (
+	"sync"
+	"time"
+)
+
+const (
+	// DefaultTimerWheelResolution is the default resolution of the timer
+	// wheel that drives the periodic tasks of connections.
+	DefaultTimerWheelResolution = time.Millisecond * 100
+
+	// defaultTimerWheelSize is the number of slots in a timer wheel.
+	defaultTimerWheelSize = 512
+)
+
+// A timerWheel schedules large amounts of coarse-grained timers using a single
+// goroutine.
+//
+// Using one wheel per client rather than one runtime timer per connection
+// and per task keeps the cost of idle connections low.
+type timerWheel struct {
+	resolution time.Duration
+	lock       sync.Mutex
+	slots      []map[*wheelTimer]struct{}
+	position   int
+	closed     chan struct{}
+	once       sync.Once
+}
+
+// A wheelTimer is a timer scheduled on a timerWheel.
+type wheelTimer struct {
+	wheel  *timerWheel
+	slot   int
+	rounds int
+	f      func()
+}
+
+func newTimerWheel(resolution time.Duration, size int) *timerWheel {
+	w := &timerWheel{
+		resolution: resolution,
+		slots:      make([]map[*wheelTimer]struct{}, size),
+		closed:     make(chan struct{}),
+	}
+
+	for i := range w.slots {
+		w.slots[i] = map[*wheelTimer]struct{}{}
+	}
+
+	go w.run()
+
+	return w
+}
+
+// AfterFunc calls f in its own goroutine after at least the specified
+// duration has elapsed, rounded up to the wheel's resolution.
+func (w *timerWheel) AfterFunc(d time.Duration, f func()) *wheelTimer {
+	ticks := int((d + w.resolution - 1) / w.resolution)
+
+	if ticks < 1 {
+		ticks = 1
+	}
+
+	t := &wheelTimer{
+		wheel: w,
+		f:     f,
+	}
+
+	w.lock.Lock()
+	defer w.lock.Unlock()
+
+	t.slot = (w.position + ticks) % len(w.slots)
+	t.rounds = (ticks - 1) / len(w.slots)
+	w.slots[t.slot][t] = struct{}{}
+
+	return t
+}
+
+// Close stops the wheel.
+//
+// Pending timers never fire.
+func (w *timerWheel) Close() {
+	w.once.Do(func() {
+		close(w.closed)
+	})
+}
+
+func (w *timerWheel) run() {
+	ticker := time.NewTicker(w.resolution)
+	defer ticker.Stop()
+
+	var expired []*wheelTimer
+
+	for {
+		select {
+		case <-w.closed:
+			return
+		case <-ticker.C:
+		}
+
+		w.lock.Lock()
+		w.position = (w.position + 1) % len(w.slots)
+
+		for t := range w.slots[w.position] {
+			if t.rounds > 0 {
+				t.rounds--
+				continue
+			}
+
+			delete(w.slots[w.position], t)
+			expired = append(expired, t)
+		}
+
+		w.lock.Unlock()
+
+		for i, t := range expired {
+			go t.f()
+			expired[i] = nil
+		}
+
+		expired = expired[:0]
+	}
+}
+
+// Stop prevents the timer from firing.
+//
+// It returns false if the timer already fired or was stopped.
+func (t *wheelTimer) Stop() bool {
+	t.wheel.lock.Lock()
+	defer t.wheel.lock.Unlock()
+
+	if _, ok := t.wheel.slots[t.slot][t]; !ok {
+		return false
+	}
+
+	delete(t.wheel.slots[t.slot], t)
+
+	return true
+}
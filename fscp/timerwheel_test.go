@@ -0,0 +1,36 @@
+package fscp
+
+import (
+	"testing"
+	"time"
+)
+
+func TestTimerWheel(t *testing.T) {
+	wheel := newTimerWheel(time.Millisecond, 8)
+	defer wheel.Close()
+
+	fired := make(chan int, 3)
+
+	wheel.AfterFunc(time.Millisecond*20, func() { fired <- 2 })
+	wheel.AfterFunc(0, func() { fired <- 1 })
+	stopped := wheel.AfterFunc(time.Millisecond*5, func() { fired <- 0 })
+
+	if !stopped.Stop() {
+		t.Fatalf("true was expected")
+	}
+
+	if stopped.Stop() {
+		t.Fatalf("false was expected")
+	}
+
+	for _, expected := range []int{1, 2} {
+		select {
+		case value := <-fired:
+			if value != expected {
+				t.Errorf("expected timer %d to fire but got %d", expected, value)
+			}
+		case <-time.After(time.Second):
+			t.Fatalf("timer %d did not fire", expected)
+		}
+	}
+}
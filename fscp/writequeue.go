@@ -0,0 +1,156 @@
+package fscp
+
+import (
+	"bytes"
+	"errors"
+	"io"
+)
+
+// DefaultWriteQueueSize is the default number of bytes that can be written
+// to a connection before its session is established.
+const DefaultWriteQueueSize = 64 * 1024
+
+// ErrWriteQueueFull is returned by writes that would block, when configured
+// to fail fast.
+var ErrWriteQueueFull = errors.New("the write queue is full")
+
+// WriteQueueConfig contains the settings of the writes that happen before a
+// session is established.
+//
+// Such writes are queued and sent right after the session gets established,
+// rather than blocking until then. Once the queue is full, writes block as
+// usual.
+type WriteQueueConfig struct {
+	// Size is the number of bytes that can be queued. A negative value
+	// disables the queue.
+	Size int
+
+	// FailFast makes writes fail with ErrWriteQueueFull instead of blocking
+	// when the queue is full.
+	FailFast bool
+
+	// Coalesce packs the queued writes into as few datagrams as possible
+	// when they are flushed, provided the remote host reads all the messages
+	// of a datagram.
+	//
+	// Writes that go through other paths than the client's socket, such as
+	// multiple paths, per-flow sockets or mesh detours, are never coalesced.
+	Coalesce bool
+
+	// MaxCoalescedSize is the maximum size of coalesced datagrams.
+	MaxCoalescedSize int
+}
+
+func (c *WriteQueueConfig) size() int {
+	if c.Size == 0 {
+		return DefaultWriteQueueSize
+	}
+
+	return c.Size
+}
+
+func (c *WriteQueueConfig) maxCoalescedSize() int {
+	if c.MaxCoalescedSize <= 0 {
+		return DefaultMaxCoalescedSize
+	}
+
+	return c.MaxCoalescedSize
+}
+
+// queueWrite queues data that is written before the session is established.
+// It tells whether the data was queued.
+func (c *Conn) queueWrite(p []byte) (bool, error) {
+	select {
+	case <-c.closed:
+		return false, io.ErrClosedPipe
+	default:
+	}
+
+	c.pendingLock.Lock()
+	defer c.pendingLock.Unlock()
+
+	if c.pendingFlushed {
+		return false, nil
+	}
+
+	if c.pendingBytes+len(p) > c.config.WriteQueue.size() {
+		if c.config.WriteQueue.FailFast {
+			return false, ErrWriteQueueFull
+		}
+
+		return false, nil
+	}
+
+	// Implementations must not retain p.
+	b := make([]byte, len(p))
+	copy(b, p)
+
+	c.pendingWrites = append(c.pendingWrites, b)
+	c.pendingBytes += len(b)
+
+	return true, nil
+}
+
+// flushPendingWrites sends the writes that were queued before the session
+// was established.
+//
+// If coalescing is enabled and the messages would all go through the client's
+// socket, they are packed into as few datagrams as possible.
+func (c *Conn) flushPendingWrites() error {
+	c.pendingLock.Lock()
+	writes := c.pendingWrites
+	c.pendingWrites, c.pendingBytes, c.pendingFlushed = nil, 0, true
+	c.pendingLock.Unlock()
+
+	if len(writes) == 0 {
+		return nil
+	}
+
+	c.debugPrintf("Flushing %d queued write(s).\n", len(writes))
+
+	if !c.coalescesWrites() {
+		for _, data := range writes {
+			if err := c.sendData(0, data); err != nil {
+				return err
+			}
+		}
+
+		return nil
+	}
+
+	maxSize := c.config.WriteQueue.maxCoalescedSize()
+	datagram := &bytes.Buffer{}
+	message := &bytes.Buffer{}
+
+	for _, data := range writes {
+		message.Reset()
+
+		if err := c.appendData(message, 0, data); err != nil {
+			return err
+		}
+
+		if datagram.Len() > 0 && datagram.Len()+message.Len() > maxSize {
+			if _, err := c.writer.Write(datagram.Bytes()); err != nil {
+				return err
+			}
+
+			datagram.Reset()
+		}
+
+		datagram.Write(message.Bytes())
+	}
+
+	_, err := c.writer.Write(datagram.Bytes())
+
+	return err
+}
+
+// coalescesWrites tells whether queued writes can be packed together, which
+// is only the case when they would all be sent through the client's socket.
+func (c *Conn) coalescesWrites() bool {
+	if !c.config.WriteQueue.Coalesce || !c.features().Has(FeatureCoalescing) {
+		return false
+	}
+
+	return !c.multipath() && c.meshDetour() == nil && !(len(c.flows) > 0 && c.features().Has(FeatureMultiFlow))
+}
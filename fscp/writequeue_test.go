@@ -0,0 +1,112 @@
+package fscp
+
+import (
+	"context"
+	"io"
+	"testing"
+	"time"
+)
+
+func TestWriteQueue(t *testing.T) {
+	testCases := []struct {
+		name   string
+		config ClientConfig
+	}{
+		{
+			name: "default",
+		},
+		{
+			name:   "coalesced",
+			config: ClientConfig{WriteQueue: WriteQueueConfig{Coalesce: true}},
+		},
+	}
+
+	for _, testCase := range testCases {
+		t.Run(testCase.name, func(t *testing.T) {
+			ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+			defer cancel()
+
+			// Only the server is slow, so that the datagrams of the client
+			// don't get reordered.
+			server := listenDelayedTestClient(t, time.Millisecond*50, nil, nil)
+			client := listenTestClient(t, &testCase.config)
+			conn, _ := client.addConn(server.Addr().(*Addr), nil)
+
+			messages := []string{"first", "second", "third"}
+			start := time.Now()
+
+			for _, message := range messages {
+				if _, err := conn.Write([]byte(message)); err != nil {
+					t.Fatalf("expected no error: %s", err)
+				}
+			}
+
+			if elapsed := time.Since(start); elapsed > time.Millisecond*50 {
+				t.Errorf("expected writes not to block but they took %s", elapsed)
+			}
+
+			serverConn, err := server.Accept()
+
+			if err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+
+			for _, message := range messages {
+				b := make([]byte, 16)
+				n, err := serverConn.Read(b)
+
+				if err != nil {
+					t.Fatalf("expected no error: %s", err)
+				}
+
+				if string(b[:n]) != message {
+					t.Errorf("expected `%s` but got `%s`", message, b[:n])
+				}
+			}
+
+			if _, err := client.Connect(ctx, server.Addr().(*Addr)); err != nil {
+				t.Fatalf("expected no error: %s", err)
+			}
+		})
+	}
+
+	t.Run("fail-fast", func(t *testing.T) {
+		server := listenDelayedTestClient(t, time.Millisecond*50, nil, nil)
+		client := listenTestClient(t, &ClientConfig{WriteQueue: WriteQueueConfig{Size: 8, FailFast: true}})
+		conn, _ := client.addConn(server.Addr().(*Addr), nil)
+
+		if _, err := conn.Write([]byte("first")); err != nil {
+			t.Fatalf("expected no error: %s", err)
+		}
+
+		if _, err := conn.Write([]byte("second")); err != ErrWriteQueueFull {
+			t.Errorf("expected %s but got: %v", ErrWriteQueueFull, err)
+		}
+	})
+
+	t.Run("closed", func(t *testing.T) {
+		server := listenDelayedTestClient(t, time.Millisecond*50, nil, nil)
+		client := listenTestClient(t, nil)
+		conn, _ := client.addConn(server.Addr().(*Addr), nil)
+		conn.Close()
+
+		if _, err := conn.Write([]byte("first")); err != io.ErrClosedPipe {
+			t.Errorf("expected %s but got: %v", io.ErrClosedPipe, err)
+		}
+	})
+	t.Run("multipath", func(t *testing.T) {
+		conn := &Conn{config: ClientConfig{WriteQueue: WriteQueueConfig{Coalesce: true}}}
+		conn.remoteFeatures = conn.remoteFeatures.With(FeatureCoalescing)
+
+		if !conn.coalescesWrites() {
+			t.Errorf("expected queued writes to be coalesced")
+		}
+
+		// Coalesced datagrams would skip the scheduling over the uplinks.
+		conn.uplinks = []*uplink{{}, {}}
+
+		if conn.coalescesWrites() {
+			t.Errorf("expected queued writes not to be coalesced")
+		}
+	})
+}
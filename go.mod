@@ -6,7 +6,7 @@ require (
 	github.com/looplab/fsm v0.0.0-20180515091235-f980bdb68a89 // indirect
 	github.com/magefile/mage v0.0.0-20180411170307-771ebed3d686
 	github.com/sparrc/go-ping v0.0.0-20160208162908-416e72114cd1
-	golang.org/x/net v0.0.0-20180706051357-32a936f46389 // indirect
+	golang.org/x/net v0.0.0-20180706051357-32a936f46389
 	golang.org/x/sys v0.0.0-20180511165053-d0faeb539838
 	golang.org/x/tools v0.0.0-20181026183834-f60e5f99f081 // indirect
 )
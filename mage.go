@@ -14,6 +14,7 @@ var (
 	Packages = []string{
 		"tuntap",
 		"fscp",
+		"tunnel",
 	}
 
 	// Default is the default target.
@@ -0,0 +1,525 @@
+package tunnel
+
+import (
+	"io"
+	"net"
+	"runtime"
+	"sync"
+	"sync/atomic"
+
+	"github.com/freelan-developers/go-freelan/fscp"
+)
+
+const (
+	// DefaultFrameSize is the default size of the buffers that frames are
+	// read in.
+	DefaultFrameSize = 2048
+
+	// DefaultBatchSize is the default maximum number of frames that are read
+	// from or written to the device at once.
+	DefaultBatchSize = 32
+
+	// DefaultQueueSize is the default number of frames received from the
+	// peers that wait to be written to the device.
+	DefaultQueueSize = 1024
+)
+
+// FrameWriter is implemented by peers that send frames without copying them,
+// as FSCP connections do.
+type FrameWriter interface {
+	// WriteFrame sends the data of frame that starts at fscp.DataHeadroom,
+	// and calls done once frame is no longer used.
+	WriteFrame(frame []byte, done func([]byte)) error
+}
+
+// BatchReader is implemented by devices that read several frames in one
+// call, such as the tuntap adapters.
+type BatchReader interface {
+	// ReadBatch reads up to len(frames) frames, stores their sizes and
+	// returns how many were read. It blocks until at least one frame is
+	// read.
+	ReadBatch(frames [][]byte, sizes []int) (int, error)
+}
+
+// BatchWriter is implemented by devices that write several frames in one
+// call.
+type BatchWriter interface {
+	// WriteBatch writes frames and returns how many were written.
+	WriteBatch(frames [][]byte) (int, error)
+}
+
+// Config contains the settings of an engine.
+//
+// The zero value is a valid configuration that uses the default settings.
+type Config struct {
+	// Workers is the number of goroutines that write to the device. Each
+	// one writes the frames of its own share of the peers, which keeps the
+	// frames of every flow in order. Defaults to the number of cores.
+	//
+	// The device is read by a single goroutine, as concurrent reads would
+	// reorder its frames.
+	Workers int
+
+	// FrameSize is the size of the buffers that frames are read in. It must
+	// be at least the MTU of the device plus its link-layer header. Defaults
+	// to DefaultFrameSize.
+	FrameSize int
+
+	// BatchSize is the maximum number of frames that are read from or
+	// written to the device at once. Defaults to DefaultBatchSize.
+	BatchSize int
+
+	// QueueSize is the number of frames received from the peers that wait
+	// to be written to the device by every worker, beyond which they are
+	// dropped. Defaults to DefaultQueueSize.
+	QueueSize int
+
+	// Route, if set, is called with every frame read from the device and
+	// returns the peer to send it to, or nil to drop it. Frames are sent to
+	// all the peers otherwise.
+	//
+	// It must not block, nor retain frame.
+	Route func(frame []byte) net.Conn
+}
+
+func (c *Config) workers() int {
+	if c.Workers <= 0 {
+		return runtime.GOMAXPROCS(0)
+	}
+
+	return c.Workers
+}
+
+func (c *Config) frameSize() int {
+	if c.FrameSize <= 0 {
+		return DefaultFrameSize
+	}
+
+	return c.FrameSize
+}
+
+func (c *Config) batchSize() int {
+	if c.BatchSize <= 0 {
+		return DefaultBatchSize
+	}
+
+	return c.BatchSize
+}
+
+func (c *Config) queueSize() int {
+	if c.QueueSize <= 0 {
+		return DefaultQueueSize
+	}
+
+	return c.QueueSize
+}
+
+// Stats contains the counters of an engine.
+type Stats struct {
+	// ReadFrames and ReadBytes count the frames read from the device.
+	ReadFrames uint64
+	ReadBytes  uint64
+
+	// ReadBatches is the number of calls that read frames from the device.
+	ReadBatches uint64
+
+	// WrittenFrames and WrittenBytes count the frames written to the device.
+	WrittenFrames uint64
+	WrittenBytes  uint64
+
+	// WriteBatches is the number of calls that wrote frames to the device.
+	WriteBatches uint64
+
+	// SentFrames and SentBytes count the frames sent to the peers.
+	SentFrames uint64
+	SentBytes  uint64
+
+	// ReceivedFrames and ReceivedBytes count the frames received from the
+	// peers.
+	ReceivedFrames uint64
+	ReceivedBytes  uint64
+
+	// Unrouted is the number of frames read from the device that were sent
+	// to no peer.
+	Unrouted uint64
+
+	// Dropped is the number of frames received from the peers that were
+	// dropped because the device was not written fast enough.
+	Dropped uint64
+
+	// Errors is the number of frames that failed to be sent or written.
+	Errors uint64
+}
+
+func (s *Stats) snapshot() Stats {
+	return Stats{
+		ReadFrames:     atomic.LoadUint64(&s.ReadFrames),
+		ReadBytes:      atomic.LoadUint64(&s.ReadBytes),
+		ReadBatches:    atomic.LoadUint64(&s.ReadBatches),
+		WrittenFrames:  atomic.LoadUint64(&s.WrittenFrames),
+		WrittenBytes:   atomic.LoadUint64(&s.WrittenBytes),
+		WriteBatches:   atomic.LoadUint64(&s.WriteBatches),
+		SentFrames:     atomic.LoadUint64(&s.SentFrames),
+		SentBytes:      atomic.LoadUint64(&s.SentBytes),
+		ReceivedFrames: atomic.LoadUint64(&s.ReceivedFrames),
+		ReceivedBytes:  atomic.LoadUint64(&s.ReceivedBytes),
+		Unrouted:       atomic.LoadUint64(&s.Unrouted),
+		Dropped:        atomic.LoadUint64(&s.Dropped),
+		Errors:         atomic.LoadUint64(&s.Errors),
+	}
+}
+
+// frame is a frame in a pooled buffer, after the headroom.
+type frame struct {
+	buf *[]byte
+	n   int
+}
+
+// An Engine forwards frames between a device, usually a tuntap.Adapter, and
+// peers, usually FSCP connections.
+//
+// Frames read from the device are sent to the peers in order, in batches when
+// the device implements BatchReader. They are read in pooled buffers that
+// leave room for the header and the GCM tag of FSCP messages, so that the
+// peers that implement FrameWriter encrypt and send them in the same buffers.
+// Frames received from the peers are queued and written to the device by
+// per-core workers, each of which handles a share of the peers, in batches
+// when the device implements BatchWriter.
+//
+// It is thread-safe.
+type Engine struct {
+	device io.ReadWriter
+	config Config
+	stats  Stats
+	pool   sync.Pool
+	writes []chan frame
+	closed chan struct{}
+	once   sync.Once
+
+	lock       sync.Mutex
+	peers      atomic.Value
+	nextWriter int
+}
+
+// NewEngine creates an engine that forwards the frames of a device, and
+// starts its workers.
+//
+// If config is nil, the default settings are used.
+func NewEngine(device io.ReadWriter, config *Config) *Engine {
+	if config == nil {
+		config = &Config{}
+	}
+
+	e := &Engine{
+		device: device,
+		config: *config,
+		writes: make([]chan frame, config.workers()),
+		closed: make(chan struct{}),
+	}
+
+	size := fscp.DataHeadroom + e.config.frameSize() + fscp.DataTailroom
+	e.pool.New = func() interface{} {
+		buf := make([]byte, size)
+		return &buf
+	}
+
+	e.peers.Store([]net.Conn(nil))
+
+	go e.readLoop()
+
+	for i := range e.writes {
+		e.writes[i] = make(chan frame, e.config.queueSize())
+
+		go e.writeLoop(e.writes[i])
+	}
+
+	return e
+}
+
+// Close stops the engine.
+//
+// The device and the peers are not closed: the workers that wait for their
+// frames stop once they are.
+func (e *Engine) Close() error {
+	e.once.Do(func() {
+		close(e.closed)
+	})
+
+	return nil
+}
+
+// Stats returns the counters of the engine.
+func (e *Engine) Stats() Stats {
+	return e.stats.snapshot()
+}
+
+// Peers returns the peers of the engine.
+func (e *Engine) Peers() []net.Conn {
+	return append([]net.Conn(nil), e.peers.Load().([]net.Conn)...)
+}
+
+// AddPeer adds a peer to exchange frames with.
+//
+// The peer is removed once reading from it fails.
+func (e *Engine) AddPeer(conn net.Conn) {
+	e.lock.Lock()
+	defer e.lock.Unlock()
+
+	peers := e.peers.Load().([]net.Conn)
+
+	for _, peer := range peers {
+		if peer == conn {
+			return
+		}
+	}
+
+	e.peers.Store(append(append([]net.Conn(nil), peers...), conn))
+
+	// All the frames of a peer go through the same worker.
+	writes := e.writes[e.nextWriter%len(e.writes)]
+	e.nextWriter++
+
+	go e.receiveLoop(conn, writes)
+}
+
+// RemovePeer stops sending frames to a peer.
+func (e *Engine) RemovePeer(conn net.Conn) {
+	e.lock.Lock()
+	defer e.lock.Unlock()
+
+	peers := e.peers.Load().([]net.Conn)
+	result := make([]net.Conn, 0, len(peers))
+
+	for _, peer := range peers {
+		if peer != conn {
+			result = append(result, peer)
+		}
+	}
+
+	e.peers.Store(result)
+}
+
+func (e *Engine) isClosed() bool {
+	select {
+	case <-e.closed:
+		return true
+	default:
+		return false
+	}
+}
+
+// readLoop reads frames from the device and sends them to the peers.
+func (e *Engine) readLoop() {
+	batchSize := e.config.batchSize()
+	bufs := make([]*[]byte, batchSize)
+	frames := make([][]byte, batchSize)
+	sizes := make([]int, batchSize)
+
+	defer func() {
+		for _, buf := range bufs {
+			if buf != nil {
+				e.pool.Put(buf)
+			}
+		}
+	}()
+
+	for !e.isClosed() {
+		// Only the buffers that peers took are replaced.
+		for i, buf := range bufs {
+			if buf == nil {
+				buf = e.pool.Get().(*[]byte)
+				bufs[i] = buf
+			}
+
+			frames[i] = (*buf)[fscp.DataHeadroom : len(*buf)-fscp.DataTailroom]
+		}
+
+		n, err := e.readDevice(frames, sizes)
+
+		if err != nil {
+			return
+		}
+
+		atomic.AddUint64(&e.stats.ReadBatches, 1)
+		atomic.AddUint64(&e.stats.ReadFrames, uint64(n))
+
+		for i := 0; i < n; i++ {
+			atomic.AddUint64(&e.stats.ReadBytes, uint64(sizes[i]))
+
+			if e.forward(frame{buf: bufs[i], n: sizes[i]}) {
+				bufs[i] = nil
+			}
+		}
+	}
+}
+
+func (e *Engine) readDevice(frames [][]byte, sizes []int) (int, error) {
+	if r, ok := e.device.(BatchReader); ok {
+		return r.ReadBatch(frames, sizes)
+	}
+
+	n, err := e.device.Read(frames[0])
+
+	if err != nil {
+		return 0, err
+	}
+
+	sizes[0] = n
+
+	return 1, nil
+}
+
+// forward sends a frame read from the device to its peers, and tells whether
+// a peer took its buffer.
+func (e *Engine) forward(f frame) bool {
+	if route := e.config.Route; route != nil {
+		if peer := route((*f.buf)[fscp.DataHeadroom : fscp.DataHeadroom+f.n]); peer != nil {
+			return e.send(peer, f, true)
+		}
+
+		atomic.AddUint64(&e.stats.Unrouted, 1)
+
+		return false
+	}
+
+	peers := e.peers.Load().([]net.Conn)
+
+	if len(peers) == 0 {
+		atomic.AddUint64(&e.stats.Unrouted, 1)
+	}
+
+	// The buffer can only be encrypted in place for one peer.
+	for _, peer := range peers {
+		if e.send(peer, f, len(peers) == 1) {
+			return true
+		}
+	}
+
+	return false
+}
+
+// send sends a frame to a peer and tells whether the peer took its buffer,
+// which only happens if it may.
+func (e *Engine) send(peer net.Conn, f frame, mayTake bool) (taken bool) {
+	data := (*f.buf)[fscp.DataHeadroom : fscp.DataHeadroom+f.n]
+	var err error
+
+	if w, ok := peer.(FrameWriter); ok && mayTake {
+		buf := f.buf
+
+		if err = w.WriteFrame((*buf)[:fscp.DataHeadroom+f.n], func([]byte) { e.pool.Put(buf) }); err == nil {
+			taken = true
+		}
+	} else {
+		_, err = peer.Write(data)
+	}
+
+	if err != nil {
+		atomic.AddUint64(&e.stats.Errors, 1)
+		return false
+	}
+
+	atomic.AddUint64(&e.stats.SentFrames, 1)
+	atomic.AddUint64(&e.stats.SentBytes, uint64(f.n))
+
+	return taken
+}
+
+// receiveLoop queues the frames received from a peer to its worker.
+func (e *Engine) receiveLoop(conn net.Conn, writes chan<- frame) {
+	defer e.RemovePeer(conn)
+
+	for !e.isClosed() {
+		buf := e.pool.Get().(*[]byte)
+		n, err := conn.Read((*buf)[fscp.DataHeadroom : len(*buf)-fscp.DataTailroom])
+
+		if err != nil {
+			e.pool.Put(buf)
+			return
+		}
+
+		atomic.AddUint64(&e.stats.ReceivedFrames, 1)
+		atomic.AddUint64(&e.stats.ReceivedBytes, uint64(n))
+
+		select {
+		case writes <- frame{buf: buf, n: n}:
+		default:
+			atomic.AddUint64(&e.stats.Dropped, 1)
+			e.pool.Put(buf)
+		}
+	}
+}
+
+// writeLoop writes the frames queued to a worker to the device, along with the
+// ones queued after them.
+func (e *Engine) writeLoop(writes <-chan frame) {
+	batchSize := e.config.batchSize()
+	batch := make([]frame, 0, batchSize)
+	frames := make([][]byte, 0, batchSize)
+
+	for {
+		select {
+		case f := <-writes:
+			batch = append(batch[:0], f)
+		case <-e.closed:
+			return
+		}
+
+		for len(batch) < batchSize {
+			select {
+			case f := <-writes:
+				batch = append(batch, f)
+				continue
+			default:
+			}
+
+			break
+		}
+
+		frames = frames[:0]
+
+		for _, f := range batch {
+			frames = append(frames, (*f.buf)[fscp.DataHeadroom:fscp.DataHeadroom+f.n])
+		}
+
+		e.writeDevice(frames)
+
+		for i, f := range batch {
+			e.pool.Put(f.buf)
+			batch[i] = frame{}
+		}
+	}
+}
+
+func (e *Engine) writeDevice(frames [][]byte) {
+	written := 0
+
+	if w, ok := e.device.(BatchWriter); ok {
+		n, err := w.WriteBatch(frames)
+		atomic.AddUint64(&e.stats.WriteBatches, 1)
+
+		for _, frame := range frames[:n] {
+			written += len(frame)
+		}
+
+		atomic.AddUint64(&e.stats.WrittenFrames, uint64(n))
+
+		if err != nil {
+			atomic.AddUint64(&e.stats.Errors, uint64(len(frames)-n))
+		}
+	} else {
+		for _, frame := range frames {
+			if _, err := e.device.Write(frame); err != nil {
+				atomic.AddUint64(&e.stats.Errors, 1)
+				continue
+			}
+
+			written += len(frame)
+			atomic.AddUint64(&e.stats.WrittenFrames, 1)
+		}
+
+		atomic.AddUint64(&e.stats.WriteBatches, uint64(len(frames)))
+	}
+
+	atomic.AddUint64(&e.stats.WrittenBytes, uint64(written))
+}
@@ -0,0 +1,244 @@
+package tunnel
+
+import (
+	"context"
+	"io"
+	"net"
+	"runtime"
+	"testing"
+	"time"
+
+	"github.com/freelan-developers/go-freelan/fscp"
+)
+
+// memDevice is a device whose frames are exchanged through channels.
+type memDevice struct {
+	in     chan []byte
+	out    chan []byte
+	closed chan struct{}
+}
+
+func newMemDevice() *memDevice {
+	return &memDevice{
+		in:     make(chan []byte, 1024),
+		out:    make(chan []byte, 1024),
+		closed: make(chan struct{}),
+	}
+}
+
+func (d *memDevice) Read(p []byte) (int, error) {
+	select {
+	case frame := <-d.in:
+		return copy(p, frame), nil
+	case <-d.closed:
+		return 0, io.EOF
+	}
+}
+
+func (d *memDevice) Write(p []byte) (int, error) {
+	select {
+	case d.out <- append([]byte(nil), p...):
+		return len(p), nil
+	case <-d.closed:
+		return 0, io.ErrClosedPipe
+	}
+}
+
+func (d *memDevice) Close() error {
+	close(d.closed)
+
+	return nil
+}
+
+// receive waits for a frame written to the device.
+func (d *memDevice) receive(tb testing.TB) []byte {
+	tb.Helper()
+
+	select {
+	case frame := <-d.out:
+		return frame
+	case <-time.After(time.Second * 5):
+		tb.Fatalf("expected a frame")
+	}
+
+	return nil
+}
+
+// connectedPeers returns two FSCP connections to one another.
+func connectedPeers(tb testing.TB) (net.Conn, net.Conn) {
+	tb.Helper()
+
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*10)
+	defer cancel()
+
+	listen := func() *fscp.Client {
+		conn, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+
+		if err != nil {
+			tb.Fatalf("expected no error: %s", err)
+		}
+
+		client, err := fscp.NewClient(conn, nil)
+
+		if err != nil {
+			conn.Close()
+			tb.Fatalf("expected no error: %s", err)
+		}
+
+		tb.Cleanup(func() { client.Close() })
+
+		return client
+	}
+
+	server := listen()
+	conn, err := listen().Connect(ctx, server.Addr().(*fscp.Addr))
+
+	if err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	remoteConn, err := server.Accept()
+
+	if err != nil {
+		tb.Fatalf("expected no error: %s", err)
+	}
+
+	return conn, remoteConn
+}
+
+// tunnelTestEngines returns the devices at both ends of a tunnel, along with
+// their engines.
+func tunnelTestEngines(tb testing.TB, configA, configB *Config) (a, b *memDevice, engineA, engineB *Engine) {
+	tb.Helper()
+
+	connA, connB := connectedPeers(tb)
+	a, b = newMemDevice(), newMemDevice()
+	engineA, engineB = NewEngine(a, configA), NewEngine(b, configB)
+
+	tb.Cleanup(func() {
+		engineA.Close()
+		engineB.Close()
+		a.Close()
+		b.Close()
+	})
+
+	engineA.AddPeer(connA)
+	engineB.AddPeer(connB)
+
+	return
+}
+
+func TestEngine(t *testing.T) {
+	a, b, engineA, engineB := tunnelTestEngines(t, nil, nil)
+
+	a.in <- []byte("from a")
+
+	if frame := b.receive(t); string(frame) != "from a" {
+		t.Errorf("expected `from a` but got `%s`", frame)
+	}
+
+	b.in <- []byte("from b")
+
+	if frame := a.receive(t); string(frame) != "from b" {
+		t.Errorf("expected `from b` but got `%s`", frame)
+	}
+
+	if stats := engineA.Stats(); stats.ReadFrames != 1 || stats.SentFrames != 1 || stats.ReceivedFrames != 1 || stats.WrittenFrames != 1 || stats.WrittenBytes != 6 {
+		t.Errorf("unexpected statistics: %+v", stats)
+	}
+
+	if stats := engineB.Stats(); stats.ReadFrames != 1 || stats.SentBytes != 6 || stats.ReceivedBytes != 6 || stats.WrittenFrames != 1 {
+		t.Errorf("unexpected statistics: %+v", stats)
+	}
+}
+
+func TestEngineOrder(t *testing.T) {
+	const window = 32
+
+	a, b, _, _ := tunnelTestEngines(t, &Config{Workers: 4}, &Config{Workers: 4})
+
+	// Frames are sent in windows, so that the socket buffers do not
+	// overflow.
+	for i := 0; i < 8; i++ {
+		for j := 0; j < window; j++ {
+			a.in <- []byte{byte(j)}
+		}
+
+		for j := 0; j < window; j++ {
+			if frame := b.receive(t); frame[0] != byte(j) {
+				t.Fatalf("expected frame %d but got %d", j, frame[0])
+			}
+		}
+	}
+}
+
+func TestEngineRoute(t *testing.T) {
+	a, b, engineA, _ := tunnelTestEngines(t, &Config{
+		Route: func(frame []byte) net.Conn {
+			return nil
+		},
+	}, nil)
+
+	a.in <- []byte("dropped")
+	b.in <- []byte("from b")
+
+	// Routes only apply to the frames read from the device.
+	if frame := a.receive(t); string(frame) != "from b" {
+		t.Errorf("expected `from b` but got `%s`", frame)
+	}
+
+	for deadline := time.Now().Add(time.Second * 5); engineA.Stats().Unrouted != 1; time.Sleep(time.Millisecond * 10) {
+		if time.Now().After(deadline) {
+			t.Fatalf("expected the frame to be unrouted: %+v", engineA.Stats())
+		}
+	}
+
+	if stats := engineA.Stats(); stats.SentFrames != 0 {
+		t.Errorf("expected no frame to be sent but got: %+v", stats)
+	}
+}
+
+// BenchmarkEngine measures the rate at which frames of a typical size go
+// through a tunnel, in millions of frames per second and per core.
+//
+// Frames are sent in windows that must be received before the next ones are
+// sent, so that the sockets buffers do not overflow on slow machines.
+func BenchmarkEngine(b *testing.B) {
+	const window = 32
+
+	in, out, _, engine := tunnelTestEngines(b, nil, nil)
+	frame := make([]byte, 1400)
+
+	b.SetBytes(int64(len(frame)))
+	b.ResetTimer()
+
+	start := time.Now()
+
+	for i := 0; i < b.N; i += window {
+		n := window
+
+		if b.N-i < n {
+			n = b.N - i
+		}
+
+		for j := 0; j < n; j++ {
+			in.in <- frame
+		}
+
+		// Lost frames never come.
+		for j := 0; j < n; j++ {
+			select {
+			case <-out.out:
+			case <-time.After(time.Millisecond * 100):
+				j = n
+			}
+		}
+	}
+
+	elapsed := time.Since(start)
+	b.StopTimer()
+
+	mpps := float64(engine.Stats().WrittenFrames) / elapsed.Seconds() / 1e6
+	b.ReportMetric(mpps, "Mpps")
+	b.ReportMetric(mpps/float64(runtime.GOMAXPROCS(0)), "Mpps/core")
+}
@@ -12,6 +12,92 @@ type Adapter interface {
 	Config() AdapterConfig
 }
 
+// BatchReader is implemented by adapters that can read several frames in one
+// call.
+type BatchReader interface {
+	// ReadBatch reads at least one frame, and at most len(frames), into frames
+	// and stores their sizes into sizes.
+	//
+	// ReadBatch blocks until a frame is available but never waits for more
+	// frames than the ones that are already pending.
+	ReadBatch(frames [][]byte, sizes []int) (int, error)
+}
+
+// BatchWriter is implemented by adapters that can write several frames in one
+// call.
+type BatchWriter interface {
+	// WriteBatch writes frames and returns the number of frames written.
+	WriteBatch(frames [][]byte) (int, error)
+}
+
+// ReadBatch reads frames from r, in one call if r is a BatchReader and one
+// frame at a time otherwise.
+func ReadBatch(r io.Reader, frames [][]byte, sizes []int) (int, error) {
+	if r, ok := r.(BatchReader); ok {
+		return r.ReadBatch(frames, sizes)
+	}
+
+	n, err := r.Read(frames[0])
+
+	if err != nil {
+		return 0, err
+	}
+
+	sizes[0] = n
+
+	return 1, nil
+}
+
+// WriteBatch writes frames to w, in one call if w is a BatchWriter and one
+// frame at a time otherwise.
+func WriteBatch(w io.Writer, frames [][]byte) (int, error) {
+	if w, ok := w.(BatchWriter); ok {
+		return w.WriteBatch(frames)
+	}
+
+	for i, frame := range frames {
+		if _, err := w.Write(frame); err != nil {
+			return i, err
+		}
+	}
+
+	return len(frames), nil
+}
+
+// readFilteredBatch reads a batch of frames from r and only keeps the ones for
+// which keep returns true, moving them at the start of frames.
+//
+// It reads again as long as no frame was kept.
+func readFilteredBatch(r io.Reader, frames [][]byte, sizes []int, keep func([]byte) bool) (int, error) {
+	for {
+		n, err := ReadBatch(r, frames, sizes)
+
+		if err != nil {
+			return 0, err
+		}
+
+		kept := 0
+
+		for i := 0; i < n; i++ {
+			if !keep(frames[i][:sizes[i]]) {
+				continue
+			}
+
+			// Frames are copied rather than swapped, so that the buffers stay
+			// where the caller put them.
+			if kept != i {
+				sizes[kept] = copy(frames[kept], frames[i][:sizes[i]])
+			}
+
+			kept++
+		}
+
+		if kept > 0 {
+			return kept, nil
+		}
+	}
+}
+
 // AdapterConfig represents a tap adapter config.
 type AdapterConfig struct {
 	// Name is the name of the tap adapter to open.
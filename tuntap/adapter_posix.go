@@ -5,6 +5,7 @@ package tuntap
 import (
 	"fmt"
 	"net"
+	"os"
 	"os/exec"
 	"runtime"
 	"strings"
@@ -28,10 +29,17 @@ type adapterImpl struct {
 
 type adapterDescriptor struct {
 	ptr *C.struct_adapter
+
+	// file is a non-blocking duplicate of the adapter descriptor, through
+	// which all reads and writes go so that they are handled by the runtime
+	// poller.
+	file *os.File
+	raw  syscall.RawConn
 }
 
 func (t *adapterDescriptor) Close() error {
 	t.SetConnectedState(false)
+	t.file.Close()
 	_, err := C.close_adapter(t.ptr)
 
 	runtime.SetFinalizer(t, nil)
@@ -44,11 +52,77 @@ func (t *adapterDescriptor) Name() string {
 }
 
 func (t *adapterDescriptor) Read(p []byte) (int, error) {
-	return syscall.Read((int)(t.ptr.fd), p)
+	return t.file.Read(p)
 }
 
 func (t *adapterDescriptor) Write(p []byte) (int, error) {
-	return syscall.Write((int)(t.ptr.fd), p)
+	return t.file.Write(p)
+}
+
+// ReadBatch waits for a frame to be readable and then reads it along with all
+// the frames that are already pending, up to len(frames).
+func (t *adapterDescriptor) ReadBatch(frames [][]byte, sizes []int) (n int, err error) {
+	rerr := t.raw.Read(func(fd uintptr) bool {
+		for n < len(frames) {
+			size, e := syscall.Read(int(fd), frames[n])
+
+			switch e {
+			case nil:
+				sizes[n] = size
+				n++
+			case syscall.EINTR:
+			case syscall.EAGAIN:
+				// Only wait for readiness if nothing was read yet.
+				return n > 0
+			default:
+				err = e
+				return true
+			}
+		}
+
+		return true
+	})
+
+	// Frames that were read are returned and the error, if any, will occur
+	// again on the next call.
+	if n > 0 {
+		return n, nil
+	}
+
+	if rerr != nil {
+		return 0, rerr
+	}
+
+	return 0, err
+}
+
+// WriteBatch writes frames one after the other, waiting only when the adapter
+// can't take any more.
+func (t *adapterDescriptor) WriteBatch(frames [][]byte) (n int, err error) {
+	rerr := t.raw.Write(func(fd uintptr) bool {
+		for n < len(frames) {
+			_, e := syscall.Write(int(fd), frames[n])
+
+			switch e {
+			case nil:
+				n++
+			case syscall.EINTR:
+			case syscall.EAGAIN:
+				return false
+			default:
+				err = e
+				return true
+			}
+		}
+
+		return true
+	})
+
+	if err == nil {
+		err = rerr
+	}
+
+	return n, err
 }
 
 func (t *adapterDescriptor) SetIPv4(addr *net.IPNet) error {
@@ -139,7 +213,33 @@ func newAdapter(name string, _type C.adapter_layer) (*adapterDescriptor, error)
 		return nil, fmt.Errorf("failed to open tap adapter `%s`: %s", name, err)
 	}
 
-	desc := &adapterDescriptor{ptr}
+	fd, err := syscall.Dup(int(ptr.fd))
+
+	if err != nil {
+		C.close_adapter(ptr)
+		return nil, fmt.Errorf("failed to duplicate the descriptor of tap adapter `%s`: %s", name, err)
+	}
+
+	if err = syscall.SetNonblock(fd, true); err != nil {
+		syscall.Close(fd)
+		C.close_adapter(ptr)
+		return nil, fmt.Errorf("failed to make tap adapter `%s` non-blocking: %s", name, err)
+	}
+
+	file := os.NewFile(uintptr(fd), C.GoString(&ptr.name[0]))
+	raw, err := file.SyscallConn()
+
+	if err != nil {
+		file.Close()
+		C.close_adapter(ptr)
+		return nil, fmt.Errorf("failed to access the descriptor of tap adapter `%s`: %s", name, err)
+	}
+
+	desc := &adapterDescriptor{
+		ptr:  ptr,
+		file: file,
+		raw:  raw,
+	}
 	runtime.SetFinalizer(desc, (*adapterDescriptor).Close)
 
 	return desc, nil
@@ -63,78 +63,98 @@ func (a *ARPProxyAdapter) Read(b []byte) (n int, err error) {
 			return
 		}
 
-		ipv4 := a.Config().IPv4
-
-		// No IPv4 address is configured: we can't reply to anything.
-		if ipv4 == nil {
+		if a.handlePacket(b[:n]) {
 			return
 		}
+	}
+}
 
-		packet := gopacket.NewPacket(
-			b[:n],
-			layers.LayerTypeEthernet,
-			gopacket.DecodeOptions{Lazy: true, NoCopy: true},
-		)
+// ReadBatch reads a batch of frames, leaving out the ARP requests it handles.
+func (a *ARPProxyAdapter) ReadBatch(frames [][]byte, sizes []int) (int, error) {
+	return readFilteredBatch(a.Adapter, frames, sizes, a.handlePacket)
+}
 
-		arp, ok := packet.Layer(layers.LayerTypeARP).(*layers.ARP)
+// WriteBatch writes a batch of frames to the underlying adapter.
+func (a *ARPProxyAdapter) WriteBatch(frames [][]byte) (int, error) {
+	return WriteBatch(a.Adapter, frames)
+}
 
-		if !ok || arp == nil {
-			return
-		}
+// handlePacket replies to the ARP request in b, if any, and returns whether b
+// must be passed through.
+func (a *ARPProxyAdapter) handlePacket(b []byte) bool {
+	ipv4 := a.Config().IPv4
 
-		// We only care about ARP requests.
-		if arp.Operation != layers.ARPRequest {
-			continue
-		}
+	// No IPv4 address is configured: we can't reply to anything.
+	if ipv4 == nil {
+		return true
+	}
 
-		// Bogus request: source protocol address is supposed to be the interface's
-		// address.
-		if bytes.Compare(arp.SourceProtAddress, ipv4.IP.To4()) != 0 {
-			continue
-		}
+	packet := gopacket.NewPacket(
+		b,
+		layers.LayerTypeEthernet,
+		gopacket.DecodeOptions{Lazy: true, NoCopy: true},
+	)
 
-		// We don't reply to gratuitous ARP requests.
-		if bytes.Compare(arp.DstProtAddress, ipv4.IP.To4()) == 0 {
-			continue
-		}
+	arp, ok := packet.Layer(layers.LayerTypeARP).(*layers.ARP)
 
-		reqIPv4 := net.IP(arp.DstProtAddress).To4()
+	if !ok || arp == nil {
+		return true
+	}
 
-		// If the request is outside the interface's network, we don't reply.
-		hwaddr := a.ARPTable.Resolve(reqIPv4)
+	// We only care about ARP requests.
+	if arp.Operation != layers.ARPRequest {
+		return false
+	}
 
-		if hwaddr == nil {
-			continue
-		}
+	// Bogus request: source protocol address is supposed to be the interface's
+	// address.
+	if bytes.Compare(arp.SourceProtAddress, ipv4.IP.To4()) != 0 {
+		return false
+	}
 
-		ethernetResp := &layers.Ethernet{
-			SrcMAC:       hwaddr,
-			DstMAC:       arp.SourceHwAddress,
-			EthernetType: layers.EthernetTypeARP,
-		}
-		arpResp := &layers.ARP{
-			AddrType:          arp.AddrType,
-			Protocol:          arp.Protocol,
-			HwAddressSize:     arp.HwAddressSize,
-			ProtAddressSize:   arp.ProtAddressSize,
-			Operation:         layers.ARPReply,
-			SourceHwAddress:   hwaddr,
-			SourceProtAddress: arp.DstProtAddress,
-			DstHwAddress:      arp.SourceHwAddress,
-			DstProtAddress:    arp.SourceProtAddress,
-		}
+	// We don't reply to gratuitous ARP requests.
+	if bytes.Compare(arp.DstProtAddress, ipv4.IP.To4()) == 0 {
+		return false
+	}
 
-		sbuf := gopacket.NewSerializeBuffer()
-		options := gopacket.SerializeOptions{
-			ComputeChecksums: true,
-			FixLengths:       true,
-		}
+	reqIPv4 := net.IP(arp.DstProtAddress).To4()
 
-		if err = gopacket.SerializeLayers(sbuf, options, ethernetResp, arpResp); err != nil {
-			panic(err)
-		}
+	// If the request is outside the interface's network, we don't reply.
+	hwaddr := a.ARPTable.Resolve(reqIPv4)
+
+	if hwaddr == nil {
+		return false
+	}
 
-		// If we failed to write the message, we do so silently. Packet loss happen...
-		a.Write(sbuf.Bytes())
+	ethernetResp := &layers.Ethernet{
+		SrcMAC:       hwaddr,
+		DstMAC:       arp.SourceHwAddress,
+		EthernetType: layers.EthernetTypeARP,
 	}
+	arpResp := &layers.ARP{
+		AddrType:          arp.AddrType,
+		Protocol:          arp.Protocol,
+		HwAddressSize:     arp.HwAddressSize,
+		ProtAddressSize:   arp.ProtAddressSize,
+		Operation:         layers.ARPReply,
+		SourceHwAddress:   hwaddr,
+		SourceProtAddress: arp.DstProtAddress,
+		DstHwAddress:      arp.SourceHwAddress,
+		DstProtAddress:    arp.SourceProtAddress,
+	}
+
+	sbuf := gopacket.NewSerializeBuffer()
+	options := gopacket.SerializeOptions{
+		ComputeChecksums: true,
+		FixLengths:       true,
+	}
+
+	if err := gopacket.SerializeLayers(sbuf, options, ethernetResp, arpResp); err != nil {
+		panic(err)
+	}
+
+	// If we failed to write the message, we do so silently. Packet loss happen...
+	a.Write(sbuf.Bytes())
+
+	return false
 }
@@ -0,0 +1,119 @@
+package tuntap
+
+import (
+	"io"
+	"net"
+	"testing"
+
+	"github.com/google/gopacket"
+	"github.com/google/gopacket/layers"
+)
+
+// memAdapter is an adapter that reads frames from a list and records the ones
+// written to it.
+type memAdapter struct {
+	config  AdapterConfig
+	frames  [][]byte
+	written [][]byte
+}
+
+func (a *memAdapter) Read(b []byte) (int, error) {
+	if len(a.frames) == 0 {
+		return 0, io.EOF
+	}
+
+	n := copy(b, a.frames[0])
+	a.frames = a.frames[1:]
+
+	return n, nil
+}
+
+func (a *memAdapter) Write(b []byte) (int, error) {
+	a.written = append(a.written, append([]byte(nil), b...))
+
+	return len(b), nil
+}
+
+func (a *memAdapter) Close() error              { return nil }
+func (a *memAdapter) Interface() *net.Interface { return nil }
+func (a *memAdapter) Config() AdapterConfig     { return a.config }
+
+func (a *memAdapter) ReadBatch(frames [][]byte, sizes []int) (n int, err error) {
+	for n < len(frames) && len(a.frames) > 0 {
+		sizes[n], _ = a.Read(frames[n])
+		n++
+	}
+
+	if n == 0 {
+		return 0, io.EOF
+	}
+
+	return n, nil
+}
+
+func arpRequestFrame(t *testing.T, src, dst net.IP) []byte {
+	t.Helper()
+
+	hwaddr := net.HardwareAddr{0x02, 0x00, 0x00, 0x00, 0x00, 0x01}
+	buf := gopacket.NewSerializeBuffer()
+	err := gopacket.SerializeLayers(
+		buf,
+		gopacket.SerializeOptions{FixLengths: true},
+		&layers.Ethernet{
+			SrcMAC:       hwaddr,
+			DstMAC:       layers.EthernetBroadcast,
+			EthernetType: layers.EthernetTypeARP,
+		},
+		&layers.ARP{
+			AddrType:          layers.LinkTypeEthernet,
+			Protocol:          layers.EthernetTypeIPv4,
+			HwAddressSize:     6,
+			ProtAddressSize:   4,
+			Operation:         layers.ARPRequest,
+			SourceHwAddress:   hwaddr,
+			SourceProtAddress: src.To4(),
+			DstHwAddress:      make([]byte, 6),
+			DstProtAddress:    dst.To4(),
+		},
+	)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	return buf.Bytes()
+}
+
+func TestARPProxyAdapterReadBatch(t *testing.T) {
+	ipv4 := &net.IPNet{IP: net.IPv4(9, 0, 0, 1), Mask: net.CIDRMask(24, 32)}
+	adapter := &memAdapter{
+		config: AdapterConfig{IPv4: ipv4},
+		frames: [][]byte{
+			[]byte("first"),
+			arpRequestFrame(t, ipv4.IP, net.IPv4(9, 0, 0, 2)),
+			[]byte("second"),
+		},
+	}
+	arpTable := NewARPTable()
+	arpTable.Register(ipv4, net.HardwareAddr{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE})
+	proxy := &ARPProxyAdapter{
+		Adapter:  adapter,
+		ARPTable: arpTable,
+	}
+
+	frames := [][]byte{make([]byte, 64), make([]byte, 64), make([]byte, 64)}
+	sizes := make([]int, len(frames))
+	n, err := ReadBatch(proxy, frames, sizes)
+
+	if err != nil {
+		t.Fatalf("expected no error: %s", err)
+	}
+
+	if n != 2 || string(frames[0][:sizes[0]]) != "first" || string(frames[1][:sizes[1]]) != "second" {
+		t.Errorf("expected the ARP request to be left out but got %d frame(s): %q", n, frames[:n])
+	}
+
+	if len(adapter.written) != 1 {
+		t.Errorf("expected the ARP request to be replied to")
+	}
+}
@@ -44,6 +44,16 @@ func (a *DHCPProxyAdapter) Read(b []byte) (n int, err error) {
 	}
 }
 
+// ReadBatch reads a batch of frames, leaving out the DHCP requests it handles.
+func (a *DHCPProxyAdapter) ReadBatch(frames [][]byte, sizes []int) (int, error) {
+	return readFilteredBatch(a.Adapter, frames, sizes, a.handlePacket)
+}
+
+// WriteBatch writes a batch of frames to the underlying adapter.
+func (a *DHCPProxyAdapter) WriteBatch(frames [][]byte) (int, error) {
+	return WriteBatch(a.Adapter, frames)
+}
+
 func (a *DHCPProxyAdapter) handlePacket(b []byte) bool {
 	// No IPv4 address is configured: we can't reply to anything.
 	if a.Config().IPv4 == nil {